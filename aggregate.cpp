@@ -0,0 +1,130 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "aggregate.h"
+
+#include "util.h"
+
+PaError OpenAggregateMemberStream(PaStream** stream, PaDeviceIndex device, double sample_rate, PaStreamCallback* callback, void* user_data)
+{
+	const PaDeviceInfo* device_info = Pa_GetDeviceInfo(device);
+	if (!device_info)
+		return paInvalidDevice;
+
+	PaStreamParameters input_parameters;
+	input_parameters.device = device;
+	input_parameters.channelCount = device_info->maxInputChannels;
+	input_parameters.sampleFormat = paFloat32 | paNonInterleaved;
+	input_parameters.suggestedLatency = device_info->defaultLowInputLatency;
+	input_parameters.hostApiSpecificStreamInfo = NULL;
+
+	PaStreamParameters output_parameters;
+	output_parameters.device = device;
+	output_parameters.channelCount = device_info->maxOutputChannels;
+	output_parameters.sampleFormat = paFloat32 | paNonInterleaved;
+	output_parameters.suggestedLatency = device_info->defaultLowOutputLatency;
+	output_parameters.hostApiSpecificStreamInfo = NULL;
+
+	return Pa_OpenStream(
+		stream,
+		device_info->maxInputChannels > 0 ? &input_parameters : NULL,
+		device_info->maxOutputChannels > 0 ? &output_parameters : NULL,
+		sample_rate, paFramesPerBufferUnspecified, paNoFlag, callback, user_data);
+}
+
+AggregateMember::AggregateMember(const std::string& name, long input_channel_count, long output_channel_count, double sample_rate) :
+	name(name), input_channel_count(input_channel_count), output_channel_count(output_channel_count), stream(NULL)
+{
+	// Half a second is plenty to absorb the callback sizes of both sides, same as for the main input device.
+	const size_t capacity = static_cast<size_t>(sample_rate / 2);
+	if (input_channel_count > 0)
+		input_compensator.reset(new DriftCompensator(input_channel_count, sample_rate, capacity));
+	if (output_channel_count > 0)
+		output_compensator.reset(new DriftCompensator(output_channel_count, sample_rate, capacity));
+}
+
+AggregateMember::~AggregateMember()
+{
+	CloseStream();
+}
+
+AggregateMember::Status AggregateMember::GetStatus() const
+{
+	Status status;
+	status.input_level = input_compensator ? input_compensator->GetLevel() : 0;
+	status.output_level = output_compensator ? output_compensator->GetLevel() : 0;
+	status.input_drift = input_compensator ? input_compensator->GetRatio() - 1 : 0;
+	status.output_drift = output_compensator ? output_compensator->GetRatio() - 1 : 0;
+	status.underrun_count = (input_compensator ? input_compensator->GetUnderrunCount() : 0) + (output_compensator ? output_compensator->GetUnderrunCount() : 0);
+	status.overrun_count = (input_compensator ? input_compensator->GetOverrunCount() : 0) + (output_compensator ? output_compensator->GetOverrunCount() : 0);
+	return status;
+}
+
+void AggregateMember::Reset()
+{
+	if (input_compensator)
+		input_compensator->Reset();
+	if (output_compensator)
+		output_compensator->Reset();
+}
+
+void AggregateMember::DeviceCallback(const float* const* input, float* const* output, size_t frames)
+{
+	if (input_compensator && input)
+		input_compensator->Push(input, frames);
+	if (output_compensator && output)
+		output_compensator->Pull(output, 0, frames);
+}
+
+void AggregateMember::PullInput(float* const* channels, size_t offset, size_t frames)
+{
+	if (input_compensator)
+		input_compensator->Pull(channels, offset, frames);
+}
+
+void AggregateMember::PushOutput(const float* const* channels, size_t frames)
+{
+	if (output_compensator)
+		output_compensator->Push(channels, frames);
+}
+
+PaError AggregateMember::OpenStream(PaDeviceIndex device, double sample_rate)
+{
+	CloseStream();
+	return OpenAggregateMemberStream(&stream, device, sample_rate, &AggregateMember::StaticStreamCallback, this);
+}
+
+void AggregateMember::CloseStream()
+{
+	if (!stream)
+		return;
+	const PaError error = Pa_CloseStream(stream);
+	if (error != paNoError)
+		Log(LOG_LEVEL_WARNING) << "Unable to close PortAudio stream for aggregate member " << name << ": " << Pa_GetErrorText(error);
+	stream = NULL;
+}
+
+int AggregateMember::StaticStreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo * /*timeInfo*/, PaStreamCallbackFlags statusFlags, void *userData) throw()
+{
+	AggregateMember* member = static_cast<AggregateMember*>(userData);
+	if (statusFlags & (paInputOverflow | paInputUnderflow | paOutputOverflow | paOutputUnderflow))
+		RealtimeLog(LOG_LEVEL_WARNING, "Aggregate member stream reported an xrun (flags {})", statusFlags);
+	member->DeviceCallback(static_cast<const float* const*>(input), static_cast<float* const*>(output), frameCount);
+	return paContinue;
+}
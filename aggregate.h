@@ -0,0 +1,88 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "drift.h"
+#include "portaudio.h"
+
+// Opens a non-interleaved float stream on a single device, using all of its input and output channels and the lowest default latency.
+PaError OpenAggregateMemberStream(PaStream** stream, PaDeviceIndex device, double sample_rate, PaStreamCallback* callback, void* user_data);
+
+// A device that contributes additional channels on top of the main devices (see Config::aggregate_devices).
+// Each member runs its own stream and callback thread, on its own clock. Its input is brought into the clock domain of the master stream (the one that drives the host) through a DriftCompensator, and its output goes through another one the other way around.
+// The audio path doesn't depend on PortAudio: DeviceCallback() can just as well be driven by a fake device, e.g. in a test program.
+class AggregateMember
+{
+	public:
+		struct Status
+		{
+			// Frames currently buffered between the master and the device, in each direction.
+			size_t input_level;
+			size_t output_level;
+			// Resampling ratios, relative to 1. Positive input drift means the device is faster than the master; positive output drift means it's slower.
+			double input_drift;
+			double output_drift;
+			unsigned long underrun_count;
+			unsigned long overrun_count;
+		};
+
+		AggregateMember(const std::string& name, long input_channel_count, long output_channel_count, double sample_rate);
+		~AggregateMember();
+
+		const std::string& GetName() const { return name; }
+		long GetInputChannelCount() const { return input_channel_count; }
+		long GetOutputChannelCount() const { return output_channel_count; }
+		// Latency added on top of the device's own, in frames.
+		size_t GetInputLatency() const { return input_compensator ? input_compensator->GetLatency() : 0; }
+		size_t GetOutputLatency() const { return output_compensator ? output_compensator->GetLatency() : 0; }
+		// Can be called from any thread.
+		Status GetStatus() const;
+
+		// Only safe while neither side is running.
+		void Reset();
+
+		// Device side, called from the member's own audio thread. Either pointer is null if the member doesn't have that direction.
+		void DeviceCallback(const float* const* input, float* const* output, size_t frames);
+		// Master side, called from the master stream callback. channels[channel] + offset receive the frames.
+		void PullInput(float* const* channels, size_t offset, size_t frames);
+		void PushOutput(const float* const* channels, size_t frames);
+
+		// Runs the member on a PortAudio stream.
+		PaError OpenStream(PaDeviceIndex device, double sample_rate);
+		PaStream* GetStream() const { return stream; }
+		void CloseStream();
+
+	private:
+		AggregateMember(const AggregateMember&);
+		AggregateMember& operator=(const AggregateMember&);
+
+		static int StaticStreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, void *userData) throw();
+
+		const std::string name;
+		const long input_channel_count;
+		const long output_channel_count;
+		// Null if the member doesn't have that direction.
+		std::unique_ptr<DriftCompensator> input_compensator;
+		std::unique_ptr<DriftCompensator> output_compensator;
+		PaStream* stream;
+};
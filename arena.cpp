@@ -0,0 +1,119 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "arena.h"
+
+#include <new>
+
+#include "util.h"
+
+namespace {
+// Large pages can only be allocated by a process that holds (and has enabled) the "Lock pages in memory" privilege.
+bool EnableLockMemoryPrivilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return false;
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	// AdjustTokenPrivileges() succeeds even if the privilege is not held, in which case it sets ERROR_NOT_ALL_ASSIGNED.
+	const bool enabled = LookupPrivilegeValueA(NULL, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return enabled;
+}
+}
+
+BufferArena::BufferArena(size_t capacity, bool large_pages) :
+	memory(nullptr), capacity(0), used(0), locked(false), large_pages(false), working_set_increase(0)
+{
+	if (capacity == 0)
+		capacity = 1;
+
+	if (large_pages)
+	{
+		const size_t large_page_size = GetLargePageMinimum();
+		if (large_page_size == 0)
+			Log(LOG_LEVEL_WARNING) << "Large pages are not supported on this system";
+		else if (!EnableLockMemoryPrivilege())
+			Log(LOG_LEVEL_WARNING) << "Unable to use large pages: the \"Lock pages in memory\" privilege is not granted";
+		else
+		{
+			const size_t large_capacity = (capacity + large_page_size - 1) / large_page_size * large_page_size;
+			memory = static_cast<char*>(VirtualAlloc(NULL, large_capacity, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+			if (!memory)
+				Log(LOG_LEVEL_WARNING) << "Unable to allocate " << large_capacity << " bytes of large pages (error " << GetLastError() << ")";
+			else
+			{
+				this->capacity = large_capacity;
+				this->large_pages = true;
+				// Large pages cannot be paged out.
+				locked = true;
+			}
+		}
+	}
+
+	if (!memory)
+	{
+		SYSTEM_INFO system_info;
+		GetSystemInfo(&system_info);
+		const size_t page_size = system_info.dwPageSize;
+		this->capacity = (capacity + page_size - 1) / page_size * page_size;
+		memory = static_cast<char*>(VirtualAlloc(NULL, this->capacity, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+		if (!memory)
+			throw std::bad_alloc();
+
+		// Committed memory is only mapped on first access. Touch every page now rather than in the first few callbacks.
+		for (size_t offset = 0; offset < this->capacity; offset += page_size)
+			static_cast<volatile char*>(memory)[offset] = 0;
+
+		// By default, a process can only lock a small amount of memory, bounded by its minimum working set.
+		SIZE_T minimum_working_set, maximum_working_set;
+		if (GetProcessWorkingSetSize(GetCurrentProcess(), &minimum_working_set, &maximum_working_set) &&
+			SetProcessWorkingSetSize(GetCurrentProcess(), minimum_working_set + this->capacity, maximum_working_set + this->capacity))
+			working_set_increase = this->capacity;
+		locked = VirtualLock(memory, this->capacity) != 0;
+		if (!locked)
+			Log(LOG_LEVEL_WARNING) << "Unable to lock " << this->capacity << " bytes of buffer memory (error " << GetLastError() << "), the audio thread might take page faults";
+	}
+}
+
+BufferArena::~BufferArena()
+{
+	if (locked && !large_pages)
+		VirtualUnlock(memory, capacity);
+	VirtualFree(memory, 0, MEM_RELEASE);
+	if (working_set_increase > 0)
+	{
+		SIZE_T minimum_working_set, maximum_working_set;
+		if (GetProcessWorkingSetSize(GetCurrentProcess(), &minimum_working_set, &maximum_working_set) && minimum_working_set >= working_set_increase)
+			SetProcessWorkingSetSize(GetCurrentProcess(), minimum_working_set - working_set_increase, maximum_working_set - working_set_increase);
+	}
+}
+
+void* BufferArena::Allocate(size_t size)
+{
+	size = Align(size);
+	if (size > capacity - used)
+		return nullptr;
+	void* allocation = memory + used;
+	used += size;
+	return allocation;
+}
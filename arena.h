@@ -0,0 +1,59 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <windows.h>
+
+#include <cstddef>
+
+// A fixed-size block of memory for buffers the audio thread works on, carved up into cache-line-aligned allocations.
+// The whole block is committed and touched up front, and locked in physical memory if possible, so that the audio thread never takes a page fault on it.
+class BufferArena
+{
+	public:
+		// Allocations are aligned to this, which is a cache line on x86 and more than any SIMD load or store needs.
+		// It also means two allocations never share a cache line, so the host and the driver working on adjacent buffers don't get in each other's way.
+		static const size_t alignment = 64;
+		static size_t Align(size_t size) { return (size + alignment - 1) & ~(alignment - 1); }
+
+		// If large_pages is true, tries to back the arena with large pages, which are always locked and reduce TLB pressure, but are typically 2 MB each.
+		// Throws std::bad_alloc if the memory cannot be allocated at all. Failing to lock it or to use large pages is not fatal.
+		BufferArena(size_t capacity, bool large_pages);
+		~BufferArena();
+
+		// Returns zeroed memory, or null if the arena is full. Not thread-safe.
+		void* Allocate(size_t size);
+
+		bool IsLocked() const { return locked; }
+		bool UsesLargePages() const { return large_pages; }
+
+	private:
+		BufferArena(const BufferArena&);
+		BufferArena& operator=(const BufferArena&);
+
+		char* memory;
+		// Rounded up to a whole number of pages.
+		size_t capacity;
+		size_t used;
+		bool locked;
+		bool large_pages;
+		// How much we grew the working set by to make room for the locked pages, to be given back on destruction.
+		SIZE_T working_set_increase;
+};
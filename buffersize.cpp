@@ -0,0 +1,103 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "buffersize.h"
+
+#include <algorithm>
+
+namespace {
+// Multiples of the device period worth trying. The larger the buffer, the less the exact size matters, hence the coarser steps.
+const long period_multiples[] = { 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128 };
+// A clean session needs to last at least this long (in seconds) to mean anything. Glitches count regardless.
+const double min_stable_session_duration = 30;
+// Callbacks that stray from the device period by more than this (in buffer periods) eat into the host's margin. If that happens regularly, the size is too tight, even if nothing has glitched yet.
+const double max_stable_jitter = 0.5;
+}
+
+BufferSizeTuning::BufferSizeTuning() : device_period(0), smallest_stable_size(0), largest_unstable_size(0) { }
+
+std::vector<long> GetBufferSizeCandidates(long device_period, double sample_rate)
+{
+	std::vector<long> candidates;
+	if (device_period <= 0)
+		return candidates;
+	for (size_t multiple_index = 0; multiple_index < sizeof(period_multiples) / sizeof(*period_multiples); ++multiple_index)
+	{
+		const long size = device_period * period_multiples[multiple_index];
+		if (!candidates.empty() && size > sample_rate)
+			break;
+		candidates.push_back(size);
+	}
+	return candidates;
+}
+
+long GetPreferredBufferSize(const BufferSizeTuning& tuning, double sample_rate)
+{
+	const std::vector<long> candidates = GetBufferSizeCandidates(tuning.device_period, sample_rate);
+	if (candidates.empty())
+		return 0;
+
+	if (tuning.smallest_stable_size == 0)
+	{
+		// Nothing has run cleanly yet: start at twice the period (which is where most systems end up), or just above the last size that glitched.
+		if (tuning.largest_unstable_size == 0)
+			return candidates[(std::min)(static_cast<size_t>(1), candidates.size() - 1)];
+		for (std::vector<long>::const_iterator candidate = candidates.begin(); candidate != candidates.end(); ++candidate)
+			if (*candidate > tuning.largest_unstable_size)
+				return *candidate;
+		return candidates.back();
+	}
+
+	// Try one step below the smallest size known to work, unless that one is known not to.
+	std::vector<long>::const_iterator smaller = std::lower_bound(candidates.begin(), candidates.end(), tuning.smallest_stable_size);
+	if (smaller != candidates.begin() && *(smaller - 1) > tuning.largest_unstable_size)
+		return *(smaller - 1);
+	return tuning.smallest_stable_size;
+}
+
+bool RecordBufferSizeSession(BufferSizeTuning* tuning, const BufferSizeSession& session)
+{
+	// Everything we know is in multiples of the old period, so it's moot if the period changes. That much is worth saving even if the session doesn't tell anything else, or the next one would be offered multiples of the old period again.
+	const bool period_changed = session.device_period != tuning->device_period;
+	if (period_changed)
+	{
+		*tuning = BufferSizeTuning();
+		tuning->device_period = session.device_period;
+	}
+
+	const bool stable = session.glitch_count == 0 && session.jitter <= max_stable_jitter;
+	if (stable && session.duration < min_stable_session_duration)
+		return period_changed;
+
+	if (stable)
+	{
+		if (tuning->smallest_stable_size == 0 || session.buffer_size < tuning->smallest_stable_size)
+			tuning->smallest_stable_size = session.buffer_size;
+		// Whatever made this size (or a larger one) glitch before is gone.
+		if (session.buffer_size <= tuning->largest_unstable_size)
+			tuning->largest_unstable_size = 0;
+	}
+	else
+	{
+		tuning->largest_unstable_size = (std::max)(tuning->largest_unstable_size, session.buffer_size);
+		if (tuning->smallest_stable_size != 0 && tuning->smallest_stable_size <= session.buffer_size)
+			tuning->smallest_stable_size = 0;
+	}
+	return true;
+}
@@ -0,0 +1,56 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <vector>
+
+// What has been learned about ASIO buffer sizes for a given set of devices at a given sample rate, across stream sessions (see Config::buffer_size_tuning).
+// All sizes are in ASIO frames; 0 means unknown.
+struct BufferSizeTuning
+{
+	BufferSizeTuning();
+
+	// How many frames the devices process per callback. Buffer sizes are multiples of this, as anything in between doesn't reduce latency but does make the host's job harder.
+	long device_period;
+	// The smallest size that ran cleanly, and the largest size that didn't.
+	long smallest_stable_size;
+	long largest_unstable_size;
+};
+
+// What happened during one stream session, as far as buffer size tuning is concerned.
+struct BufferSizeSession
+{
+	long buffer_size;
+	long device_period;
+	// In seconds.
+	double duration;
+	// Overflows, underflows and missed deadlines.
+	unsigned long long glitch_count;
+	// 99th percentile of the deviation of callback times from the device period, in buffer periods.
+	double jitter;
+};
+
+// Sizes worth trying for a given device period, in increasing order: multiples of the period, up to about a second's worth.
+std::vector<long> GetBufferSizeCandidates(long device_period, double sample_rate);
+// The size to suggest to the host next time. Once a size has run cleanly, this tries the next smaller candidate, until one glitches.
+// Returns 0 if nothing is known yet.
+long GetPreferredBufferSize(const BufferSizeTuning& tuning, double sample_rate);
+// Updates what we know from a session that just ended. Returns false if nothing changed, because the session was too short to tell anything and ran at the same device period as before.
+bool RecordBufferSizeSession(BufferSizeTuning* tuning, const BufferSizeSession& session);
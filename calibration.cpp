@@ -0,0 +1,168 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "calibration.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+
+namespace {
+const int signal_order = 15;
+// -12 dBFS, loud enough to stand out but unlikely to clip anything on the way back.
+const float signal_level = 0.25f;
+const double lead_in_duration = 0.1;
+// A peak that is not at least this many times above the RMS of the whole correlation is considered noise.
+// With pure noise, the highest peak over a one second search window stays around 4-5; with the signal 24 dB below the noise, the true peak comes out at 9-15 (see tests/calibration_test.cpp).
+const double min_peak_to_noise_ratio = 7;
+
+// In-place iterative radix-2 FFT. The size must be a power of two.
+void FFT(std::vector<std::complex<double>>& data, bool inverse)
+{
+	const size_t size = data.size();
+	for (size_t index = 1, reversed = 0; index < size; ++index)
+	{
+		size_t bit = size >> 1;
+		for (; reversed & bit; bit >>= 1)
+			reversed ^= bit;
+		reversed ^= bit;
+		if (index < reversed)
+			std::swap(data[index], data[reversed]);
+	}
+	for (size_t length = 2; length <= size; length <<= 1)
+	{
+		const double angle = 2 * 3.14159265358979323846 / length * (inverse ? 1 : -1);
+		const std::complex<double> root(cos(angle), sin(angle));
+		for (size_t start = 0; start < size; start += length)
+		{
+			std::complex<double> twiddle(1);
+			for (size_t offset = 0; offset < length / 2; ++offset)
+			{
+				const std::complex<double> even = data[start + offset];
+				const std::complex<double> odd = data[start + offset + length / 2] * twiddle;
+				data[start + offset] = even + odd;
+				data[start + offset + length / 2] = even - odd;
+				twiddle *= root;
+			}
+		}
+	}
+}
+}
+
+std::vector<float> GenerateMaximumLengthSequence(int order)
+{
+	// Taps for a maximal-length LFSR, indexed by order (see Xilinx XAPP 052).
+	static const unsigned taps[] = { 0, 0, 0x3, 0x6, 0xC, 0x14, 0x30, 0x60, 0xB8, 0x110, 0x240, 0x500, 0xE08, 0x1C80, 0x3802, 0x6000, 0xD008 };
+	std::vector<float> sequence((size_t(1) << order) - 1);
+	unsigned state = 1;
+	for (size_t index = 0; index < sequence.size(); ++index)
+	{
+		sequence[index] = (state & 1) ? 1.0f : -1.0f;
+		unsigned feedback = state & taps[order];
+		// Parity of the tapped bits.
+		feedback ^= feedback >> 16;
+		feedback ^= feedback >> 8;
+		feedback ^= feedback >> 4;
+		feedback ^= feedback >> 2;
+		feedback ^= feedback >> 1;
+		state = ((state << 1) | (feedback & 1)) & ((1u << order) - 1);
+	}
+	return sequence;
+}
+
+bool DetectDelay(const std::vector<float>& reference, const std::vector<float>& recording, size_t* delay, double* peak_to_noise_ratio)
+{
+	if (reference.empty() || recording.size() < reference.size())
+		return false;
+
+	size_t size = 1;
+	while (size < recording.size() + reference.size())
+		size <<= 1;
+	std::vector<std::complex<double>> reference_spectrum(size);
+	std::vector<std::complex<double>> recording_spectrum(size);
+	std::copy(reference.begin(), reference.end(), reference_spectrum.begin());
+	std::copy(recording.begin(), recording.end(), recording_spectrum.begin());
+	FFT(reference_spectrum, false);
+	FFT(recording_spectrum, false);
+	for (size_t bin = 0; bin < size; ++bin)
+		recording_spectrum[bin] *= std::conj(reference_spectrum[bin]);
+	FFT(recording_spectrum, true);
+
+	// Only non-negative lags where the whole reference fits in the recording make sense. The absolute value catches inverted polarity.
+	const size_t lag_count = recording.size() - reference.size() + 1;
+	size_t peak_lag = 0;
+	double peak = 0;
+	double energy = 0;
+	for (size_t lag = 0; lag < lag_count; ++lag)
+	{
+		const double correlation = std::abs(recording_spectrum[lag].real());
+		energy += correlation * correlation;
+		if (correlation > peak)
+		{
+			peak = correlation;
+			peak_lag = lag;
+		}
+	}
+	const double rms = sqrt(energy / lag_count);
+	*peak_to_noise_ratio = rms > 0 ? peak / rms : 0;
+	*delay = peak_lag;
+	return *peak_to_noise_ratio >= min_peak_to_noise_ratio;
+}
+
+const double LatencyCalibration::max_latency = 1.0;
+
+LatencyCalibration::LatencyCalibration(long output_channel, long input_channel, double sample_rate) :
+	output_channel(output_channel), input_channel(input_channel),
+	lead_in(static_cast<size_t>(lead_in_duration * sample_rate)),
+	signal(GenerateMaximumLengthSequence(signal_order)), position(0), complete(false)
+{
+	for (size_t index = 0; index < signal.size(); ++index)
+		signal[index] *= signal_level;
+	recording.resize(lead_in + signal.size() + static_cast<size_t>(max_latency * sample_rate));
+}
+
+void LatencyCalibration::Process(const float* const* input, float* const* output, long output_channel_count, size_t frames)
+{
+	if (complete.load(std::memory_order_relaxed))
+		return;
+
+	for (long channel = 0; channel < output_channel_count; ++channel)
+		memset(output[channel], 0, frames * sizeof(float));
+	for (size_t frame = 0; frame < frames && position + frame < recording.size(); ++frame)
+	{
+		const size_t signal_position = position + frame;
+		if (signal_position >= lead_in && signal_position - lead_in < signal.size())
+			output[output_channel][frame] = signal[signal_position - lead_in];
+		recording[signal_position] = input[input_channel][frame];
+	}
+
+	position += frames;
+	if (position >= recording.size())
+		complete.store(true, std::memory_order_release);
+}
+
+bool LatencyCalibration::Analyze(size_t* round_trip_frames, double* peak_to_noise_ratio) const
+{
+	size_t delay;
+	const bool found = DetectDelay(signal, recording, &delay, peak_to_noise_ratio) && delay >= lead_in;
+	if (found)
+		*round_trip_frames = delay - lead_in;
+	return found;
+}
@@ -0,0 +1,64 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Maximum length sequence of the given order (2^order - 1 samples of +/-1), generated by a Fibonacci LFSR.
+// Its autocorrelation is a single sharp peak, which makes it easy to find in a recording even with a lot of noise.
+std::vector<float> GenerateMaximumLengthSequence(int order);
+
+// Looks for reference in recording using FFT cross-correlation. On success, *delay is the offset of reference in recording, in samples.
+// Fails if the correlation peak doesn't stand out clearly enough from the rest (e.g. the signal is not there at all).
+// This is a pure function so that it can be checked offline against synthetic signals.
+bool DetectDelay(const std::vector<float>& reference, const std::vector<float>& recording, size_t* delay, double* peak_to_noise_ratio);
+
+// Measures round-trip latency by playing a test signal on one output channel and recording one input channel.
+// Process() runs on the audio thread; once IsComplete() returns true, Analyze() can be called from any thread.
+class LatencyCalibration
+{
+	public:
+		// The longest round-trip latency we can measure, in seconds.
+		static const double max_latency;
+
+		LatencyCalibration(long output_channel, long input_channel, double sample_rate);
+
+		// Real-time safe. While calibration is in progress, all output channels are muted except output_channel, which gets the test signal.
+		void Process(const float* const* input, float* const* output, long output_channel_count, size_t frames);
+		bool IsComplete() const { return complete.load(std::memory_order_acquire); }
+		// Returns false if the test signal could not be found in the recording. *peak_to_noise_ratio tells how clearly it stood out.
+		bool Analyze(size_t* round_trip_frames, double* peak_to_noise_ratio) const;
+
+	private:
+		LatencyCalibration(const LatencyCalibration&);
+		LatencyCalibration& operator=(const LatencyCalibration&);
+
+		const long output_channel;
+		const long input_channel;
+		// Silence played before the signal, in frames, to let the devices settle.
+		const size_t lead_in;
+		std::vector<float> signal;
+		std::vector<float> recording;
+		// Audio thread only.
+		size_t position;
+		std::atomic<bool> complete;
+};
@@ -0,0 +1,626 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "capabilities.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include "util.h"
+
+namespace {
+const char cache_magic[4] = { 'F', 'X', 'C', 'C' };
+// Version 1 files lack latency corrections, versions 1 and 2 lack buffer size tunings, and versions 1 to 3 lack device snapshots, but are otherwise compatible.
+const unsigned long cache_version = 4;
+
+// The cache file is a flat little-endian binary blob; these helpers (de)serialize it field by field.
+class CacheWriter
+{
+	public:
+		template <typename T> void Write(const T& value) { data.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+		void WriteString(const std::string& value) { Write(static_cast<unsigned long>(value.size())); data.append(value); }
+		const std::string& GetData() const { return data; }
+
+	private:
+		std::string data;
+};
+
+class CacheReader
+{
+	public:
+		explicit CacheReader(const std::string& data) : data(data), offset(0), failed(false) { }
+
+		template <typename T> T Read()
+		{
+			T value = T();
+			if (failed || data.size() - offset < sizeof(value))
+			{
+				failed = true;
+				return value;
+			}
+			memcpy(&value, data.data() + offset, sizeof(value));
+			offset += sizeof(value);
+			return value;
+		}
+		std::string ReadString()
+		{
+			const unsigned long size = Read<unsigned long>();
+			if (failed || data.size() - offset < size)
+			{
+				failed = true;
+				return std::string();
+			}
+			std::string value = data.substr(offset, size);
+			offset += size;
+			return value;
+		}
+		bool HasFailed() const { return failed; }
+
+	private:
+		const std::string& data;
+		size_t offset;
+		bool failed;
+};
+
+void WriteFormat(CacheWriter* writer, const DeviceCapabilities& capabilities)
+{
+	writer->Write(capabilities.input_channel_count);
+	writer->Write(capabilities.output_channel_count);
+	writer->Write(capabilities.input_channel_mask);
+	writer->Write(capabilities.output_channel_mask);
+	writer->Write(capabilities.input_default_sample_rate);
+	writer->Write(capabilities.output_default_sample_rate);
+	writer->Write(capabilities.input_latency_low);
+	writer->Write(capabilities.input_latency_high);
+	writer->Write(capabilities.output_latency_low);
+	writer->Write(capabilities.output_latency_high);
+}
+
+void ReadFormat(CacheReader* reader, DeviceCapabilities* capabilities)
+{
+	capabilities->input_channel_count = reader->Read<long>();
+	capabilities->output_channel_count = reader->Read<long>();
+	capabilities->input_channel_mask = reader->Read<DWORD>();
+	capabilities->output_channel_mask = reader->Read<DWORD>();
+	capabilities->input_default_sample_rate = reader->Read<double>();
+	capabilities->output_default_sample_rate = reader->Read<double>();
+	capabilities->input_latency_low = reader->Read<double>();
+	capabilities->input_latency_high = reader->Read<double>();
+	capabilities->output_latency_low = reader->Read<double>();
+	capabilities->output_latency_high = reader->Read<double>();
+}
+
+// Takes the values from saved, except those in changed, which this instance learned itself, and keeps precedence.
+template <typename Value> void MergeValues(const std::string& key, const std::map<double, Value>& saved, const std::set<std::pair<std::string, double>>& changed, std::map<double, Value>* values)
+{
+	for (typename std::map<double, Value>::const_iterator value = saved.begin(); value != saved.end(); ++value)
+		if (changed.count(std::make_pair(key, value->first)) == 0)
+			(*values)[value->first] = value->second;
+}
+
+unsigned long long GetCurrentFileTime()
+{
+	FILETIME file_time;
+	GetSystemTimeAsFileTime(&file_time);
+	return (static_cast<unsigned long long>(file_time.dwHighDateTime) << 32) | file_time.dwLowDateTime;
+}
+}
+
+DeviceCapabilities::DeviceCapabilities() :
+	input_channel_count(0), output_channel_count(0), input_channel_mask(0), output_channel_mask(0),
+	input_default_sample_rate(0), output_default_sample_rate(0),
+	input_latency_low(0), input_latency_high(0), output_latency_low(0), output_latency_high(0),
+	last_used(0) { }
+
+bool DeviceCapabilities::HasSameFormat(const DeviceCapabilities& other) const
+{
+	return input_channel_count == other.input_channel_count && output_channel_count == other.output_channel_count &&
+		input_channel_mask == other.input_channel_mask && output_channel_mask == other.output_channel_mask &&
+		input_default_sample_rate == other.input_default_sample_rate && output_default_sample_rate == other.output_default_sample_rate &&
+		input_latency_low == other.input_latency_low && input_latency_high == other.input_latency_high &&
+		output_latency_low == other.output_latency_low && output_latency_high == other.output_latency_high;
+}
+
+DeviceSnapshot::DeviceSnapshot() : host_api_type(0), sample_rate(0), sample_format(SAMPLE_FORMAT_COUNT), last_used(0) { }
+
+bool DeviceSnapshot::IsCompatibleWith(const DeviceSnapshot& other) const
+{
+	if (host_api_type != other.host_api_type || input_device_name != other.input_device_name || output_device_name != other.output_device_name ||
+		capabilities.input_channel_count != other.capabilities.input_channel_count || capabilities.output_channel_count != other.capabilities.output_channel_count ||
+		capabilities.input_channel_mask != other.capabilities.input_channel_mask || capabilities.output_channel_mask != other.capabilities.output_channel_mask ||
+		sample_rate != other.sample_rate || aggregate_devices.size() != other.aggregate_devices.size())
+		return false;
+	for (size_t aggregate_device_index = 0; aggregate_device_index < aggregate_devices.size(); ++aggregate_device_index)
+	{
+		const AggregateDevice& aggregate_device = aggregate_devices[aggregate_device_index];
+		const AggregateDevice& other_aggregate_device = other.aggregate_devices[aggregate_device_index];
+		if (aggregate_device.name != other_aggregate_device.name || aggregate_device.input_channel_count != other_aggregate_device.input_channel_count || aggregate_device.output_channel_count != other_aggregate_device.output_channel_count)
+			return false;
+	}
+	return true;
+}
+
+std::string CapabilityCache::GetDefaultPath()
+{
+	char local_app_data[MAX_PATH];
+	const DWORD size = GetEnvironmentVariableA("LOCALAPPDATA", local_app_data, sizeof(local_app_data));
+	if (size == 0 || size >= sizeof(local_app_data))
+		return std::string();
+	const std::string directory = std::string(local_app_data) + "\\FlexASIO";
+	CreateDirectoryA(directory.c_str(), NULL);
+	return directory + "\\capabilities.bin";
+}
+
+CapabilityCache::CapabilityCache(const std::string& path) : path(path), dirty(false) { }
+
+void CapabilityCache::Load()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	dirty = false;
+	changed_entries.clear();
+	changed_sample_rates.clear();
+	changed_latency_corrections.clear();
+	changed_buffer_size_tunings.clear();
+	ReadCacheFile(&entries, &snapshots);
+	Log() << "Loaded " << entries.size() << " entries and " << snapshots.size() << " device snapshots from capability cache " << path;
+}
+
+void CapabilityCache::ReadCacheFile(std::map<std::string, DeviceCapabilities>* entries, std::map<std::string, DeviceSnapshot>* snapshots) const
+{
+	entries->clear();
+	snapshots->clear();
+
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+	{
+		Log(LOG_LEVEL_DEBUG) << "No capability cache at " << path;
+		return;
+	}
+	std::string data;
+	char chunk[4096];
+	size_t chunk_size;
+	while ((chunk_size = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		data.append(chunk, chunk_size);
+	fclose(file);
+
+	CacheReader reader(data);
+	char magic[sizeof(cache_magic)];
+	for (size_t magic_index = 0; magic_index < sizeof(magic); ++magic_index)
+		magic[magic_index] = reader.Read<char>();
+	const unsigned long version = reader.Read<unsigned long>();
+	if (reader.HasFailed() || memcmp(magic, cache_magic, sizeof(magic)) != 0 || version < 1 || version > cache_version)
+	{
+		Log(LOG_LEVEL_WARNING) << "Ignoring capability cache " << path << " as it is in an unknown format";
+		return;
+	}
+
+	const unsigned long entry_count = reader.Read<unsigned long>();
+	for (unsigned long entry_index = 0; entry_index < entry_count && !reader.HasFailed(); ++entry_index)
+	{
+		const std::string key = reader.ReadString();
+		DeviceCapabilities capabilities;
+		ReadFormat(&reader, &capabilities);
+		capabilities.last_used = reader.Read<unsigned long long>();
+		const unsigned long sample_rate_count = reader.Read<unsigned long>();
+		for (unsigned long sample_rate_index = 0; sample_rate_index < sample_rate_count && !reader.HasFailed(); ++sample_rate_index)
+		{
+			const double sample_rate = reader.Read<double>();
+			capabilities.sample_rates[sample_rate] = reader.Read<unsigned char>() != 0;
+		}
+		const unsigned long latency_correction_count = version >= 2 ? reader.Read<unsigned long>() : 0;
+		for (unsigned long latency_correction_index = 0; latency_correction_index < latency_correction_count && !reader.HasFailed(); ++latency_correction_index)
+		{
+			const double sample_rate = reader.Read<double>();
+			capabilities.latency_corrections[sample_rate] = reader.Read<double>();
+		}
+		const unsigned long buffer_size_tuning_count = version >= 3 ? reader.Read<unsigned long>() : 0;
+		for (unsigned long buffer_size_tuning_index = 0; buffer_size_tuning_index < buffer_size_tuning_count && !reader.HasFailed(); ++buffer_size_tuning_index)
+		{
+			const double sample_rate = reader.Read<double>();
+			BufferSizeTuning& tuning = capabilities.buffer_size_tunings[sample_rate];
+			tuning.device_period = reader.Read<long>();
+			tuning.smallest_stable_size = reader.Read<long>();
+			tuning.largest_unstable_size = reader.Read<long>();
+		}
+		if (!reader.HasFailed())
+			(*entries)[key] = capabilities;
+	}
+	const unsigned long snapshot_count = version >= 4 ? reader.Read<unsigned long>() : 0;
+	for (unsigned long snapshot_index = 0; snapshot_index < snapshot_count && !reader.HasFailed(); ++snapshot_index)
+	{
+		const std::string key = reader.ReadString();
+		DeviceSnapshot snapshot;
+		snapshot.host_api_type = reader.Read<long>();
+		snapshot.host_api_name = reader.ReadString();
+		snapshot.input_device_name = reader.ReadString();
+		snapshot.output_device_name = reader.ReadString();
+		ReadFormat(&reader, &snapshot.capabilities);
+		snapshot.sample_rate = reader.Read<double>();
+		const unsigned long sample_format = reader.Read<unsigned long>();
+		snapshot.sample_format = sample_format < SAMPLE_FORMAT_COUNT ? static_cast<SampleFormat>(sample_format) : SAMPLE_FORMAT_COUNT;
+		const unsigned long aggregate_device_count = reader.Read<unsigned long>();
+		for (unsigned long aggregate_device_index = 0; aggregate_device_index < aggregate_device_count && !reader.HasFailed(); ++aggregate_device_index)
+		{
+			DeviceSnapshot::AggregateDevice aggregate_device;
+			aggregate_device.name = reader.ReadString();
+			aggregate_device.input_channel_count = reader.Read<long>();
+			aggregate_device.output_channel_count = reader.Read<long>();
+			snapshot.aggregate_devices.push_back(aggregate_device);
+		}
+		snapshot.last_used = reader.Read<unsigned long long>();
+		if (!reader.HasFailed())
+			(*snapshots)[key] = snapshot;
+	}
+	if (reader.HasFailed())
+	{
+		Log(LOG_LEVEL_WARNING) << "Capability cache " << path << " is truncated, ignoring it";
+		entries->clear();
+		snapshots->clear();
+	}
+}
+
+void CapabilityCache::Save()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!dirty)
+		return;
+
+	// Other driver instances, in this process or others, might have saved what they learned since we loaded the cache. Merge that in, and keep them from doing the same until we're done, or one of us would lose what the other learned.
+	// A mutex abandoned by an instance that crashed mid-save is fine to take over, as the cache file itself is only ever replaced whole.
+	const HANDLE file_mutex = CreateMutexA(NULL, FALSE, "Local\\FlexASIO-CapabilityCache");
+	if (file_mutex == NULL)
+	{
+		Log(LOG_LEVEL_WARNING) << "Unable to create capability cache mutex, not saving";
+		return;
+	}
+	const DWORD wait_result = WaitForSingleObject(file_mutex, 5000);
+	if (wait_result != WAIT_OBJECT_0 && wait_result != WAIT_ABANDONED)
+	{
+		Log(LOG_LEVEL_WARNING) << "Timed out waiting for another instance to save the capability cache, not saving";
+		CloseHandle(file_mutex);
+		return;
+	}
+	Merge();
+
+	// Evict the entries that haven't been used for the longest time.
+	while (entries.size() > max_entries)
+	{
+		std::map<std::string, DeviceCapabilities>::iterator oldest = entries.begin();
+		for (std::map<std::string, DeviceCapabilities>::iterator entry = entries.begin(); entry != entries.end(); ++entry)
+			if (entry->second.last_used < oldest->second.last_used)
+				oldest = entry;
+		entries.erase(oldest);
+	}
+	while (snapshots.size() > max_entries)
+	{
+		std::map<std::string, DeviceSnapshot>::iterator oldest = snapshots.begin();
+		for (std::map<std::string, DeviceSnapshot>::iterator snapshot = snapshots.begin(); snapshot != snapshots.end(); ++snapshot)
+			if (snapshot->second.last_used < oldest->second.last_used)
+				oldest = snapshot;
+		snapshots.erase(oldest);
+	}
+
+	const bool written = WriteCacheFile();
+	ReleaseMutex(file_mutex);
+	CloseHandle(file_mutex);
+	if (!written)
+		return;
+	dirty = false;
+	changed_entries.clear();
+	changed_sample_rates.clear();
+	changed_latency_corrections.clear();
+	changed_buffer_size_tunings.clear();
+	Log() << "Saved " << entries.size() << " entries to capability cache " << path;
+}
+
+void CapabilityCache::Merge()
+{
+	std::map<std::string, DeviceCapabilities> saved_entries;
+	std::map<std::string, DeviceSnapshot> saved_snapshots;
+	ReadCacheFile(&saved_entries, &saved_snapshots);
+
+	for (std::map<std::string, DeviceCapabilities>::const_iterator saved = saved_entries.begin(); saved != saved_entries.end(); ++saved)
+	{
+		std::map<std::string, DeviceCapabilities>::iterator entry = entries.find(saved->first);
+		if (entry == entries.end())
+		{
+			entries.insert(*saved);
+			continue;
+		}
+		// Ours was started over (see Validate()), or theirs was for a different format: the most recently used one wins.
+		if (changed_entries.count(saved->first) > 0 || !entry->second.HasSameFormat(saved->second))
+		{
+			if (saved->second.last_used > entry->second.last_used)
+				entry->second = saved->second;
+			continue;
+		}
+		// Otherwise, take whatever they learned, except where we learned something ourselves since we loaded the cache.
+		MergeValues(saved->first, saved->second.sample_rates, changed_sample_rates, &entry->second.sample_rates);
+		MergeValues(saved->first, saved->second.latency_corrections, changed_latency_corrections, &entry->second.latency_corrections);
+		MergeValues(saved->first, saved->second.buffer_size_tunings, changed_buffer_size_tunings, &entry->second.buffer_size_tunings);
+		entry->second.last_used = (std::max)(entry->second.last_used, saved->second.last_used);
+	}
+	for (std::map<std::string, DeviceSnapshot>::const_iterator saved = saved_snapshots.begin(); saved != saved_snapshots.end(); ++saved)
+	{
+		std::map<std::string, DeviceSnapshot>::iterator snapshot = snapshots.find(saved->first);
+		if (snapshot == snapshots.end() || saved->second.last_used > snapshot->second.last_used)
+			snapshots[saved->first] = saved->second;
+	}
+}
+
+bool CapabilityCache::WriteCacheFile() const
+{
+	CacheWriter writer;
+	for (size_t magic_index = 0; magic_index < sizeof(cache_magic); ++magic_index)
+		writer.Write(cache_magic[magic_index]);
+	writer.Write(cache_version);
+	writer.Write(static_cast<unsigned long>(entries.size()));
+	for (std::map<std::string, DeviceCapabilities>::const_iterator entry = entries.begin(); entry != entries.end(); ++entry)
+	{
+		const DeviceCapabilities& capabilities = entry->second;
+		writer.WriteString(entry->first);
+		WriteFormat(&writer, capabilities);
+		writer.Write(capabilities.last_used);
+		writer.Write(static_cast<unsigned long>(capabilities.sample_rates.size()));
+		for (std::map<double, bool>::const_iterator sample_rate = capabilities.sample_rates.begin(); sample_rate != capabilities.sample_rates.end(); ++sample_rate)
+		{
+			writer.Write(sample_rate->first);
+			writer.Write(static_cast<unsigned char>(sample_rate->second));
+		}
+		writer.Write(static_cast<unsigned long>(capabilities.latency_corrections.size()));
+		for (std::map<double, double>::const_iterator latency_correction = capabilities.latency_corrections.begin(); latency_correction != capabilities.latency_corrections.end(); ++latency_correction)
+		{
+			writer.Write(latency_correction->first);
+			writer.Write(latency_correction->second);
+		}
+		writer.Write(static_cast<unsigned long>(capabilities.buffer_size_tunings.size()));
+		for (std::map<double, BufferSizeTuning>::const_iterator tuning = capabilities.buffer_size_tunings.begin(); tuning != capabilities.buffer_size_tunings.end(); ++tuning)
+		{
+			writer.Write(tuning->first);
+			writer.Write(tuning->second.device_period);
+			writer.Write(tuning->second.smallest_stable_size);
+			writer.Write(tuning->second.largest_unstable_size);
+		}
+	}
+	writer.Write(static_cast<unsigned long>(snapshots.size()));
+	for (std::map<std::string, DeviceSnapshot>::const_iterator entry = snapshots.begin(); entry != snapshots.end(); ++entry)
+	{
+		const DeviceSnapshot& snapshot = entry->second;
+		writer.WriteString(entry->first);
+		writer.Write(snapshot.host_api_type);
+		writer.WriteString(snapshot.host_api_name);
+		writer.WriteString(snapshot.input_device_name);
+		writer.WriteString(snapshot.output_device_name);
+		WriteFormat(&writer, snapshot.capabilities);
+		writer.Write(snapshot.sample_rate);
+		writer.Write(static_cast<unsigned long>(snapshot.sample_format));
+		writer.Write(static_cast<unsigned long>(snapshot.aggregate_devices.size()));
+		for (std::vector<DeviceSnapshot::AggregateDevice>::const_iterator aggregate_device = snapshot.aggregate_devices.begin(); aggregate_device != snapshot.aggregate_devices.end(); ++aggregate_device)
+		{
+			writer.WriteString(aggregate_device->name);
+			writer.Write(aggregate_device->input_channel_count);
+			writer.Write(aggregate_device->output_channel_count);
+		}
+		writer.Write(snapshot.last_used);
+	}
+
+	// Write to a temporary file first, so that another driver instance never sees a half-written cache. The name is unique to this instance, in case another one is writing at the same time after all (e.g. it gave up waiting for the mutex).
+	static std::atomic<unsigned long> temporary_file_count(0);
+	const std::string temporary_path = path + "." + std::to_string(GetCurrentProcessId()) + "." + std::to_string(temporary_file_count++) + ".tmp";
+	FILE* file = fopen(temporary_path.c_str(), "wb");
+	if (!file)
+	{
+		Log(LOG_LEVEL_WARNING) << "Unable to write capability cache " << temporary_path;
+		return false;
+	}
+	const bool written = fwrite(writer.GetData().data(), 1, writer.GetData().size(), file) == writer.GetData().size();
+	if (fclose(file) != 0 || !written || !MoveFileExA(temporary_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		Log(LOG_LEVEL_WARNING) << "Unable to write capability cache " << path;
+		DeleteFileA(temporary_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+void CapabilityCache::Validate(const std::string& key, DeviceCapabilities* capabilities)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, DeviceCapabilities>::iterator entry = entries.find(key);
+	if (entry == entries.end())
+		Log() << "No cached capabilities for these devices";
+	else if (!entry->second.HasSameFormat(*capabilities))
+	{
+		Log() << "The format of the devices changed, discarding cached capabilities";
+		entries.erase(entry);
+		changed_entries.insert(key);
+	}
+	else
+	{
+		capabilities->sample_rates = entry->second.sample_rates;
+		capabilities->latency_corrections = entry->second.latency_corrections;
+		capabilities->buffer_size_tunings = entry->second.buffer_size_tunings;
+		Log() << "Using cached capabilities (" << capabilities->sample_rates.size() << " sample rates known, " << capabilities->latency_corrections.size() << " latency calibrations)";
+	}
+	capabilities->last_used = GetCurrentFileTime();
+	entries[key] = *capabilities;
+	dirty = true;
+}
+
+bool CapabilityCache::GetSampleRate(const std::string& key, double sample_rate, bool* supported) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, DeviceCapabilities>::const_iterator entry = entries.find(key);
+	if (entry == entries.end())
+		return false;
+	std::map<double, bool>::const_iterator cached = entry->second.sample_rates.find(sample_rate);
+	if (cached == entry->second.sample_rates.end())
+		return false;
+	*supported = cached->second;
+	return true;
+}
+
+void CapabilityCache::SetSampleRate(const std::string& key, double sample_rate, bool supported)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, DeviceCapabilities>::iterator entry = entries.find(key);
+	if (entry == entries.end())
+		return;
+	std::map<double, bool>::iterator cached = entry->second.sample_rates.find(sample_rate);
+	if (cached != entry->second.sample_rates.end() && cached->second == supported)
+		return;
+	entry->second.sample_rates[sample_rate] = supported;
+	entry->second.last_used = GetCurrentFileTime();
+	changed_sample_rates.insert(std::make_pair(key, sample_rate));
+	dirty = true;
+}
+
+bool CapabilityCache::GetLatencyCorrection(const std::string& key, double sample_rate, double* correction) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, DeviceCapabilities>::const_iterator entry = entries.find(key);
+	if (entry == entries.end())
+		return false;
+	std::map<double, double>::const_iterator cached = entry->second.latency_corrections.find(sample_rate);
+	if (cached == entry->second.latency_corrections.end())
+		return false;
+	*correction = cached->second;
+	return true;
+}
+
+void CapabilityCache::SetLatencyCorrection(const std::string& key, double sample_rate, double correction)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, DeviceCapabilities>::iterator entry = entries.find(key);
+	if (entry == entries.end())
+		return;
+	entry->second.latency_corrections[sample_rate] = correction;
+	entry->second.last_used = GetCurrentFileTime();
+	changed_latency_corrections.insert(std::make_pair(key, sample_rate));
+	dirty = true;
+}
+
+bool CapabilityCache::GetBufferSizeTuning(const std::string& key, double sample_rate, BufferSizeTuning* tuning) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, DeviceCapabilities>::const_iterator entry = entries.find(key);
+	if (entry == entries.end())
+		return false;
+	std::map<double, BufferSizeTuning>::const_iterator cached = entry->second.buffer_size_tunings.find(sample_rate);
+	if (cached == entry->second.buffer_size_tunings.end())
+		return false;
+	*tuning = cached->second;
+	return true;
+}
+
+void CapabilityCache::SetBufferSizeTuning(const std::string& key, double sample_rate, const BufferSizeTuning& tuning)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, DeviceCapabilities>::iterator entry = entries.find(key);
+	if (entry == entries.end())
+		return;
+	entry->second.buffer_size_tunings[sample_rate] = tuning;
+	entry->second.last_used = GetCurrentFileTime();
+	changed_buffer_size_tunings.insert(std::make_pair(key, sample_rate));
+	dirty = true;
+}
+
+bool CapabilityCache::GetDeviceSnapshot(const std::string& key, DeviceSnapshot* snapshot)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<std::string, DeviceSnapshot>::iterator cached = snapshots.find(key);
+	if (cached == snapshots.end())
+		return false;
+	cached->second.last_used = GetCurrentFileTime();
+	dirty = true;
+	*snapshot = cached->second;
+	return true;
+}
+
+void CapabilityCache::SetDeviceSnapshot(const std::string& key, const DeviceSnapshot& snapshot)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	DeviceSnapshot& cached = snapshots[key];
+	cached = snapshot;
+	cached.last_used = GetCurrentFileTime();
+	dirty = true;
+}
+
+SampleRateProber::SampleRateProber(const ProbeFunction& probe, const std::vector<double>& sample_rates) :
+	probe(probe), pending(sample_rates), current_sample_rate(0), probing(false), cancelled(false)
+{
+	thread = std::thread(&SampleRateProber::Run, this);
+}
+
+SampleRateProber::~SampleRateProber()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		cancelled = true;
+		pending.clear();
+	}
+	probed.notify_all();
+	thread.join();
+}
+
+bool SampleRateProber::Wait(double sample_rate, bool* supported)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		std::map<double, bool>::const_iterator result = results.find(sample_rate);
+		if (result != results.end())
+		{
+			*supported = result->second;
+			return true;
+		}
+		if (cancelled)
+			return false;
+		if (!probing || current_sample_rate != sample_rate)
+		{
+			const std::vector<double>::iterator scheduled = std::find(pending.begin(), pending.end(), sample_rate);
+			if (scheduled == pending.end())
+				return false;
+			// Bring the rate we're waiting for to the front of the queue.
+			pending.erase(scheduled);
+			pending.insert(pending.begin(), sample_rate);
+		}
+		probed.wait(lock);
+	}
+}
+
+void SampleRateProber::Run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!cancelled && !pending.empty())
+	{
+		const double sample_rate = pending.front();
+		pending.erase(pending.begin());
+		current_sample_rate = sample_rate;
+		probing = true;
+		lock.unlock();
+		const bool supported = probe(sample_rate);
+		lock.lock();
+		probing = false;
+		results[sample_rate] = supported;
+		probed.notify_all();
+	}
+}
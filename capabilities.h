@@ -0,0 +1,189 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <windows.h>
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffersize.h"
+#include "convert.h"
+
+// What a given combination of devices looks like, as far as the ASIO host is concerned.
+// Finding out which sample rates are supported is slow (PortAudio needs to open a stream for each of them), so this is cached on disk across driver instances.
+struct DeviceCapabilities
+{
+	DeviceCapabilities();
+
+	// The default format of the devices. If any of this changes, whatever we know about sample rates is stale.
+	long input_channel_count;
+	long output_channel_count;
+	DWORD input_channel_mask;
+	DWORD output_channel_mask;
+	double input_default_sample_rate;
+	double output_default_sample_rate;
+	// In seconds, as reported by PortAudio.
+	double input_latency_low;
+	double input_latency_high;
+	double output_latency_low;
+	double output_latency_high;
+
+	// Sample rates that have been probed so far, and whether they are supported.
+	std::map<double, bool> sample_rates;
+	// Measured round-trip latency minus the latency reported by PortAudio, in seconds, by sample rate (see LatencyCalibration).
+	std::map<double, double> latency_corrections;
+	// What has been learned about buffer sizes, by sample rate.
+	std::map<double, BufferSizeTuning> buffer_size_tunings;
+	// When the entry was last used, as a FILETIME. Used to evict old entries.
+	unsigned long long last_used;
+
+	bool HasSameFormat(const DeviceCapabilities& other) const;
+};
+
+// Everything init() needs to tell the host about the devices, so that it can do so without initializing PortAudio (which enumerates every device of every host API).
+// Taken whenever the devices are initialized for real, and keyed by the part of the configuration that selects the devices.
+struct DeviceSnapshot
+{
+	DeviceSnapshot();
+
+	struct AggregateDevice
+	{
+		AggregateDevice() : input_channel_count(0), output_channel_count(0) { }
+
+		std::string name;
+		long input_channel_count;
+		long output_channel_count;
+	};
+
+	// A PaHostApiTypeId.
+	long host_api_type;
+	std::string host_api_name;
+	// Empty if there is no device in that direction.
+	std::string input_device_name;
+	std::string output_device_name;
+	// Only the format of the devices is used; whatever has been learned about them lives in the capability cache entry.
+	DeviceCapabilities capabilities;
+	// The highest default sample rate of the devices, or 0 if unknown.
+	double sample_rate;
+	// SAMPLE_FORMAT_COUNT if the native format of the devices is unknown.
+	SampleFormat sample_format;
+	// In the order they are listed in the configuration.
+	std::vector<AggregateDevice> aggregate_devices;
+	// When the snapshot was last used, as a FILETIME. Used to evict old snapshots.
+	unsigned long long last_used;
+
+	// True if the host can't tell the difference: same devices, channels, channel names and default sample rate.
+	bool IsCompatibleWith(const DeviceSnapshot& other) const;
+};
+
+// On-disk cache of DeviceCapabilities, keyed by host API, device names and stream mode.
+// Cached sample rates are trusted without any probing. They are validated lazily: if opening a stream for real contradicts the cache, the caller corrects the entry.
+// All methods are thread-safe.
+class CapabilityCache
+{
+	public:
+		// Returns an empty string if the local application data folder cannot be found.
+		static std::string GetDefaultPath();
+
+		explicit CapabilityCache(const std::string& path);
+
+		// A missing or corrupt file results in an empty cache.
+		void Load();
+		// Does nothing if the cache hasn't changed since it was loaded.
+		// Otherwise, merges in what other instances saved in the meantime, keeping what this one learned where they disagree, and replaces the file, holding a named mutex throughout.
+		void Save();
+
+		// Looks up the entry for key and makes sure it matches the current format of the devices, discarding it if it doesn't.
+		// Also marks the entry as used. On return, *capabilities contains whatever is known about the devices.
+		void Validate(const std::string& key, DeviceCapabilities* capabilities);
+		bool GetSampleRate(const std::string& key, double sample_rate, bool* supported) const;
+		void SetSampleRate(const std::string& key, double sample_rate, bool supported);
+		bool GetLatencyCorrection(const std::string& key, double sample_rate, double* correction) const;
+		void SetLatencyCorrection(const std::string& key, double sample_rate, double correction);
+		bool GetBufferSizeTuning(const std::string& key, double sample_rate, BufferSizeTuning* tuning) const;
+		void SetBufferSizeTuning(const std::string& key, double sample_rate, const BufferSizeTuning& tuning);
+		// Snapshots are keyed separately from the entries, as the entry key depends on the device names, which is what the snapshot is for.
+		bool GetDeviceSnapshot(const std::string& key, DeviceSnapshot* snapshot);
+		void SetDeviceSnapshot(const std::string& key, const DeviceSnapshot& snapshot);
+
+	private:
+		static const size_t max_entries = 16;
+
+		CapabilityCache(const CapabilityCache&);
+		CapabilityCache& operator=(const CapabilityCache&);
+
+		// Leaves the maps empty if the file is missing or corrupt.
+		void ReadCacheFile(std::map<std::string, DeviceCapabilities>* entries, std::map<std::string, DeviceSnapshot>* snapshots) const;
+		// Merges the file into entries and snapshots (see Save()).
+		void Merge();
+		bool WriteCacheFile() const;
+
+		const std::string path;
+		mutable std::mutex mutex;
+		std::map<std::string, DeviceCapabilities> entries;
+		std::map<std::string, DeviceSnapshot> snapshots;
+		bool dirty;
+		// What this instance changed since it loaded or saved the cache, by entry key and sample rate, which takes precedence over what other instances saved (see Merge()).
+		// Entries in changed_entries were started over, and are merged as a whole.
+		std::set<std::string> changed_entries;
+		std::set<std::pair<std::string, double>> changed_sample_rates;
+		std::set<std::pair<std::string, double>> changed_latency_corrections;
+		std::set<std::pair<std::string, double>> changed_buffer_size_tunings;
+};
+
+// Probes a list of sample rates on a background thread, so that the host doesn't have to wait for all of them in turn when it calls canSampleRate().
+// The probe function is called from the background thread, one rate at a time.
+class SampleRateProber
+{
+	public:
+		typedef std::function<bool(double sample_rate)> ProbeFunction;
+
+		SampleRateProber(const ProbeFunction& probe, const std::vector<double>& sample_rates);
+		// Waits for the probe in progress (if any) to finish, and abandons the rest.
+		~SampleRateProber();
+
+		// If sample_rate is scheduled to be probed, waits for the result and returns true. Returns false if the caller should probe the rate itself.
+		bool Wait(double sample_rate, bool* supported);
+
+	private:
+		SampleRateProber(const SampleRateProber&);
+		SampleRateProber& operator=(const SampleRateProber&);
+
+		void Run();
+
+		const ProbeFunction probe;
+		std::mutex mutex;
+		std::condition_variable probed;
+		// Rates still to be probed, in order.
+		std::vector<double> pending;
+		std::map<double, bool> results;
+		// The rate being probed right now, if any.
+		double current_sample_rate;
+		bool probing;
+		bool cancelled;
+		std::thread thread;
+};
@@ -0,0 +1,125 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "config.h"
+
+#include <windows.h>
+
+#include <vector>
+
+namespace {
+const char config_key[] = "Software\\FlexASIO";
+
+bool ReadString(HKEY key, const char* name, std::string* value)
+{
+	DWORD type;
+	DWORD size = 0;
+	if (RegQueryValueExA(key, name, NULL, &type, NULL, &size) != ERROR_SUCCESS || type != REG_SZ)
+		return false;
+	std::vector<char> buffer(size + 1);
+	if (RegQueryValueExA(key, name, NULL, &type, reinterpret_cast<BYTE*>(buffer.data()), &size) != ERROR_SUCCESS)
+		return false;
+	buffer[size] = '\0';
+	*value = buffer.data();
+	return true;
+}
+
+bool ReadDword(HKEY key, const char* name, DWORD* value)
+{
+	DWORD type;
+	DWORD size = sizeof(*value);
+	return RegQueryValueExA(key, name, NULL, &type, reinterpret_cast<BYTE*>(value), &size) == ERROR_SUCCESS && type == REG_DWORD;
+}
+}
+
+Config::Config() :
+	log_level(LOG_LEVEL_INFO), log_sink("debug"), drift_compensation(false), capability_cache(true),
+	calibrate_latency(false), calibration_output_channel(0), calibration_input_channel(0),
+	overload_threshold(80), large_pages(false), resampler_quality("medium"), buffer_size_tuning(false),
+	deferred_initialization(true), background_initialization(false), stream_pool_timeout(10000), stall_timeout(2000), metering(false), host_thread_buffers(0),
+	loopback_input_channels(0), loopback_output_channels(0), loopback_name("FlexASIO"),
+	virtual_output_channels(2), virtual_speed(0), virtual_stall_interval(0)
+{
+}
+
+Config LoadConfig()
+{
+	Config config;
+
+	HKEY key;
+	if (RegOpenKeyExA(HKEY_CURRENT_USER, config_key, 0, KEY_READ, &key) != ERROR_SUCCESS)
+		return config;
+
+	std::string value;
+	if (ReadString(key, "LogLevel", &value))
+		ParseLogLevel(value, &config.log_level);
+	ReadString(key, "LogSink", &config.log_sink);
+	ReadString(key, "LogFile", &config.log_file);
+	ReadString(key, "SampleType", &config.sample_type);
+	ReadString(key, "InputMatrix", &config.input_matrix);
+	ReadString(key, "OutputMatrix", &config.output_matrix);
+	ReadString(key, "AggregateDevices", &config.aggregate_devices);
+	ReadString(key, "ResamplerQuality", &config.resampler_quality);
+	ReadString(key, "LoopbackName", &config.loopback_name);
+	ReadString(key, "EngineName", &config.engine_name);
+	ReadString(key, "VirtualInputFile", &config.virtual_input_file);
+	ReadString(key, "VirtualOutputFile", &config.virtual_output_file);
+	DWORD dword_value;
+	if (ReadDword(key, "DriftCompensation", &dword_value))
+		config.drift_compensation = dword_value != 0;
+	if (ReadDword(key, "CapabilityCache", &dword_value))
+		config.capability_cache = dword_value != 0;
+	if (ReadDword(key, "CalibrateLatency", &dword_value))
+		config.calibrate_latency = dword_value != 0;
+	if (ReadDword(key, "CalibrationOutputChannel", &dword_value))
+		config.calibration_output_channel = dword_value;
+	if (ReadDword(key, "CalibrationInputChannel", &dword_value))
+		config.calibration_input_channel = dword_value;
+	if (ReadDword(key, "OverloadThreshold", &dword_value))
+		config.overload_threshold = dword_value;
+	if (ReadDword(key, "LargePages", &dword_value))
+		config.large_pages = dword_value != 0;
+	if (ReadDword(key, "BufferSizeTuning", &dword_value))
+		config.buffer_size_tuning = dword_value != 0;
+	if (ReadDword(key, "DeferredInitialization", &dword_value))
+		config.deferred_initialization = dword_value != 0;
+	if (ReadDword(key, "BackgroundInitialization", &dword_value))
+		config.background_initialization = dword_value != 0;
+	if (ReadDword(key, "StreamPoolTimeout", &dword_value))
+		config.stream_pool_timeout = dword_value;
+	if (ReadDword(key, "StallTimeout", &dword_value))
+		config.stall_timeout = dword_value;
+	if (ReadDword(key, "Metering", &dword_value))
+		config.metering = dword_value != 0;
+	if (ReadDword(key, "HostThreadBuffers", &dword_value))
+		config.host_thread_buffers = dword_value;
+	if (ReadDword(key, "LoopbackInputChannels", &dword_value))
+		config.loopback_input_channels = dword_value;
+	if (ReadDword(key, "LoopbackOutputChannels", &dword_value))
+		config.loopback_output_channels = dword_value;
+	if (ReadDword(key, "VirtualOutputChannels", &dword_value))
+		config.virtual_output_channels = dword_value;
+	if (ReadDword(key, "VirtualSpeed", &dword_value))
+		config.virtual_speed = dword_value;
+	if (ReadDword(key, "VirtualStallInterval", &dword_value))
+		config.virtual_stall_interval = dword_value;
+
+	RegCloseKey(key);
+	return config;
+}
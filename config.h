@@ -0,0 +1,124 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <string>
+
+#include "log.h"
+
+// User-tweakable settings. These are read from the registry under HKEY_CURRENT_USER\Software\FlexASIO when the driver is instantiated.
+// Any value that is absent or malformed keeps its default.
+struct Config
+{
+	Config();
+
+	// "LogLevel" (string): off, error, warning, info, debug or trace.
+	LogLevel log_level;
+	// "LogSink" (string): debug (OutputDebugString), file or stderr.
+	std::string log_sink;
+	// "LogFile" (string): path of the log file, used when LogSink is "file".
+	std::string log_file;
+
+	// "SampleType" (string): sample type exposed to the ASIO host, one of Int16, Int24, Int32, Float32 or Float64 (all little-endian).
+	// If empty, the native format of the device is used when it is known, otherwise Float32.
+	std::string sample_type;
+
+	// "DriftCompensation" (DWORD): if non-zero and the input and output devices are different, run them as two separate streams and resample the input to follow the output clock.
+	// If zero, a single full-duplex stream is used, which only works reliably if both devices share the same clock.
+	bool drift_compensation;
+
+	// "CapabilityCache" (DWORD): if zero, always probe the devices instead of using the capability cache in %LOCALAPPDATA%\FlexASIO.
+	bool capability_cache;
+
+	// "CalibrateLatency" (DWORD): if non-zero, measure the round-trip latency when the stream starts, unless it has already been measured for these devices at this sample rate.
+	// This requires a loopback connection from "CalibrationOutputChannel" to "CalibrationInputChannel" (DWORDs, zero-based, both default to 0).
+	bool calibrate_latency;
+	long calibration_output_channel;
+	long calibration_input_channel;
+
+	// "OverloadThreshold" (DWORD): percentage of the buffer period the host can spend in bufferSwitch() before FlexASIO starts considering it overloaded.
+	// If that happens for several buffers in a row, kAsioOverload is sent to the host (if it supports it). 0 disables overload detection.
+	unsigned long overload_threshold;
+
+	// "LargePages" (DWORD): if non-zero, back the ASIO buffers with large pages. This requires the "Lock pages in memory" privilege, and uses at least one large page (typically 2 MB).
+	bool large_pages;
+
+	// "InputMatrix" and "OutputMatrix" (strings): if set, the ASIO channels are virtual channels made of gain-weighted combinations of device channels, instead of mapping 1:1 to them.
+	// Each matrix has one row per ASIO channel, separated by semicolons; each row lists the gain of every device channel, separated by commas.
+	// For example, an OutputMatrix of "1,0,1,0;0,1,0,1" sends ASIO outputs 1 and 2 to device outputs 1/3 and 2/4 respectively, and an InputMatrix of "0.5,0.5" exposes a single input that is the average of the first two device inputs.
+	std::string input_matrix;
+	std::string output_matrix;
+
+	// "AggregateDevices" (string): names of additional devices (from the same host API as the main devices) whose channels are appended after those of the main devices, separated by semicolons.
+	// Each of these devices runs on its own clock, and is resampled to follow the main devices, as with DriftCompensation.
+	std::string aggregate_devices;
+
+	// "ResamplerQuality" (string): low, medium or high. Quality of the conversion used when the host asks for a sample rate the devices don't support, in which case the devices run at their default sample rate instead.
+	// "off" disables conversion, and only sample rates supported by the devices are accepted.
+	std::string resampler_quality;
+
+	// "BufferSizeTuning" (DWORD): if non-zero, suggest buffer sizes to the host based on how previous sessions went (glitches and callback jitter), instead of a fixed 1024 samples.
+	// FlexASIO then starts at twice the device period and steps down one size per clean session of at least 30 seconds, backing off when a size glitches. This requires the capability cache.
+	bool buffer_size_tuning;
+
+	// "DeferredInitialization" (DWORD): if non-zero (the default), init() answers the host from a snapshot of the devices taken by a previous instance, and PortAudio is only initialized once the devices are actually needed (typically in createBuffers()).
+	// Hosts often instantiate the driver just to list it, and initializing PortAudio enumerates every device of every host API. This requires the capability cache, and only applies to WASAPI.
+	bool deferred_initialization;
+	// "BackgroundInitialization" (DWORD): if non-zero, start initializing PortAudio on a background thread as soon as init() returns, instead of waiting for the devices to be needed.
+	// This makes createBuffers() faster, but makes releasing a driver instance that was only used for listing slower, as it has to wait for PortAudio.
+	bool background_initialization;
+
+	// "StreamPoolTimeout" (DWORD): how long, in milliseconds, the PortAudio streams are kept open after disposeBuffers() in case the next createBuffers() can reuse them (default 10000). 0 closes them right away.
+	unsigned long stream_pool_timeout;
+
+	// "StallTimeout" (DWORD): if the stream doesn't call back for this many milliseconds (default 2000), or 8 ASIO buffers if that's longer, FlexASIO considers it stalled (e.g. the device was unplugged) and reopens it in the background.
+	// The host is then asked to resync (kAsioResyncRequest), or to reset (kAsioResetRequest) if the devices can't be reopened. 0 disables the watchdog.
+	unsigned long stall_timeout;
+
+	// "Metering" (DWORD): if non-zero, measure the peak and RMS level of every device channel in each callback, and count clipped samples. Levels can be read with IFlexASIO::GetChannelLevels(), or directly from the shared memory section "Local\FlexASIO-Meters-<process ID>" (see MeterData).
+	bool metering;
+
+	// "HostThreadBuffers" (DWORD): if 0 (the default), the host runs inside the stream callback, as soon as a buffer is ready. Otherwise, the host runs on its own thread, and the stream callback only exchanges audio with it through the FIFOs (see HostThread).
+	// The value is how many ASIO buffers deep the exchange is, from 2 to 8: the host can then fall up to that many buffers minus one behind before the device notices, at the cost of as much extra output latency.
+	unsigned long host_thread_buffers;
+
+	// "LoopbackInputChannels" and "LoopbackOutputChannels" (DWORDs): extra input and output channels, after those of the devices, which other processes can write and read through a shared memory section (see LoopbackClient).
+	// The section is named after "LoopbackName" (string, default "FlexASIO"), which must be unique among the driver instances running at the same time.
+	long loopback_input_channels;
+	long loopback_output_channels;
+	std::string loopback_name;
+
+	// "EngineName" (string): if set, FlexASIO doesn't open the devices itself, but connects to the FlexASIOEngine process started with the same --name, which mixes the output of all its clients and sends the input to all of them.
+	// This lets several ASIO hosts use the same devices at the same time. Channel counts and the native sample rate are those of the engine; each client keeps its own buffer size. Aggregate devices are not available.
+	std::string engine_name;
+
+	// "VirtualInputFile" and "VirtualOutputFile" (strings): if either is set, FlexASIO doesn't use PortAudio at all. Input is read from a WAV file, output is written to a 32-bit float WAV file, and callbacks are driven by a virtual clock.
+	// This runs the host through the real driver code path without any audio hardware, e.g. for offline regression renders.
+	// The input file sets the number of input channels and the sample rate; the output file has "VirtualOutputChannels" (DWORD, default 2) channels. Without an input file, any sample rate is accepted.
+	std::string virtual_input_file;
+	std::string virtual_output_file;
+	long virtual_output_channels;
+	// "VirtualSpeed" (DWORD): how fast the virtual clock runs, as a multiple of real time. 0 (the default) runs as fast as the host can process.
+	unsigned long virtual_speed;
+	// "VirtualStallInterval" (DWORD): if non-zero, the virtual clock stops after this many callbacks, as if the device had disappeared, until the stream is restarted. This exercises the stall recovery (see StallTimeout).
+	unsigned long virtual_stall_interval;
+};
+
+Config LoadConfig();
@@ -0,0 +1,238 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "convert.h"
+#include "convert_kernels.h"
+
+#ifdef FLEXASIO_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace {
+const float int16_factor = 1.0f / int16_scale;
+const float int24_factor = 1.0f / int24_scale;
+const float int32_factor = 1.0f / int32_scale;
+
+const struct { SampleFormat format; size_t size; const char* name; } sample_formats[] = {
+	{ SAMPLE_FORMAT_INT16, 2, "Int16" },
+	{ SAMPLE_FORMAT_INT24, 3, "Int24" },
+	{ SAMPLE_FORMAT_INT32, 4, "Int32" },
+	{ SAMPLE_FORMAT_FLOAT32, 4, "Float32" },
+	{ SAMPLE_FORMAT_FLOAT64, 8, "Float64" },
+};
+
+#ifdef FLEXASIO_X86
+void Cpuid(int leaf, int subleaf, unsigned int registers[4])
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuidex(info, leaf, subleaf);
+	for (size_t register_index = 0; register_index < 4; ++register_index)
+		registers[register_index] = static_cast<unsigned int>(info[register_index]);
+#else
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+unsigned long long Xgetbv()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return static_cast<unsigned long long>(edx) << 32 | eax;
+#endif
+}
+
+InstructionSet DetectInstructionSet()
+{
+	unsigned int registers[4];
+	Cpuid(0, 0, registers);
+	const unsigned int max_leaf = registers[0];
+	if (max_leaf < 1)
+		return INSTRUCTION_SET_SCALAR;
+
+	Cpuid(1, 0, registers);
+	const bool sse2 = (registers[3] & (1 << 26)) != 0;
+	const bool osxsave = (registers[2] & (1 << 27)) != 0;
+	const bool avx = (registers[2] & (1 << 28)) != 0;
+	if (!sse2)
+		return INSTRUCTION_SET_SCALAR;
+
+	// AVX2 also requires the OS to save the YMM registers on context switches (XCR0 bits 1 and 2).
+	if (max_leaf >= 7 && osxsave && avx && (Xgetbv() & 0x6) == 0x6)
+	{
+		Cpuid(7, 0, registers);
+		if (registers[1] & (1 << 5))
+			return INSTRUCTION_SET_AVX2;
+	}
+	return INSTRUCTION_SET_SSE2;
+}
+#else
+InstructionSet DetectInstructionSet()
+{
+	return INSTRUCTION_SET_SCALAR;
+}
+#endif
+
+const ConversionKernels& GetConversionKernels(InstructionSet instruction_set)
+{
+	switch (instruction_set)
+	{
+#ifdef FLEXASIO_X86
+		case INSTRUCTION_SET_AVX2: return avx2_conversion_kernels;
+		case INSTRUCTION_SET_SSE2: return sse2_conversion_kernels;
+#endif
+		default: return scalar_conversion_kernels;
+	}
+}
+}
+
+void DecodeInt16Scalar(float* destination, const void* source, size_t count)
+{
+	const int16_t* samples = static_cast<const int16_t*>(source);
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+		destination[sample_index] = static_cast<float>(samples[sample_index]) * int16_factor;
+}
+
+void EncodeInt16Scalar(void* destination, const float* source, size_t count)
+{
+	int16_t* samples = static_cast<int16_t*>(destination);
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+		samples[sample_index] = static_cast<int16_t>(EncodeIntegerSample(source[sample_index], int16_scale, int16_minimum, int16_maximum));
+}
+
+void DecodeInt24Scalar(float* destination, const void* source, size_t count)
+{
+	const uint8_t* samples = static_cast<const uint8_t*>(source);
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+		destination[sample_index] = static_cast<float>(ReadInt24(samples + sample_index * 3)) * int24_factor;
+}
+
+void EncodeInt24Scalar(void* destination, const float* source, size_t count)
+{
+	uint8_t* samples = static_cast<uint8_t*>(destination);
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+		WriteInt24(samples + sample_index * 3, EncodeIntegerSample(source[sample_index], int24_scale, int24_minimum, int24_maximum));
+}
+
+void DecodeInt32Scalar(float* destination, const void* source, size_t count)
+{
+	const int32_t* samples = static_cast<const int32_t*>(source);
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+		destination[sample_index] = static_cast<float>(samples[sample_index]) * int32_factor;
+}
+
+void EncodeInt32Scalar(void* destination, const float* source, size_t count)
+{
+	int32_t* samples = static_cast<int32_t*>(destination);
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+		samples[sample_index] = EncodeIntegerSample(source[sample_index], int32_scale, int32_minimum, int32_maximum);
+}
+
+void CopyFloat32(float* destination, const void* source, size_t count)
+{
+	memcpy(destination, source, count * sizeof(float));
+}
+
+void CopyToFloat32(void* destination, const float* source, size_t count)
+{
+	memcpy(destination, source, count * sizeof(float));
+}
+
+void DecodeFloat64Scalar(float* destination, const void* source, size_t count)
+{
+	const double* samples = static_cast<const double*>(source);
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+		destination[sample_index] = static_cast<float>(samples[sample_index]);
+}
+
+void EncodeFloat64Scalar(void* destination, const float* source, size_t count)
+{
+	double* samples = static_cast<double*>(destination);
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+		samples[sample_index] = source[sample_index];
+}
+
+const ConversionKernels scalar_conversion_kernels = {
+	{ DecodeInt16Scalar, DecodeInt24Scalar, DecodeInt32Scalar, CopyFloat32, DecodeFloat64Scalar },
+	{ EncodeInt16Scalar, EncodeInt24Scalar, EncodeInt32Scalar, CopyToFloat32, EncodeFloat64Scalar },
+};
+
+size_t GetSampleSize(SampleFormat format)
+{
+	return sample_formats[format].size;
+}
+
+const char* GetSampleFormatName(SampleFormat format)
+{
+	return sample_formats[format].name;
+}
+
+bool ParseSampleFormat(const std::string& name, SampleFormat* format)
+{
+	for (size_t format_index = 0; format_index < SAMPLE_FORMAT_COUNT; ++format_index)
+		if (name == sample_formats[format_index].name)
+		{
+			*format = sample_formats[format_index].format;
+			return true;
+		}
+	return false;
+}
+
+const char* GetInstructionSetName(InstructionSet instruction_set)
+{
+	switch (instruction_set)
+	{
+		case INSTRUCTION_SET_SSE2: return "SSE2";
+		case INSTRUCTION_SET_AVX2: return "AVX2";
+		default: return "scalar";
+	}
+}
+
+InstructionSet GetBestInstructionSet()
+{
+	static const InstructionSet instruction_set = DetectInstructionSet();
+	return instruction_set;
+}
+
+SampleConverter GetSampleConverter(SampleFormat format)
+{
+	return GetSampleConverter(format, GetBestInstructionSet());
+}
+
+SampleConverter GetSampleConverter(SampleFormat format, InstructionSet instruction_set)
+{
+	if (instruction_set > GetBestInstructionSet())
+		instruction_set = GetBestInstructionSet();
+	const ConversionKernels& kernels = GetConversionKernels(instruction_set);
+
+	SampleConverter converter;
+	converter.format = format;
+	converter.sample_size = GetSampleSize(format);
+	converter.instruction_set = instruction_set;
+	converter.decode = kernels.decode[format];
+	converter.encode = kernels.encode[format];
+	return converter;
+}
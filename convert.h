@@ -0,0 +1,69 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Sample formats we can expose to the ASIO host. All of them are little-endian; 24-bit samples are packed (3 bytes per sample).
+// Internally (and on the PortAudio side), samples are always 32-bit floats.
+enum SampleFormat
+{
+	SAMPLE_FORMAT_INT16,
+	SAMPLE_FORMAT_INT24,
+	SAMPLE_FORMAT_INT32,
+	SAMPLE_FORMAT_FLOAT32,
+	SAMPLE_FORMAT_FLOAT64,
+	SAMPLE_FORMAT_COUNT,
+};
+
+size_t GetSampleSize(SampleFormat format);
+const char* GetSampleFormatName(SampleFormat format);
+bool ParseSampleFormat(const std::string& name, SampleFormat* format);
+
+enum InstructionSet
+{
+	INSTRUCTION_SET_SCALAR,
+	INSTRUCTION_SET_SSE2,
+	INSTRUCTION_SET_AVX2,
+};
+
+const char* GetInstructionSetName(InstructionSet instruction_set);
+// The most capable instruction set supported by both the CPU and the OS. This is detected once and cached.
+InstructionSet GetBestInstructionSet();
+
+// Converts count samples from the given format to floats.
+typedef void (*DecodeSamplesFunction)(float* destination, const void* source, size_t count);
+// Converts count floats to the given format. Floats are clamped to [-1, 1) and rounded to nearest when converting to integers.
+typedef void (*EncodeSamplesFunction)(void* destination, const float* source, size_t count);
+
+// All the kernels for a given format produce bit-exact results, regardless of the instruction set.
+struct SampleConverter
+{
+	SampleFormat format;
+	size_t sample_size;
+	InstructionSet instruction_set;
+	DecodeSamplesFunction decode;
+	EncodeSamplesFunction encode;
+};
+
+SampleConverter GetSampleConverter(SampleFormat format);
+// Falls back to a lesser instruction set if the requested one is not available.
+SampleConverter GetSampleConverter(SampleFormat format, InstructionSet instruction_set);
@@ -0,0 +1,167 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// These kernels must only be called after checking for CPU support, which GetSampleConverter() takes care of.
+// Note that this file is deliberately *not* built with /arch:AVX2: MSVC doesn't need it for intrinsics, and it would allow AVX2 code to leak into inline functions shared with the rest of the DLL.
+
+#include "convert_kernels.h"
+
+#ifdef FLEXASIO_X86
+
+#if defined(__GNUC__) && !defined(__AVX2__)
+#pragma GCC target("avx2")
+#endif
+
+#include <algorithm>
+
+#include <immintrin.h>
+
+namespace {
+const size_t int24_block_size = 64;
+
+__m256i EncodeIntegers(__m256 values, __m256 scale, __m256 minimum, __m256 maximum)
+{
+	return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(values, scale), minimum), maximum));
+}
+
+void DecodeInt16(float* destination, const void* source, size_t count)
+{
+	const int16_t* samples = static_cast<const int16_t*>(source);
+	const __m256 factor = _mm256_set1_ps(1.0f / int16_scale);
+	size_t sample_index = 0;
+	for (; sample_index + 8 <= count; sample_index += 8)
+	{
+		const __m256i values = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + sample_index)));
+		_mm256_storeu_ps(destination + sample_index, _mm256_mul_ps(_mm256_cvtepi32_ps(values), factor));
+	}
+	DecodeInt16Scalar(destination + sample_index, samples + sample_index, count - sample_index);
+}
+
+void EncodeInt16(void* destination, const float* source, size_t count)
+{
+	int16_t* samples = static_cast<int16_t*>(destination);
+	const __m256 scale = _mm256_set1_ps(int16_scale);
+	const __m256 minimum = _mm256_set1_ps(int16_minimum);
+	const __m256 maximum = _mm256_set1_ps(int16_maximum);
+	size_t sample_index = 0;
+	for (; sample_index + 16 <= count; sample_index += 16)
+	{
+		const __m256i low = EncodeIntegers(_mm256_loadu_ps(source + sample_index), scale, minimum, maximum);
+		const __m256i high = EncodeIntegers(_mm256_loadu_ps(source + sample_index + 8), scale, minimum, maximum);
+		// VPACKSSDW works within 128-bit lanes, so the result needs to be put back in order.
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(samples + sample_index), packed);
+	}
+	EncodeInt16Scalar(samples + sample_index, source + sample_index, count - sample_index);
+}
+
+void DecodeInt32Block(float* destination, const int32_t* samples, size_t count, float factor_value)
+{
+	const __m256 factor = _mm256_set1_ps(factor_value);
+	size_t sample_index = 0;
+	for (; sample_index + 8 <= count; sample_index += 8)
+	{
+		const __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(samples + sample_index));
+		_mm256_storeu_ps(destination + sample_index, _mm256_mul_ps(_mm256_cvtepi32_ps(values), factor));
+	}
+	for (; sample_index < count; ++sample_index)
+		destination[sample_index] = static_cast<float>(samples[sample_index]) * factor_value;
+}
+
+void EncodeInt32Block(int32_t* samples, const float* source, size_t count, float scale_value, float minimum_value, float maximum_value)
+{
+	const __m256 scale = _mm256_set1_ps(scale_value);
+	const __m256 minimum = _mm256_set1_ps(minimum_value);
+	const __m256 maximum = _mm256_set1_ps(maximum_value);
+	size_t sample_index = 0;
+	for (; sample_index + 8 <= count; sample_index += 8)
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(samples + sample_index), EncodeIntegers(_mm256_loadu_ps(source + sample_index), scale, minimum, maximum));
+	for (; sample_index < count; ++sample_index)
+		samples[sample_index] = EncodeIntegerSample(source[sample_index], scale_value, minimum_value, maximum_value);
+}
+
+void DecodeInt24(float* destination, const void* source, size_t count)
+{
+	const uint8_t* samples = static_cast<const uint8_t*>(source);
+	int32_t block[int24_block_size];
+	for (size_t block_start = 0; block_start < count; block_start += int24_block_size)
+	{
+		const size_t block_count = (std::min)(int24_block_size, count - block_start);
+		for (size_t sample_index = 0; sample_index < block_count; ++sample_index)
+			block[sample_index] = ReadInt24(samples + (block_start + sample_index) * 3);
+		DecodeInt32Block(destination + block_start, block, block_count, 1.0f / int24_scale);
+	}
+}
+
+void EncodeInt24(void* destination, const float* source, size_t count)
+{
+	uint8_t* samples = static_cast<uint8_t*>(destination);
+	int32_t block[int24_block_size];
+	for (size_t block_start = 0; block_start < count; block_start += int24_block_size)
+	{
+		const size_t block_count = (std::min)(int24_block_size, count - block_start);
+		EncodeInt32Block(block, source + block_start, block_count, int24_scale, int24_minimum, int24_maximum);
+		for (size_t sample_index = 0; sample_index < block_count; ++sample_index)
+			WriteInt24(samples + (block_start + sample_index) * 3, block[sample_index]);
+	}
+}
+
+void DecodeInt32(float* destination, const void* source, size_t count)
+{
+	DecodeInt32Block(destination, static_cast<const int32_t*>(source), count, 1.0f / int32_scale);
+}
+
+void EncodeInt32(void* destination, const float* source, size_t count)
+{
+	EncodeInt32Block(static_cast<int32_t*>(destination), source, count, int32_scale, int32_minimum, int32_maximum);
+}
+
+void DecodeFloat64(float* destination, const void* source, size_t count)
+{
+	const double* samples = static_cast<const double*>(source);
+	size_t sample_index = 0;
+	for (; sample_index + 8 <= count; sample_index += 8)
+	{
+		const __m128 low = _mm256_cvtpd_ps(_mm256_loadu_pd(samples + sample_index));
+		const __m128 high = _mm256_cvtpd_ps(_mm256_loadu_pd(samples + sample_index + 4));
+		_mm256_storeu_ps(destination + sample_index, _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1));
+	}
+	DecodeFloat64Scalar(destination + sample_index, samples + sample_index, count - sample_index);
+}
+
+void EncodeFloat64(void* destination, const float* source, size_t count)
+{
+	double* samples = static_cast<double*>(destination);
+	size_t sample_index = 0;
+	for (; sample_index + 8 <= count; sample_index += 8)
+	{
+		const __m256 values = _mm256_loadu_ps(source + sample_index);
+		_mm256_storeu_pd(samples + sample_index, _mm256_cvtps_pd(_mm256_castps256_ps128(values)));
+		_mm256_storeu_pd(samples + sample_index + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(values, 1)));
+	}
+	EncodeFloat64Scalar(samples + sample_index, source + sample_index, count - sample_index);
+}
+}
+
+const ConversionKernels avx2_conversion_kernels = {
+	{ DecodeInt16, DecodeInt24, DecodeInt32, CopyFloat32, DecodeFloat64 },
+	{ EncodeInt16, EncodeInt24, EncodeInt32, CopyToFloat32, EncodeFloat64 },
+};
+
+#endif
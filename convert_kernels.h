@@ -0,0 +1,98 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// Internal to the sample conversion code. Use convert.h instead.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "convert.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FLEXASIO_X86 1
+#endif
+
+struct ConversionKernels
+{
+	DecodeSamplesFunction decode[SAMPLE_FORMAT_COUNT];
+	EncodeSamplesFunction encode[SAMPLE_FORMAT_COUNT];
+};
+
+extern const ConversionKernels scalar_conversion_kernels;
+#ifdef FLEXASIO_X86
+extern const ConversionKernels sse2_conversion_kernels;
+extern const ConversionKernels avx2_conversion_kernels;
+#endif
+
+// Scaling constants. The upper clamping bound for 32-bit integers is the largest float below 2^31, since 2^31 itself is not representable.
+const float int16_scale = 32768.0f;
+const float int16_minimum = -32768.0f;
+const float int16_maximum = 32767.0f;
+const float int24_scale = 8388608.0f;
+const float int24_minimum = -8388608.0f;
+const float int24_maximum = 8388607.0f;
+const float int32_scale = 2147483648.0f;
+const float int32_minimum = -2147483648.0f;
+const float int32_maximum = 2147483520.0f;
+
+// The scalar helpers below are written to match the semantics of the SSE instructions used by the vector kernels, so that vector loop tails can reuse them and all kernels stay bit-exact.
+
+// Same as MINPS(MAXPS(value, minimum), maximum), including NaN handling (NaN becomes the minimum).
+inline float ClampSample(float value, float minimum, float maximum)
+{
+	value = value > minimum ? value : minimum;
+	return value < maximum ? value : maximum;
+}
+
+// Same as CVTPS2DQ: rounds according to the current rounding mode (round to nearest even by default).
+inline int32_t RoundSample(float value)
+{
+	return static_cast<int32_t>(lrintf(value));
+}
+
+inline int32_t EncodeIntegerSample(float value, float scale, float minimum, float maximum)
+{
+	return RoundSample(ClampSample(value * scale, minimum, maximum));
+}
+
+inline int32_t ReadInt24(const uint8_t* source)
+{
+	return static_cast<int32_t>(static_cast<uint32_t>(source[0]) << 8 | static_cast<uint32_t>(source[1]) << 16 | static_cast<uint32_t>(source[2]) << 24) >> 8;
+}
+
+inline void WriteInt24(uint8_t* destination, int32_t value)
+{
+	destination[0] = static_cast<uint8_t>(value);
+	destination[1] = static_cast<uint8_t>(value >> 8);
+	destination[2] = static_cast<uint8_t>(value >> 16);
+}
+
+void DecodeInt16Scalar(float* destination, const void* source, size_t count);
+void EncodeInt16Scalar(void* destination, const float* source, size_t count);
+void DecodeInt24Scalar(float* destination, const void* source, size_t count);
+void EncodeInt24Scalar(void* destination, const float* source, size_t count);
+void DecodeInt32Scalar(float* destination, const void* source, size_t count);
+void EncodeInt32Scalar(void* destination, const float* source, size_t count);
+void CopyFloat32(float* destination, const void* source, size_t count);
+void CopyToFloat32(void* destination, const float* source, size_t count);
+void DecodeFloat64Scalar(float* destination, const void* source, size_t count);
+void EncodeFloat64Scalar(void* destination, const float* source, size_t count);
@@ -0,0 +1,164 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "convert_kernels.h"
+
+#include <algorithm>
+
+#ifdef FLEXASIO_X86
+
+#include <emmintrin.h>
+
+namespace {
+// 24-bit samples are unpacked to (or packed from) 32-bit integers in blocks of this size, and the vector code does the rest.
+const size_t int24_block_size = 64;
+
+void DecodeInt16(float* destination, const void* source, size_t count)
+{
+	const int16_t* samples = static_cast<const int16_t*>(source);
+	const __m128 factor = _mm_set1_ps(1.0f / int16_scale);
+	size_t sample_index = 0;
+	for (; sample_index + 8 <= count; sample_index += 8)
+	{
+		const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + sample_index));
+		// Sign-extend by unpacking each 16-bit sample into the high half of a 32-bit lane, then shifting it back down.
+		const __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16);
+		const __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(packed, packed), 16);
+		_mm_storeu_ps(destination + sample_index, _mm_mul_ps(_mm_cvtepi32_ps(low), factor));
+		_mm_storeu_ps(destination + sample_index + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), factor));
+	}
+	DecodeInt16Scalar(destination + sample_index, samples + sample_index, count - sample_index);
+}
+
+__m128i EncodeIntegers(__m128 values, __m128 scale, __m128 minimum, __m128 maximum)
+{
+	return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(values, scale), minimum), maximum));
+}
+
+void EncodeInt16(void* destination, const float* source, size_t count)
+{
+	int16_t* samples = static_cast<int16_t*>(destination);
+	const __m128 scale = _mm_set1_ps(int16_scale);
+	const __m128 minimum = _mm_set1_ps(int16_minimum);
+	const __m128 maximum = _mm_set1_ps(int16_maximum);
+	size_t sample_index = 0;
+	for (; sample_index + 8 <= count; sample_index += 8)
+	{
+		const __m128i low = EncodeIntegers(_mm_loadu_ps(source + sample_index), scale, minimum, maximum);
+		const __m128i high = EncodeIntegers(_mm_loadu_ps(source + sample_index + 4), scale, minimum, maximum);
+		// Values are already clamped, so the saturation in PACKSSDW never kicks in.
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(samples + sample_index), _mm_packs_epi32(low, high));
+	}
+	EncodeInt16Scalar(samples + sample_index, source + sample_index, count - sample_index);
+}
+
+void DecodeInt32Block(float* destination, const int32_t* samples, size_t count, float factor_value)
+{
+	const __m128 factor = _mm_set1_ps(factor_value);
+	size_t sample_index = 0;
+	for (; sample_index + 4 <= count; sample_index += 4)
+	{
+		const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + sample_index));
+		_mm_storeu_ps(destination + sample_index, _mm_mul_ps(_mm_cvtepi32_ps(values), factor));
+	}
+	for (; sample_index < count; ++sample_index)
+		destination[sample_index] = static_cast<float>(samples[sample_index]) * factor_value;
+}
+
+void EncodeInt32Block(int32_t* samples, const float* source, size_t count, float scale_value, float minimum_value, float maximum_value)
+{
+	const __m128 scale = _mm_set1_ps(scale_value);
+	const __m128 minimum = _mm_set1_ps(minimum_value);
+	const __m128 maximum = _mm_set1_ps(maximum_value);
+	size_t sample_index = 0;
+	for (; sample_index + 4 <= count; sample_index += 4)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(samples + sample_index), EncodeIntegers(_mm_loadu_ps(source + sample_index), scale, minimum, maximum));
+	for (; sample_index < count; ++sample_index)
+		samples[sample_index] = EncodeIntegerSample(source[sample_index], scale_value, minimum_value, maximum_value);
+}
+
+void DecodeInt24(float* destination, const void* source, size_t count)
+{
+	const uint8_t* samples = static_cast<const uint8_t*>(source);
+	int32_t block[int24_block_size];
+	for (size_t block_start = 0; block_start < count; block_start += int24_block_size)
+	{
+		const size_t block_count = (std::min)(int24_block_size, count - block_start);
+		for (size_t sample_index = 0; sample_index < block_count; ++sample_index)
+			block[sample_index] = ReadInt24(samples + (block_start + sample_index) * 3);
+		DecodeInt32Block(destination + block_start, block, block_count, 1.0f / int24_scale);
+	}
+}
+
+void EncodeInt24(void* destination, const float* source, size_t count)
+{
+	uint8_t* samples = static_cast<uint8_t*>(destination);
+	int32_t block[int24_block_size];
+	for (size_t block_start = 0; block_start < count; block_start += int24_block_size)
+	{
+		const size_t block_count = (std::min)(int24_block_size, count - block_start);
+		EncodeInt32Block(block, source + block_start, block_count, int24_scale, int24_minimum, int24_maximum);
+		for (size_t sample_index = 0; sample_index < block_count; ++sample_index)
+			WriteInt24(samples + (block_start + sample_index) * 3, block[sample_index]);
+	}
+}
+
+void DecodeInt32(float* destination, const void* source, size_t count)
+{
+	DecodeInt32Block(destination, static_cast<const int32_t*>(source), count, 1.0f / int32_scale);
+}
+
+void EncodeInt32(void* destination, const float* source, size_t count)
+{
+	EncodeInt32Block(static_cast<int32_t*>(destination), source, count, int32_scale, int32_minimum, int32_maximum);
+}
+
+void DecodeFloat64(float* destination, const void* source, size_t count)
+{
+	const double* samples = static_cast<const double*>(source);
+	size_t sample_index = 0;
+	for (; sample_index + 4 <= count; sample_index += 4)
+	{
+		const __m128 low = _mm_cvtpd_ps(_mm_loadu_pd(samples + sample_index));
+		const __m128 high = _mm_cvtpd_ps(_mm_loadu_pd(samples + sample_index + 2));
+		_mm_storeu_ps(destination + sample_index, _mm_movelh_ps(low, high));
+	}
+	DecodeFloat64Scalar(destination + sample_index, samples + sample_index, count - sample_index);
+}
+
+void EncodeFloat64(void* destination, const float* source, size_t count)
+{
+	double* samples = static_cast<double*>(destination);
+	size_t sample_index = 0;
+	for (; sample_index + 4 <= count; sample_index += 4)
+	{
+		const __m128 values = _mm_loadu_ps(source + sample_index);
+		_mm_storeu_pd(samples + sample_index, _mm_cvtps_pd(values));
+		_mm_storeu_pd(samples + sample_index + 2, _mm_cvtps_pd(_mm_movehl_ps(values, values)));
+	}
+	EncodeFloat64Scalar(samples + sample_index, source + sample_index, count - sample_index);
+}
+}
+
+const ConversionKernels sse2_conversion_kernels = {
+	{ DecodeInt16, DecodeInt24, DecodeInt32, CopyFloat32, DecodeFloat64 },
+	{ EncodeInt16, EncodeInt24, EncodeInt32, CopyToFloat32, EncodeFloat64 },
+};
+
+#endif
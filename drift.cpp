@@ -0,0 +1,199 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "drift.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "log.h"
+
+namespace {
+// The loop behaves like a second-order system with this natural frequency (in rad/s) and damping ratio.
+// It is deliberately slow: real clock drift changes over minutes, and a fast loop would audibly modulate the pitch with callback jitter.
+const double natural_frequency = 0.1;
+const double damping_ratio = 1.0;
+// Time constant of the level filter, in seconds. This needs to be an order of magnitude faster than the loop itself to keep it stable.
+const double level_filter_time_constant = 1.0;
+// The resampler processes at most this many frames at a time, which bounds its scratch buffer.
+const size_t max_chunk_frames = 1024;
+}
+
+const double DriftController::max_correction = 0.001;
+
+DriftController::DriftController(double sample_rate) :
+	sample_rate(sample_rate),
+	// Derived from d(error)/dt = sample_rate * (drift - correction), where correction = Kp * error + Ki * integral(error).
+	proportional_gain(2 * damping_ratio * natural_frequency / sample_rate),
+	integral_gain(natural_frequency * natural_frequency / sample_rate),
+	filtered_level(0), integral(0), ratio(1) { }
+
+void DriftController::Reset(double level)
+{
+	filtered_level = level;
+	integral = 0;
+	ratio = 1;
+}
+
+double DriftController::Update(double level, double target_level, size_t frames)
+{
+	const double elapsed = frames / sample_rate;
+	filtered_level += (level - filtered_level) * elapsed / (level_filter_time_constant + elapsed);
+
+	// A positive error means the producer is running faster than we are, so we need to consume more than one frame per frame.
+	const double error = filtered_level - target_level;
+	const double candidate_integral = integral + integral_gain * error * elapsed;
+	ratio = 1 + proportional_gain * error + candidate_integral;
+	// Anti-windup: the integral only moves while the output is not saturated.
+	if (ratio > 1 + max_correction)
+		ratio = 1 + max_correction;
+	else if (ratio < 1 - max_correction)
+		ratio = 1 - max_correction;
+	else
+		integral = candidate_integral;
+	return ratio;
+}
+
+AdaptiveResampler::AdaptiveResampler(size_t channel_count, size_t max_output_frames) :
+	channel_count(channel_count),
+	// One more frame than strictly necessary to account for the fractional phase.
+	max_input_frames(static_cast<size_t>(std::ceil(max_output_frames * (1 + DriftController::max_correction))) + 1),
+	scratch(channel_count * (history_frames + max_input_frames)), input_buffers(channel_count), phase(0)
+{
+	for (size_t channel = 0; channel < channel_count; ++channel)
+		input_buffers[channel] = scratch.data() + channel * (history_frames + max_input_frames);
+	Reset();
+}
+
+void AdaptiveResampler::Reset()
+{
+	std::fill(scratch.begin(), scratch.end(), 0.0f);
+	phase = 0;
+}
+
+size_t AdaptiveResampler::GetInputFrames(size_t output_frames, double ratio) const
+{
+	return static_cast<size_t>(std::floor(phase + output_frames * ratio));
+}
+
+void AdaptiveResampler::Process(float* const* output, size_t output_offset, size_t output_frames, double ratio)
+{
+	const size_t input_frames = GetInputFrames(output_frames, ratio);
+	for (size_t channel = 0; channel < channel_count; ++channel)
+	{
+		// The new input frames sit right after the history, so x[-1], x[0], x[1] and x[2] for output frame n start at floor(phase + n * ratio).
+		float* const samples = input_buffers[channel];
+		float* const destination = output[channel] + output_offset;
+		for (size_t frame = 0; frame < output_frames; ++frame)
+		{
+			const double position = phase + frame * ratio;
+			const size_t index = static_cast<size_t>(position);
+			const float t = static_cast<float>(position - index);
+			const float xm1 = samples[index];
+			const float x0 = samples[index + 1];
+			const float x1 = samples[index + 2];
+			const float x2 = samples[index + 3];
+			const float c1 = 0.5f * (x1 - xm1);
+			const float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+			const float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+			destination[frame] = ((c3 * t + c2) * t + c1) * t + x0;
+		}
+		// Keep the last frames around as history for the next call.
+		memmove(samples, samples + input_frames, history_frames * sizeof(float));
+	}
+	phase = phase + output_frames * ratio - input_frames;
+}
+
+DriftCompensator::DriftCompensator(size_t channel_count, double sample_rate, size_t capacity) :
+	ring(channel_count, capacity), controller(sample_rate), resampler(channel_count, max_chunk_frames), primed(false),
+	max_push_frames(0), max_pull_frames(0), overrun_pending(false), ratio(1), underruns(0), overruns(0) { }
+
+void DriftCompensator::Reset()
+{
+	ring.Reset();
+	controller.Reset(0);
+	resampler.Reset();
+	primed = false;
+	overrun_pending.store(false);
+	ratio.store(1);
+}
+
+void DriftCompensator::Push(const float* const* channels, size_t frames)
+{
+	if (frames > max_push_frames.load(std::memory_order_relaxed))
+		max_push_frames.store(frames, std::memory_order_relaxed);
+
+	if (ring.GetWriteAvailable() < frames)
+	{
+		RealtimeLog(LOG_LEVEL_WARNING, "Drift compensation ring overrun, dropping {} frames", frames);
+		overruns.fetch_add(1, std::memory_order_relaxed);
+		overrun_pending.store(true, std::memory_order_relaxed);
+		return;
+	}
+	ring.Write(channels, 0, frames);
+}
+
+void DriftCompensator::Pull(float* const* channels, size_t offset, size_t frames)
+{
+	if (frames > max_pull_frames.load(std::memory_order_relaxed))
+		max_pull_frames.store(frames, std::memory_order_relaxed);
+
+	const size_t target_level = GetTargetLevel();
+	size_t level = ring.GetReadAvailable();
+	if (overrun_pending.exchange(false, std::memory_order_relaxed))
+		primed = false;
+	if (!primed)
+	{
+		if (level < target_level)
+		{
+			// Still waiting for the producer to fill the ring.
+			for (size_t channel = 0; channel < ring.GetChannelCount(); ++channel)
+				memset(channels[channel] + offset, 0, frames * sizeof(float));
+			return;
+		}
+		// Throw away whatever is in excess, so that we start right at the target level.
+		RealtimeLog(LOG_LEVEL_DEBUG, "Drift compensation: starting with {} frames buffered, skipping {}", level, level - target_level);
+		ring.CommitRead(level - target_level);
+		level = target_level;
+		controller.Reset(static_cast<double>(level));
+		primed = true;
+	}
+
+	const double current_ratio = controller.Update(static_cast<double>(level), static_cast<double>(target_level), frames);
+	ratio.store(current_ratio, std::memory_order_relaxed);
+
+	for (size_t chunk_offset = 0; chunk_offset < frames; )
+	{
+		const size_t chunk_frames = (std::min)(frames - chunk_offset, max_chunk_frames);
+		const size_t input_frames = resampler.GetInputFrames(chunk_frames, current_ratio);
+		if (ring.GetReadAvailable() < input_frames)
+		{
+			RealtimeLog(LOG_LEVEL_WARNING, "Drift compensation ring underrun, inserting {} frames of silence", frames - chunk_offset);
+			underruns.fetch_add(1, std::memory_order_relaxed);
+			for (size_t channel = 0; channel < ring.GetChannelCount(); ++channel)
+				memset(channels[channel] + offset + chunk_offset, 0, (frames - chunk_offset) * sizeof(float));
+			primed = false;
+			return;
+		}
+		ring.Read(resampler.GetInputBuffers(), AdaptiveResampler::history_frames, input_frames);
+		resampler.Process(channels, offset + chunk_offset, chunk_frames, current_ratio);
+		chunk_offset += chunk_frames;
+	}
+}
@@ -0,0 +1,131 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "ring.h"
+
+// PI loop that steers a resampling ratio so that the fill level of a ring buffer stays at a target depth, despite the producer and the consumer running on different clocks.
+// The measured level is low-pass filtered first, because it naturally jumps around by a whole callback worth of frames every time either side runs.
+class DriftController
+{
+	public:
+		// Clock drift between two independent crystals is typically within +/- 200 ppm; the correction is capped well above that.
+		static const double max_correction;
+
+		explicit DriftController(double sample_rate);
+
+		void Reset(double level);
+		// Called by the consumer every time it is about to consume frames (in its own clock domain). Returns the ratio to use: producer frames consumed per consumer frame.
+		double Update(double level, double target_level, size_t frames);
+
+		double GetRatio() const { return ratio; }
+		double GetFilteredLevel() const { return filtered_level; }
+
+	private:
+		const double sample_rate;
+		const double proportional_gain;
+		const double integral_gain;
+		double filtered_level;
+		double integral;
+		double ratio;
+};
+
+// 4-point cubic Hermite (Catmull-Rom) interpolator with a continuously variable ratio.
+// This does no anti-aliasing filtering at all, so it's only meant for ratios extremely close to 1, i.e. clock drift compensation.
+class AdaptiveResampler
+{
+	public:
+		static const size_t history_frames = 4;
+
+		// max_output_frames is the largest number of frames Process() will be asked for.
+		AdaptiveResampler(size_t channel_count, size_t max_output_frames);
+
+		void Reset();
+		// How many new input frames Process() will consume to produce output_frames at the given ratio (input frames per output frame).
+		size_t GetInputFrames(size_t output_frames, double ratio) const;
+		// Where the caller must put the input frames before calling Process(). There is room for up to GetInputFrames(max_output_frames, 1 + DriftController::max_correction) frames.
+		float* const* GetInputBuffers() { return input_buffers.data(); }
+		void Process(float* const* output, size_t output_offset, size_t output_frames, double ratio);
+
+	private:
+		const size_t channel_count;
+		const size_t max_input_frames;
+		// Per channel: history_frames frames of history, followed by the new input frames.
+		std::vector<float> scratch;
+		std::vector<float*> input_buffers;
+		// Fractional read position, in [0, 1).
+		double phase;
+};
+
+// Brings audio captured by a stream running on its own clock (the "slave", e.g. a separate input device) into the clock domain of the stream that drives the driver (the "master").
+// The slave pushes frames into a lock-free ring; the master pulls them through an AdaptiveResampler whose ratio is steered by a DriftController to keep the ring at a constant depth.
+// Nothing here actually depends on which side is the master, so the same works the other way around, e.g. for output devices running on their own clock: the master pushes, and the slave pulls.
+// The target depth is learned from the largest chunks seen on both sides, which is the minimum that guarantees neither side ever runs dry if callbacks are perfectly regular, plus headroom for callback timing jitter.
+class DriftCompensator
+{
+	public:
+		// capacity is the ring size in frames; it needs to be comfortably larger than the sum of the largest slave and master callbacks.
+		DriftCompensator(size_t channel_count, double sample_rate, size_t capacity);
+
+		// Only safe while neither side is running.
+		void Reset();
+
+		// Producer side (normally the slave).
+		void Push(const float* const* channels, size_t frames);
+		// Consumer side (normally the master). channels[channel] + offset receive the frames.
+		void Pull(float* const* channels, size_t offset, size_t frames);
+
+		// These can be called from any thread.
+		size_t GetTargetLevel() const
+		{
+			const size_t push_frames = max_push_frames.load(std::memory_order_relaxed);
+			const size_t pull_frames = max_pull_frames.load(std::memory_order_relaxed);
+			// A callback that comes in early by a quarter period, or the extra frame the interpolator needs when the ratio is above 1, must not be enough to run dry.
+			return push_frames + pull_frames + (push_frames > pull_frames ? push_frames : pull_frames) / 4 + 1;
+		}
+		double GetRatio() const { return ratio.load(std::memory_order_relaxed); }
+		unsigned long GetUnderrunCount() const { return underruns.load(std::memory_order_relaxed); }
+		unsigned long GetOverrunCount() const { return overruns.load(std::memory_order_relaxed); }
+		// Frames currently buffered in the ring.
+		size_t GetLevel() const { return ring.GetReadAvailable(); }
+		// Frames buffered by the ring, plus the interpolation delay.
+		size_t GetLatency() const { return GetTargetLevel() + AdaptiveResampler::history_frames / 2; }
+
+	private:
+		DriftCompensator(const DriftCompensator&);
+		DriftCompensator& operator=(const DriftCompensator&);
+
+		SampleRing ring;
+		DriftController controller;
+		AdaptiveResampler resampler;
+		// Consumer side only.
+		bool primed;
+
+		std::atomic<size_t> max_push_frames;
+		std::atomic<size_t> max_pull_frames;
+		std::atomic<bool> overrun_pending;
+		std::atomic<double> ratio;
+		std::atomic<unsigned long> underruns;
+		std::atomic<unsigned long> overruns;
+};
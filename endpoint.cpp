@@ -0,0 +1,67 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "endpoint.h"
+
+#include <windows.h>
+#include <mmdeviceapi.h>
+// The property keys are not in any import library, so they have to be defined here.
+#include <initguid.h>
+#include <functiondiscoverykeys_devpkey.h>
+
+#include <vector>
+
+#include <atlbase.h>
+
+bool GetDefaultEndpointName(bool input, std::string* name)
+{
+	CComPtr<IMMDeviceEnumerator> enumerator;
+	if (FAILED(enumerator.CoCreateInstance(__uuidof(MMDeviceEnumerator))))
+		return false;
+
+	CComPtr<IMMDevice> device;
+	const HRESULT result = enumerator->GetDefaultAudioEndpoint(input ? eCapture : eRender, eMultimedia, &device);
+	if (result == E_NOTFOUND)
+	{
+		name->clear();
+		return true;
+	}
+	if (FAILED(result))
+		return false;
+
+	CComPtr<IPropertyStore> properties;
+	if (FAILED(device->OpenPropertyStore(STGM_READ, &properties)))
+		return false;
+	PROPVARIANT friendly_name;
+	PropVariantInit(&friendly_name);
+	if (FAILED(properties->GetValue(PKEY_Device_FriendlyName, &friendly_name)) || friendly_name.vt != VT_LPWSTR)
+	{
+		PropVariantClear(&friendly_name);
+		return false;
+	}
+
+	// PortAudio converts device names to UTF-8.
+	const int size = WideCharToMultiByte(CP_UTF8, 0, friendly_name.pwszVal, -1, NULL, 0, NULL, NULL);
+	std::vector<char> buffer(size > 0 ? size : 1, '\0');
+	if (size > 0)
+		WideCharToMultiByte(CP_UTF8, 0, friendly_name.pwszVal, -1, buffer.data(), size, NULL, NULL);
+	PropVariantClear(&friendly_name);
+	*name = buffer.data();
+	return size > 0;
+}
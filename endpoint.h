@@ -0,0 +1,27 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <string>
+
+// Looks up the friendly name of the default Windows audio endpoint (multimedia role) in the given direction, which is also what PortAudio names the default WASAPI device.
+// This only takes a few milliseconds, as opposed to initializing PortAudio. The calling thread must have initialized COM.
+// Sets *name to an empty string if there is no default endpoint in that direction. Returns false if the endpoints could not be queried at all.
+bool GetDefaultEndpointName(bool input, std::string* name);
@@ -0,0 +1,417 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <sstream>
+
+#include "util.h"
+
+namespace {
+// About 85 ms at 48 kHz, which is plenty for a client that is woken up every engine period. Larger rings would only let latency build up.
+const unsigned long engine_capacity = 4096;
+// How long a client waits for the engine before checking whether it should stop.
+const DWORD engine_wait_timeout_ms = 100;
+
+// Client output beyond this many engine periods is dropped, so that a client that was late once doesn't keep the extra latency forever.
+const size_t max_queued_periods = 2;
+}
+
+std::string GetEngineSectionName(const std::string& name)
+{
+	return "Local\\FlexASIO-Engine-" + name;
+}
+
+std::string GetEngineEventName(const std::string& name, unsigned long slot)
+{
+	std::stringstream event_name;
+	event_name << GetEngineSectionName(name) << "-" << slot;
+	return event_name.str();
+}
+
+EngineServer::EngineServer() : mapping(NULL), section(nullptr), multiply_add(GetMultiplyAddFunction())
+{
+	for (unsigned long slot = 0; slot < EngineSection::max_clients; ++slot)
+	{
+		events[slot] = NULL;
+		primed[slot] = false;
+	}
+}
+
+EngineServer::~EngineServer()
+{
+	for (unsigned long slot = 0; slot < EngineSection::max_clients; ++slot)
+		if (events[slot])
+			CloseHandle(events[slot]);
+	if (section)
+	{
+		// Open() might have failed because another engine owns the section.
+		unsigned long expected_process_id = GetCurrentProcessId();
+		section->engine_process_id.compare_exchange_strong(expected_process_id, 0);
+		UnmapViewOfFile(section);
+	}
+	if (mapping)
+		CloseHandle(mapping);
+}
+
+bool EngineServer::Open(const std::string& name, double sample_rate, long input_channel_count, long output_channel_count)
+{
+	const std::string section_name = GetEngineSectionName(name);
+	const size_t size = EngineSection::GetSize(engine_capacity, input_channel_count, output_channel_count);
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, static_cast<DWORD>(size), section_name.c_str());
+	if (!mapping)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to create engine section " << section_name;
+		return false;
+	}
+	const bool existing = GetLastError() == ERROR_ALREADY_EXISTS;
+	section = static_cast<EngineSection*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+	if (!section)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to map engine section " << section_name;
+		return false;
+	}
+
+	// A section left over by a previous engine is still open in some clients. If the layout is the same, they can carry on with the new engine once their watchdog restarts their stream.
+	if (existing)
+	{
+		const DWORD owner_process_id = section->engine_process_id.load();
+		if (owner_process_id != 0 && IsProcessRunning(owner_process_id))
+		{
+			Log(LOG_LEVEL_ERROR) << "Engine section " << section_name << " is already used by engine process " << owner_process_id;
+			return false;
+		}
+		const bool compatible = memcmp(section->magic, "FlexASIO", sizeof(section->magic)) == 0 && section->version == EngineSection::current_version && section->size == size &&
+			section->input_channel_count == static_cast<unsigned long>(input_channel_count) && section->output_channel_count == static_cast<unsigned long>(output_channel_count);
+		if (!compatible)
+		{
+			Log(LOG_LEVEL_ERROR) << "Engine section " << section_name << " is left over from a different configuration, and still open in some client";
+			return false;
+		}
+		Log() << "Taking over existing engine section " << section_name;
+	}
+	else
+	{
+		section = new (section) EngineSection;
+		memcpy(section->magic, "FlexASIO", sizeof(section->magic));
+		section->version = EngineSection::current_version;
+		section->size = static_cast<unsigned long>(size);
+		section->capacity = engine_capacity;
+		section->input_channel_count = input_channel_count;
+		section->output_channel_count = output_channel_count;
+		for (unsigned long slot = 0; slot < EngineSection::max_clients; ++slot)
+		{
+			EngineSlot& client = section->slots[slot];
+			client.client_process_id.store(0);
+			client.running.store(0);
+			LoopbackRing* const rings[] = { &client.to_client, &client.from_client };
+			for (size_t ring_index = 0; ring_index < 2; ++ring_index)
+			{
+				rings[ring_index]->write_position.store(0);
+				rings[ring_index]->read_position.store(0);
+				rings[ring_index]->client_attached.store(0);
+				rings[ring_index]->underrun_count.store(0);
+				rings[ring_index]->overrun_count.store(0);
+			}
+		}
+	}
+	// The sample rate is not part of the layout: clients read it when they connect.
+	section->sample_rate = sample_rate;
+	section->input_latency.store(0);
+	section->output_latency.store(0);
+	section->period.store(0);
+
+	for (unsigned long slot = 0; slot < EngineSection::max_clients; ++slot)
+	{
+		events[slot] = CreateEventA(NULL, FALSE, FALSE, GetEngineEventName(name, slot).c_str());
+		if (!events[slot])
+		{
+			Log(LOG_LEVEL_ERROR) << "Unable to create engine event for slot " << slot;
+			return false;
+		}
+	}
+
+	section->engine_process_id.store(GetCurrentProcessId());
+	Log() << "Engine section " << section_name << " is ready: " << input_channel_count << " input channels, " << output_channel_count << " output channels at " << sample_rate << " Hz, " << EngineSection::max_clients << " slots";
+	return true;
+}
+
+void EngineServer::Process(const float* const* input, float* const* output, size_t frames)
+{
+	const unsigned long input_channel_count = input ? section->input_channel_count : 0;
+	const unsigned long output_channel_count = output ? section->output_channel_count : 0;
+	const size_t capacity = section->capacity;
+	section->period.store(static_cast<unsigned long>(frames), std::memory_order_relaxed);
+	for (unsigned long channel = 0; channel < output_channel_count; ++channel)
+		memset(output[channel], 0, frames * sizeof(float));
+
+	for (unsigned long slot = 0; slot < EngineSection::max_clients; ++slot)
+	{
+		EngineSlot& client = section->slots[slot];
+		if (client.client_process_id.load(std::memory_order_acquire) == 0 || !client.running.load(std::memory_order_acquire))
+		{
+			primed[slot] = false;
+			continue;
+		}
+
+		// Fan out the input. The positions advance even without input channels, as they are the clock of the client.
+		LoopbackRing& to_client = client.to_client;
+		const unsigned long long write_position = to_client.write_position.load(std::memory_order_relaxed);
+		const size_t free_frames = static_cast<size_t>(capacity - (write_position - to_client.read_position.load(std::memory_order_acquire)));
+		const size_t written_frames = (std::min)(frames, free_frames);
+		section->VisitRegions(write_position, written_frames, [&](size_t ring_offset, size_t frame_offset, size_t frame_count) {
+			for (unsigned long channel = 0; channel < input_channel_count; ++channel)
+				memcpy(section->GetToClientChannel(slot, channel) + ring_offset, input[channel] + frame_offset, frame_count * sizeof(float));
+		});
+		to_client.write_position.store(write_position + written_frames, std::memory_order_release);
+		if (written_frames < frames)
+			to_client.overrun_count.store(to_client.overrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		// Mix in the output.
+		LoopbackRing& from_client = client.from_client;
+		unsigned long long read_position = from_client.read_position.load(std::memory_order_relaxed);
+		const size_t queued_frames = static_cast<size_t>(from_client.write_position.load(std::memory_order_acquire) - read_position);
+		if (queued_frames > max_queued_periods * frames)
+			read_position += queued_frames - max_queued_periods * frames;
+		const size_t read_frames = (std::min)(frames, (std::min)(queued_frames, max_queued_periods * frames));
+		section->VisitRegions(read_position, read_frames, [&](size_t ring_offset, size_t frame_offset, size_t frame_count) {
+			for (unsigned long channel = 0; channel < output_channel_count; ++channel)
+				multiply_add(output[channel] + frame_offset, section->GetFromClientChannel(slot, channel) + ring_offset, 1, frame_count);
+		});
+		from_client.read_position.store(read_position + read_frames, std::memory_order_release);
+		if (read_frames < frames && primed[slot])
+			from_client.underrun_count.store(from_client.underrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if (read_frames > 0)
+			primed[slot] = true;
+
+		// Doesn't block: the kernel just marks the client thread as ready to run.
+		SetEvent(events[slot]);
+	}
+}
+
+void EngineServer::Reap()
+{
+	for (unsigned long slot = 0; slot < EngineSection::max_clients; ++slot)
+	{
+		EngineSlot& client = section->slots[slot];
+		const unsigned long process_id = client.client_process_id.load();
+		if (process_id == 0 || IsProcessRunning(process_id))
+			continue;
+		Log(LOG_LEVEL_WARNING) << "Client process " << process_id << " went away without releasing slot " << slot;
+		client.running.store(0);
+		unsigned long expected_process_id = process_id;
+		client.client_process_id.compare_exchange_strong(expected_process_id, 0);
+	}
+}
+
+std::vector<EngineServer::ClientStatus> EngineServer::GetClientStatus() const
+{
+	std::vector<ClientStatus> status;
+	for (unsigned long slot = 0; slot < EngineSection::max_clients; ++slot)
+	{
+		const EngineSlot& client = section->slots[slot];
+		ClientStatus client_status;
+		client_status.process_id = client.client_process_id.load();
+		if (client_status.process_id == 0)
+			continue;
+		client_status.running = client.running.load() != 0;
+		client_status.underrun_count = client.from_client.underrun_count.load();
+		client_status.overrun_count = client.to_client.overrun_count.load();
+		status.push_back(client_status);
+	}
+	return status;
+}
+
+EngineDevice::EngineDevice() : mapping(NULL), section(nullptr), slot(invalid_slot), event(NULL), callback(NULL), user_data(NULL), stopping(false) { }
+
+EngineDevice::~EngineDevice()
+{
+	StopStream();
+	CloseStream();
+	if (section)
+		UnmapViewOfFile(section);
+	if (mapping)
+		CloseHandle(mapping);
+}
+
+bool EngineDevice::Connect(const std::string& name)
+{
+	const std::string section_name = GetEngineSectionName(name);
+	mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, section_name.c_str());
+	if (!mapping)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to open engine section " << section_name << "; is FlexASIOEngine running?";
+		return false;
+	}
+	section = static_cast<EngineSection*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+	if (!section)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to map engine section " << section_name;
+		return false;
+	}
+	MEMORY_BASIC_INFORMATION memory_info;
+	if (VirtualQuery(section, &memory_info, sizeof(memory_info)) != sizeof(memory_info) || memory_info.RegionSize < sizeof(EngineSection) ||
+		memcmp(section->magic, "FlexASIO", sizeof(section->magic)) != 0 || section->version != EngineSection::current_version ||
+		memory_info.RegionSize < section->size || section->size != EngineSection::GetSize(section->capacity, section->input_channel_count, section->output_channel_count))
+	{
+		Log(LOG_LEVEL_ERROR) << "Engine section " << section_name << " is not compatible with this version of FlexASIO";
+		UnmapViewOfFile(section);
+		section = nullptr;
+		return false;
+	}
+	const DWORD engine_process_id = section->engine_process_id.load();
+	if (engine_process_id == 0 || !IsProcessRunning(engine_process_id))
+	{
+		Log(LOG_LEVEL_ERROR) << "The engine that created " << section_name << " is not running anymore";
+		UnmapViewOfFile(section);
+		section = nullptr;
+		return false;
+	}
+	this->name = name;
+	Log() << "Connected to engine process " << engine_process_id << ": " << section->input_channel_count << " input channels, " << section->output_channel_count << " output channels at " << section->sample_rate << " Hz";
+	return true;
+}
+
+bool EngineDevice::OpenStream(PaStreamCallback* callback, void* user_data)
+{
+	const unsigned long process_id = GetCurrentProcessId();
+	for (unsigned long candidate_slot = 0; candidate_slot < EngineSection::max_clients && slot == invalid_slot; ++candidate_slot)
+	{
+		unsigned long expected_process_id = 0;
+		if (section->slots[candidate_slot].client_process_id.compare_exchange_strong(expected_process_id, process_id))
+			slot = candidate_slot;
+	}
+	if (slot == invalid_slot)
+	{
+		Log(LOG_LEVEL_ERROR) << "All " << EngineSection::max_clients << " engine slots are taken";
+		return false;
+	}
+	event = OpenEventA(SYNCHRONIZE, FALSE, GetEngineEventName(name, slot).c_str());
+	if (!event)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to open engine event for slot " << slot;
+		CloseStream();
+		return false;
+	}
+
+	this->callback = callback;
+	this->user_data = user_data;
+	discard_buffer.assign(section->output_channel_count * section->capacity, 0);
+	input_channels.assign(section->input_channel_count, nullptr);
+	output_channels.assign(section->output_channel_count, nullptr);
+	Log() << "Claimed engine slot " << slot;
+	return true;
+}
+
+void EngineDevice::CloseStream()
+{
+	if (event)
+	{
+		CloseHandle(event);
+		event = NULL;
+	}
+	if (slot == invalid_slot)
+		return;
+	Log() << "Releasing engine slot " << slot;
+	section->slots[slot].running.store(0);
+	section->slots[slot].client_process_id.store(0);
+	slot = invalid_slot;
+	callback = NULL;
+}
+
+PaError EngineDevice::StartStream()
+{
+	if (!callback)
+		return paBadStreamPtr;
+	if (thread.joinable())
+		return paStreamIsNotStopped;
+
+	// Both positions we pick up from are owned by the engine, which doesn't move them while the slot isn't running.
+	EngineSlot& client = section->slots[slot];
+	client.to_client.read_position.store(client.to_client.write_position.load());
+	client.from_client.write_position.store(client.from_client.read_position.load());
+	client.running.store(1);
+	stopping.store(false);
+	thread = std::thread(&EngineDevice::Run, this);
+	return paNoError;
+}
+
+PaError EngineDevice::StopStream()
+{
+	if (!thread.joinable())
+		return paStreamIsStopped;
+	section->slots[slot].running.store(0);
+	stopping.store(true);
+	thread.join();
+	return paNoError;
+}
+
+double EngineDevice::GetStreamTime() const
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void EngineDevice::Run()
+{
+	EngineSlot& client = section->slots[slot];
+	const size_t capacity = section->capacity;
+	const unsigned long input_channel_count = section->input_channel_count;
+	const unsigned long output_channel_count = section->output_channel_count;
+	while (!stopping.load())
+	{
+		// If the engine goes away, we just stop calling back, and the stall watchdog takes it from there.
+		if (WaitForSingleObject(event, engine_wait_timeout_ms) != WAIT_OBJECT_0)
+			continue;
+
+		for (;;)
+		{
+			const unsigned long long read_position = client.to_client.read_position.load(std::memory_order_relaxed);
+			const size_t available_frames = static_cast<size_t>(client.to_client.write_position.load(std::memory_order_acquire) - read_position);
+			if (available_frames == 0)
+				break;
+			const unsigned long long write_position = client.from_client.write_position.load(std::memory_order_relaxed);
+			const size_t free_frames = static_cast<size_t>(capacity - (write_position - client.from_client.read_position.load(std::memory_order_acquire)));
+
+			// Each call gets a region that is contiguous in both rings, so that the callback can work in place.
+			const size_t read_offset = static_cast<size_t>(read_position % capacity);
+			const size_t write_offset = static_cast<size_t>(write_position % capacity);
+			size_t frames = (std::min)(available_frames, capacity - read_offset);
+			if (free_frames > 0)
+				frames = (std::min)(frames, (std::min)(free_frames, capacity - write_offset));
+			for (unsigned long channel = 0; channel < input_channel_count; ++channel)
+				input_channels[channel] = section->GetToClientChannel(slot, channel) + read_offset;
+			for (unsigned long channel = 0; channel < output_channel_count; ++channel)
+				output_channels[channel] = free_frames > 0 ? section->GetFromClientChannel(slot, channel) + write_offset : discard_buffer.data() + channel * capacity;
+
+			PaStreamCallbackTimeInfo time_info;
+			time_info.currentTime = time_info.inputBufferAdcTime = time_info.outputBufferDacTime = GetStreamTime();
+			callback(input_channels.empty() ? NULL : input_channels.data(), output_channels.empty() ? NULL : output_channels.data(), static_cast<unsigned long>(frames), &time_info, 0, user_data);
+
+			if (free_frames > 0)
+				client.from_client.write_position.store(write_position + frames, std::memory_order_release);
+			else
+				client.from_client.overrun_count.store(client.from_client.overrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			client.to_client.read_position.store(read_position + frames, std::memory_order_release);
+		}
+	}
+}
@@ -0,0 +1,178 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <windows.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "loopback.h"
+#include "mixer.h"
+#include "portaudio.h"
+
+// The engine (FlexASIOEngine.exe, see Config::engine_name) owns the one PortAudio stream, so that several driver instances, typically in different ASIO hosts, can share the same devices.
+// Engine and drivers talk through a named file mapping, "Local\FlexASIO-Engine-<name>", which holds an EngineSection followed by the samples of each slot.
+// Each driver instance claims a slot. In every stream callback, the engine writes the device input to the to_client ring of every running slot, and mixes the from_client rings of all running slots into the device output.
+// It then sets the slot event ("Local\FlexASIO-Engine-<name>-<slot index>", auto-reset), which wakes up the driver, which runs its host on whatever input has arrived and writes its output back.
+// The rings follow the LoopbackRing protocol; their positions double as the clock of the client, even if there are no channels in that direction.
+
+struct EngineSlot
+{
+	// The driver process that claimed the slot, 0 if it is free. Claimed by compare-and-swap, so that two drivers can't get the same slot.
+	std::atomic<unsigned long> client_process_id;
+	// Non-zero while the client stream is started. The engine doesn't touch the rings otherwise, so that the client can pick up from the engine's position when it starts.
+	std::atomic<unsigned long> running;
+	LoopbackRing to_client;
+	LoopbackRing from_client;
+};
+
+struct EngineSection
+{
+	static const unsigned long current_version = 1;
+	static const unsigned long max_clients = 16;
+
+	// "FlexASIO", not null-terminated.
+	char magic[8];
+	unsigned long version;
+	// Of the whole section, samples included (see GetSize()).
+	unsigned long size;
+	// The engine process that currently owns the section, 0 if none.
+	std::atomic<unsigned long> engine_process_id;
+	double sample_rate;
+	// In frames, for all rings.
+	unsigned long capacity;
+	// Device input channels, which every client receives, and device output channels, to which every client contributes.
+	unsigned long input_channel_count;
+	unsigned long output_channel_count;
+	// Latencies of the engine stream and frames per engine callback, as of the last callback. Clients add them to their own.
+	std::atomic<unsigned long> input_latency;
+	std::atomic<unsigned long> output_latency;
+	std::atomic<unsigned long> period;
+	EngineSlot slots[max_clients];
+
+	static size_t GetSlotSize(unsigned long capacity, unsigned long input_channel_count, unsigned long output_channel_count) { return (input_channel_count + output_channel_count) * capacity * sizeof(float); }
+	static size_t GetSize(unsigned long capacity, unsigned long input_channel_count, unsigned long output_channel_count) { return sizeof(EngineSection) + max_clients * GetSlotSize(capacity, input_channel_count, output_channel_count); }
+	// The samples follow this header, one slot after the other, non-interleaved: capacity frames for each input channel (to_client), then for each output channel (from_client).
+	float* GetToClientChannel(unsigned long slot, unsigned long channel) { return GetSlotSamples(slot) + channel * capacity; }
+	float* GetFromClientChannel(unsigned long slot, unsigned long channel) { return GetSlotSamples(slot) + (input_channel_count + channel) * capacity; }
+
+	template <typename Function> void VisitRegions(unsigned long long position, size_t frames, Function function) const { VisitRingRegions(capacity, position, frames, function); }
+
+	private:
+		float* GetSlotSamples(unsigned long slot) { return reinterpret_cast<float*>(this + 1) + slot * (input_channel_count + output_channel_count) * capacity; }
+};
+
+std::string GetEngineSectionName(const std::string& name);
+std::string GetEngineEventName(const std::string& name, unsigned long slot);
+
+// The engine side of the section, used by FlexASIOEngine.exe. It is clocked by the engine stream callback.
+class EngineServer
+{
+	public:
+		struct ClientStatus
+		{
+			unsigned long process_id;
+			bool running;
+			// Engine callbacks for which the client hadn't written its output in time.
+			unsigned long long underrun_count;
+			// Engine callbacks for which the client hadn't read its input in time, and lost some of it.
+			unsigned long long overrun_count;
+		};
+
+		EngineServer();
+		~EngineServer();
+
+		// Fails if another engine is running under the same name.
+		bool Open(const std::string& name, double sample_rate, long input_channel_count, long output_channel_count);
+		void SetLatencies(unsigned long input_latency, unsigned long output_latency) { section->input_latency.store(input_latency); section->output_latency.store(output_latency); }
+
+		// Real-time safe, called from the engine stream callback. input is null if there are no input channels, output if there are no output channels.
+		void Process(const float* const* input, float* const* output, size_t frames);
+
+		// Frees the slots of clients that went away without releasing them, e.g. because their host crashed. Call this every now and then from a non-real-time thread.
+		void Reap();
+		// Can be called from any thread. Only lists slots that are claimed.
+		std::vector<ClientStatus> GetClientStatus() const;
+
+	private:
+		EngineServer(const EngineServer&);
+		EngineServer& operator=(const EngineServer&);
+
+		HANDLE mapping;
+		EngineSection* section;
+		HANDLE events[EngineSection::max_clients];
+		MultiplyAddFunction multiply_add;
+		// Whether each client has written any output since it started. Underruns are only counted afterwards, as the client needs one engine callback to get going.
+		bool primed[EngineSection::max_clients];
+};
+
+// The driver side of the section. Stands in for the PortAudio devices, like VirtualDevice, and calls back with the same signature as PortAudio.
+// Callbacks come from a thread woken up by the engine, and get whatever the engine has produced since the previous one, in one or more calls. The buffers point straight into the section.
+// The callback size is up to the engine, not the driver: the driver FIFOs re-block to the ASIO buffer size, which is how each client gets its own.
+class EngineDevice
+{
+	public:
+		EngineDevice();
+		~EngineDevice();
+
+		// Fails if the engine isn't running.
+		bool Connect(const std::string& name);
+		long GetInputChannelCount() const { return static_cast<long>(section->input_channel_count); }
+		long GetOutputChannelCount() const { return static_cast<long>(section->output_channel_count); }
+		double GetSampleRate() const { return section->sample_rate; }
+		// Added latencies of the engine, in frames. Output latency includes one engine period, which is how long client output waits in the ring on average.
+		unsigned long GetInputLatency() const { return section->input_latency.load(); }
+		unsigned long GetOutputLatency() const { return section->output_latency.load() + section->period.load(); }
+
+		// The equivalent of Pa_OpenStream(). Claims a slot; fails if there is none left.
+		bool OpenStream(PaStreamCallback* callback, void* user_data);
+		// Releases the slot.
+		void CloseStream();
+		PaError StartStream();
+		PaError StopStream();
+		// The equivalent of Pa_GetStreamTime().
+		double GetStreamTime() const;
+
+	private:
+		EngineDevice(const EngineDevice&);
+		EngineDevice& operator=(const EngineDevice&);
+
+		void Run();
+
+		static const unsigned long invalid_slot = ~0UL;
+
+		HANDLE mapping;
+		EngineSection* section;
+		// invalid_slot if no slot is claimed.
+		unsigned long slot;
+		HANDLE event;
+		std::string name;
+		PaStreamCallback* callback;
+		void* user_data;
+		// Where the output goes when the engine isn't reading it fast enough.
+		std::vector<float> discard_buffer;
+		std::vector<const float*> input_channels;
+		std::vector<float*> output_channels;
+		std::atomic<bool> stopping;
+		std::thread thread;
+};
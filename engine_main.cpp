@@ -0,0 +1,207 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// FlexASIOEngine.exe: owns the PortAudio stream on behalf of every driver instance configured with the same EngineName (see engine.h).
+// Usage: FlexASIOEngine [--name <name>] [--sample-rate <Hz>] [--buffer-size <frames>]
+// The engine runs until Ctrl+C, and logs its CPU usage and the state of its clients every 10 seconds.
+
+#include <windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+#include "stats.h"
+#include "util.h"
+
+#include "portaudio.h"
+
+namespace {
+const std::chrono::seconds status_interval(10);
+
+std::atomic<bool> stopping(false);
+
+struct EngineState
+{
+	EngineServer server;
+	// How long each call to EngineServer::Process() took, which is the cost of the engine on top of the devices.
+	DurationHistogram process_duration;
+};
+
+BOOL WINAPI ConsoleCtrlHandler(DWORD)
+{
+	stopping.store(true);
+	return TRUE;
+}
+
+int StreamCallback(const void* input, void* output, unsigned long frameCount, const PaStreamCallbackTimeInfo*, PaStreamCallbackFlags, void* userData)
+{
+	EngineState* const state = static_cast<EngineState*>(userData);
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	state->server.Process(static_cast<const float* const*>(input), static_cast<float* const*>(output), frameCount);
+	state->process_duration.Record(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	return paContinue;
+}
+
+// The histogram is only written by the audio thread, so it covers the whole run; CPU usage is over the last interval.
+void LogStatus(EngineState* state, std::chrono::steady_clock::duration elapsed, double* previous_total)
+{
+	const double elapsed_us = std::chrono::duration<double, std::micro>(elapsed).count();
+	const double total = state->process_duration.GetTotal();
+	Log() << state->process_duration.GetCount() << " callbacks, processing took " << state->process_duration.GetPercentile(0.5) << " us (median), " << state->process_duration.GetPercentile(0.99) << " us (99th percentile), "
+	      << state->process_duration.GetMax() << " us (max), " << (elapsed_us > 0 ? (total - *previous_total) / elapsed_us * 100 : 0) << "% of the time";
+	const std::vector<EngineServer::ClientStatus> clients = state->server.GetClientStatus();
+	for (std::vector<EngineServer::ClientStatus>::const_iterator client = clients.begin(); client != clients.end(); ++client)
+		Log() << "Client process " << client->process_id << ": " << (client->running ? "running" : "stopped") << ", " << client->underrun_count << " output underruns, " << client->overrun_count << " input overruns";
+	*previous_total = total;
+}
+
+int Run(const std::string& name, double sample_rate, unsigned long buffer_size)
+{
+	PaHostApiIndex pa_api_index = Pa_HostApiTypeIdToHostApiIndex(paWASAPI);
+	if (pa_api_index == paHostApiNotFound)
+		pa_api_index = Pa_GetDefaultHostApi();
+	const PaHostApiInfo* pa_api_info = pa_api_index >= 0 ? Pa_GetHostApiInfo(pa_api_index) : NULL;
+	if (!pa_api_info)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to get PortAudio API info";
+		return EXIT_FAILURE;
+	}
+	const PaDeviceInfo* input_device_info = pa_api_info->defaultInputDevice != paNoDevice ? Pa_GetDeviceInfo(pa_api_info->defaultInputDevice) : NULL;
+	const PaDeviceInfo* output_device_info = pa_api_info->defaultOutputDevice != paNoDevice ? Pa_GetDeviceInfo(pa_api_info->defaultOutputDevice) : NULL;
+	if (!input_device_info && !output_device_info)
+	{
+		Log(LOG_LEVEL_ERROR) << "No default devices for host API " << pa_api_info->name;
+		return EXIT_FAILURE;
+	}
+	if (sample_rate == 0)
+		sample_rate = output_device_info ? output_device_info->defaultSampleRate : input_device_info->defaultSampleRate;
+
+	PaStreamParameters input_parameters = { 0 };
+	if (input_device_info)
+	{
+		Log() << "Input device: " << input_device_info->name << ", " << input_device_info->maxInputChannels << " channels";
+		input_parameters.device = pa_api_info->defaultInputDevice;
+		input_parameters.channelCount = input_device_info->maxInputChannels;
+		input_parameters.sampleFormat = paFloat32 | paNonInterleaved;
+		input_parameters.suggestedLatency = input_device_info->defaultLowInputLatency;
+	}
+	PaStreamParameters output_parameters = { 0 };
+	if (output_device_info)
+	{
+		Log() << "Output device: " << output_device_info->name << ", " << output_device_info->maxOutputChannels << " channels";
+		output_parameters.device = pa_api_info->defaultOutputDevice;
+		output_parameters.channelCount = output_device_info->maxOutputChannels;
+		output_parameters.sampleFormat = paFloat32 | paNonInterleaved;
+		output_parameters.suggestedLatency = output_device_info->defaultLowOutputLatency;
+	}
+
+	std::unique_ptr<EngineState> state(new EngineState);
+	state->process_duration.Reset();
+	if (!state->server.Open(name, sample_rate, input_parameters.channelCount, output_parameters.channelCount))
+		return EXIT_FAILURE;
+
+	PaStream* stream = NULL;
+	PaError error = Pa_OpenStream(&stream, input_device_info ? &input_parameters : NULL, output_device_info ? &output_parameters : NULL, sample_rate, buffer_size, paNoFlag, &StreamCallback, state.get());
+	if (error != paNoError)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to open PortAudio stream: " << Pa_GetErrorText(error);
+		return EXIT_FAILURE;
+	}
+	const PaStreamInfo* stream_info = Pa_GetStreamInfo(stream);
+	if (stream_info)
+		state->server.SetLatencies(static_cast<unsigned long>(stream_info->inputLatency * sample_rate), static_cast<unsigned long>(stream_info->outputLatency * sample_rate));
+	error = Pa_StartStream(stream);
+	if (error != paNoError)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to start PortAudio stream: " << Pa_GetErrorText(error);
+		Pa_CloseStream(stream);
+		return EXIT_FAILURE;
+	}
+	Log() << "Engine " << name << " running at " << sample_rate << " Hz";
+
+	std::chrono::steady_clock::time_point status_time = std::chrono::steady_clock::now();
+	double previous_total = 0;
+	while (!stopping.load() && Pa_IsStreamActive(stream) == 1)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+		state->server.Reap();
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - status_time >= status_interval)
+		{
+			LogStatus(state.get(), now - status_time, &previous_total);
+			status_time = now;
+		}
+	}
+	if (!stopping.load())
+		Log(LOG_LEVEL_ERROR) << "The PortAudio stream stopped on its own";
+
+	Log() << "Stopping engine";
+	Pa_StopStream(stream);
+	Pa_CloseStream(stream);
+	return stopping.load() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+}
+
+int main(int argc, char** argv)
+{
+	Logger::Get().SetSink(CreateLogSink("stderr", std::string()));
+	LoggerReference logger_reference;
+
+	std::string name = "FlexASIO";
+	double sample_rate = 0;
+	unsigned long buffer_size = paFramesPerBufferUnspecified;
+	for (int argument_index = 1; argument_index < argc; ++argument_index)
+	{
+		const std::string argument = argv[argument_index];
+		if (argument_index + 1 >= argc)
+		{
+			Log(LOG_LEVEL_ERROR) << "Missing value for " << argument;
+			return EXIT_FAILURE;
+		}
+		const char* const value = argv[++argument_index];
+		if (argument == "--name")
+			name = value;
+		else if (argument == "--sample-rate")
+			sample_rate = atof(value);
+		else if (argument == "--buffer-size")
+			buffer_size = strtoul(value, NULL, 10);
+		else
+		{
+			Log(LOG_LEVEL_ERROR) << "Unknown option " << argument << "; usage: FlexASIOEngine [--name <name>] [--sample-rate <Hz>] [--buffer-size <frames>]";
+			return EXIT_FAILURE;
+		}
+	}
+
+	SetConsoleCtrlHandler(&ConsoleCtrlHandler, TRUE);
+	PaError error = Pa_Initialize();
+	if (error != paNoError)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to initialize PortAudio: " << Pa_GetErrorText(error);
+		return EXIT_FAILURE;
+	}
+	const int result = Run(name, sample_rate, buffer_size);
+	Pa_Terminate();
+	return result;
+}
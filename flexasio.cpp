@@ -19,37 +19,368 @@
 
 #include "flexasio.h"
 
+#include <cmath>
+
 #include <MMReg.h>
+#include <ksmedia.h>
 #include "pa_win_wasapi.h"
 
-CFlexASIO::CFlexASIO() :
-	portaudio_initialized(false), init_error(""), pa_api_info(nullptr),
+namespace {
+// Sample rates probed in the background after init(), in addition to the default sample rate of the devices. These are the rates hosts typically ask about.
+const double common_sample_rates[] = { 44100, 48000, 88200, 96000, 176400, 192000, 8000, 11025, 16000, 22050, 32000, 352800, 384000 };
+
+// ASIO splits 64-bit values into two 32-bit halves, most significant first.
+ASIOSamples MakeASIOSamples(long long samples)
+{
+	ASIOSamples asio_samples;
+	asio_samples.hi = static_cast<unsigned long>(static_cast<unsigned long long>(samples) >> 32);
+	asio_samples.lo = static_cast<unsigned long>(samples);
+	return asio_samples;
+}
+
+ASIOTimeStamp MakeASIOTimeStamp(long long timestamp)
+{
+	ASIOTimeStamp asio_timestamp;
+	asio_timestamp.hi = static_cast<unsigned long>(static_cast<unsigned long long>(timestamp) >> 32);
+	asio_timestamp.lo = static_cast<unsigned long>(timestamp);
+	return asio_timestamp;
+}
+
+// ASIO system time uses the timeGetTime() timebase, which only has millisecond resolution (at best).
+// To make the most of the high resolution PortAudio clock, this waits for timeGetTime() to tick and samples the PortAudio clock right then.
+// Returns what to add to PortAudio time to get timeGetTime() time, in seconds.
+double GetSystemTimeOffset(PaStream* stream)
+{
+	const DWORD initial_tick = timeGetTime();
+	// With the default timer resolution, timeGetTime() ticks every 15.6 ms. Don't wait forever if it doesn't.
+	const PaTime deadline = Pa_GetStreamTime(stream) + 0.05;
+	DWORD tick;
+	PaTime stream_time;
+	do
+	{
+		tick = timeGetTime();
+		stream_time = Pa_GetStreamTime(stream);
+	} while (tick == initial_tick && stream_time < deadline);
+	return tick / 1000.0 - stream_time;
+}
+
+// With separate input and output streams, input is pulled from the drift compensator in chunks of at most this many frames.
+const size_t drift_chunk_frames = 1024;
+
+// kAsioOverload is only sent once the host has exceeded Config::overload_threshold for this many buffers in a row.
+const unsigned long host_overload_buffer_count = 3;
+
+ASIOSampleType GetASIOSampleType(SampleFormat format)
+{
+	switch (format)
+	{
+		case SAMPLE_FORMAT_INT16: return ASIOSTInt16LSB;
+		case SAMPLE_FORMAT_INT24: return ASIOSTInt24LSB;
+		case SAMPLE_FORMAT_INT32: return ASIOSTInt32LSB;
+		case SAMPLE_FORMAT_FLOAT64: return ASIOSTFloat64LSB;
+		default: return ASIOSTFloat32LSB;
+	}
+}
+
+// Maps the native format of a WASAPI device to the closest format we can offer to the ASIO host, so that a host working in the device format doesn't have to convert.
+bool GetWaveFormatSampleFormat(const WAVEFORMATEXTENSIBLE& waveformat, SampleFormat* format)
+{
+	const bool is_extensible = waveformat.Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE;
+	const bool is_float = waveformat.Format.wFormatTag == WAVE_FORMAT_IEEE_FLOAT || (is_extensible && IsEqualGUID(waveformat.SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT));
+	const bool is_pcm = waveformat.Format.wFormatTag == WAVE_FORMAT_PCM || (is_extensible && IsEqualGUID(waveformat.SubFormat, KSDATAFORMAT_SUBTYPE_PCM));
+	if (is_float)
+	{
+		if (waveformat.Format.wBitsPerSample == 32) { *format = SAMPLE_FORMAT_FLOAT32; return true; }
+		if (waveformat.Format.wBitsPerSample == 64) { *format = SAMPLE_FORMAT_FLOAT64; return true; }
+	}
+	if (is_pcm)
+	{
+		if (waveformat.Format.wBitsPerSample == 16) { *format = SAMPLE_FORMAT_INT16; return true; }
+		if (waveformat.Format.wBitsPerSample == 24) { *format = SAMPLE_FORMAT_INT24; return true; }
+		if (waveformat.Format.wBitsPerSample == 32) { *format = SAMPLE_FORMAT_INT32; return true; }
+	}
+	return false;
+}
+
+// Identifies the devices in the capability cache. This doesn't change when the snapshot is taken from an older instance, so that deferred initialization doesn't invalidate anything.
+std::string GetCapabilityKey(const DeviceSnapshot& snapshot, bool separate_streams)
+{
+	std::stringstream key;
+	key << snapshot.host_api_name << "|" << snapshot.input_device_name << "|" << snapshot.output_device_name << "|" << (separate_streams ? "separate" : "duplex");
+	for (std::vector<DeviceSnapshot::AggregateDevice>::const_iterator device = snapshot.aggregate_devices.begin(); device != snapshot.aggregate_devices.end(); ++device)
+		key << "|" << device->name;
+	return key.str();
+}
+
+double GetMilliseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+}
+
+CFlexASIO::CFlexASIO() throw() :
+	config(LoadConfig()), logger_reference(config.log_level, config.log_sink, config.log_file),
+	initialized(false), portaudio_initialized(false), init_error(""), devices_pending(false), devices_failed(false), deferred_result(false), pa_api_info(nullptr),
 	input_device_info(nullptr), output_device_info(nullptr),
 	input_channel_count(0), output_channel_count(0),
-	input_channel_mask(0), output_channel_mask(0),
-	sample_rate(0), buffers(nullptr), stream(NULL), started(false)
+	input_channel_mask(0), output_channel_mask(0), aggregate_input_channel_count(0), aggregate_output_channel_count(0), loopback_input_channel_count(0), loopback_output_channel_count(0),
+	sample_rate(0), native_sample_rate(0), device_sample_rate(0), resampler_enabled(false), resampler_quality(RESAMPLER_QUALITY_MEDIUM), sample_format(SAMPLE_FORMAT_FLOAT32), buffers(nullptr), fifo_output_latency(0), stream(NULL), input_stream(NULL), stream_pool(std::chrono::milliseconds(config.stream_pool_timeout)),
+	calibration_cancelled(false), latency_correction(0), latency_correction_known(false),
+	host_thread_lookahead(0), host_thread_period(0), host_thread_primed(false), host_thread_dropped_frames(0), host_thread_slip(0), host_thread_frame_position(0), host_thread_realignment(0),
+	previous_callback_frames(0), max_callback_frames(0), callback_host_duration(0), consecutive_host_overloads(0),
+	position(0), position_timestamp(0), stream_frame_position(0), block_stream_frame(0), system_time_offset(0), started(false), stream_lost(false),
+	stall_watchdog([this](std::chrono::milliseconds stall_duration) { RecoverStreams(stall_duration); })
 {
 	Log() << "CFlexASIO::CFlexASIO()";
+	if (!statistics.GetSharedMemoryName().empty())
+		Log() << "Publishing stream statistics in shared memory section " << statistics.GetSharedMemoryName();
+	else
+		Log() << "Stream statistics are not available in shared memory (another instance might be using it)";
 }
 
 ASIOBool CFlexASIO::init(void* sysHandle)
 {
 	Log() << "CFlexASIO::init()";
-	if (input_device_info || output_device_info)
+	if (IsInitialized())
 	{
 		Log() << "Already initialized";
 		return ASE_NotPresent;
 	}
 
+	const std::chrono::steady_clock::time_point init_start = std::chrono::steady_clock::now();
+	sample_rate = 0;
+	sample_format = SAMPLE_FORMAT_FLOAT32;
+	bool sample_format_from_device = false;
+	const bool use_virtual_device = !config.virtual_input_file.empty() || !config.virtual_output_file.empty();
+	const bool use_engine = !use_virtual_device && !config.engine_name.empty();
+	// The virtual device and the engine have nothing worth caching.
+	if (config.capability_cache && !use_virtual_device && !use_engine)
+	{
+		const std::string capability_cache_path = CapabilityCache::GetDefaultPath();
+		if (capability_cache_path.empty())
+			Log(LOG_LEVEL_WARNING) << "Unable to locate the capability cache";
+		else
+		{
+			capability_cache.reset(new CapabilityCache(capability_cache_path));
+			capability_cache->Load();
+		}
+	}
+
+	if (use_virtual_device)
+	{
+		if (!InitializeVirtualDevice())
+			return ASIOFalse;
+	}
+	else if (use_engine)
+	{
+		if (!InitializeEngineDevice())
+			return ASIOFalse;
+	}
+	else
+	{
+		DeviceSnapshot snapshot;
+		if (config.deferred_initialization && capability_cache && capability_cache->GetDeviceSnapshot(GetDeviceSnapshotKey(), &snapshot) && IsDeviceSnapshotCurrent(snapshot))
+		{
+			Log() << "Using the snapshot of " << snapshot.host_api_name << " devices from a previous instance; PortAudio will be initialized when the devices are needed";
+			devices_pending = true;
+		}
+		else
+		{
+			if (!InitializeDevices(&snapshot, &init_error))
+			{
+				Log(LOG_LEVEL_ERROR) << init_error;
+				return ASIOFalse;
+			}
+			if (capability_cache)
+				capability_cache->SetDeviceSnapshot(GetDeviceSnapshotKey(), snapshot);
+		}
+		ApplyDeviceSnapshot(snapshot);
+		sample_format_from_device = snapshot.sample_format != SAMPLE_FORMAT_COUNT;
+		if (sample_format_from_device)
+			sample_format = snapshot.sample_format;
+	}
+
+	if (!config.sample_type.empty())
+	{
+		if (ParseSampleFormat(config.sample_type, &sample_format))
+			Log() << "Using sample type from configuration: " << GetSampleFormatName(sample_format);
+		else
+			Log(LOG_LEVEL_WARNING) << "Ignoring unknown sample type in configuration: " << config.sample_type;
+	}
+	else if (sample_format_from_device)
+		Log() << "Using the native sample type of the device: " << GetSampleFormatName(sample_format);
+	Log() << "Sample type: " << GetSampleFormatName(sample_format) << " (conversions use " << GetInstructionSetName(GetBestInstructionSet()) << " kernels)";
+	loopback_input_channel_count = (std::max)(0L, config.loopback_input_channels);
+	loopback_output_channel_count = (std::max)(0L, config.loopback_output_channels);
+	if (loopback_input_channel_count > 0 || loopback_output_channel_count > 0)
+		Log() << "Loopback: " << loopback_input_channel_count << " input channels, " << loopback_output_channel_count << " output channels, named " << config.loopback_name;
+	InitializeMixers();
+	if (config.metering && (GetTotalInputChannelCount() > 0 || GetTotalOutputChannelCount() > 0))
+	{
+		meters.reset(new Meters(GetTotalInputChannelCount(), GetTotalOutputChannelCount()));
+		Log() << "Metering " << GetTotalInputChannelCount() << " input channels and " << GetTotalOutputChannelCount() << " output channels" << (meters->GetSharedMemoryName().empty() ? "" : ", shared in section " + meters->GetSharedMemoryName());
+	}
+
+	if (sample_rate == 0)
+		sample_rate = 44100;
+	native_sample_rate = sample_rate;
+	if (config.resampler_quality == "off")
+		Log() << "Sample rate conversion is disabled, only sample rates supported by the devices will be available";
+	else if (ParseResamplerQuality(config.resampler_quality, &resampler_quality))
+	{
+		resampler_enabled = true;
+		Log() << "Other sample rates will be converted from " << native_sample_rate << " Hz with " << GetResamplerQualityName(resampler_quality) << " quality";
+	}
+	else
+		Log(LOG_LEVEL_WARNING) << "Ignoring unknown resampler quality in configuration: " << config.resampler_quality;
+
+	if (capability_cache)
+	{
+		DeviceCapabilities capabilities = device_snapshot.capabilities;
+		capability_key = GetCapabilityKey(device_snapshot, UseSeparateStreams());
+		capability_cache->Validate(capability_key, &capabilities);
+
+		std::vector<double> sample_rates(1, sample_rate);
+		sample_rates.insert(sample_rates.end(), common_sample_rates, common_sample_rates + sizeof(common_sample_rates) / sizeof(*common_sample_rates));
+		std::vector<double> unknown_sample_rates;
+		for (size_t sample_rate_index = 0; sample_rate_index < sample_rates.size(); ++sample_rate_index)
+			if (capabilities.sample_rates.find(sample_rates[sample_rate_index]) == capabilities.sample_rates.end() &&
+				std::find(unknown_sample_rates.begin(), unknown_sample_rates.end(), sample_rates[sample_rate_index]) == unknown_sample_rates.end())
+				unknown_sample_rates.push_back(sample_rates[sample_rate_index]);
+		// Probing needs PortAudio. If it isn't initialized yet, canSampleRate() initializes it if it has to.
+		if (!unknown_sample_rates.empty() && !devices_pending)
+		{
+			Log() << "Probing " << unknown_sample_rates.size() << " sample rates in the background";
+			sample_rate_prober.reset(new SampleRateProber([this](double sample_rate) {
+				const bool supported = ProbeSampleRate(sample_rate);
+				capability_cache->SetSampleRate(capability_key, sample_rate, supported);
+				return supported;
+			}, unknown_sample_rates));
+		}
+	}
+
+	if (devices_pending && config.background_initialization)
+	{
+		Log() << "Initializing PortAudio in the background";
+		initialization_thread = std::thread(&CFlexASIO::RunDeferredInitialization, this);
+	}
+
+	initialized = true;
+	Log() << "Initialized successfully in " << GetMilliseconds(init_start) << " ms" << (devices_pending ? " (PortAudio initialization deferred)" : "");
+	return ASIOTrue;
+}
+
+std::string CFlexASIO::GetDeviceSnapshotKey() const
+{
+	// The devices are the default devices of the preferred host API, plus the aggregate devices.
+	return "default|" + config.aggregate_devices;
+}
+
+bool CFlexASIO::IsDeviceSnapshotCurrent(const DeviceSnapshot& snapshot) const throw()
+{
+	// Only WASAPI names its devices after the endpoints. Other host APIs can't be checked without PortAudio.
+	if (snapshot.host_api_type != paWASAPI)
+	{
+		Log() << "Not using the device snapshot, as it is not for WASAPI";
+		return false;
+	}
+	std::string input_device_name;
+	std::string output_device_name;
+	if (!GetDefaultEndpointName(true, &input_device_name) || !GetDefaultEndpointName(false, &output_device_name))
+	{
+		Log() << "Not using the device snapshot, as the default endpoints could not be queried";
+		return false;
+	}
+	if (input_device_name != snapshot.input_device_name || output_device_name != snapshot.output_device_name)
+	{
+		Log() << "Not using the device snapshot, as the default devices changed (now " << input_device_name << " and " << output_device_name << ")";
+		return false;
+	}
+	return true;
+}
+
+void CFlexASIO::ApplyDeviceSnapshot(const DeviceSnapshot& snapshot) throw()
+{
+	device_snapshot = snapshot;
+	input_channel_count = snapshot.capabilities.input_channel_count;
+	output_channel_count = snapshot.capabilities.output_channel_count;
+	input_channel_mask = snapshot.capabilities.input_channel_mask;
+	output_channel_mask = snapshot.capabilities.output_channel_mask;
+	sample_rate = snapshot.sample_rate;
+	aggregate_input_channel_count = 0;
+	aggregate_output_channel_count = 0;
+	for (std::vector<DeviceSnapshot::AggregateDevice>::const_iterator device = snapshot.aggregate_devices.begin(); device != snapshot.aggregate_devices.end(); ++device)
+	{
+		aggregate_input_channel_count += device->input_channel_count;
+		aggregate_output_channel_count += device->output_channel_count;
+	}
+	Log() << "Devices: " << (snapshot.input_device_name.empty() ? "no input" : snapshot.input_device_name) << " (" << input_channel_count << " channels), "
+	      << (snapshot.output_device_name.empty() ? "no output" : snapshot.output_device_name) << " (" << output_channel_count << " channels), "
+	      << snapshot.aggregate_devices.size() << " aggregate devices";
+}
+
+bool CFlexASIO::EnsureDevices() throw()
+{
+	if (devices_failed)
+		return false;
+	if (!devices_pending)
+		return true;
+
+	if (initialization_thread.joinable())
+	{
+		Log() << "Waiting for PortAudio to be initialized in the background";
+		initialization_thread.join();
+	}
+	else
+		RunDeferredInitialization();
+	devices_pending = false;
+
+	if (!deferred_result)
+	{
+		init_error = deferred_error;
+		Log(LOG_LEVEL_ERROR) << init_error;
+		devices_failed = true;
+		return false;
+	}
+	// Whatever the host has been told stays true until the next instance, so the next instance had better be told the truth.
+	if (capability_cache)
+		capability_cache->SetDeviceSnapshot(GetDeviceSnapshotKey(), deferred_snapshot);
+	if (!deferred_snapshot.IsCompatibleWith(device_snapshot))
+	{
+		init_error = "The audio devices changed since the driver was initialized, please reset the driver";
+		Log(LOG_LEVEL_ERROR) << init_error;
+		devices_failed = true;
+		return false;
+	}
+	// The latencies might still have changed, which makes whatever has been learned about the devices stale.
+	if (capability_cache)
+	{
+		DeviceCapabilities capabilities = deferred_snapshot.capabilities;
+		capability_cache->Validate(capability_key, &capabilities);
+	}
+	device_snapshot = deferred_snapshot;
+	return true;
+}
+
+void CFlexASIO::RunDeferredInitialization() throw()
+{
+	const std::chrono::steady_clock::time_point initialization_start = std::chrono::steady_clock::now();
+	deferred_result = InitializeDevices(&deferred_snapshot, &deferred_error);
+	Log() << "Deferred PortAudio initialization took " << GetMilliseconds(initialization_start) << " ms";
+}
+
+bool CFlexASIO::InitializeDevices(DeviceSnapshot* snapshot, std::string* error_message) throw()
+{
+	const std::chrono::steady_clock::time_point initialization_start = std::chrono::steady_clock::now();
 	Log() << "Initializing PortAudio";
 	PaError error = Pa_Initialize();
 	if (error != paNoError)
 	{
-		init_error = std::string("Could not initialize PortAudio: ") + Pa_GetErrorText(error);
-		Log() << init_error;
-		return ASIOFalse;
+		*error_message = std::string("Could not initialize PortAudio: ") + Pa_GetErrorText(error);
+		return false;
 	}
 	portaudio_initialized = true;
+	Log() << "PortAudio initialized in " << GetMilliseconds(initialization_start) << " ms";
 
 	// The default API used by PortAudio is WinMME. It's also the worst one.
 	// The following attempts to get a better API (in order of preference).
@@ -60,21 +391,19 @@ ASIOBool CFlexASIO::init(void* sysHandle)
 		pa_api_index = Pa_GetDefaultHostApi();
 	if (pa_api_index < 0)
 	{
-		init_error = "Unable to get PortAudio API index";
-		Log() << init_error;
-		return ASIOFalse;
+		*error_message = "Unable to get PortAudio API index";
+		return false;
 	}
 
 	pa_api_info = Pa_GetHostApiInfo(pa_api_index);
 	if (!pa_api_info)
 	{
-		init_error = "Unable to get PortAudio API info";
-		Log() << init_error;
-		return ASIOFalse;
+		*error_message = "Unable to get PortAudio API info";
+		return false;
 	}
 	Log() << "Selected host API #" << pa_api_index << " (" << pa_api_info->name << ")";
-
-	sample_rate = 0;
+	snapshot->host_api_type = pa_api_info->type;
+	snapshot->host_api_name = pa_api_info->name;
 
 	Log() << "Getting input device info";
 	if (pa_api_info->defaultInputDevice != paNoDevice)
@@ -82,13 +411,16 @@ ASIOBool CFlexASIO::init(void* sysHandle)
 		input_device_info = Pa_GetDeviceInfo(pa_api_info->defaultInputDevice);
 		if (!input_device_info)
 		{
-			init_error = std::string("Unable to get input device info");
-			Log() << init_error;
-			return ASIOFalse;
+			*error_message = "Unable to get input device info";
+			return false;
 		}
 		Log() << "Selected input device: " << input_device_info->name;
-		input_channel_count = input_device_info->maxInputChannels;
-		sample_rate = (std::max)(input_device_info->defaultSampleRate, sample_rate);
+		snapshot->input_device_name = input_device_info->name;
+		snapshot->capabilities.input_channel_count = input_device_info->maxInputChannels;
+		snapshot->capabilities.input_default_sample_rate = input_device_info->defaultSampleRate;
+		snapshot->capabilities.input_latency_low = input_device_info->defaultLowInputLatency;
+		snapshot->capabilities.input_latency_high = input_device_info->defaultHighInputLatency;
+		snapshot->sample_rate = (std::max)(input_device_info->defaultSampleRate, snapshot->sample_rate);
 	}
 
 	Log() << "Getting output device info";
@@ -97,13 +429,16 @@ ASIOBool CFlexASIO::init(void* sysHandle)
 		output_device_info = Pa_GetDeviceInfo(pa_api_info->defaultOutputDevice);
 		if (!output_device_info)
 		{
-			init_error = std::string("Unable to get output device info");
-			Log() << init_error;
-			return ASIOFalse;
+			*error_message = "Unable to get output device info";
+			return false;
 		}
 		Log() << "Selected output device: " << output_device_info->name;
-		output_channel_count = output_device_info->maxOutputChannels;
-		sample_rate = (std::max)(output_device_info->defaultSampleRate, sample_rate);
+		snapshot->output_device_name = output_device_info->name;
+		snapshot->capabilities.output_channel_count = output_device_info->maxOutputChannels;
+		snapshot->capabilities.output_default_sample_rate = output_device_info->defaultSampleRate;
+		snapshot->capabilities.output_latency_low = output_device_info->defaultLowOutputLatency;
+		snapshot->capabilities.output_latency_high = output_device_info->defaultHighOutputLatency;
+		snapshot->sample_rate = (std::max)(output_device_info->defaultSampleRate, snapshot->sample_rate);
 	}
 
 	if (pa_api_info->type == paWASAPI)
@@ -111,12 +446,15 @@ ASIOBool CFlexASIO::init(void* sysHandle)
 		// PortAudio has some WASAPI-specific goodies to make us smarter.
 		WAVEFORMATEXTENSIBLE input_waveformat;
 		PaError error = PaWasapi_GetDeviceDefaultFormat(&input_waveformat, sizeof(input_waveformat), pa_api_info->defaultInputDevice);
+		SampleFormat sample_format;
 		if (error <= 0)
 			Log() << "Unable to get WASAPI default format for input device";
 		else
 		{
-			input_channel_count = input_waveformat.Format.nChannels;
-			input_channel_mask = input_waveformat.dwChannelMask;
+			snapshot->capabilities.input_channel_count = input_waveformat.Format.nChannels;
+			snapshot->capabilities.input_channel_mask = input_waveformat.dwChannelMask;
+			if (GetWaveFormatSampleFormat(input_waveformat, &sample_format))
+				snapshot->sample_format = sample_format;
 		}
 
 		WAVEFORMATEXTENSIBLE output_waveformat;
@@ -125,25 +463,165 @@ ASIOBool CFlexASIO::init(void* sysHandle)
 			Log() << "Unable to get WASAPI default format for output device";
 		else
 		{
-			output_channel_count = output_waveformat.Format.nChannels;
-			output_channel_mask = output_waveformat.dwChannelMask;
+			snapshot->capabilities.output_channel_count = output_waveformat.Format.nChannels;
+			snapshot->capabilities.output_channel_mask = output_waveformat.dwChannelMask;
+			// If the input and output devices disagree, the output device wins.
+			if (GetWaveFormatSampleFormat(output_waveformat, &sample_format))
+				snapshot->sample_format = sample_format;
 		}
 	}
 
-	if (sample_rate == 0)
-		sample_rate = 44100;
+	InitializeAggregateDevices(pa_api_index, snapshot);
+	return true;
+}
 
-	Log() << "Initialized successfully";
-	return ASIOTrue;
+bool CFlexASIO::InitializeVirtualDevice() throw()
+{
+	Log() << "Using a virtual device instead of PortAudio";
+	std::unique_ptr<VirtualDevice> temp_virtual_device(new VirtualDevice);
+	if (!config.virtual_input_file.empty() && !temp_virtual_device->OpenInput(config.virtual_input_file))
+	{
+		init_error = "Unable to open the virtual input file";
+		Log(LOG_LEVEL_ERROR) << init_error;
+		return false;
+	}
+	input_channel_count = temp_virtual_device->GetInputChannelCount();
+	output_channel_count = config.virtual_output_file.empty() ? 0 : config.virtual_output_channels;
+	if (input_channel_count <= 0 && output_channel_count <= 0)
+	{
+		init_error = "The virtual device has no channels";
+		Log(LOG_LEVEL_ERROR) << init_error;
+		return false;
+	}
+	sample_rate = temp_virtual_device->GetInputSampleRate();
+	if (!config.aggregate_devices.empty())
+		Log(LOG_LEVEL_WARNING) << "Ignoring aggregate devices, which cannot be used along with the virtual device";
+	if (config.virtual_stall_interval > 0)
+	{
+		Log() << "Virtual device: stalling every " << config.virtual_stall_interval << " callbacks";
+		temp_virtual_device->SetStallInterval(config.virtual_stall_interval);
+	}
+	if (config.virtual_speed == 0)
+		Log() << "Virtual device: " << input_channel_count << " input channels, " << output_channel_count << " output channels, running as fast as possible";
+	else
+		Log() << "Virtual device: " << input_channel_count << " input channels, " << output_channel_count << " output channels, running at " << config.virtual_speed << "x real time";
+	virtual_device = std::move(temp_virtual_device);
+	return true;
+}
+
+bool CFlexASIO::InitializeEngineDevice() throw()
+{
+	Log() << "Using engine " << config.engine_name << " instead of PortAudio";
+	std::unique_ptr<EngineDevice> temp_engine_device(new EngineDevice);
+	if (!temp_engine_device->Connect(config.engine_name))
+	{
+		init_error = "Unable to connect to the FlexASIO engine";
+		Log(LOG_LEVEL_ERROR) << init_error;
+		return false;
+	}
+	input_channel_count = temp_engine_device->GetInputChannelCount();
+	output_channel_count = temp_engine_device->GetOutputChannelCount();
+	sample_rate = temp_engine_device->GetSampleRate();
+	if (!config.aggregate_devices.empty())
+		Log(LOG_LEVEL_WARNING) << "Ignoring aggregate devices, which cannot be used along with the engine";
+	engine_device = std::move(temp_engine_device);
+	return true;
+}
+
+void CFlexASIO::InitializeAggregateDevices(PaHostApiIndex pa_api_index, DeviceSnapshot* snapshot) throw()
+{
+	std::istringstream device_names(config.aggregate_devices);
+	std::string device_name;
+	while (std::getline(device_names, device_name, ';'))
+	{
+		if (device_name.empty())
+			continue;
+		PaDeviceIndex device = paNoDevice;
+		for (int api_device_index = 0; api_device_index < pa_api_info->deviceCount && device == paNoDevice; ++api_device_index)
+		{
+			const PaDeviceIndex candidate = Pa_HostApiDeviceIndexToDeviceIndex(pa_api_index, api_device_index);
+			const PaDeviceInfo* candidate_info = Pa_GetDeviceInfo(candidate);
+			if (candidate_info && device_name == candidate_info->name)
+				device = candidate;
+		}
+		if (device == paNoDevice)
+		{
+			Log(LOG_LEVEL_WARNING) << "Ignoring aggregate device " << device_name << ": there is no such device in host API " << pa_api_info->name;
+			continue;
+		}
+		// A device can only be opened once.
+		if (device == pa_api_info->defaultInputDevice || device == pa_api_info->defaultOutputDevice || std::find(aggregate_devices.begin(), aggregate_devices.end(), device) != aggregate_devices.end())
+		{
+			Log(LOG_LEVEL_WARNING) << "Ignoring aggregate device " << device_name << ": it is already in use";
+			continue;
+		}
+
+		const PaDeviceInfo* device_info = Pa_GetDeviceInfo(device);
+		Log() << "Aggregating device: " << device_info->name << " (" << device_info->maxInputChannels << " input channels, " << device_info->maxOutputChannels << " output channels)";
+		aggregate_devices.push_back(device);
+		DeviceSnapshot::AggregateDevice aggregate_device;
+		aggregate_device.name = device_info->name;
+		aggregate_device.input_channel_count = device_info->maxInputChannels;
+		aggregate_device.output_channel_count = device_info->maxOutputChannels;
+		snapshot->aggregate_devices.push_back(aggregate_device);
+	}
+}
+
+void CFlexASIO::InitializeMixers() throw()
+{
+	const long device_input_channel_count = GetTotalInputChannelCount();
+	const long device_output_channel_count = GetTotalOutputChannelCount();
+	MixingMatrix matrix;
+	// In the configuration layout, empty if there is no mixer.
+	MixingMatrix input_matrix;
+	MixingMatrix output_matrix;
+	if (!config.input_matrix.empty() && device_input_channel_count > 0)
+	{
+		if (!ParseMixingMatrix(config.input_matrix, &matrix) || matrix.empty() || matrix[0].size() > static_cast<size_t>(device_input_channel_count))
+			Log(LOG_LEVEL_WARNING) << "Ignoring invalid input matrix (there should be at most " << device_input_channel_count << " gains per row): " << config.input_matrix;
+		else if (IsIdentityMixingMatrix(matrix, device_input_channel_count))
+			Log() << "Input matrix is the identity, ignoring it";
+		else
+		{
+			// Input matrix rows are ASIO channels, which is what the mixer produces.
+			input_mixer.reset(new ChannelMixer(matrix, device_input_channel_count));
+			input_matrix = matrix;
+			Log() << "Input matrix mixes " << device_input_channel_count << " device channels into " << input_mixer->GetDestinationCount() << " ASIO channels";
+		}
+	}
+	if (!config.output_matrix.empty() && device_output_channel_count > 0)
+	{
+		if (!ParseMixingMatrix(config.output_matrix, &matrix) || matrix.empty() || matrix[0].size() > static_cast<size_t>(device_output_channel_count))
+			Log(LOG_LEVEL_WARNING) << "Ignoring invalid output matrix (there should be at most " << device_output_channel_count << " gains per row): " << config.output_matrix;
+		else if (IsIdentityMixingMatrix(matrix, device_output_channel_count))
+			Log() << "Output matrix is the identity, ignoring it";
+		else
+		{
+			// Output matrix rows are ASIO channels too, but the mixer produces device channels.
+			output_mixer.reset(new ChannelMixer(TransposeMixingMatrix(matrix, device_output_channel_count), matrix.size()));
+			output_matrix = matrix;
+			Log() << "Output matrix mixes " << output_mixer->GetSourceCount() << " ASIO channels into " << device_output_channel_count << " device channels";
+		}
+	}
+
+	if (device_input_channel_count > 0 && device_output_channel_count > 0)
+		input_monitor.reset(new InputMonitor(input_matrix, output_matrix, device_input_channel_count, device_output_channel_count, GetASIOInputChannelCount(), GetASIOOutputChannelCount()));
 }
 
 CFlexASIO::~CFlexASIO()
 {
 	Log() << "CFlexASIO::~CFlexASIO()";
+	// PortAudio can't be terminated while it's being initialized.
+	if (initialization_thread.joinable())
+		initialization_thread.join();
 	if (started)
 		stop();
 	if (buffers)
 		disposeBuffers();
+	sample_rate_prober.reset();
+	stream_pool.Clear();
+	if (capability_cache)
+		capability_cache->Save();
 	if (portaudio_initialized)
 	{
 		Log() << "Closing PortAudio";
@@ -184,17 +662,17 @@ ASIOError CFlexASIO::setClockSource(long reference) throw()
 	return ASE_OK;
 }
 
-ASIOError CFlexASIO::getChannels(long* numInputChannels, long* numOutputChannels)
+ASIOError CFlexASIO::getChannels(long* numInputChannels, long* numOutputChannels) throw()
 {
 	Log() << "CFlexASIO::getChannels()";
-	if (!input_device_info && !output_device_info)
+	if (!IsInitialized())
 	{
 		Log() << "getChannels() called in unitialized state";
 		return ASE_NotPresent;
 	}
 
-	*numInputChannels = input_channel_count;
-	*numOutputChannels = output_channel_count;
+	*numInputChannels = GetASIOInputChannelCount();
+	*numOutputChannels = GetASIOOutputChannelCount();
 
 	Log() << "Returning " << *numInputChannels << " input channels and " << *numOutputChannels << " output channels";
 	return ASE_OK;
@@ -256,14 +734,14 @@ std::string getChannelName(size_t channel, DWORD channelMask)
 }
 }
 
-ASIOError CFlexASIO::getChannelInfo(ASIOChannelInfo* info)
+ASIOError CFlexASIO::getChannelInfo(ASIOChannelInfo* info) throw()
 {
 	Log() << "CFlexASIO::getChannelInfo()";
 
 	Log() << "Channel info requested for " << (info->isInput ? "input" : "output") << " channel " << info->channel;
 	if (info->isInput)
 	{
-		if (info->channel < 0 || info->channel >= input_channel_count)
+		if (info->channel < 0 || info->channel >= GetASIOInputChannelCount())
 		{
 			Log() << "No such input channel, returning error";
 			return ASE_NotPresent;
@@ -271,7 +749,7 @@ ASIOError CFlexASIO::getChannelInfo(ASIOChannelInfo* info)
 	}
 	else
 	{
-		if (info->channel < 0 || info->channel >= output_channel_count)
+		if (info->channel < 0 || info->channel >= GetASIOOutputChannelCount())
 		{
 			Log() << "No such output channel, returning error";
 			return ASE_NotPresent;
@@ -287,19 +765,52 @@ ASIOError CFlexASIO::getChannelInfo(ASIOChannelInfo* info)
 		}
 
 	info->channelGroup = 0;
-	info->type = asio_sample_type;
+	info->type = GetASIOSampleType(sample_format);
 	std::stringstream channel_string;
-	channel_string << (info->isInput ? "IN" : "OUT") << " " << getChannelName(info->channel, info->isInput ? input_channel_mask : output_channel_mask);
-	strcpy_s(info->name, 32, channel_string.str().c_str());
+	channel_string << (info->isInput ? "IN" : "OUT") << " ";
+	if (info->isInput ? input_mixer : output_mixer)
+		channel_string << info->channel << " (mix)";
+	else if (info->channel >= (info->isInput ? input_channel_count : output_channel_count))
+	{
+		// Aggregate member channels are named after their device, which is the only way to tell them apart. The loopback channels come after them.
+		long member_channel = info->channel - (info->isInput ? input_channel_count : output_channel_count);
+		std::string member_name = "Loopback";
+		for (std::vector<DeviceSnapshot::AggregateDevice>::const_iterator device = device_snapshot.aggregate_devices.begin(); device != device_snapshot.aggregate_devices.end(); ++device)
+		{
+			const long member_channel_count = info->isInput ? device->input_channel_count : device->output_channel_count;
+			if (member_channel < member_channel_count)
+			{
+				member_name = device->name;
+				break;
+			}
+			member_channel -= member_channel_count;
+		}
+		channel_string << member_channel << " " << member_name;
+	}
+	else
+		channel_string << getChannelName(info->channel, info->isInput ? input_channel_mask : output_channel_mask);
+	// Device names can be longer than what ASIO allows for.
+	strcpy_s(info->name, 32, channel_string.str().substr(0, 31).c_str());
 	Log() << "Returning: " << info->name << ", " << (info->isActive ? "active" : "inactive") << ", group " << info->channelGroup << ", type " << info->type;
 	return ASE_OK;
 }
 
-ASIOError CFlexASIO::getBufferSize(long* minSize, long* maxSize, long* preferredSize, long* granularity)
+ASIOError CFlexASIO::getBufferSize(long* minSize, long* maxSize, long* preferredSize, long* granularity) throw()
 {
-	// These values are purely arbitrary, since PortAudio doesn't provide them. Feel free to change them if you'd like.
-	// TODO: let the user should these values
 	Log() << "CFlexASIO::getBufferSize()";
+	BufferSizeTuning tuning;
+	if (config.buffer_size_tuning && capability_cache && capability_cache->GetBufferSizeTuning(capability_key, sample_rate, &tuning) && tuning.device_period > 0)
+	{
+		// Anything that isn't a multiple of the device period makes callbacks uneven without reducing latency.
+		const std::vector<long> candidates = GetBufferSizeCandidates(tuning.device_period, sample_rate);
+		*minSize = candidates.front();
+		*maxSize = candidates.back();
+		*preferredSize = GetPreferredBufferSize(tuning, sample_rate);
+		*granularity = tuning.device_period;
+		Log() << "Returning: min buffer size " << *minSize << ", max buffer size " << *maxSize << ", preferred buffer size " << *preferredSize << " (tuned), granularity " << *granularity;
+		return ASE_OK;
+	}
+	// These values are purely arbitrary, since PortAudio doesn't provide them. Feel free to change them if you'd like.
 	*minSize = 48; // 1 ms at 48kHz, there's basically no chance we'll get glitch-free streaming below this
 	*maxSize = 48000; // 1 second at 48kHz, more would be silly
 	*preferredSize = 1024; // typical - 21.3 ms at 48kHz
@@ -308,13 +819,13 @@ ASIOError CFlexASIO::getBufferSize(long* minSize, long* maxSize, long* preferred
 	return ASE_OK;
 }
 
-PaError CFlexASIO::OpenStream(PaStream** stream, double sampleRate, unsigned long framesPerBuffer) throw()
+PaError CFlexASIO::OpenStream(PaStream** stream, double sampleRate, unsigned long framesPerBuffer, bool use_input, bool use_output, PaStreamCallback* callback) throw()
 {
-	Log() << "CFlexASIO::OpenStream(" << sampleRate << ", " << framesPerBuffer << ")";
+	Log() << "CFlexASIO::OpenStream(" << sampleRate << ", " << framesPerBuffer << ", " << (use_input ? "input" : "no input") << ", " << (use_output ? "output" : "no output") << ")";
 
 	PaStreamParameters input_parameters;
 	PaWasapiStreamInfo input_wasapi_stream_info;
-	if (input_device_info)
+	if (use_input)
 	{
 		input_parameters.device = pa_api_info->defaultInputDevice;
 		input_parameters.channelCount = input_channel_count;
@@ -338,7 +849,7 @@ PaError CFlexASIO::OpenStream(PaStream** stream, double sampleRate, unsigned lon
 
 	PaStreamParameters output_parameters;
 	PaWasapiStreamInfo output_wasapi_stream_info;
-	if (output_device_info)
+	if (use_output)
 	{
 		output_parameters.device = pa_api_info->defaultOutputDevice;
 		output_parameters.channelCount = output_channel_count;
@@ -362,34 +873,104 @@ PaError CFlexASIO::OpenStream(PaStream** stream, double sampleRate, unsigned lon
 
 	return Pa_OpenStream(
 		stream,
-		input_device_info ? &input_parameters : NULL,
-		output_device_info ? &output_parameters : NULL,
-		sampleRate, framesPerBuffer, paNoFlag, &CFlexASIO::StaticStreamCallback, this);
+		use_input ? &input_parameters : NULL,
+		use_output ? &output_parameters : NULL,
+		sampleRate, framesPerBuffer, paNoFlag, callback, this);
 }
 
 ASIOError CFlexASIO::canSampleRate(ASIOSampleRate sampleRate) throw()
 {
 	Log() << "CFlexASIO::canSampleRate(" << sampleRate << ")";
-	if (!input_device_info && !output_device_info)
+	if (!IsInitialized())
 	{
 		Log() << "canSampleRate() called in unitialized state";
 		return ASE_NotPresent;
 	}
 
-	PaStream* temp_stream;
-	PaError error = OpenStream(&temp_stream, sampleRate, paFramesPerBufferUnspecified);
-	if (error != paNoError)
+	if (!IsSampleRateSupportedByDevices(sampleRate))
 	{
-		init_error = std::string("Cannot do this sample rate: ") + Pa_GetErrorText(error);
-		Log() << init_error;
-		return ASE_NoClock;
+		if (!CanConvertSampleRate(sampleRate))
+		{
+			init_error = "Cannot do this sample rate";
+			Log(LOG_LEVEL_ERROR) << init_error;
+			return ASE_NoClock;
+		}
+		Log() << "Sample rate is available through conversion from " << native_sample_rate << " Hz";
+		return ASE_OK;
 	}
 
 	Log() << "Sample rate is available";
-	Pa_CloseStream(temp_stream);
 	return ASE_OK;
 }
 
+bool CFlexASIO::IsSampleRateSupportedByDevices(double sampleRate) throw()
+{
+	// The virtual device can run at any rate, except that the input file has one of its own.
+	if (virtual_device)
+		return virtual_device->GetInputChannelCount() == 0 || sampleRate == virtual_device->GetInputSampleRate();
+	// Other rates go through the resampler, as the engine is shared with other clients.
+	if (engine_device)
+		return sampleRate == engine_device->GetSampleRate();
+
+	bool supported;
+	if (capability_cache && capability_cache->GetSampleRate(capability_key, sampleRate, &supported))
+		Log() << "Using cached result";
+	else
+	{
+		if (!sample_rate_prober || !sample_rate_prober->Wait(sampleRate, &supported))
+		{
+			// Probing needs PortAudio, which might not be initialized yet.
+			if (!EnsureDevices())
+				return false;
+			// Streams from previous buffers would keep the devices busy.
+			stream_pool.Clear();
+			supported = ProbeSampleRate(sampleRate);
+		}
+		if (capability_cache)
+			capability_cache->SetSampleRate(capability_key, sampleRate, supported);
+	}
+	return supported;
+}
+
+bool CFlexASIO::CanConvertSampleRate(double sampleRate) const throw()
+{
+	return resampler_enabled && SampleRateConverter::IsSupported(native_sample_rate, sampleRate) && SampleRateConverter::IsSupported(sampleRate, native_sample_rate);
+}
+
+bool CFlexASIO::ProbeSampleRate(double sampleRate) throw()
+{
+	std::lock_guard<std::mutex> lock(probe_mutex);
+	Log() << "Probing sample rate " << sampleRate;
+
+	// With separate streams, each device only has to support the sample rate on its own.
+	const bool separate_streams = UseSeparateStreams();
+	for (int stream_index = 0; stream_index < (separate_streams ? 2 : 1); ++stream_index)
+	{
+		const bool use_input = input_device_info && (!separate_streams || stream_index == 0);
+		const bool use_output = output_device_info && (!separate_streams || stream_index == 1);
+		PaStream* temp_stream;
+		PaError error = OpenStream(&temp_stream, sampleRate, paFramesPerBufferUnspecified, use_input, use_output, &CFlexASIO::StaticStreamCallback);
+		if (error != paNoError)
+		{
+			Log() << "Sample rate " << sampleRate << " is not available: " << Pa_GetErrorText(error);
+			return false;
+		}
+		Pa_CloseStream(temp_stream);
+	}
+	for (std::vector<PaDeviceIndex>::const_iterator device = aggregate_devices.begin(); device != aggregate_devices.end(); ++device)
+	{
+		PaStream* temp_stream;
+		PaError error = OpenAggregateMemberStream(&temp_stream, *device, sampleRate, &CFlexASIO::StaticStreamCallback, this);
+		if (error != paNoError)
+		{
+			Log() << "Sample rate " << sampleRate << " is not available on aggregate device " << Pa_GetDeviceInfo(*device)->name << ": " << Pa_GetErrorText(error);
+			return false;
+		}
+		Pa_CloseStream(temp_stream);
+	}
+	return true;
+}
+
 ASIOError CFlexASIO::getSampleRate(ASIOSampleRate* sampleRate) throw()
 {
 	Log() << "CFlexASIO::getSampleRate()";
@@ -432,7 +1013,7 @@ ASIOError CFlexASIO::createBuffers(ASIOBufferInfo* bufferInfos, long numChannels
 		Log() << "Invalid invocation";
 		return ASE_InvalidMode;
 	}
-	if (!input_device_info && !output_device_info)
+	if (!IsInitialized())
 	{
 		Log() << "createBuffers() called in unitialized state";
 		return ASE_InvalidMode;
@@ -442,16 +1023,20 @@ ASIOError CFlexASIO::createBuffers(ASIOBufferInfo* bufferInfos, long numChannels
 		Log() << "createBuffers() called twice";
 		return ASE_InvalidMode;
 	}
+	if (!virtual_device && !engine_device && !EnsureDevices())
+		return ASE_HWMalfunction;
 
 	buffers_info.reserve(numChannels);
-	std::unique_ptr<Buffers> temp_buffers(new Buffers(2, numChannels, bufferSize));
-	Log() << "Buffers instantiated, memory range : " << temp_buffers->buffers << "-" << temp_buffers->buffers + temp_buffers->getSize();
+	const SampleConverter temp_sample_converter = GetSampleConverter(sample_format);
+	std::unique_ptr<Buffers> temp_buffers(new Buffers(2, numChannels, bufferSize, temp_sample_converter.sample_size, config.large_pages));
+	Log() << "Buffers instantiated, memory range : " << static_cast<void*>(temp_buffers->buffers) << "-" << static_cast<void*>(temp_buffers->buffers + temp_buffers->getSize())
+	      << (temp_buffers->arena.IsLocked() ? ", locked" : ", not locked") << (temp_buffers->arena.UsesLargePages() ? ", large pages" : "");
 	for (long channel_index = 0; channel_index < numChannels; ++channel_index)
 	{
 		ASIOBufferInfo& buffer_info = bufferInfos[channel_index];
 		if (buffer_info.isInput)
 		{
-			if (buffer_info.channelNum < 0 || buffer_info.channelNum >= input_channel_count)
+			if (buffer_info.channelNum < 0 || buffer_info.channelNum >= GetASIOInputChannelCount())
 			{
 				Log() << "out of bounds input channel";
 				return ASE_InvalidMode;
@@ -459,92 +1044,435 @@ ASIOError CFlexASIO::createBuffers(ASIOBufferInfo* bufferInfos, long numChannels
 		}
 		else
 		{
-			if (buffer_info.channelNum < 0 || buffer_info.channelNum >= output_channel_count)
+			if (buffer_info.channelNum < 0 || buffer_info.channelNum >= GetASIOOutputChannelCount())
 			{
 				Log() << "out of bounds output channel";
 				return ASE_InvalidMode;
 			}
 		}
 
-		Sample* first_half = temp_buffers->getBuffer(0, channel_index);
-		Sample* second_half = temp_buffers->getBuffer(1, channel_index);
+		char* first_half = temp_buffers->getBuffer(0, channel_index);
+		char* second_half = temp_buffers->getBuffer(1, channel_index);
 		buffer_info.buffers[0] = static_cast<void*>(first_half);
 		buffer_info.buffers[1] = static_cast<void*>(second_half);
 		Log() << "ASIO buffer #" << channel_index << " is " << (buffer_info.isInput ? "input" : "output") << " channel " << buffer_info.channelNum
-		      << " - first half: " << first_half << "-" << first_half + bufferSize << " - second half: " << second_half << "-" << second_half + bufferSize;
+		      << " - first half: " << static_cast<void*>(first_half) << "-" << static_cast<void*>(first_half + bufferSize * temp_buffers->sample_size)
+		      << " - second half: " << static_cast<void*>(second_half) << "-" << static_cast<void*>(second_half + bufferSize * temp_buffers->sample_size);
 		buffers_info.push_back(buffer_info);
 	}
 
 	
-	Log() << "Opening PortAudio stream";
+	// From now on the host is not going to ask about other sample rates, and background probing would only get in the way.
+	sample_rate_prober.reset();
+
 	if (sample_rate == 0)
 	{
 		sample_rate = 44100;
 		Log() << "The sample rate was never specified, using " << sample_rate << " as fallback";
 	}
-	PaStream* temp_stream;
-	PaError error = OpenStream(&temp_stream, sample_rate, temp_buffers->buffer_size);
-	if (error != paNoError)
+	device_sample_rate = sample_rate;
+	if (sample_rate != native_sample_rate && CanConvertSampleRate(sample_rate) && !IsSampleRateSupportedByDevices(sample_rate))
 	{
-		init_error = std::string("Unable to open PortAudio stream: ") + Pa_GetErrorText(error);
-		Log() << init_error;
-		return ASE_HWMalfunction;
+		device_sample_rate = native_sample_rate;
+		Log() << "The devices don't support " << sample_rate << " Hz, running them at " << device_sample_rate << " Hz instead and converting";
 	}
-
-	buffers = std::move(temp_buffers);
-	stream = temp_stream;
-	this->callbacks = *callbacks;
-	return ASE_OK;
-}
-
-ASIOError CFlexASIO::disposeBuffers() throw()
-{
-	Log() << "CFlexASIO::disposeBuffers()";
-	if (!buffers)
+	const bool separate_streams = UseSeparateStreams();
+	PaStream* temp_stream = NULL;
+	PaStream* temp_input_stream = NULL;
+	std::vector<std::unique_ptr<AggregateMember>> temp_aggregate_members;
+	if (virtual_device)
 	{
-		Log() << "disposeBuffers() called before createBuffers()";
-		return ASE_InvalidMode;
+		if (!virtual_device->OpenStream(&CFlexASIO::StaticStreamCallback, this, device_sample_rate, bufferSize, config.virtual_speed, config.virtual_output_file, output_channel_count))
+		{
+			init_error = "Unable to open the virtual device stream";
+			Log(LOG_LEVEL_ERROR) << init_error;
+			return ASE_HWMalfunction;
+		}
 	}
-	if (started)
+	else if (engine_device)
 	{
-		Log() << "disposeBuffers() called before stop()";
-		return ASE_InvalidMode;
+		if (!engine_device->OpenStream(&CFlexASIO::StaticStreamCallback, this))
+		{
+			init_error = "Unable to get a slot on the FlexASIO engine";
+			Log(LOG_LEVEL_ERROR) << init_error;
+			return ASE_HWMalfunction;
+		}
 	}
-
-	Log() << "Closing PortAudio stream";
-	PaError error = Pa_CloseStream(stream);
-	if (error != paNoError)
+	else
 	{
-		init_error = std::string("Unable to close PortAudio stream: ") + Pa_GetErrorText(error);
-		Log() << init_error;
-		return ASE_NotPresent;
+		const ASIOError error = OpenStreams(&temp_stream, &temp_input_stream, &temp_aggregate_members);
+		if (error != ASE_OK)
+			return error;
 	}
-	stream = NULL;
 
-	buffers.reset();
-	buffers_info.clear();
-	return ASE_OK;
-}
+	double cached_latency_correction;
+	latency_correction_known = capability_cache && capability_cache->GetLatencyCorrection(capability_key, sample_rate, &cached_latency_correction);
+	latency_correction.store(latency_correction_known ? cached_latency_correction : 0);
+	if (latency_correction_known)
+		Log() << "Using calibrated round-trip latency correction of " << cached_latency_correction * 1000 << " ms";
 
-ASIOError CFlexASIO::getLatencies(long* inputLatency, long* outputLatency)
-{
-	Log() << "CFlexASIO::getLatencies()";
-	if (!stream)
+	if (separate_streams)
 	{
-		Log() << "getLatencies() called before createBuffers()";
-		return ASE_NotPresent;
+		// Half a second of input is plenty to absorb the callback sizes of both devices.
+		drift_compensator.reset(new DriftCompensator(input_channel_count, device_sample_rate, static_cast<size_t>(device_sample_rate / 2)));
+		drift_input_buffer.assign(drift_chunk_frames * input_channel_count, 0);
+		drift_input_channels.resize(input_channel_count);
+		for (long channel = 0; channel < input_channel_count; ++channel)
+			drift_input_channels[channel] = drift_input_buffer.data() + channel * drift_chunk_frames;
+		drift_output_channels.resize(output_channel_count);
 	}
 
-	const PaStreamInfo* stream_info = Pa_GetStreamInfo(stream);
-	if (!stream_info)
+	if (config.host_thread_buffers > 0 && !host_thread)
+		host_thread.reset(new HostThread([this] { RunHostThread(); }));
+	host_thread_lookahead = host_thread ? ((std::min)((std::max)(config.host_thread_buffers, 2UL), 8UL) - 1) * bufferSize : 0;
+	if (host_thread)
+		Log() << "Running the host on its own thread, " << host_thread_lookahead << " frames ahead of the device";
+
+	// Both FIFOs hold at most two ASIO buffers at any given time (see StreamCallback()); the rest is headroom.
+	// With the host thread, they also hold the lookahead, one device period, whose size we don't know yet, and however far behind the host falls: they get at least 100 ms.
+	const long device_input_channel_count = GetTotalInputChannelCount();
+	const long device_output_channel_count = GetTotalOutputChannelCount();
+	const size_t fifo_capacity = host_thread ? (std::max)(4 * (bufferSize + host_thread_lookahead), static_cast<size_t>(sample_rate / 10)) : 4 * bufferSize;
+	input_fifo.reset(device_input_channel_count > 0 ? new SampleRing(device_input_channel_count, fifo_capacity) : nullptr);
+	output_fifo.reset(device_output_channel_count > 0 ? new SampleRing(device_output_channel_count, fifo_capacity) : nullptr);
+	fifo_output_latency.store(output_fifo ? host_thread_lookahead : 0);
+
+	// Member channels come after those of the main devices, followed by the loopback channels. Their input is pulled into aggregate_buffer, and their output is rendered there before being pushed out.
+	const long appended_input_channel_count = aggregate_input_channel_count + loopback_input_channel_count;
+	const long appended_output_channel_count = aggregate_output_channel_count + loopback_output_channel_count;
+	aggregate_buffer.assign((appended_input_channel_count + appended_output_channel_count) * drift_chunk_frames, 0);
+	aggregate_input_channels.assign(device_input_channel_count, nullptr);
+	aggregate_output_channels.assign(device_output_channel_count, nullptr);
+	aggregate_member_input_channels.clear();
+	for (long channel = 0; channel < appended_input_channel_count; ++channel)
 	{
-		Log() << "Unable to get stream info";
-		return ASE_NotPresent;
+		aggregate_member_input_channels.push_back(aggregate_buffer.data() + channel * drift_chunk_frames);
+		aggregate_input_channels[input_channel_count + channel] = aggregate_member_input_channels.back();
+	}
+	for (long channel = 0; channel < appended_output_channel_count; ++channel)
+		aggregate_output_channels[output_channel_count + channel] = aggregate_buffer.data() + (appended_input_channel_count + channel) * drift_chunk_frames;
+	if ((loopback_input_channel_count > 0 || loopback_output_channel_count > 0) && !loopback)
+	{
+		loopback.reset(new Loopback(config.loopback_name, loopback_input_channel_count, loopback_output_channel_count));
+		if (!loopback->GetSharedMemoryName().empty())
+			Log() << "Loopback channels are shared in section " << loopback->GetSharedMemoryName();
+	}
+	if (loopback)
+		loopback->SetSampleRate(device_sample_rate);
+
+	input_converter.reset();
+	output_converter.reset();
+	converter_input_channels.clear();
+	converter_output_channels.clear();
+	if (device_sample_rate != sample_rate)
+	{
+		// ProcessDeviceFrames() converts at most drift_chunk_frames device frames at a time. This is how many ASIO frames that can be, with some slack for rounding.
+		const size_t converter_chunk_frames = static_cast<size_t>(std::ceil(drift_chunk_frames * sample_rate / device_sample_rate)) + 2;
+		converter_buffer.assign((device_input_channel_count + device_output_channel_count) * converter_chunk_frames, 0);
+		for (long channel = 0; channel < device_input_channel_count; ++channel)
+			converter_input_channels.push_back(converter_buffer.data() + channel * converter_chunk_frames);
+		for (long channel = 0; channel < device_output_channel_count; ++channel)
+			converter_output_channels.push_back(converter_buffer.data() + (device_input_channel_count + channel) * converter_chunk_frames);
+		if (device_input_channel_count > 0)
+		{
+			input_converter.reset(new SampleRateConverter(device_input_channel_count, device_sample_rate, sample_rate, resampler_quality, drift_chunk_frames));
+			Log() << "Input sample rate converter: " << input_converter->GetTapCount() << " taps per phase, " << input_converter->GetDelay() * 1000 << " ms delay";
+		}
+		if (device_output_channel_count > 0)
+		{
+			output_converter.reset(new SampleRateConverter(device_output_channel_count, sample_rate, device_sample_rate, resampler_quality, converter_chunk_frames));
+			Log() << "Output sample rate converter: " << output_converter->GetTapCount() << " taps per phase, " << output_converter->GetDelay() * 1000 << " ms delay";
+		}
 	}
 
-	// TODO: should we add the buffer size?
-	*inputLatency = (long)(stream_info->inputLatency * sample_rate);
-	*outputLatency = (long)(stream_info->outputLatency * sample_rate);
+	// ASIO channels that go through a mixer live in mix_buffer, which starts out silent. Channels the host doesn't use are never written to, so they stay that way.
+	const size_t mix_input_channel_count = input_mixer && input_fifo ? input_mixer->GetDestinationCount() : 0;
+	const size_t mix_output_channel_count = output_mixer && output_fifo ? output_mixer->GetSourceCount() : 0;
+	mix_buffer.assign((mix_input_channel_count + mix_output_channel_count) * bufferSize, 0);
+	std::unique_ptr<RoutingPlan> temp_routing_plan(new RoutingPlan);
+	for (size_t channel = 0; channel < mix_input_channel_count; ++channel)
+		temp_routing_plan->input_mix_channels.push_back(mix_buffer.data() + channel * bufferSize);
+	for (size_t channel = 0; channel < mix_output_channel_count; ++channel)
+		temp_routing_plan->output_mix_channels.push_back(mix_buffer.data() + (mix_input_channel_count + channel) * bufferSize);
+	if (mix_input_channel_count > 0)
+		for (long channel = 0; channel < device_input_channel_count; ++channel)
+			temp_routing_plan->input_fifo_channels.push_back(input_fifo->GetChannel(channel));
+	if (mix_output_channel_count > 0)
+		for (long channel = 0; channel < device_output_channel_count; ++channel)
+			temp_routing_plan->output_fifo_channels.push_back(output_fifo->GetChannel(channel));
+
+	std::vector<bool> mapped_output_channels(device_output_channel_count, false);
+	for (std::vector<ASIOBufferInfo>::const_iterator buffers_info_it = buffers_info.begin(); buffers_info_it != buffers_info.end(); ++buffers_info_it)
+	{
+		SampleRing* fifo = buffers_info_it->isInput ? input_fifo.get() : output_fifo.get();
+		if (!fifo)
+			continue;
+		RoutingPlan::Route route;
+		route.asio_buffers[0] = static_cast<char*>(buffers_info_it->buffers[0]);
+		route.asio_buffers[1] = static_cast<char*>(buffers_info_it->buffers[1]);
+		if (buffers_info_it->isInput)
+		{
+			route.channel = mix_input_channel_count > 0 ? temp_routing_plan->input_mix_channels[buffers_info_it->channelNum] : fifo->GetChannel(buffers_info_it->channelNum);
+			temp_routing_plan->input_routes.push_back(route);
+		}
+		else
+		{
+			route.channel = mix_output_channel_count > 0 ? temp_routing_plan->output_mix_channels[buffers_info_it->channelNum] : fifo->GetChannel(buffers_info_it->channelNum);
+			temp_routing_plan->output_routes.push_back(route);
+			if (mix_output_channel_count == 0)
+				mapped_output_channels[buffers_info_it->channelNum] = true;
+		}
+	}
+	if (output_fifo && mix_output_channel_count == 0)
+		for (long output_channel_index = 0; output_channel_index < device_output_channel_count; ++output_channel_index)
+			if (!mapped_output_channels[output_channel_index])
+				temp_routing_plan->unmapped_output_channels.push_back(output_fifo->GetChannel(output_channel_index));
+	Log() << "Routing plan: " << temp_routing_plan->input_routes.size() << " input channels, " << temp_routing_plan->output_routes.size() << " output channels, " << temp_routing_plan->unmapped_output_channels.size() << " unused output channels";
+	routing_plan = std::move(temp_routing_plan);
+
+	buffers = std::move(temp_buffers);
+	sample_converter = temp_sample_converter;
+	stream = temp_stream;
+	input_stream = temp_input_stream;
+	aggregate_members = std::move(temp_aggregate_members);
+	this->callbacks = *callbacks;
+	PublishStreamLatencies();
+	return ASE_OK;
+}
+
+ASIOError CFlexASIO::OpenStreams(PaStream** temp_stream, PaStream** temp_input_stream, std::vector<std::unique_ptr<AggregateMember>>* temp_aggregate_members) throw()
+{
+	const std::chrono::steady_clock::time_point open_start = std::chrono::steady_clock::now();
+	StreamPool::Streams pooled_streams;
+	if (stream_pool.Take(device_sample_rate, &pooled_streams))
+	{
+		*temp_stream = pooled_streams.stream;
+		*temp_input_stream = pooled_streams.input_stream;
+		*temp_aggregate_members = std::move(pooled_streams.aggregate_members);
+		Log() << "Reusing the PortAudio streams of the previous buffers";
+		return ASE_OK;
+	}
+
+	// The stream callback re-frames whatever PortAudio gives us into ASIO-sized blocks, so we let PortAudio pick the buffer size that suits the backend best.
+	// This avoids an additional adaptation layer inside PortAudio.
+	Log() << "Opening PortAudio stream";
+	const bool separate_streams = UseSeparateStreams();
+	if (separate_streams)
+	{
+		Log() << "Drift compensation is enabled, opening a separate input stream";
+		PaError error = OpenStream(temp_input_stream, device_sample_rate, paFramesPerBufferUnspecified, true, false, &CFlexASIO::StaticInputStreamCallback);
+		if (error != paNoError)
+		{
+			init_error = std::string("Unable to open PortAudio input stream: ") + Pa_GetErrorText(error);
+			Log(LOG_LEVEL_ERROR) << init_error;
+			return ASE_HWMalfunction;
+		}
+	}
+	PaError error = separate_streams ?
+		OpenStream(temp_stream, device_sample_rate, paFramesPerBufferUnspecified, false, true, &CFlexASIO::StaticOutputStreamCallback) :
+		OpenStream(temp_stream, device_sample_rate, paFramesPerBufferUnspecified, input_device_info != NULL, output_device_info != NULL, &CFlexASIO::StaticStreamCallback);
+	if (error != paNoError)
+	{
+		if (*temp_input_stream)
+			Pa_CloseStream(*temp_input_stream);
+		// This is where cached sample rates get validated: if the cache was wrong, make sure we don't make the same mistake next time.
+		if (error == paInvalidSampleRate && capability_cache)
+			capability_cache->SetSampleRate(capability_key, device_sample_rate, false);
+		init_error = std::string("Unable to open PortAudio stream: ") + Pa_GetErrorText(error);
+		Log(LOG_LEVEL_ERROR) << init_error;
+		return ASE_HWMalfunction;
+	}
+	for (std::vector<PaDeviceIndex>::const_iterator device = aggregate_devices.begin(); device != aggregate_devices.end(); ++device)
+	{
+		const PaDeviceInfo* device_info = Pa_GetDeviceInfo(*device);
+		std::unique_ptr<AggregateMember> member(new AggregateMember(device_info->name, device_info->maxInputChannels, device_info->maxOutputChannels, device_sample_rate));
+		Log() << "Opening PortAudio stream for aggregate device " << member->GetName();
+		error = member->OpenStream(*device, device_sample_rate);
+		if (error != paNoError)
+		{
+			// Members opened so far are closed along with temp_aggregate_members.
+			Pa_CloseStream(*temp_stream);
+			if (*temp_input_stream)
+				Pa_CloseStream(*temp_input_stream);
+			if (error == paInvalidSampleRate && capability_cache)
+				capability_cache->SetSampleRate(capability_key, device_sample_rate, false);
+			init_error = std::string("Unable to open PortAudio stream for aggregate device ") + member->GetName() + ": " + Pa_GetErrorText(error);
+			Log(LOG_LEVEL_ERROR) << init_error;
+			return ASE_HWMalfunction;
+		}
+		temp_aggregate_members->push_back(std::move(member));
+	}
+	if (capability_cache)
+		capability_cache->SetSampleRate(capability_key, device_sample_rate, true);
+	Log() << "Opened PortAudio streams in " << GetMilliseconds(open_start) << " ms";
+	return ASE_OK;
+}
+
+ASIOError CFlexASIO::disposeBuffers() throw()
+{
+	Log() << "CFlexASIO::disposeBuffers()";
+	if (!buffers)
+	{
+		Log() << "disposeBuffers() called before createBuffers()";
+		return ASE_InvalidMode;
+	}
+	if (started)
+	{
+		Log() << "disposeBuffers() called before stop()";
+		return ASE_InvalidMode;
+	}
+
+	// The channels and sample rate of the next buffers might be different.
+	recorder.Stop();
+
+	if (virtual_device)
+	{
+		Log() << "Closing virtual device stream";
+		virtual_device->CloseStream();
+	}
+	else if (engine_device)
+		engine_device->CloseStream();
+	else
+	{
+		const ASIOError error = CloseStreams();
+		if (error != ASE_OK)
+			return error;
+	}
+
+	aggregate_members.clear();
+	aggregate_buffer.clear();
+	aggregate_input_channels.clear();
+	aggregate_output_channels.clear();
+	aggregate_member_input_channels.clear();
+
+	input_converter.reset();
+	output_converter.reset();
+	converter_buffer.clear();
+	converter_input_channels.clear();
+	converter_output_channels.clear();
+
+	drift_compensator.reset();
+	input_fifo.reset();
+	output_fifo.reset();
+	routing_plan.reset();
+	mix_buffer.clear();
+	buffers.reset();
+	buffers_info.clear();
+	PublishStreamLatencies();
+	return ASE_OK;
+}
+
+ASIOError CFlexASIO::CloseStreams() throw()
+{
+	if (stream_lost)
+	{
+		Log() << "The streams were lost, there is nothing to close";
+		stream_lost = false;
+		return ASE_OK;
+	}
+
+	// The streams are stopped, so they can be kept around for the next buffers; the pool closes them eventually.
+	StreamPool::Streams streams;
+	streams.stream = stream;
+	streams.input_stream = input_stream;
+	streams.aggregate_members = std::move(aggregate_members);
+	stream_pool.Park(device_sample_rate, &streams);
+	stream = NULL;
+	input_stream = NULL;
+	return ASE_OK;
+}
+
+bool CFlexASIO::GetStreamLatencies(double* input_latency, double* output_latency) throw()
+{
+	if (virtual_device)
+	{
+		// The virtual device hands buffers to and from the files immediately.
+		*input_latency = input_converter ? input_converter->GetDelay() * sample_rate : 0;
+		*output_latency = output_converter ? output_converter->GetDelay() * sample_rate : 0;
+		return true;
+	}
+	if (engine_device)
+	{
+		// The engine latencies are in device frames, like those of PortAudio.
+		*input_latency = engine_device->GetInputLatency() * sample_rate / device_sample_rate + (input_converter ? input_converter->GetDelay() * sample_rate : 0);
+		*output_latency = engine_device->GetOutputLatency() * sample_rate / device_sample_rate + (output_converter ? output_converter->GetDelay() * sample_rate : 0);
+		return true;
+	}
+
+	const PaStreamInfo* stream_info = Pa_GetStreamInfo(stream);
+	if (!stream_info)
+	{
+		Log() << "Unable to get stream info";
+		return false;
+	}
+	*input_latency = stream_info->inputLatency * sample_rate;
+	*output_latency = stream_info->outputLatency * sample_rate;
+	if (input_stream)
+	{
+		const PaStreamInfo* input_stream_info = Pa_GetStreamInfo(input_stream);
+		if (!input_stream_info)
+		{
+			Log() << "Unable to get input stream info";
+			return false;
+		}
+		*input_latency = input_stream_info->inputLatency * sample_rate + drift_compensator->GetLatency() * sample_rate / device_sample_rate;
+	}
+	// All channels share the same ASIO latency, so the slowest device sets it for everyone.
+	for (std::vector<std::unique_ptr<AggregateMember>>::const_iterator member = aggregate_members.begin(); member != aggregate_members.end(); ++member)
+	{
+		const PaStreamInfo* member_stream_info = Pa_GetStreamInfo((*member)->GetStream());
+		if (!member_stream_info)
+		{
+			Log() << "Unable to get stream info for aggregate device " << (*member)->GetName();
+			return false;
+		}
+		if ((*member)->GetInputChannelCount() > 0)
+			*input_latency = (std::max)(*input_latency, member_stream_info->inputLatency * sample_rate + (*member)->GetInputLatency() * sample_rate / device_sample_rate);
+		if ((*member)->GetOutputChannelCount() > 0)
+			*output_latency = (std::max)(*output_latency, member_stream_info->outputLatency * sample_rate + (*member)->GetOutputLatency() * sample_rate / device_sample_rate);
+	}
+	if (input_converter)
+		*input_latency += input_converter->GetDelay() * sample_rate;
+	if (output_converter)
+		*output_latency += output_converter->GetDelay() * sample_rate;
+	return true;
+}
+
+void CFlexASIO::PublishStreamLatencies() throw()
+{
+	StreamLatencies stream_latencies = {};
+	if (buffers)
+	{
+		stream_latencies.buffer_size = static_cast<long>(buffers->buffer_size);
+		stream_latencies.known = GetStreamLatencies(&stream_latencies.input, &stream_latencies.output);
+	}
+	published_stream_latencies.Store(stream_latencies);
+}
+
+ASIOError CFlexASIO::getLatencies(long* inputLatency, long* outputLatency) throw()
+{
+	Log() << "CFlexASIO::getLatencies()";
+	// No stream_mutex here: this can be called from within kAsioLatenciesChanged, on the audio thread, while stop() holds it waiting for that very thread.
+	const StreamLatencies stream_latencies = published_stream_latencies.Load();
+	if (stream_latencies.buffer_size == 0)
+	{
+		Log() << "getLatencies() called before createBuffers()";
+		return ASE_NotPresent;
+	}
+	if (!stream_latencies.known)
+		return ASE_NotPresent;
+
+	double stream_input_latency = stream_latencies.input;
+	double stream_output_latency = stream_latencies.output;
+	// The engine can change its latencies at any time. They live in shared memory, so reading them doesn't need stream_mutex either.
+	if (engine_device && !GetStreamLatencies(&stream_input_latency, &stream_output_latency))
+		return ASE_NotPresent;
+
+	// Both directions include one ASIO buffer: an input block is only handed to the host once its last frame comes in, and an output block only starts playing once the host is done with it.
+	// On top of that the FIFOs only add latency on the output side, including the host thread lookahead (if any), and calibration (if any) corrects whatever PortAudio got wrong about the round trip.
+	const long buffer_size = stream_latencies.buffer_size;
+	*inputLatency = (std::max)(0L, (long)(stream_input_latency + latency_correction.load() * sample_rate)) + buffer_size;
+	*outputLatency = (long)(stream_output_latency + fifo_output_latency.load()) + buffer_size;
 	Log() << "Returning input latency of " << *inputLatency << " samples and output latency of " << *outputLatency << " samples";
 	return ASE_OK;
 }
@@ -552,6 +1480,7 @@ ASIOError CFlexASIO::getLatencies(long* inputLatency, long* outputLatency)
 ASIOError CFlexASIO::start() throw()
 {
 	Log() << "CFlexASIO::start()";
+	std::lock_guard<std::mutex> lock(stream_mutex);
 	if (!buffers)
 	{
 		Log() << "start() called before createBuffers()";
@@ -568,28 +1497,307 @@ ASIOError CFlexASIO::start() throw()
 		callbacks.asioMessage(kAsioSupportsTimeInfo, 0, NULL, NULL) == 1;
 	if (host_supports_timeinfo)
 		Log() << "The host supports time info";
+	host_supports_latencies_changed = callbacks.asioMessage &&
+		callbacks.asioMessage(kAsioSelectorSupported, kAsioLatenciesChanged, NULL, NULL) == 1;
+	if (host_supports_latencies_changed)
+		Log() << "The host supports latency change notifications";
+	host_supports_overload = callbacks.asioMessage &&
+		callbacks.asioMessage(kAsioSelectorSupported, kAsioOverload, NULL, NULL) == 1;
+	if (host_supports_overload)
+		Log() << "The host supports overload notifications";
+	host_supports_resync = callbacks.asioMessage &&
+		callbacks.asioMessage(kAsioSelectorSupported, kAsioResyncRequest, NULL, NULL) == 1;
+	host_supports_reset = callbacks.asioMessage &&
+		callbacks.asioMessage(kAsioSelectorSupported, kAsioResetRequest, NULL, NULL) == 1;
+
+	if (stream_lost)
+	{
+		Log() << "The streams were lost after a stall, reopening them";
+		const ASIOError error = ReopenStreams();
+		if (error != ASE_OK)
+			return error;
+	}
 
 	Log() << "Starting stream";
-	our_buffer_index = 0;
-	position.samples = 0;
-	position_timestamp.timestamp = ((long long int) timeGetTime()) * 1000000;
+	statistics.Reset();
+	max_callback_frames = 0;
+	position = 0;
+	ResetStreamState();
+	if (config.calibrate_latency && !latency_correction_known)
+	{
+		if (config.calibration_output_channel < 0 || config.calibration_output_channel >= GetTotalOutputChannelCount() ||
+			config.calibration_input_channel < 0 || config.calibration_input_channel >= GetTotalInputChannelCount())
+			Log(LOG_LEVEL_WARNING) << "Cannot calibrate latency: invalid calibration channels";
+		else
+		{
+			Log() << "Calibrating round-trip latency from output channel " << config.calibration_output_channel << " to input channel " << config.calibration_input_channel << "; output from the host is muted in the meantime";
+			latency_calibration.reset(new LatencyCalibration(config.calibration_output_channel, config.calibration_input_channel, sample_rate));
+		}
+	}
+
+	if (host_thread && !host_thread->Start())
+	{
+		latency_calibration.reset();
+		return ASE_HWMalfunction;
+	}
 	started = true;
-	PaError error = Pa_StartStream(stream);
-	if (error != paNoError)
+	const ASIOError error = StartStreams();
+	if (error != ASE_OK)
 	{
 		started = false;
+		if (host_thread)
+			host_thread->Stop();
+		latency_calibration.reset();
+		return error;
+	}
+
+	if (latency_calibration)
+		StartLatencyCalibrationThread();
+	if (config.stall_timeout > 0)
+		stall_watchdog.Arm(GetStallTimeout());
+
+	Log() << "Started successfully";
+	return ASE_OK;
+}
+
+void CFlexASIO::ResetStreamState() throw()
+{
+	our_buffer_index = 0;
+	if (input_fifo)
+		input_fifo->Reset();
+	if (output_fifo)
+		output_fifo->Reset();
+	if (input_converter)
+		input_converter->Reset();
+	if (output_converter)
+		output_converter->Reset();
+	previous_callback_frames = 0;
+	consecutive_host_overloads = 0;
+	// Virtual time is whatever the virtual device says it is, so there is nothing to sample. Engine time is the steady clock, which runs at the same rate as timeGetTime().
+	const double stream_time = virtual_device ? virtual_device->GetStreamTime() : engine_device ? engine_device->GetStreamTime() : Pa_GetStreamTime(stream);
+	system_time_offset = virtual_device || engine_device ? timeGetTime() / 1000.0 - stream_time : GetSystemTimeOffset(stream);
+	stream_clock.Reset(sample_rate);
+	stream_frame_position = 0;
+	block_stream_frame = 0;
+	position_timestamp = static_cast<long long>((stream_time + system_time_offset) * 1e9);
+	const SamplePosition initial_position = { position, position_timestamp };
+	published_position.Store(initial_position);
+	if (host_thread)
+	{
+		// Until the first callback, the host thread can only go by the nominal sample rate.
+		const StreamClockPoint initial_clock_point = { 0, stream_time, 1 / sample_rate };
+		published_stream_clock.Store(initial_clock_point);
+		host_thread_period.store(0);
+		host_thread_primed = false;
+		host_thread_dropped_frames.store(0);
+		host_thread_slip.store(0);
+		host_thread_frame_position = 0;
+		host_thread_realignment = 0;
+		if (output_fifo)
+			output_fifo->Write(nullptr, 0, host_thread_lookahead);
+	}
+}
+
+ASIOError CFlexASIO::StartStreams() throw()
+{
+	stream_start_time = std::chrono::steady_clock::now();
+	if (input_stream)
+	{
+		// The input stream starts first so that the drift compensator can build up its buffer by the time the output stream asks for input.
+		drift_compensator->Reset();
+		PaError error = Pa_StartStream(input_stream);
+		if (error != paNoError)
+		{
+			init_error = std::string("Unable to start PortAudio input stream: ") + Pa_GetErrorText(error);
+			Log(LOG_LEVEL_ERROR) << init_error;
+			return ASE_HWMalfunction;
+		}
+	}
+	// Same for the aggregate members, which also need to have pulled some output before the main stream has anything to push.
+	for (size_t member_index = 0; member_index < aggregate_members.size(); ++member_index)
+	{
+		aggregate_members[member_index]->Reset();
+		PaError error = Pa_StartStream(aggregate_members[member_index]->GetStream());
+		if (error != paNoError)
+		{
+			for (size_t started_member_index = 0; started_member_index < member_index; ++started_member_index)
+				Pa_StopStream(aggregate_members[started_member_index]->GetStream());
+			if (input_stream)
+				Pa_StopStream(input_stream);
+			init_error = std::string("Unable to start PortAudio stream for aggregate device ") + aggregate_members[member_index]->GetName() + ": " + Pa_GetErrorText(error);
+			Log(LOG_LEVEL_ERROR) << init_error;
+			return ASE_HWMalfunction;
+		}
+	}
+	PaError error = virtual_device ? virtual_device->StartStream() : engine_device ? engine_device->StartStream() : Pa_StartStream(stream);
+	if (error != paNoError)
+	{
+		for (size_t member_index = 0; member_index < aggregate_members.size(); ++member_index)
+			Pa_StopStream(aggregate_members[member_index]->GetStream());
+		if (input_stream)
+			Pa_StopStream(input_stream);
 		init_error = std::string("Unable to start PortAudio stream: ") + Pa_GetErrorText(error);
-		Log() << init_error;
+		Log(LOG_LEVEL_ERROR) << init_error;
 		return ASE_HWMalfunction;
 	}
+	return ASE_OK;
+}
 
-	Log() << "Started successfully";
+ASIOError CFlexASIO::ReopenStreams() throw()
+{
+	if (!virtual_device && !engine_device)
+	{
+		PaStream* temp_stream = NULL;
+		PaStream* temp_input_stream = NULL;
+		std::vector<std::unique_ptr<AggregateMember>> temp_aggregate_members;
+		const ASIOError error = OpenStreams(&temp_stream, &temp_input_stream, &temp_aggregate_members);
+		if (error != ASE_OK)
+			return error;
+		stream = temp_stream;
+		input_stream = temp_input_stream;
+		aggregate_members = std::move(temp_aggregate_members);
+	}
+	stream_lost = false;
+	PublishStreamLatencies();
 	return ASE_OK;
 }
 
-ASIOError CFlexASIO::stop()
+void CFlexASIO::AbandonStreams() throw()
+{
+	if (stream_lost)
+		return;
+	stream_lost = true;
+	if (virtual_device)
+	{
+		virtual_device->StopStream();
+		return;
+	}
+	// The slot stays claimed, so that the stream can start again as soon as the engine is back.
+	if (engine_device)
+	{
+		engine_device->StopStream();
+		return;
+	}
+
+	// Pa_StopStream() would wait for buffers that might never play. Errors don't matter here, as the streams are going away anyway.
+	Pa_AbortStream(stream);
+	if (input_stream)
+		Pa_AbortStream(input_stream);
+	for (std::vector<std::unique_ptr<AggregateMember>>::const_iterator member = aggregate_members.begin(); member != aggregate_members.end(); ++member)
+		Pa_AbortStream((*member)->GetStream());
+	PaError error = Pa_CloseStream(stream);
+	if (error != paNoError)
+		Log(LOG_LEVEL_WARNING) << "Unable to close PortAudio stream: " << Pa_GetErrorText(error);
+	if (input_stream)
+	{
+		error = Pa_CloseStream(input_stream);
+		if (error != paNoError)
+			Log(LOG_LEVEL_WARNING) << "Unable to close PortAudio input stream: " << Pa_GetErrorText(error);
+	}
+	// The members close their own streams.
+	aggregate_members.clear();
+	stream = NULL;
+	input_stream = NULL;
+}
+
+std::chrono::milliseconds CFlexASIO::GetStallTimeout() const throw()
+{
+	const std::chrono::milliseconds buffer_period(static_cast<long long>(buffers->buffer_size * 1000 / sample_rate));
+	return (std::max)(std::chrono::milliseconds(config.stall_timeout), 8 * buffer_period);
+}
+
+void CFlexASIO::RecoverStreams(std::chrono::milliseconds stall_duration) throw()
+{
+	if (!stall_watchdog.HasStalled())
+		return;
+	// Stopped before taking stream_mutex, as the calibration thread takes it. Whatever was recorded across the stall is useless anyway; the calibration starts over below.
+	StopLatencyCalibrationThread();
+	long message = 0;
+	{
+		std::lock_guard<std::mutex> lock(stream_mutex);
+		// The host might have stopped or restarted the stream while the watchdog was getting here.
+		if (!started || !stall_watchdog.HasStalled())
+		{
+			// If the stream is still running, so is the test signal, and the calibration can carry on where it was.
+			if (started && latency_calibration && !latency_correction_known)
+				StartLatencyCalibrationThread();
+			return;
+		}
+
+		const std::chrono::steady_clock::time_point recovery_start = std::chrono::steady_clock::now();
+		const bool already_lost = stream_lost;
+		if (already_lost)
+			Log() << "Trying to reopen the streams lost after a stall";
+		else
+		{
+			Log(LOG_LEVEL_WARNING) << "No callback for " << stall_duration.count() << " ms, the stream seems to have stalled; restarting it";
+			statistics.RecordStall();
+			AbandonStreams();
+		}
+
+		// The buffers stay as they are, so that the pointers the host has remain valid. Only the sample position carries over.
+		ASIOError error = ReopenStreams();
+		if (error == ASE_OK)
+		{
+			// The host thread might still be catching up on the audio from before the stall, and ResetStreamState() pulls the FIFOs from under it.
+			if (host_thread)
+				host_thread->Stop();
+			ResetStreamState();
+			if (latency_calibration && !latency_correction_known)
+			{
+				Log() << "Restarting the latency calibration interrupted by the stall";
+				latency_calibration.reset(new LatencyCalibration(config.calibration_output_channel, config.calibration_input_channel, sample_rate));
+			}
+			if (host_thread)
+				host_thread->Start();
+			error = StartStreams();
+			if (error != ASE_OK)
+				AbandonStreams();
+			else if (latency_calibration && !latency_correction_known)
+				StartLatencyCalibrationThread();
+		}
+		if (error == ASE_OK)
+		{
+			const double recovery_time = GetMilliseconds(recovery_start);
+			statistics.RecordRecovery(recovery_time * 1000);
+			Log(LOG_LEVEL_WARNING) << "Stream restarted in " << recovery_time << " ms";
+			// The stream picks up where it left off, but the audio and timestamps around the stall are discontinuous.
+			if (host_supports_resync)
+				message = kAsioResyncRequest;
+		}
+		else
+		{
+			statistics.RecordFailedRecovery();
+			Log(LOG_LEVEL_ERROR) << "Unable to restart the stream after a stall, trying again in " << GetStallTimeout().count() << " ms";
+			// Asking once is enough. In the meantime, keep trying in case the device comes back.
+			if (!already_lost && host_supports_reset)
+				message = kAsioResetRequest;
+		}
+		stall_watchdog.Arm(GetStallTimeout());
+	}
+
+	// Not holding stream_mutex, as the host might call stop() right away.
+	if (message != 0)
+	{
+		Log() << "Sending " << (message == kAsioResyncRequest ? "resync" : "reset") << " request to the host";
+		callbacks.asioMessage(message, 0, NULL, NULL);
+	}
+}
+
+ASIOError CFlexASIO::stop() throw()
 {
 	Log() << "CFlexASIO::stop()";
+	// The calibration thread is stopped before taking stream_mutex, which it takes. RecoverStreams() might start it again in the meantime, and it can only do that while holding stream_mutex.
+	std::unique_lock<std::mutex> lock(stream_mutex, std::defer_lock);
+	for (;;)
+	{
+		StopLatencyCalibrationThread();
+		lock.lock();
+		std::lock_guard<std::mutex> calibration_lock(calibration_mutex);
+		if (!calibration_thread.joinable())
+			break;
+		lock.unlock();
+	}
 	if (!started)
 	{
 		Log() << "stop() called before start()";
@@ -597,60 +1805,569 @@ ASIOError CFlexASIO::stop()
 	}
 
 	Log() << "Stopping stream";
-	PaError error = Pa_StopStream(stream);
+	stall_watchdog.Disarm();
+	// If the streams were lost after a stall, they are already closed.
+	PaError error = stream_lost ? paNoError : virtual_device ? virtual_device->StopStream() : engine_device ? engine_device->StopStream() : Pa_StopStream(stream);
+	// Once the stream is stopped, nothing wakes up the host thread anymore, and the host mustn't be called after stop() returns.
+	if (host_thread)
+		host_thread->Stop();
 	if (error != paNoError)
 	{
 		init_error = std::string("Unable to stop PortAudio stream: ") + Pa_GetErrorText(error);
-		Log() << init_error;
+		Log(LOG_LEVEL_ERROR) << init_error;
 		return ASE_NotPresent;
 	}
+	if (input_stream)
+	{
+		error = Pa_StopStream(input_stream);
+		if (error != paNoError)
+		{
+			init_error = std::string("Unable to stop PortAudio input stream: ") + Pa_GetErrorText(error);
+			Log(LOG_LEVEL_ERROR) << init_error;
+			return ASE_NotPresent;
+		}
+		Log() << "Drift compensation: final ratio " << (drift_compensator->GetRatio() - 1) * 1e6 << " ppm, " << drift_compensator->GetUnderrunCount() << " underruns, " << drift_compensator->GetOverrunCount() << " overruns";
+	}
+	for (std::vector<std::unique_ptr<AggregateMember>>::const_iterator member = aggregate_members.begin(); member != aggregate_members.end(); ++member)
+	{
+		// The main stream is already stopped, so there is no point in failing here.
+		error = Pa_StopStream((*member)->GetStream());
+		if (error != paNoError)
+			Log(LOG_LEVEL_WARNING) << "Unable to stop PortAudio stream for aggregate device " << (*member)->GetName() << ": " << Pa_GetErrorText(error);
+		const AggregateMember::Status status = (*member)->GetStatus();
+		Log() << "Aggregate device " << (*member)->GetName() << ": input drift " << status.input_drift * 1e6 << " ppm (" << status.input_level << " frames buffered), output drift " << status.output_drift * 1e6 << " ppm (" << status.output_level << " frames buffered), "
+		      << status.underrun_count << " underruns, " << status.overrun_count << " overruns";
+	}
+
+	latency_calibration.reset();
 
 	started = false;
+	const StreamStatistics::Summary summary = statistics.GetSummary();
+	Log() << "Stream statistics: " << summary.callback_count << " callbacks, " << summary.deadline_miss_count << " deadline misses (" << summary.deadline_miss_percentage << "%), " << summary.host_overload_count << " host overloads; "
+	      << "input overflows/underflows: " << summary.input_overflow_count << "/" << summary.input_underflow_count << ", output overflows/underflows: " << summary.output_overflow_count << "/" << summary.output_underflow_count << "; "
+	      << "load: average " << summary.average_load * 100 << "%, max " << summary.max_load * 100 << "%";
+	Log() << "Stream timings (us, median/99th percentile/max): callback " << summary.callback_duration.median << "/" << summary.callback_duration.p99 << "/" << summary.callback_duration.max
+	      << ", jitter " << summary.callback_jitter.median << "/" << summary.callback_jitter.p99 << "/" << summary.callback_jitter.max
+	      << ", host " << summary.host_duration.median << "/" << summary.host_duration.p99 << "/" << summary.host_duration.max
+	      << ", copy " << summary.copy_duration.median << "/" << summary.copy_duration.p99 << "/" << summary.copy_duration.max;
+	if (summary.stall_count > 0)
+		Log(LOG_LEVEL_WARNING) << "The stream stalled " << summary.stall_count << " times; restarting it took " << summary.recovery_duration.median / 1000 << " ms (median), " << summary.recovery_duration.max / 1000 << " ms (max), and failed " << summary.failed_recovery_count << " times";
+	if (host_thread)
+		Log() << "Host thread: " << summary.late_buffer_count << " late buffers, with a lookahead of " << host_thread_lookahead << " frames";
+	if (loopback)
+	{
+		const Loopback::Status status = loopback->GetStatus();
+		Log() << "Loopback: input client " << (status.input_client_attached ? "attached" : "not attached") << " (" << status.input_level << " frames buffered, " << status.input_underrun_count << " underruns), "
+		      << "output client " << (status.output_client_attached ? "attached" : "not attached") << " (" << status.output_level << " frames buffered, " << status.output_overrun_count << " overruns)";
+	}
+	if (config.buffer_size_tuning)
+		UpdateBufferSizeTuning(summary);
 	Log() << "Stopped successfully";
 	return ASE_OK;
 }
 
-int CFlexASIO::StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags)
+int CFlexASIO::StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags) throw()
 {
-	Log() << "CFlexASIO::StreamCallback("<< frameCount << ")";
+	const std::chrono::steady_clock::time_point callback_start = std::chrono::steady_clock::now();
+	RealtimeLog(LOG_LEVEL_TRACE, "CFlexASIO::StreamCallback({})", frameCount);
 	if (!started)
 	{
-		Log() << "Ignoring callback as stream is not started";
+		RealtimeLog(LOG_LEVEL_TRACE, "Ignoring callback as stream is not started");
 		return paContinue;
 	}
-	if (frameCount != buffers->buffer_size)
+
+	LogStatusFlags(statusFlags);
+	UpdateStreamClock(timeInfo);
+	ProcessStreamFrames(static_cast<const Sample* const*>(input), static_cast<Sample* const*>(output), frameCount);
+	RecordCallback(callback_start, frameCount);
+
+	RealtimeLog(LOG_LEVEL_TRACE, "Returning from stream callback");
+	return paContinue;
+}
+
+void CFlexASIO::UpdateStreamClock(const PaStreamCallbackTimeInfo* timeInfo) throw()
+{
+	// Not all host APIs fill in the callback time, but when they don't, the stream time is on the same clock. The virtual device and the engine always do, the former starting from zero.
+	const PaTime time = timeInfo && (timeInfo->currentTime > 0 || virtual_device || engine_device) ? timeInfo->currentTime : Pa_GetStreamTime(stream);
+	stream_clock.Update(time, stream_frame_position);
+	if (host_thread)
 	{
-		Log() << "Expected " << buffers->buffer_size << " frames, got " << frameCount << " instead, aborting";
-		return paContinue;
+		const StreamClockPoint clock_point = { stream_frame_position, stream_clock.GetTime(stream_frame_position), stream_clock.GetPeriod() };
+		published_stream_clock.Store(clock_point);
 	}
+}
 
+void CFlexASIO::LogStatusFlags(PaStreamCallbackFlags statusFlags) throw()
+{
 	if (statusFlags & paInputOverflow)
-		Log() << "INPUT OVERFLOW detected (some input data was discarded)";
+	{
+		RealtimeLog(LOG_LEVEL_WARNING, "INPUT OVERFLOW detected (some input data was discarded)");
+		statistics.RecordInputOverflow();
+	}
 	if (statusFlags & paInputUnderflow)
-		Log() << "INPUT UNDERFLOW detected (gaps were inserted in the input)";
+	{
+		RealtimeLog(LOG_LEVEL_WARNING, "INPUT UNDERFLOW detected (gaps were inserted in the input)");
+		statistics.RecordInputUnderflow();
+	}
 	if (statusFlags & paOutputOverflow)
-		Log() << "OUTPUT OVERFLOW detected (some output data was discarded)";
+	{
+		RealtimeLog(LOG_LEVEL_WARNING, "OUTPUT OVERFLOW detected (some output data was discarded)");
+		statistics.RecordOutputOverflow();
+	}
 	if (statusFlags & paOutputUnderflow)
-		Log() << "OUTPUT UNDERFLOW detected (gaps were inserted in the output)";
+	{
+		RealtimeLog(LOG_LEVEL_WARNING, "OUTPUT UNDERFLOW detected (gaps were inserted in the output)");
+		statistics.RecordOutputUnderflow();
+	}
+}
+
+void CFlexASIO::RecordCallback(std::chrono::steady_clock::time_point callback_start, unsigned long frameCount) throw()
+{
+	const double duration = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - callback_start).count();
+	statistics.RecordCallback(duration, frameCount * 1e6 / device_sample_rate, callback_host_duration);
+	callback_host_duration = 0;
+	// The first callback tells how long the devices take to get going. After that, callbacks are ideally spaced by exactly the duration of the audio they process.
+	if (previous_callback_frames == 0)
+		RealtimeLog(LOG_LEVEL_INFO, "First callback came {} ms after start()", std::chrono::duration<double, std::milli>(callback_start - stream_start_time).count());
+	else
+	{
+		const double interval = std::chrono::duration<double, std::micro>(callback_start - previous_callback_start).count();
+		statistics.RecordJitter(std::abs(interval - previous_callback_frames * 1e6 / device_sample_rate));
+	}
+	previous_callback_start = callback_start;
+	previous_callback_frames = frameCount;
+	stall_watchdog.Feed();
+	max_callback_frames = (std::max)(max_callback_frames, frameCount);
+}
+
+void CFlexASIO::UpdateBufferSizeTuning(const StreamStatistics::Summary& summary)
+{
+	if (!capability_cache || max_callback_frames == 0)
+		return;
+
+	BufferSizeSession session;
+	session.buffer_size = static_cast<long>(buffers->buffer_size);
+	// The devices might not run at the ASIO sample rate, but buffer sizes are in ASIO frames.
+	session.device_period = static_cast<long>(std::ceil(max_callback_frames * sample_rate / device_sample_rate));
+	session.duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - stream_start_time).count();
+	session.glitch_count = summary.deadline_miss_count + summary.input_overflow_count + summary.input_underflow_count + summary.output_overflow_count + summary.output_underflow_count + summary.late_buffer_count;
+	session.jitter = summary.callback_jitter.p99 / (session.buffer_size * 1e6 / sample_rate);
+
+	BufferSizeTuning tuning;
+	capability_cache->GetBufferSizeTuning(capability_key, sample_rate, &tuning);
+	if (!RecordBufferSizeSession(&tuning, session))
+	{
+		Log() << "Session too short for buffer size tuning";
+		return;
+	}
+	capability_cache->SetBufferSizeTuning(capability_key, sample_rate, tuning);
+	Log() << "Buffer size tuning: session at " << session.buffer_size << " frames had " << session.glitch_count << " glitches, jitter " << session.jitter * 100 << "% of a buffer period; "
+	      << "device period " << tuning.device_period << " frames, smallest stable size " << tuning.smallest_stable_size << ", largest unstable size " << tuning.largest_unstable_size << ", next preferred size " << GetPreferredBufferSize(tuning, sample_rate);
+}
+
+void CFlexASIO::ProcessStreamFrames(const Sample* const* input_samples, Sample* const* output_samples, size_t frameCount) throw()
+{
+	if (aggregate_members.empty() && !loopback)
+	{
+		ProcessDeviceFrames(input_samples, output_samples, frameCount);
+		if (input_monitor && input_samples && output_samples && !latency_calibration)
+			input_monitor->Process(input_samples, output_samples, frameCount);
+		recorder.Tap(input_samples, output_samples, frameCount);
+		if (meters)
+		{
+			meters->Measure(input_samples, output_samples, frameCount);
+			meters->Publish();
+		}
+		return;
+	}
+
+	// The member channels are appended to those of the main devices: their input is pulled (resampled to our clock) before the host runs, and their output is pushed right after.
+	// The loopback channels come last, and are exchanged with the clients the same way, minus the resampling.
+	for (size_t frame_offset = 0; frame_offset < frameCount; )
+	{
+		const size_t chunk_frames = (std::min)(frameCount - frame_offset, drift_chunk_frames);
+		for (long input_channel_index = 0; input_channel_index < input_channel_count; ++input_channel_index)
+			aggregate_input_channels[input_channel_index] = input_samples[input_channel_index] + frame_offset;
+		for (long output_channel_index = 0; output_channel_index < output_channel_count; ++output_channel_index)
+			aggregate_output_channels[output_channel_index] = output_samples[output_channel_index] + frame_offset;
+
+		Sample* const* member_input_channels = aggregate_member_input_channels.data();
+		for (std::vector<std::unique_ptr<AggregateMember>>::const_iterator member = aggregate_members.begin(); member != aggregate_members.end(); ++member)
+		{
+			(*member)->PullInput(member_input_channels, 0, chunk_frames);
+			member_input_channels += (*member)->GetInputChannelCount();
+		}
+		if (loopback)
+			loopback->PullInput(member_input_channels, chunk_frames);
+		ProcessDeviceFrames(aggregate_input_channels.data(), aggregate_output_channels.data(), chunk_frames);
+		if (input_monitor && !latency_calibration)
+			input_monitor->Process(aggregate_input_channels.data(), aggregate_output_channels.data(), chunk_frames);
+		Sample* const* member_output_channels = aggregate_output_channels.data() + output_channel_count;
+		for (std::vector<std::unique_ptr<AggregateMember>>::const_iterator member = aggregate_members.begin(); member != aggregate_members.end(); ++member)
+		{
+			(*member)->PushOutput(member_output_channels, chunk_frames);
+			member_output_channels += (*member)->GetOutputChannelCount();
+		}
+		if (loopback)
+			loopback->PushOutput(member_output_channels, chunk_frames);
+		recorder.Tap(aggregate_input_channels.data(), aggregate_output_channels.data(), chunk_frames);
+		if (meters)
+			meters->Measure(aggregate_input_channels.data(), aggregate_output_channels.data(), chunk_frames);
+
+		frame_offset += chunk_frames;
+	}
+	if (meters)
+		meters->Publish();
+}
+
+void CFlexASIO::ProcessDeviceFrames(const Sample* const* input_samples, Sample* const* output_samples, size_t frameCount) throw()
+{
+	if (!input_converter && !output_converter)
+	{
+		ProcessFrames(input_samples, output_samples, frameCount);
+		stream_frame_position += frameCount;
+		return;
+	}
+
+	// Both converters are reset together and their frame counts follow the same L/M cycle, so the input converter produces exactly as many ASIO frames as the output converter needs (give or take a frame it keeps for next time).
+	for (size_t frame_offset = 0; frame_offset < frameCount; )
+	{
+		const size_t chunk_frames = (std::min)(frameCount - frame_offset, drift_chunk_frames);
+		size_t converted_frames;
+		if (input_converter)
+		{
+			input_converter->Write(input_samples, frame_offset, chunk_frames);
+			converted_frames = input_converter->GetReadAvailable();
+			input_converter->Read(converter_input_channels.data(), 0, converted_frames);
+		}
+		else
+			converted_frames = output_converter->GetInputFrames(chunk_frames);
+
+		ProcessFrames(converter_input_channels.data(), converter_output_channels.data(), converted_frames);
+
+		if (output_converter)
+		{
+			output_converter->Write(converter_output_channels.data(), 0, converted_frames);
+			if (output_converter->GetReadAvailable() < chunk_frames)
+				RealtimeLog(LOG_LEVEL_WARNING, "Output sample rate converter is short of {} frames", chunk_frames - output_converter->GetReadAvailable());
+			output_converter->Read(output_samples, frame_offset, chunk_frames);
+		}
+
+		stream_frame_position += converted_frames;
+		frame_offset += chunk_frames;
+	}
+}
+
+void CFlexASIO::ProcessFrames(const Sample* const* input_samples, Sample* const* output_samples, size_t frameCount) throw()
+{
+	if (host_thread)
+		ExchangeHostThreadFrames(input_samples, output_samples, frameCount);
+	else
+	{
+		// PortAudio can give us any number of frames, which the FIFOs cut into ASIO-sized blocks: a single callback can run the host zero, one or several times.
+		// The PortAudio buffer is processed in chunks of at most one ASIO buffer, which guarantees the FIFOs never overflow.
+		const size_t buffer_size = buffers->buffer_size;
+		for (size_t frame_offset = 0; frame_offset < frameCount; )
+		{
+			const size_t chunk_frames = (std::min)(frameCount - frame_offset, buffer_size);
+
+			if (input_fifo)
+			{
+				input_fifo->Write(input_samples, frame_offset, chunk_frames);
+				block_stream_frame = stream_frame_position + frame_offset + chunk_frames;
+				while (input_fifo->GetReadAvailable() >= buffer_size)
+					ProcessBlock();
+			}
+			else
+			{
+				block_stream_frame = stream_frame_position + frame_offset;
+				while (output_fifo->GetReadAvailable() < chunk_frames)
+					ProcessBlock();
+			}
+
+			// The output FIFO can run short while it fills up at the beginning of the stream, or if PortAudio starts using larger chunks than before.
+			// The silence ReadOutputFifo() inserts then effectively becomes additional output latency, which it accounts for.
+			if (output_fifo)
+				ReadOutputFifo(output_samples, frame_offset, chunk_frames);
+
+			frame_offset += chunk_frames;
+		}
+	}
+
+	// Calibration overrides whatever the host wrote.
+	if (latency_calibration)
+		latency_calibration->Process(input_samples, output_samples, GetTotalOutputChannelCount(), frameCount);
+}
+
+void CFlexASIO::ExchangeHostThreadFrames(const Sample* const* input_samples, Sample* const* output_samples, size_t frameCount) throw()
+{
+	if (frameCount > host_thread_period.load(std::memory_order_relaxed))
+		host_thread_period.store(frameCount, std::memory_order_relaxed);
+
+	// If the host thread is so far behind that the input doesn't fit, the only thing we can do without waiting is to drop it.
+	size_t dropped_frames = 0;
+	size_t missed_frames = 0;
+	if (input_fifo)
+	{
+		if (input_fifo->GetWriteAvailable() >= frameCount)
+			input_fifo->Write(input_samples, 0, frameCount);
+		else
+		{
+			RealtimeLog(LOG_LEVEL_WARNING, "Host thread is late, dropping {} input frames", frameCount);
+			dropped_frames = frameCount;
+		}
+	}
+	if (output_fifo)
+	{
+		// The host thread only gets to work on these frames once we wake it up, so the first ones can't have anything for us yet. Playing silence instead of reading the FIFO gives it the time to catch up, and keeps the lookahead intact.
+		if (!host_thread_primed)
+			for (long output_channel_index = 0; output_channel_index < GetTotalOutputChannelCount(); ++output_channel_index)
+				memset(output_samples[output_channel_index], 0, frameCount * sizeof(Sample));
+		else
+			missed_frames = ReadOutputFifo(output_samples, 0, frameCount);
+	}
+	host_thread_primed = true;
+	if (dropped_frames > 0 || missed_frames > 0)
+	{
+		statistics.RecordLateBuffer();
+		// Either way, the frames in flight between the FIFOs are no longer what the lookahead says they are. The host thread puts that right (see RealignHostThread()).
+		// The slip goes last, so that by the time the host thread sees it, it also sees the dropped frames it comes with (the reverse doesn't hold, see RealignHostThread()).
+		if (dropped_frames > 0)
+			host_thread_dropped_frames.fetch_add(dropped_frames);
+		host_thread_slip.fetch_add(static_cast<long long>(missed_frames) - static_cast<long long>(dropped_frames));
+	}
+	host_thread->Wake();
+}
 
-	const Sample* const* input_samples = static_cast<const Sample* const*>(input);
+size_t CFlexASIO::ReadOutputFifo(Sample* const* output_samples, size_t frame_offset, size_t frameCount) throw()
+{
+	const size_t available_frames = (std::min)(output_fifo->GetReadAvailable(), frameCount);
+	output_fifo->Read(output_samples, frame_offset, available_frames);
+	if (available_frames < frameCount)
+	{
+		RealtimeLog(host_thread ? LOG_LEVEL_WARNING : LOG_LEVEL_DEBUG, "Output FIFO is short of {} frames, inserting silence", frameCount - available_frames);
+		for (long output_channel_index = 0; output_channel_index < GetTotalOutputChannelCount(); ++output_channel_index)
+			memset(output_samples[output_channel_index] + frame_offset + available_frames, 0, (frameCount - available_frames) * sizeof(Sample));
+	}
+
+	// The host thread keeps the latency where it was set up to be (see RealignHostThread()), so there is nothing to track.
+	if (host_thread)
+		return frameCount - available_frames;
+
+	const size_t queued_frames = output_fifo->GetReadAvailable();
+	if (queued_frames > fifo_output_latency.load(std::memory_order_relaxed))
+	{
+		RealtimeLog(LOG_LEVEL_DEBUG, "Output FIFO latency is now {} frames", queued_frames);
+		fifo_output_latency.store(queued_frames, std::memory_order_relaxed);
+		if (host_supports_latencies_changed)
+			callbacks.asioMessage(kAsioLatenciesChanged, 0, NULL, NULL);
+	}
+	return frameCount - available_frames;
+}
+
+void CFlexASIO::RealignHostThread() throw()
+{
+	// Read in the opposite order from ExchangeHostThreadFrames(), so that a slip is never seen without the dropped frames that go with it. Dropped frames can still be seen one pass before their slip, which only delays the realignment by a pass, as it is cumulative.
+	const long long slip = host_thread_slip.exchange(0);
+	const long long dropped_frames = host_thread_dropped_frames.exchange(0);
+
+	// Input that was dropped is input the host will never see: its blocks are that much further along in the stream.
+	host_thread_frame_position += dropped_frames;
+	if (!input_fifo)
+	{
+		// Without input, the host thread just refills the output FIFO to the lookahead. The device went on playing silence meanwhile, so the blocks are also that much further along.
+		host_thread_frame_position += slip;
+		return;
+	}
+	if (!output_fifo)
+		return;
+
+	// Every frame the audio thread writes to the input FIFO comes with one it reads from the output FIFO, and every block moves as many frames from one to the other, so the frames in both add up to the lookahead (plus the head start), and so does the latency.
+	// Output that ran short leaves more frames in flight than that, and dropped input less. Skipping input, or queuing silence for output, brings it back, at the cost of a glitch the host is already late for anyway.
+	host_thread_realignment += slip;
+	if (host_thread_realignment > 0)
+	{
+		const size_t skipped_frames = (std::min)(static_cast<size_t>(host_thread_realignment), input_fifo->GetReadAvailable());
+		RealtimeLog(LOG_LEVEL_WARNING, "Host thread realigning: skipping {} input frames", skipped_frames);
+		input_fifo->CommitRead(skipped_frames);
+		host_thread_frame_position += skipped_frames;
+		host_thread_realignment -= skipped_frames;
+	}
+	else if (host_thread_realignment < 0)
+	{
+		const size_t padded_frames = (std::min)(static_cast<size_t>(-host_thread_realignment), output_fifo->GetWriteAvailable());
+		RealtimeLog(LOG_LEVEL_WARNING, "Host thread realigning: queuing {} frames of silence", padded_frames);
+		output_fifo->Write(nullptr, 0, padded_frames);
+		host_thread_realignment += padded_frames;
+	}
+}
+
+void CFlexASIO::RunHostThread() throw()
+{
+	// With input, the host runs as soon as a buffer of it has come in, and the output follows one for one, after the lookahead.
+	// Without input, nothing paces the host but the room in the output FIFO, which is kept filled with the lookahead plus one device period.
+	const size_t buffer_size = buffers->buffer_size;
+	for (;;)
+	{
+		RealignHostThread();
+		if (input_fifo ? input_fifo->GetReadAvailable() < buffer_size : output_fifo->GetCapacity() - output_fifo->GetWriteAvailable() >= host_thread_lookahead + host_thread_period.load(std::memory_order_relaxed))
+			return;
+		// Can't happen with input, as both FIFOs move at the same rate, unless the audio thread stops reading, in which case the input it keeps writing eventually gets dropped.
+		if (output_fifo && output_fifo->GetWriteAvailable() < buffer_size)
+			return;
+		block_stream_frame = host_thread_frame_position + (input_fifo ? buffer_size : host_thread_lookahead);
+		ProcessBlock();
+		host_thread_frame_position += buffer_size;
+	}
+}
+
+int CFlexASIO::InputStreamCallback(const void *input, unsigned long frameCount, PaStreamCallbackFlags statusFlags) throw()
+{
+	RealtimeLog(LOG_LEVEL_TRACE, "CFlexASIO::InputStreamCallback({})", frameCount);
+	LogStatusFlags(statusFlags);
+	drift_compensator->Push(static_cast<const Sample* const*>(input), frameCount);
+	return paContinue;
+}
+
+int CFlexASIO::OutputStreamCallback(void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags) throw()
+{
+	const std::chrono::steady_clock::time_point callback_start = std::chrono::steady_clock::now();
+	RealtimeLog(LOG_LEVEL_TRACE, "CFlexASIO::OutputStreamCallback({})", frameCount);
+	if (!started)
+	{
+		RealtimeLog(LOG_LEVEL_TRACE, "Ignoring callback as stream is not started");
+		return paContinue;
+	}
+
+	LogStatusFlags(statusFlags);
+	UpdateStreamClock(timeInfo);
+	// Pull the input, resampled to the output clock, and process it along with the output as if it came from a single full-duplex stream.
 	Sample* const* output_samples = static_cast<Sample* const*>(output);
+	for (size_t frame_offset = 0; frame_offset < frameCount; )
+	{
+		const size_t chunk_frames = (std::min)(frameCount - frame_offset, drift_chunk_frames);
+		drift_compensator->Pull(drift_input_channels.data(), 0, chunk_frames);
+		for (long output_channel_index = 0; output_channel_index < output_channel_count; ++output_channel_index)
+			drift_output_channels[output_channel_index] = output_samples[output_channel_index] + frame_offset;
+		ProcessStreamFrames(drift_input_channels.data(), drift_output_channels.data(), chunk_frames);
+		frame_offset += chunk_frames;
+	}
+	RecordCallback(callback_start, frameCount);
+	return paContinue;
+}
+
+void CFlexASIO::RunLatencyCalibration() throw()
+{
+	while (!latency_calibration->IsComplete())
+	{
+		if (calibration_cancelled.load())
+		{
+			Log(LOG_LEVEL_WARNING) << "Latency calibration was interrupted";
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+
+	size_t round_trip_frames;
+	double peak_to_noise_ratio;
+	if (!latency_calibration->Analyze(&round_trip_frames, &peak_to_noise_ratio))
+	{
+		Log(LOG_LEVEL_WARNING) << "Latency calibration failed: the test signal could not be found in the input (peak-to-noise ratio " << peak_to_noise_ratio << "). Is there a loopback connection from output channel " << config.calibration_output_channel << " to input channel " << config.calibration_input_channel << "?";
+		return;
+	}
 
-	for (int output_channel_index = 0; output_channel_index < output_channel_count; ++output_channel_index)
-		memset(output_samples[output_channel_index], 0, frameCount * sizeof(Sample));
+	double stream_input_latency, stream_output_latency;
+	{
+		// RecoverStreams() might be replacing the streams.
+		std::lock_guard<std::mutex> lock(stream_mutex);
+		if (!GetStreamLatencies(&stream_input_latency, &stream_output_latency))
+			return;
+	}
+	const double correction = (round_trip_frames - stream_input_latency - stream_output_latency) / sample_rate;
+	Log() << "Measured round-trip latency of " << round_trip_frames << " samples (peak-to-noise ratio " << peak_to_noise_ratio << "), PortAudio reports " << stream_input_latency + stream_output_latency << " samples; correction is " << correction * 1000 << " ms";
+	latency_correction.store(correction);
+	latency_correction_known = true;
+	if (capability_cache)
+		capability_cache->SetLatencyCorrection(capability_key, sample_rate, correction);
+	if (host_supports_latencies_changed)
+		callbacks.asioMessage(kAsioLatenciesChanged, 0, NULL, NULL);
+}
+
+void CFlexASIO::StartLatencyCalibrationThread() throw()
+{
+	std::lock_guard<std::mutex> lock(calibration_mutex);
+	calibration_cancelled.store(false);
+	calibration_thread = std::thread(&CFlexASIO::RunLatencyCalibration, this);
+}
+
+void CFlexASIO::StopLatencyCalibrationThread() throw()
+{
+	std::lock_guard<std::mutex> lock(calibration_mutex);
+	if (!calibration_thread.joinable())
+		return;
+	calibration_cancelled.store(true);
+	calibration_thread.join();
+}
+
+void CFlexASIO::ProcessBlock() throw()
+{
+	const size_t frames = buffers->buffer_size;
+	const size_t sample_size = buffers->sample_size;
 
 	size_t locked_buffer_index = (our_buffer_index + 1) % 2; // The host is currently busy with locked_buffer_index and is not touching our_buffer_index.
-	Log() << "Transferring between PortAudio and buffer #" << our_buffer_index;
-	for (std::vector<ASIOBufferInfo>::const_iterator buffers_info_it = buffers_info.begin(); buffers_info_it != buffers_info.end(); ++buffers_info_it)
+	RealtimeLog(LOG_LEVEL_TRACE, "Transferring between the FIFOs and buffer #{}", our_buffer_index);
+	if (input_fifo)
 	{
-		Sample* buffer = reinterpret_cast<Sample*>(buffers_info_it->buffers[our_buffer_index]);
-		if (buffers_info_it->isInput)
-			memcpy(buffer, input_samples[buffers_info_it->channelNum], frameCount * sizeof(Sample));
+		if (!input_mixer)
+			input_fifo->VisitRead(frames, [&](size_t fifo_offset, size_t frame_offset, size_t frame_count) {
+				for (std::vector<RoutingPlan::Route>::const_iterator route = routing_plan->input_routes.begin(); route != routing_plan->input_routes.end(); ++route)
+					sample_converter.encode(route->asio_buffers[our_buffer_index] + frame_offset * sample_size, route->channel + fifo_offset, frame_count);
+			});
+		else
+		{
+			input_fifo->VisitRead(frames, [&](size_t fifo_offset, size_t frame_offset, size_t frame_count) {
+				input_mixer->Mix(routing_plan->input_fifo_channels.data(), fifo_offset, routing_plan->input_mix_channels.data(), frame_offset, frame_count);
+			});
+			for (std::vector<RoutingPlan::Route>::const_iterator route = routing_plan->input_routes.begin(); route != routing_plan->input_routes.end(); ++route)
+				sample_converter.encode(route->asio_buffers[our_buffer_index], route->channel, frames);
+		}
+		input_fifo->CommitRead(frames);
+	}
+	if (output_fifo)
+	{
+		if (!output_mixer)
+			output_fifo->VisitWrite(frames, [&](size_t fifo_offset, size_t frame_offset, size_t frame_count) {
+				for (std::vector<Sample*>::const_iterator channel = routing_plan->unmapped_output_channels.begin(); channel != routing_plan->unmapped_output_channels.end(); ++channel)
+					memset(*channel + fifo_offset, 0, frame_count * sizeof(Sample));
+				for (std::vector<RoutingPlan::Route>::const_iterator route = routing_plan->output_routes.begin(); route != routing_plan->output_routes.end(); ++route)
+					sample_converter.decode(route->channel + fifo_offset, route->asio_buffers[our_buffer_index] + frame_offset * sample_size, frame_count);
+			});
 		else
-			memcpy(output_samples[buffers_info_it->channelNum], buffer, frameCount * sizeof(Sample));
+		{
+			for (std::vector<RoutingPlan::Route>::const_iterator route = routing_plan->output_routes.begin(); route != routing_plan->output_routes.end(); ++route)
+				sample_converter.decode(route->channel, route->asio_buffers[our_buffer_index], frames);
+			output_fifo->VisitWrite(frames, [&](size_t fifo_offset, size_t frame_offset, size_t frame_count) {
+				output_mixer->Mix(routing_plan->output_mix_channels.data(), frame_offset, routing_plan->output_fifo_channels.data(), fifo_offset, frame_count);
+			});
+		}
+		output_fifo->CommitWrite(frames);
 	}
 
-	Log() << "Handing off the buffer to the ASIO host";
+	// The timestamp is when the block was completed on the PortAudio side, as seen through the DLL. That's a lot more stable than the time at which the host happens to get called.
+	const double block_time = host_thread ? published_stream_clock.Load().GetTime(block_stream_frame) : stream_clock.GetTime(block_stream_frame);
+	position_timestamp = static_cast<long long>((block_time + system_time_offset) * 1e9);
+	const SamplePosition current_position = { position, position_timestamp };
+	published_position.Store(current_position);
+
+	CallHost();
+	std::swap(locked_buffer_index, our_buffer_index);
+	position += frames;
+}
+
+void CFlexASIO::CallHost() throw()
+{
+	const std::chrono::steady_clock::time_point host_start = std::chrono::steady_clock::now();
+	RealtimeLog(LOG_LEVEL_TRACE, "Handing off the buffer to the ASIO host");
 	if (!host_supports_timeinfo)
 		callbacks.bufferSwitch(our_buffer_index, ASIOFalse);
 	else
@@ -658,33 +2375,246 @@ int CFlexASIO::StreamCallback(const void *input, void *output, unsigned long fra
 		ASIOTime time;
 		time.timeInfo.flags = kSystemTimeValid | kSamplePositionValid | kSampleRateValid | kSpeedValid;
 		time.timeInfo.speed = 1;
-		time.timeInfo.samplePosition = position.asio_samples;
-		time.timeInfo.systemTime = position_timestamp.asio_timestamp;
+		time.timeInfo.samplePosition = MakeASIOSamples(position);
+		time.timeInfo.systemTime = MakeASIOTimeStamp(position_timestamp);
 		time.timeInfo.sampleRate = sample_rate;
 		time.timeCode.flags = 0;
 		time.timeCode.timeCodeSamples.lo = time.timeCode.timeCodeSamples.hi = 0;
 		time.timeCode.speed = 1;
 		callbacks.bufferSwitchTimeInfo(&time, our_buffer_index, ASIOFalse);
 	}
-	std::swap(locked_buffer_index, our_buffer_index);
-	position.samples += frameCount;
-	position_timestamp.timestamp = ((long long int) timeGetTime()) * 1000000;
-	
-	Log() << "Returning from stream callback";
-	return paContinue;
+	const double host_duration = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - host_start).count();
+	statistics.RecordHost(host_duration);
+	// On the host thread, the host doesn't take any of the callback's time.
+	if (!host_thread)
+		callback_host_duration += host_duration;
+
+	// A single slow buffer is not worth bothering the host about; it only gets told if it's consistently too slow.
+	if (config.overload_threshold == 0)
+		return;
+	if (host_duration * 100 <= config.overload_threshold * (buffers->buffer_size * 1e6 / sample_rate))
+	{
+		consecutive_host_overloads = 0;
+		return;
+	}
+	if (++consecutive_host_overloads < host_overload_buffer_count)
+		return;
+	consecutive_host_overloads = 0;
+	RealtimeLog(LOG_LEVEL_WARNING, "Host took {} us to process a buffer, which is more than {}% of the buffer period, for {} buffers in a row", host_duration, config.overload_threshold, host_overload_buffer_count);
+	statistics.RecordHostOverload();
+	if (host_supports_overload)
+		callbacks.asioMessage(kAsioOverload, 0, NULL, NULL);
 }
 
-ASIOError CFlexASIO::getSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp)
+ASIOError CFlexASIO::getSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp) throw()
 {
-	Log() << "CFlexASIO::getSamplePosition()";
+	Log(LOG_LEVEL_TRACE) << "CFlexASIO::getSamplePosition()";
 	if (!started)
 	{
 		Log() << "getSamplePosition() called before start()";
 		return ASE_SPNotAdvancing;
 	}
 
-	*sPos = position.asio_samples;
-	*tStamp = position_timestamp.asio_timestamp;
-	Log() << "Returning: sample position " << position.samples << ", timestamp " << position_timestamp.timestamp;
+	const SamplePosition current_position = published_position.Load();
+	*sPos = MakeASIOSamples(current_position.samples);
+	*tStamp = MakeASIOTimeStamp(current_position.timestamp);
+	Log(LOG_LEVEL_TRACE) << "Returning: sample position " << current_position.samples << ", timestamp " << current_position.timestamp;
 	return ASE_OK;
 }
+
+ASIOError CFlexASIO::future(long selector, void* opt) throw()
+{
+	Log() << "CFlexASIO::future(" << selector << ")";
+	switch (selector)
+	{
+		case kAsioCanInputMonitor:
+			return input_monitor ? ASE_SUCCESS : ASE_InvalidParameter;
+		case kAsioSetInputMonitor:
+			return SetInputMonitor(static_cast<const ASIOInputMonitor*>(opt));
+		default:
+			return ASE_InvalidParameter;
+	}
+}
+
+ASIOError CFlexASIO::SetInputMonitor(const ASIOInputMonitor* settings) throw()
+{
+	if (!input_monitor || !settings)
+		return ASE_InvalidParameter;
+	// ASIO gains go from 0 (-inf dB) to 0x7fffffff (+12 dB), with 0 dB at 0x20000000; pans go from 0 (left) to 0x7fffffff (right).
+	const float gain = static_cast<float>(settings->gain) / 0x20000000;
+	const float pan = static_cast<float>(settings->pan) / 0x7fffffff;
+	Log() << "Input monitor: input " << settings->input << (settings->state ? " on" : " off") << ", output " << settings->output << ", gain " << gain << ", pan " << pan;
+	if (!input_monitor->Set(settings->input, settings->output, gain, pan, settings->state == ASIOTrue))
+	{
+		Log() << "Invalid input monitor channels";
+		return ASE_InvalidParameter;
+	}
+	return ASE_SUCCESS;
+}
+
+HRESULT CFlexASIO::GetStatistics(FlexASIOStatistics* statistics) throw()
+{
+	Log(LOG_LEVEL_TRACE) << "CFlexASIO::GetStatistics()";
+	if (!statistics)
+		return E_POINTER;
+
+	const StreamStatistics::Summary summary = this->statistics.GetSummary();
+	statistics->callbackCount = summary.callback_count;
+	statistics->inputOverflowCount = summary.input_overflow_count;
+	statistics->inputUnderflowCount = summary.input_underflow_count;
+	statistics->outputOverflowCount = summary.output_overflow_count;
+	statistics->outputUnderflowCount = summary.output_underflow_count;
+	statistics->deadlineMissCount = summary.deadline_miss_count;
+	statistics->hostOverloadCount = summary.host_overload_count;
+	statistics->deadlineMissPercentage = summary.deadline_miss_percentage;
+	statistics->averageLoad = summary.average_load;
+	statistics->maxLoad = summary.max_load;
+	statistics->callbackDurationMedian = summary.callback_duration.median;
+	statistics->callbackDurationP99 = summary.callback_duration.p99;
+	statistics->callbackDurationMax = summary.callback_duration.max;
+	statistics->callbackJitterMedian = summary.callback_jitter.median;
+	statistics->callbackJitterP99 = summary.callback_jitter.p99;
+	statistics->callbackJitterMax = summary.callback_jitter.max;
+	statistics->hostDurationMedian = summary.host_duration.median;
+	statistics->hostDurationP99 = summary.host_duration.p99;
+	statistics->hostDurationMax = summary.host_duration.max;
+	statistics->copyDurationMedian = summary.copy_duration.median;
+	statistics->copyDurationP99 = summary.copy_duration.p99;
+	statistics->copyDurationMax = summary.copy_duration.max;
+	statistics->stallCount = summary.stall_count;
+	statistics->failedRecoveryCount = summary.failed_recovery_count;
+	statistics->recoveryDurationMedian = summary.recovery_duration.median;
+	statistics->recoveryDurationP99 = summary.recovery_duration.p99;
+	statistics->recoveryDurationMax = summary.recovery_duration.max;
+	statistics->lateBufferCount = summary.late_buffer_count;
+	return S_OK;
+}
+
+HRESULT CFlexASIO::ResetStatistics() throw()
+{
+	Log() << "CFlexASIO::ResetStatistics()";
+	// The audio thread is the only writer, and resetting behind its back would race with it.
+	if (started)
+	{
+		Log() << "ResetStatistics() called while the stream is running";
+		return E_ILLEGAL_METHOD_CALL;
+	}
+
+	statistics.Reset();
+	if (meters)
+		meters->Reset();
+	return S_OK;
+}
+
+HRESULT CFlexASIO::StartRecording(LPCWSTR path, unsigned long inputChannelCount, const unsigned long* inputChannels, unsigned long outputChannelCount, const unsigned long* outputChannels) throw()
+{
+	Log() << "CFlexASIO::StartRecording(" << inputChannelCount << " input channels, " << outputChannelCount << " output channels)";
+	if (!path || (inputChannelCount > 0 && !inputChannels) || (outputChannelCount > 0 && !outputChannels))
+		return E_POINTER;
+	// Until then, we don't know the device sample rate.
+	if (!buffers)
+	{
+		Log() << "StartRecording() called before createBuffers()";
+		return E_ILLEGAL_METHOD_CALL;
+	}
+	if (inputChannelCount == 0 && outputChannelCount == 0)
+	{
+		Log() << "No channels to record";
+		return E_INVALIDARG;
+	}
+
+	std::vector<size_t> input_channels;
+	for (unsigned long channel_index = 0; channel_index < inputChannelCount; ++channel_index)
+	{
+		if (inputChannels[channel_index] >= static_cast<unsigned long>(GetTotalInputChannelCount()))
+		{
+			Log() << "Invalid input channel " << inputChannels[channel_index];
+			return E_INVALIDARG;
+		}
+		input_channels.push_back(inputChannels[channel_index]);
+	}
+	std::vector<size_t> output_channels;
+	for (unsigned long channel_index = 0; channel_index < outputChannelCount; ++channel_index)
+	{
+		if (outputChannels[channel_index] >= static_cast<unsigned long>(GetTotalOutputChannelCount()))
+		{
+			Log() << "Invalid output channel " << outputChannels[channel_index];
+			return E_INVALIDARG;
+		}
+		output_channels.push_back(outputChannels[channel_index]);
+	}
+
+	return recorder.Start(path, device_sample_rate, input_channels, output_channels) ? S_OK : E_FAIL;
+}
+
+HRESULT CFlexASIO::StopRecording() throw()
+{
+	Log() << "CFlexASIO::StopRecording()";
+	recorder.Stop();
+	return S_OK;
+}
+
+HRESULT CFlexASIO::GetRecordingStatus(FlexASIORecordingStatus* status) throw()
+{
+	Log(LOG_LEVEL_TRACE) << "CFlexASIO::GetRecordingStatus()";
+	if (!status)
+		return E_POINTER;
+
+	const Recorder::Status recorder_status = recorder.GetStatus();
+	status->recording = recorder_status.recording;
+	status->framesWritten = recorder_status.frames_written;
+	status->overrunCount = recorder_status.overrun_count;
+	status->droppedFrameCount = recorder_status.dropped_frame_count;
+	status->writeError = recorder_status.write_error;
+	return S_OK;
+}
+
+HRESULT CFlexASIO::GetLoopbackStatus(FlexASIOLoopbackStatus* status) throw()
+{
+	Log(LOG_LEVEL_TRACE) << "CFlexASIO::GetLoopbackStatus()";
+	if (!status)
+		return E_POINTER;
+	if (!loopback)
+	{
+		Log() << "GetLoopbackStatus() called without loopback channels";
+		return E_ILLEGAL_METHOD_CALL;
+	}
+
+	const Loopback::Status loopback_status = loopback->GetStatus();
+	status->inputClientAttached = loopback_status.input_client_attached;
+	status->outputClientAttached = loopback_status.output_client_attached;
+	status->inputLevel = static_cast<unsigned long>(loopback_status.input_level);
+	status->outputLevel = static_cast<unsigned long>(loopback_status.output_level);
+	status->inputUnderrunCount = loopback_status.input_underrun_count;
+	status->outputOverrunCount = loopback_status.output_overrun_count;
+	return S_OK;
+}
+
+HRESULT CFlexASIO::GetChannelLevels(unsigned long* inputChannelCount, FlexASIOChannelLevels* inputLevels, unsigned long* outputChannelCount, FlexASIOChannelLevels* outputLevels) throw()
+{
+	Log(LOG_LEVEL_TRACE) << "CFlexASIO::GetChannelLevels()";
+	if (!inputChannelCount || !outputChannelCount || (*inputChannelCount > 0 && !inputLevels) || (*outputChannelCount > 0 && !outputLevels))
+		return E_POINTER;
+	if (!meters)
+	{
+		Log() << "GetChannelLevels() called without metering";
+		return E_ILLEGAL_METHOD_CALL;
+	}
+
+	std::vector<Meters::Levels> input_levels(*inputChannelCount);
+	std::vector<Meters::Levels> output_levels(*outputChannelCount);
+	meters->GetLevels(input_levels.data(), input_levels.size(), output_levels.data(), output_levels.size());
+	*inputChannelCount = (std::min)(*inputChannelCount, static_cast<unsigned long>(meters->GetInputChannelCount()));
+	*outputChannelCount = (std::min)(*outputChannelCount, static_cast<unsigned long>(meters->GetOutputChannelCount()));
+	for (unsigned long channel = 0; channel < *inputChannelCount + *outputChannelCount; ++channel)
+	{
+		const bool input = channel < *inputChannelCount;
+		const Meters::Levels& levels = input ? input_levels[channel] : output_levels[channel - *inputChannelCount];
+		FlexASIOChannelLevels& result = input ? inputLevels[channel] : outputLevels[channel - *inputChannelCount];
+		result.peak = levels.peak;
+		result.rms = levels.rms;
+		result.maxPeak = levels.max_peak;
+		result.clipCount = levels.clip_count;
+	}
+	return S_OK;
+}
@@ -21,52 +21,127 @@
 
 #include "flexasio_h.h"
 
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <atlbase.h>
 #include <atlcom.h>
 
+#include "aggregate.h"
+#include "arena.h"
+#include "calibration.h"
+#include "capabilities.h"
+#include "config.h"
+#include "convert.h"
+#include "drift.h"
+#include "endpoint.h"
+#include "engine.h"
 #include "flexasio.rc.h"
+#include "hostthread.h"
 #include "iasiodrv.h"
+#include "log.h"
+#include "loopback.h"
+#include "meter.h"
+#include "mixer.h"
+#include "monitor.h"
+#include "recorder.h"
+#include "ring.h"
+#include "samplerate.h"
+#include "seqlock.h"
+#include "stats.h"
+#include "streampool.h"
+#include "timing.h"
 #include "util.h"
+#include "virtual.h"
+#include "watchdog.h"
 #include "portaudio.h"
 
+// PortAudio always works in floats; conversion to and from the sample format exposed to the ASIO host happens in the stream callback.
 const PaSampleFormat portaudio_sample_format = paFloat32;
-const ASIOSampleType asio_sample_type = ASIOSTFloat32LSB;
 typedef float Sample;
 
 struct Buffers
 {
-	Buffers(size_t buffer_count, size_t channel_count, size_t buffer_size) :
-		buffer_count(buffer_count), channel_count(channel_count), buffer_size(buffer_size),
-		buffers(new Sample[getSize()]()) { }
-	~Buffers() { delete[] buffers; }
-	Sample* getBuffer(size_t buffer, size_t channel) { return buffers + buffer * channel_count * buffer_size + channel * buffer_size; }
-	size_t getSize() { return buffer_count * channel_count * buffer_size; }
+	Buffers(size_t buffer_count, size_t channel_count, size_t buffer_size, size_t sample_size, bool large_pages) :
+		buffer_count(buffer_count), channel_count(channel_count), buffer_size(buffer_size), sample_size(sample_size),
+		channel_stride(BufferArena::Align(buffer_size * sample_size)), arena(buffer_count * channel_count * channel_stride, large_pages),
+		buffers(static_cast<char*>(arena.Allocate(getSize()))) { }
+	char* getBuffer(size_t buffer, size_t channel) { return buffers + (buffer * channel_count + channel) * channel_stride; }
+	size_t getSize() { return buffer_count * channel_count * channel_stride; }
 	
 	const size_t buffer_count;
 	const size_t channel_count;
 	const size_t buffer_size;
+	// In bytes, as ASIO buffers use the sample format negotiated with the host.
+	const size_t sample_size;
+	// In bytes. Each channel buffer is padded to the arena alignment, so that every buffer starts on its own cache line (and SIMD-aligned).
+	const size_t channel_stride;
+	BufferArena arena;
 
 	// This is a giant buffer containing all ASIO buffers. It is organized as follows:
 	// [ input channel 0 buffer 0 ] [ input channel 1 buffer 0 ] ... [ input channel N buffer 0 ] [ output channel 0 buffer 0 ] [ output channel 1 buffer 0 ] .. [ output channel N buffer 0 ]
 	// [ input channel 0 buffer 1 ] [ input channel 1 buffer 1 ] ... [ input channel N buffer 1 ] [ output channel 0 buffer 1 ] [ output channel 1 buffer 1 ] .. [ output channel N buffer 1 ]
 	// The reason why this is a giant blob is to slightly improve performance by (theroretically) improving memory locality.
-	Sample* const buffers;
+	// It lives in a locked, prefaulted arena so that the first callbacks don't take page faults when they touch it.
+	char* const buffers;
 };
 
-union ASIOSamplesUnion
+// Where each ASIO buffer goes, worked out once by createBuffers() so that ProcessBlock() doesn't have to walk buffers_info and branch on every entry.
+// It never changes while the stream is running: ASIO only allows the host to change the buffers between disposeBuffers() and createBuffers().
+struct RoutingPlan
 {
-	ASIOSamples asio_samples;
-	long long int samples;
+	struct Route
+	{
+		// Indexed by ASIO buffer index (i.e. half).
+		char* asio_buffers[2];
+		// The PortAudio channel in the FIFO or, if the direction goes through a mixer, the ASIO channel in the mix buffer.
+		Sample* channel;
+	};
+
+	std::vector<Route> input_routes;
+	std::vector<Route> output_routes;
+	// FIFO output channels the host doesn't have a buffer for. These are the only ones that need to be filled with silence.
+	// When there is an output mixer, it writes every FIFO channel, and ASIO channels without a buffer just stay silent in the mix buffer, so this is empty.
+	std::vector<Sample*> unmapped_output_channels;
+	// Channel pointers for the mixers, if any: FIFO channels on the device side, mix buffer channels on the ASIO side.
+	std::vector<Sample*> input_fifo_channels;
+	std::vector<Sample*> input_mix_channels;
+	std::vector<Sample*> output_mix_channels;
+	std::vector<Sample*> output_fifo_channels;
 };
 
-union ASIOTimeStampUnion
+// A sample position and the system time it corresponds to (in nanoseconds, in the timeGetTime() timebase), as published to getSamplePosition().
+struct SamplePosition
 {
-	ASIOTimeStamp asio_timestamp;
-	long long int timestamp;
+	long long samples;
+	long long timestamp;
+};
+
+// A snapshot of the stream clock (see DelayLockedLoop), as published to the host thread (see Config::host_thread_buffers).
+struct StreamClockPoint
+{
+	long long frame;
+	// In PortAudio time, in seconds.
+	double time;
+	double period;
+
+	double GetTime(long long frame) const { return time + period * (frame - this->frame); }
+};
+
+// The latencies of the streams as they were opened, as published to getLatencies() (see CFlexASIO::PublishStreamLatencies()).
+struct StreamLatencies
+{
+	// Zero if there are no buffers.
+	long buffer_size;
+	// False if the streams couldn't tell.
+	bool known;
+	double input;
+	double output;
 };
 
 // ASIO doesn't use COM properly, and doesn't define a proper interface.
@@ -116,19 +191,132 @@ class CFlexASIO :
 		virtual ASIOError start() throw();
 		virtual ASIOError stop() throw();
 		virtual ASIOError getSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp) throw();
+		// Only kAsioCanInputMonitor and kAsioSetInputMonitor are supported.
+		virtual ASIOError future(long selector, void *opt) throw();
+
+		// IFlexASIO implementation
+
+		virtual HRESULT STDMETHODCALLTYPE GetStatistics(FlexASIOStatistics* statistics) throw();
+		virtual HRESULT STDMETHODCALLTYPE ResetStatistics() throw();
+		virtual HRESULT STDMETHODCALLTYPE StartRecording(LPCWSTR path, unsigned long inputChannelCount, const unsigned long* inputChannels, unsigned long outputChannelCount, const unsigned long* outputChannels) throw();
+		virtual HRESULT STDMETHODCALLTYPE StopRecording() throw();
+		virtual HRESULT STDMETHODCALLTYPE GetRecordingStatus(FlexASIORecordingStatus* status) throw();
+		virtual HRESULT STDMETHODCALLTYPE GetLoopbackStatus(FlexASIOLoopbackStatus* status) throw();
+		virtual HRESULT STDMETHODCALLTYPE GetChannelLevels(unsigned long* inputChannelCount, FlexASIOChannelLevels* inputLevels, unsigned long* outputChannelCount, FlexASIOChannelLevels* outputLevels) throw();
 
 		// Not implemented
 		virtual ASIOError controlPanel() throw()  { Log() << "CFlexASIO::controlPanel()"; return ASE_NotPresent; }
-		virtual ASIOError future(long selector, void *opt) throw()  { Log() << "CFlexASIO::future()"; return ASE_InvalidParameter; }
 		virtual ASIOError outputReady() throw()  { Log() << "CFlexASIO::outputReady()"; return ASE_NotPresent; }
 
 	private:
-		PaError OpenStream(PaStream**, double sampleRate, unsigned long framesPerBuffer) throw();
+		bool IsInitialized() const throw() { return initialized; }
+		// True if input and output run as two separate PortAudio streams, with the input following the output clock through drift compensation.
+		bool UseSeparateStreams() const throw() { return config.drift_compensation && !device_snapshot.input_device_name.empty() && !device_snapshot.output_device_name.empty(); }
+		// The device channels: those of the main devices, followed by those of the aggregate devices and the loopback channels (if any).
+		long GetTotalInputChannelCount() const throw() { return input_channel_count + aggregate_input_channel_count + loopback_input_channel_count; }
+		long GetTotalOutputChannelCount() const throw() { return output_channel_count + aggregate_output_channel_count + loopback_output_channel_count; }
+		// The channels exposed to the host, which are not the device channels if there is a mixer in that direction.
+		long GetASIOInputChannelCount() const throw() { return input_mixer ? static_cast<long>(input_mixer->GetDestinationCount()) : GetTotalInputChannelCount(); }
+		long GetASIOOutputChannelCount() const throw() { return output_mixer ? static_cast<long>(output_mixer->GetSourceCount()) : GetTotalOutputChannelCount(); }
+		// The part of init() that sets up PortAudio and the devices, and describes them in *snapshot. The others are used instead when the virtual device or the engine is configured.
+		// This doesn't touch anything the host can see, so that it can run on initialization_thread.
+		bool InitializeDevices(DeviceSnapshot* snapshot, std::string* error_message) throw();
+		bool InitializeVirtualDevice() throw();
+		bool InitializeEngineDevice() throw();
+		// Looks up the devices listed in Config::aggregate_devices among the devices of the given host API.
+		void InitializeAggregateDevices(PaHostApiIndex pa_api_index, DeviceSnapshot* snapshot) throw();
+		// Makes snapshot the device_snapshot, and takes the channel counts, masks and default sample rate from it.
+		void ApplyDeviceSnapshot(const DeviceSnapshot& snapshot) throw();
+		// The capability cache key under which the snapshot of the configured devices is stored.
+		std::string GetDeviceSnapshotKey() const;
+		// True if the default endpoints are still the devices the snapshot was taken from, in which case init() can trust it.
+		bool IsDeviceSnapshotCurrent(const DeviceSnapshot& snapshot) const throw();
+		// Initializes PortAudio and the devices if init() deferred it, and checks that they still match what the host was told. Must be called before using PortAudio.
+		bool EnsureDevices() throw();
+		// Runs InitializeDevices() for EnsureDevices(), either on initialization_thread or directly.
+		void RunDeferredInitialization() throw();
+		// Sets up input_mixer and output_mixer from the configuration, once the device channel counts are known, as well as input_monitor, which depends on them.
+		void InitializeMixers() throw();
+		ASIOError SetInputMonitor(const ASIOInputMonitor* settings) throw();
+		PaError OpenStream(PaStream**, double sampleRate, unsigned long framesPerBuffer, bool use_input, bool use_output, PaStreamCallback* callback) throw();
+		// Opens and closes a stream at the given sample rate. Can be called from any thread.
+		bool ProbeSampleRate(double sampleRate) throw();
+		// Same, but goes through the capability cache and the background prober first.
+		bool IsSampleRateSupportedByDevices(double sampleRate) throw();
+		// True if the host can use this sample rate while the devices stay at native_sample_rate.
+		bool CanConvertSampleRate(double sampleRate) const throw();
 		static int StaticStreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, void *userData) throw() { return static_cast<CFlexASIO*>(userData)->StreamCallback(input, output, frameCount, timeInfo, statusFlags); }
 		int StreamCallback(const void *input, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags) throw();
-
+		// Feeds the time of the current PortAudio callback into stream_clock.
+		void UpdateStreamClock(const PaStreamCallbackTimeInfo* timeInfo) throw();
+		void LogStatusFlags(PaStreamCallbackFlags statusFlags) throw();
+		void RecordCallback(std::chrono::steady_clock::time_point callback_start, unsigned long frameCount) throw();
+		// Feeds the session that just ended into the buffer size tuning for the current sample rate.
+		void UpdateBufferSizeTuning(const StreamStatistics::Summary& summary);
+		// Calls the host with the current buffer, and keeps track of how long it takes.
+		void CallHost() throw();
+		// The PortAudio part of createBuffers() and disposeBuffers(). The streams go through stream_pool.
+		ASIOError OpenStreams(PaStream** temp_stream, PaStream** temp_input_stream, std::vector<std::unique_ptr<AggregateMember>>* temp_aggregate_members) throw();
+		ASIOError CloseStreams() throw();
+		// Opens the streams again after they were abandoned. The virtual device stream stays open, as reopening it would start the output file over.
+		ASIOError ReopenStreams() throw();
+		// Aborts the streams, and closes them without going through stream_pool, as they might not be usable anymore. Sets stream_lost.
+		void AbandonStreams() throw();
+		// The part of start() that is also done when recovering from a stall: resets everything the audio thread keeps across callbacks, except for the sample position, and starts the streams.
+		void ResetStreamState() throw();
+		ASIOError StartStreams() throw();
+		// How long the stream can go without calling back before stall_watchdog considers it stalled (see Config::stall_timeout).
+		std::chrono::milliseconds GetStallTimeout() const throw();
+		// Runs on the stall_watchdog thread: reopens and restarts the streams, keeping the buffers, and tells the host what happened.
+		void RecoverStreams(std::chrono::milliseconds stall_duration) throw();
+		// The latencies of the PortAudio side of the pipeline, in frames. This is what the test signal goes through during latency calibration.
+		bool GetStreamLatencies(double* input_latency, double* output_latency) throw();
+		// Publishes the buffer size and GetStreamLatencies() for getLatencies(), which doesn't take stream_mutex: the host calls it from kAsioLatenciesChanged, which the audio thread sends. Called whenever the buffers are created or disposed of, and the streams reopened.
+		// Must only be called from one thread at a time, which holds stream_mutex or has the streams stopped.
+		void PublishStreamLatencies() throw();
+		// Runs on calibration_thread: waits for the test signal to be recorded, then analyzes it.
+		void RunLatencyCalibration() throw();
+		// Start and stop calibration_thread. Starting is only done with stream_mutex held, which stop() relies on. Stopping cancels the calibration and waits for the thread, so it must be done without holding stream_mutex, which the thread takes.
+		void StartLatencyCalibrationThread() throw();
+		void StopLatencyCalibrationThread() throw();
+		// Runs frames from the stream that drives the host through ProcessFrames(), along with the channels of the aggregate members, and advances stream_frame_position.
+		void ProcessStreamFrames(const Sample* const* input_samples, Sample* const* output_samples, size_t frameCount) throw();
+		// Runs frames at the device sample rate through the sample rate converters (if any) and ProcessFrames(), and advances stream_frame_position.
+		void ProcessDeviceFrames(const Sample* const* input_samples, Sample* const* output_samples, size_t frameCount) throw();
+		// Runs frames at the ASIO sample rate through the FIFOs, calling the host as needed.
+		void ProcessFrames(const Sample* const* input_samples, Sample* const* output_samples, size_t frameCount) throw();
+		// What ProcessFrames() does instead when the host runs on host_thread: only moves frames in and out of the FIFOs, and wakes the host thread.
+		void ExchangeHostThreadFrames(const Sample* const* input_samples, Sample* const* output_samples, size_t frameCount) throw();
+		// Reads frames from the output FIFO, filling whatever it's short of with silence. Returns the number of frames that were missing.
+		size_t ReadOutputFifo(Sample* const* output_samples, size_t frame_offset, size_t frameCount) throw();
+		// Runs on host_thread: calls ProcessBlock() for as many buffers as the FIFOs allow.
+		void RunHostThread() throw();
+		// Called by RunHostThread() before each block, to make up for the frames the audio thread had to drop or play silence for.
+		void RealignHostThread() throw();
+		static int StaticInputStreamCallback(const void *input, void * /*output*/, unsigned long frameCount, const PaStreamCallbackTimeInfo * /*timeInfo*/, PaStreamCallbackFlags statusFlags, void *userData) throw() { return static_cast<CFlexASIO*>(userData)->InputStreamCallback(input, frameCount, statusFlags); }
+		int InputStreamCallback(const void *input, unsigned long frameCount, PaStreamCallbackFlags statusFlags) throw();
+		static int StaticOutputStreamCallback(const void * /*input*/, void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, void *userData) throw() { return static_cast<CFlexASIO*>(userData)->OutputStreamCallback(output, frameCount, timeInfo, statusFlags); }
+		int OutputStreamCallback(void *output, unsigned long frameCount, const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags) throw();
+		// Moves one ASIO buffer worth of frames between the FIFOs and the ASIO buffers, and hands it off to the host.
+		void ProcessBlock() throw();
+
+		const Config config;
+		// Keeps the log writer thread running for as long as this instance exists. Also sets up the log from the config, unless another instance already did.
+		LoggerReference logger_reference;
+
+		bool initialized;
 		bool portaudio_initialized;
 		std::string init_error;
+		// What the host has been told about the devices. Empty for the virtual device.
+		DeviceSnapshot device_snapshot;
+		// Set if init() answered from a snapshot and PortAudio hasn't been initialized yet (see Config::deferred_initialization), and if that failed.
+		bool devices_pending;
+		bool devices_failed;
+		// Runs the deferred initialization in the background (see Config::background_initialization). Its results are only looked at after joining it.
+		std::thread initialization_thread;
+		bool deferred_result;
+		DeviceSnapshot deferred_snapshot;
+		std::string deferred_error;
 
 		const PaHostApiInfo* pa_api_info;
 		const PaDeviceInfo* input_device_info;
@@ -138,23 +326,156 @@ class CFlexASIO :
 		// WAVEFORMATEXTENSIBLE channel masks. Not always available.
 		DWORD input_channel_mask;
 		DWORD output_channel_mask;
+		// Devices listed in Config::aggregate_devices that were found (once PortAudio is initialized), and how many channels they add in total.
+		std::vector<PaDeviceIndex> aggregate_devices;
+		long aggregate_input_channel_count;
+		long aggregate_output_channel_count;
+		// From the configuration (see Config::loopback_input_channels). They are handled like the channels of one more aggregate device, except that they follow the master stream clock.
+		long loopback_input_channel_count;
+		long loopback_output_channel_count;
+		// Null unless a non-trivial mixing matrix is configured. The input mixer turns device channels into ASIO channels, and the output mixer does the reverse.
+		std::unique_ptr<ChannelMixer> input_mixer;
+		std::unique_ptr<ChannelMixer> output_mixer;
+		// Null if there are no input or no output channels. Applied by ProcessStreamFrames() to the device channels, at the device sample rate.
+		std::unique_ptr<InputMonitor> input_monitor;
+		// Holds one ASIO buffer worth of each ASIO channel on its way to or from a mixer; input channels first, then output channels.
+		std::vector<Sample> mix_buffer;
+
+		// Null if the cache is disabled. capability_key identifies the current devices in the cache.
+		std::unique_ptr<CapabilityCache> capability_cache;
+		std::string capability_key;
+		// Probes sample rates in the background after init(), so that canSampleRate() rarely has to wait. Null once createBuffers() has been called.
+		std::unique_ptr<SampleRateProber> sample_rate_prober;
+		// PortAudio is not thread-safe; this serializes stream opening between the host thread and sample_rate_prober.
+		std::mutex probe_mutex;
 
 		ASIOSampleRate sample_rate;
+		// The default sample rate of the devices, and the one the streams actually run at. The latter is either sample_rate, or native_sample_rate if the devices don't support sample_rate.
+		double native_sample_rate;
+		double device_sample_rate;
+		// resampler_quality only matters if resampler_enabled is set.
+		bool resampler_enabled;
+		ResamplerQuality resampler_quality;
+		// The sample format of the ASIO buffers, as advertised to the host in getChannelInfo().
+		SampleFormat sample_format;
+		SampleConverter sample_converter;
 
 		// PortAudio buffer addresses are dynamic and are only valid for the duration of the stream callback.
 		// In contrast, ASIO buffer addresses are static and are valid for as long as the stream is running.
 		// Thus we need our own buffer on top of PortAudio's buffers. This doens't add any latency because buffers are copied immediately.
 		std::unique_ptr<Buffers> buffers;
 		std::vector<ASIOBufferInfo> buffers_info;
+		std::unique_ptr<const RoutingPlan> routing_plan;
 		ASIOCallbacks callbacks;
-
+		// PortAudio callbacks don't necessarily line up with ASIO buffers. These FIFOs sit between PortAudio buffers and ASIO buffers and re-frame the audio.
+		// They use the PortAudio channel layout and sample format. They are null if the corresponding direction is unused.
+		std::unique_ptr<SampleRing> input_fifo;
+		std::unique_ptr<SampleRing> output_fifo;
+		// Convert between device_sample_rate on the PortAudio side and sample_rate on the FIFO side. Null if the rates are the same or the direction is unused.
+		std::unique_ptr<SampleRateConverter> input_converter;
+		std::unique_ptr<SampleRateConverter> output_converter;
+		// Preallocated room for ASIO rate frames on their way between the converters and the FIFOs.
+		std::vector<Sample> converter_buffer;
+		std::vector<Sample*> converter_input_channels;
+		std::vector<Sample*> converter_output_channels;
+		// The largest number of frames ever left in the output FIFO after PortAudio has taken its share, i.e. the latency added by re-framing.
+		// With the host thread, it is the lookahead, which RealignHostThread() maintains.
+		std::atomic<size_t> fifo_output_latency;
+
+		// When input and output run separately (see UseSeparateStreams()), "stream" is the output stream and drives the host, and "input_stream" feeds drift_compensator.
 		PaStream* stream;
+		PaStream* input_stream;
+		std::unique_ptr<DriftCompensator> drift_compensator;
+		// Preallocated room for input frames pulled from drift_compensator, so that the output callback can hand them to StreamCallback().
+		std::vector<Sample> drift_input_buffer;
+		std::vector<Sample*> drift_input_channels;
+		std::vector<Sample*> drift_output_channels;
+		// Replaces PortAudio entirely when Config::virtual_input_file or Config::virtual_output_file is set. Null otherwise.
+		std::unique_ptr<VirtualDevice> virtual_device;
+		// Replaces PortAudio entirely when Config::engine_name is set. Null otherwise.
+		std::unique_ptr<EngineDevice> engine_device;
+		// One per entry in aggregate_devices, while the buffers exist.
+		std::vector<std::unique_ptr<AggregateMember>> aggregate_members;
+		// Where stream, input_stream and aggregate_members go between disposeBuffers() and the next createBuffers().
+		StreamPool stream_pool;
+		// Preallocated room for the channels of the aggregate members, which ProcessStreamFrames() appends to the channels of the main devices.
+		std::vector<Sample> aggregate_buffer;
+		std::vector<const Sample*> aggregate_input_channels;
+		std::vector<Sample*> aggregate_output_channels;
+		// The part of aggregate_input_channels past the main devices, which is where the members, and then the loopback, write their input.
+		std::vector<Sample*> aggregate_member_input_channels;
+		// Created by the first createBuffers() if there are loopback channels, and kept until the instance goes away, so that clients can stay connected.
+		std::unique_ptr<Loopback> loopback;
+		// Non-null while the round-trip latency is being measured. The audio thread plays and records the test signal, and calibration_thread analyzes it.
+		std::unique_ptr<LatencyCalibration> latency_calibration;
+		std::thread calibration_thread;
+		std::atomic<bool> calibration_cancelled;
+		// Serializes starting and stopping calibration_thread, which start() and stop() do on the host thread, and RecoverStreams() on the stall_watchdog thread.
+		std::mutex calibration_mutex;
+		// Measured round-trip latency minus the PortAudio latencies, in seconds. Added to the input latency.
+		std::atomic<double> latency_correction;
+		bool latency_correction_known;
+		StreamStatistics statistics;
+		// Tapped in ProcessStreamFrames(), with all the device channels (see IFlexASIO::StartRecording()).
+		Recorder recorder;
+		// Null unless Config::metering is set. Also fed by ProcessStreamFrames().
+		std::unique_ptr<Meters> meters;
+		// Null unless Config::host_thread_buffers is set. Created by the first createBuffers(), running between start() and stop().
+		// When it is there, ProcessBlock() and CallHost(), and everything they touch, run on that thread instead of the audio thread.
+		std::unique_ptr<HostThread> host_thread;
+		// Silence the output FIFO starts with, so that the host can fall that far behind without the device noticing: one ASIO buffer less than Config::host_thread_buffers.
+		size_t host_thread_lookahead;
+		// The largest number of frames the audio thread has taken from the FIFOs at once. Without input to go by, the host thread keeps that much output queued on top of the lookahead.
+		std::atomic<size_t> host_thread_period;
+		// Audio thread side: false until the first frames have gone through, which don't read the output FIFO, so that the host thread gets a head start of one device period.
+		bool host_thread_primed;
+		// Audio thread to host thread: input frames that didn't fit in the input FIFO, and how many more frames than that are in flight between the FIFOs, i.e. output frames that weren't there when the device needed them, minus the dropped input frames.
+		std::atomic<long long> host_thread_dropped_frames;
+		std::atomic<long long> host_thread_slip;
+		// Host thread side: ASIO frames handed off to the host since the stream (re)started.
+		long long host_thread_frame_position;
+		// Host thread side: the slip RealignHostThread() hasn't been able to make up for yet, because there wasn't enough input to skip or room to queue silence.
+		long long host_thread_realignment;
+		// Written by the audio thread, so that the host thread can timestamp its blocks.
+		SeqLock<StreamClockPoint> published_stream_clock;
+		// Written by PublishStreamLatencies(), read by getLatencies(). While the streams are lost after a stall, the latencies of the last ones remain the best guess.
+		SeqLock<StreamLatencies> published_stream_latencies;
+		// When the previous callback started, and how many frames it processed. Used to measure callback jitter.
+		std::chrono::steady_clock::time_point previous_callback_start;
+		unsigned long previous_callback_frames;
+		// Largest number of frames seen in a single callback of the stream that drives the host, i.e. the device period. Used for buffer size tuning (see Config::buffer_size_tuning).
+		unsigned long max_callback_frames;
+		std::chrono::steady_clock::time_point stream_start_time;
+		// Time spent in the host during the current callback, in microseconds.
+		double callback_host_duration;
+		// Consecutive buffers for which the host exceeded config.overload_threshold.
+		unsigned long consecutive_host_overloads;
 		bool host_supports_timeinfo;
+		bool host_supports_latencies_changed;
+		bool host_supports_overload;
+		bool host_supports_resync;
+		bool host_supports_reset;
 		// The index of the "unlocked" buffer (or "half-buffer", i.e. 0 or 1) that contains data not currently being processed by the ASIO host.
+		// ASIO only ever has two, so the host thread doesn't change that: the extra depth lives in the FIFOs.
 		size_t our_buffer_index;
-		ASIOSamplesUnion position;
-		ASIOTimeStampUnion position_timestamp;
+		// The position and system time of the block being handed off to the host. Only touched by the thread that calls the host; other threads go through published_position.
+		long long position;
+		long long position_timestamp;
+		SeqLock<SamplePosition> published_position;
+		// Frames processed so far by the stream that drives the host, and the frame at which the block being handed off to the host was completed. Both are in ASIO frames, i.e. after sample rate conversion.
+		long long stream_frame_position;
+		long long block_stream_frame;
+		// Smooths PortAudio callback times into a stable mapping between stream frames and time, from which position timestamps are derived.
+		DelayLockedLoop stream_clock;
+		// What to add to PortAudio time to get timeGetTime() time, in seconds.
+		double system_time_offset;
 		bool started;
+		// Set if the streams were abandoned after a stall and couldn't be reopened yet. In that case stream is null and there is nothing to stop.
+		bool stream_lost;
+		// Serializes start(), stop() and the latency calibration with RecoverStreams(), which replaces the streams.
+		std::mutex stream_mutex;
+		// Fed by the stream that drives the host. Declared last so that it is destroyed first, as its thread calls RecoverStreams().
+		StallWatchdog stall_watchdog;
 };
 
 OBJECT_ENTRY_AUTO(__uuidof(CFlexASIO), CFlexASIO)
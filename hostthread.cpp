@@ -0,0 +1,86 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "hostthread.h"
+
+#include <avrt.h>
+
+#include "util.h"
+
+namespace {
+// The handler runs on every wakeup anyway. This only bounds how long Stop() can take if the stream has stopped calling back.
+const DWORD host_thread_wait_timeout_ms = 100;
+}
+
+HostThread::HostThread(Handler on_wake) : on_wake(on_wake), event(CreateEventA(NULL, FALSE, FALSE, NULL)), stopping(false) { }
+
+HostThread::~HostThread()
+{
+	Stop();
+	if (event)
+		CloseHandle(event);
+}
+
+bool HostThread::Start()
+{
+	if (thread.joinable())
+		return true;
+	if (!event)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to create host thread event (error " << GetLastError() << ")";
+		return false;
+	}
+	ResetEvent(event);
+	stopping.store(false);
+	thread = std::thread(&HostThread::Run, this);
+	return true;
+}
+
+void HostThread::Stop()
+{
+	if (!thread.joinable())
+		return;
+	stopping.store(true);
+	SetEvent(event);
+	thread.join();
+}
+
+void HostThread::Run()
+{
+	DWORD task_index = 0;
+	const HANDLE task = AvSetMmThreadCharacteristicsA("Pro Audio", &task_index);
+	if (task)
+		AvSetMmThreadPriority(task, AVRT_PRIORITY_CRITICAL);
+	else
+	{
+		Log(LOG_LEVEL_WARNING) << "Unable to register the host thread with MMCSS (error " << GetLastError() << "), using time-critical priority instead";
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+	}
+
+	while (!stopping.load())
+	{
+		if (WaitForSingleObject(event, host_thread_wait_timeout_ms) != WAIT_OBJECT_0 || stopping.load())
+			continue;
+		on_wake();
+	}
+
+	if (task)
+		AvRevertMmThreadCharacteristics(task);
+}
@@ -0,0 +1,59 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#pragma once
+
+#include <windows.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+// Runs the host on its own thread instead of the stream callback (see Config::host_thread_buffers), so that the host can take longer than one buffer period now and then without the device noticing.
+// The stream callback only moves audio in and out of the FIFOs, which are wait-free, and calls Wake(). The thread then calls the handler, which runs the host for as many buffers as the FIFOs allow.
+// The thread is registered with MMCSS as "Pro Audio", like the WASAPI stream thread, or runs at time-critical priority if that's not possible.
+class HostThread
+{
+	public:
+		typedef std::function<void()> Handler;
+
+		explicit HostThread(Handler on_wake);
+		// Stops the thread, if it's running.
+		~HostThread();
+
+		// Fails if the thread couldn't be set up.
+		bool Start();
+		// Waits for the handler to return, if it's running. The handler isn't called again until the next Start().
+		void Stop();
+		// Real-time safe.
+		void Wake() { SetEvent(event); }
+
+	private:
+		HostThread(const HostThread&);
+		HostThread& operator=(const HostThread&);
+
+		void Run();
+
+		const Handler on_wake;
+		// Auto-reset: wakeups that come while the handler is running are coalesced into one more call.
+		HANDLE event;
+		std::atomic<bool> stopping;
+		std::thread thread;
+};
@@ -0,0 +1,325 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "log.h"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+long long GetTimestampMicroseconds()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FormatArgument(std::ostream& stream, const LogArgument& argument)
+{
+	switch (argument.type)
+	{
+		case LogArgument::TYPE_SIGNED: stream << argument.signed_value; break;
+		case LogArgument::TYPE_UNSIGNED: stream << argument.unsigned_value; break;
+		case LogArgument::TYPE_DOUBLE: stream << argument.double_value; break;
+		case LogArgument::TYPE_POINTER: stream << argument.pointer_value; break;
+		case LogArgument::TYPE_STRING: stream << (argument.string_value ? argument.string_value : "(null)"); break;
+	}
+}
+}
+
+bool ParseLogLevel(const std::string& name, LogLevel* level)
+{
+	static const struct { const char* name; LogLevel level; } levels[] = {
+		{ "off", LOG_LEVEL_OFF },
+		{ "error", LOG_LEVEL_ERROR },
+		{ "warning", LOG_LEVEL_WARNING },
+		{ "info", LOG_LEVEL_INFO },
+		{ "debug", LOG_LEVEL_DEBUG },
+		{ "trace", LOG_LEVEL_TRACE },
+	};
+	for (size_t level_index = 0; level_index < sizeof(levels) / sizeof(*levels); ++level_index)
+		if (name == levels[level_index].name)
+		{
+			*level = levels[level_index].level;
+			return true;
+		}
+	return false;
+}
+
+void DebugOutputLogSink::Write(const std::string& line)
+{
+	OutputDebugStringA((line + "\n").c_str());
+}
+
+FileLogSink::FileLogSink(const std::string& path) : file(nullptr)
+{
+	file = fopen(path.c_str(), "a");
+}
+
+FileLogSink::~FileLogSink()
+{
+	if (file)
+		fclose(file);
+}
+
+void FileLogSink::Write(const std::string& line)
+{
+	fputs(line.c_str(), file);
+	fputc('\n', file);
+}
+
+void FileLogSink::Flush()
+{
+	fflush(file);
+}
+
+void StderrLogSink::Write(const std::string& line)
+{
+	fputs(line.c_str(), stderr);
+	fputc('\n', stderr);
+}
+
+void StderrLogSink::Flush()
+{
+	fflush(stderr);
+}
+
+std::unique_ptr<LogSink> CreateLogSink(const std::string& name, const std::string& file)
+{
+	if (name == "debug")
+		return std::unique_ptr<LogSink>(new DebugOutputLogSink);
+	if (name == "stderr")
+		return std::unique_ptr<LogSink>(new StderrLogSink);
+	if (name == "file")
+	{
+		std::unique_ptr<FileLogSink> file_sink(new FileLogSink(file));
+		if (!file_sink->IsOpen())
+			return nullptr;
+		return std::unique_ptr<LogSink>(file_sink.release());
+	}
+	return nullptr;
+}
+
+Logger& Logger::Get()
+{
+	static Logger logger;
+	return logger;
+}
+
+Logger::Logger() :
+	level(LOG_LEVEL_INFO), cells(new Cell[ring_size]), enqueue_position(0), dequeue_position(0), dropped_records(0),
+	sink(new DebugOutputLogSink), references(0), stopping(false)
+{
+	for (size_t cell_index = 0; cell_index < ring_size; ++cell_index)
+		cells[cell_index].sequence.store(cell_index, std::memory_order_relaxed);
+}
+
+Logger::~Logger()
+{
+	// This runs when the DLL is unloaded, under the loader lock. Joining a thread here would deadlock, so if someone leaked a reference we just let the thread go.
+	if (thread.joinable())
+		thread.detach();
+}
+
+void Logger::SetSink(std::unique_ptr<LogSink> sink)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	ReplaceSink(std::move(sink));
+}
+
+void Logger::ReplaceSink(std::unique_ptr<LogSink> sink)
+{
+	Drain();
+	if (this->sink)
+		this->sink->Flush();
+	this->sink = sink ? std::move(sink) : std::unique_ptr<LogSink>(new DebugOutputLogSink);
+}
+
+Logger::Cell* Logger::Claim(size_t& position)
+{
+	position = enqueue_position.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		Cell* cell = &cells[position % ring_size];
+		const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		const ptrdiff_t difference = static_cast<ptrdiff_t>(sequence - position);
+		if (difference == 0)
+		{
+			if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				return cell;
+		}
+		else if (difference < 0)
+			return nullptr; // The ring is full.
+		else
+			position = enqueue_position.load(std::memory_order_relaxed);
+	}
+}
+
+void Logger::PushRecord(LogLevel level, const char* format, const LogArgument* arguments, size_t argument_count)
+{
+	size_t position;
+	Cell* cell = Claim(position);
+	if (!cell)
+	{
+		dropped_records.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	LogRecord& record = cell->record;
+	record.level = level;
+	record.timestamp_us = GetTimestampMicroseconds();
+	record.format = format;
+	record.argument_count = argument_count;
+	for (size_t argument_index = 0; argument_index < argument_count; ++argument_index)
+		record.arguments[argument_index] = arguments[argument_index];
+	Publish(cell, position);
+}
+
+void Logger::Write(LogLevel level, const std::string& text)
+{
+	size_t position;
+	Cell* cell = Claim(position);
+	if (!cell)
+	{
+		dropped_records.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	LogRecord& record = cell->record;
+	record.level = level;
+	record.timestamp_us = GetTimestampMicroseconds();
+	record.format = nullptr;
+	record.argument_count = 0;
+	const size_t length = (std::min)(text.size(), LogRecord::max_text_length);
+	memcpy(record.text, text.data(), length);
+	record.text[length] = '\0';
+	Publish(cell, position);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (thread.joinable())
+		wakeup.notify_one();
+	else
+	{
+		Drain();
+		sink->Flush();
+	}
+}
+
+void Logger::Drain()
+{
+	const unsigned long dropped = dropped_records.exchange(0, std::memory_order_relaxed);
+	if (dropped > 0)
+	{
+		std::stringstream line;
+		line << "FlexASIO: " << dropped << " log records were dropped because the log ring was full";
+		sink->Write(line.str());
+	}
+
+	for (;;)
+	{
+		Cell* cell = &cells[dequeue_position % ring_size];
+		if (cell->sequence.load(std::memory_order_acquire) != dequeue_position + 1)
+			break;
+		WriteLine(cell->record);
+		cell->sequence.store(dequeue_position + ring_size, std::memory_order_release);
+		++dequeue_position;
+	}
+}
+
+void Logger::WriteLine(const LogRecord& record)
+{
+	std::stringstream line;
+	line << "FlexASIO: [" << record.timestamp_us / 1000 << "." << std::setfill('0') << std::setw(3) << record.timestamp_us % 1000 << std::setfill(' ') << "] ";
+	if (!record.format)
+		line << record.text;
+	else
+	{
+		size_t argument_index = 0;
+		for (const char* format = record.format; *format; ++format)
+		{
+			if (format[0] == '{' && format[1] == '}' && argument_index < record.argument_count)
+			{
+				FormatArgument(line, record.arguments[argument_index++]);
+				++format;
+			}
+			else
+				line << *format;
+		}
+	}
+	sink->Write(line.str());
+}
+
+void Logger::Start()
+{
+	std::lock_guard<std::mutex> lifecycle_lock(lifecycle_mutex);
+	std::lock_guard<std::mutex> lock(mutex);
+	StartWriter();
+}
+
+void Logger::Start(LogLevel level, const std::string& sink_name, const std::string& sink_file)
+{
+	std::lock_guard<std::mutex> lifecycle_lock(lifecycle_mutex);
+	std::lock_guard<std::mutex> lock(mutex);
+	if (references == 0)
+	{
+		this->level.store(level, std::memory_order_relaxed);
+		ReplaceSink(CreateLogSink(sink_name, sink_file));
+	}
+	StartWriter();
+}
+
+void Logger::StartWriter()
+{
+	if (references++ > 0)
+		return;
+	stopping = false;
+	thread = std::thread(&Logger::Run, this);
+}
+
+void Logger::Stop()
+{
+	std::lock_guard<std::mutex> lifecycle_lock(lifecycle_mutex);
+	std::unique_lock<std::mutex> lock(mutex);
+	if (references == 0 || --references > 0)
+		return;
+	stopping = true;
+	wakeup.notify_one();
+	std::thread writer = std::move(thread);
+	lock.unlock();
+	writer.join();
+
+	lock.lock();
+	Drain();
+	sink->Flush();
+}
+
+void Logger::Run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping)
+	{
+		// Real-time producers never signal us (that could mean a system call on the audio thread), so we also poll.
+		wakeup.wait_for(lock, std::chrono::milliseconds(20));
+		Drain();
+		sink->Flush();
+	}
+}
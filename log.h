@@ -0,0 +1,223 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+enum LogLevel
+{
+	LOG_LEVEL_OFF,
+	LOG_LEVEL_ERROR,
+	LOG_LEVEL_WARNING,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_DEBUG,
+	LOG_LEVEL_TRACE,
+};
+
+bool ParseLogLevel(const std::string& name, LogLevel* level);
+
+// Where formatted log lines end up. Sinks are only ever called from one thread at a time, so they don't need to be thread-safe.
+class LogSink
+{
+	public:
+		virtual ~LogSink() { }
+		virtual void Write(const std::string& line) = 0;
+		virtual void Flush() { }
+};
+
+class DebugOutputLogSink : public LogSink
+{
+	public:
+		virtual void Write(const std::string& line);
+};
+
+class FileLogSink : public LogSink
+{
+	public:
+		explicit FileLogSink(const std::string& path);
+		virtual ~FileLogSink();
+		bool IsOpen() const { return file != nullptr; }
+		virtual void Write(const std::string& line);
+		virtual void Flush();
+
+	private:
+		FileLogSink(const FileLogSink&);
+		FileLogSink& operator=(const FileLogSink&);
+
+		FILE* file;
+};
+
+class StderrLogSink : public LogSink
+{
+	public:
+		virtual void Write(const std::string& line);
+		virtual void Flush();
+};
+
+// Returns nullptr if the name is unknown or the sink cannot be opened.
+std::unique_ptr<LogSink> CreateLogSink(const std::string& name, const std::string& file);
+
+// Argument of a real-time log record. This is a POD on purpose so that it can live in a union inside the preallocated ring.
+struct LogArgument
+{
+	enum Type { TYPE_SIGNED, TYPE_UNSIGNED, TYPE_DOUBLE, TYPE_POINTER, TYPE_STRING };
+
+	Type type;
+	union
+	{
+		long long signed_value;
+		unsigned long long unsigned_value;
+		double double_value;
+		const void* pointer_value;
+		// Only the pointer is stored, so the string must outlive the record (string literals are the typical use case).
+		const char* string_value;
+	};
+};
+
+inline LogArgument MakeLogArgument(int value) { LogArgument argument; argument.type = LogArgument::TYPE_SIGNED; argument.signed_value = value; return argument; }
+inline LogArgument MakeLogArgument(long value) { LogArgument argument; argument.type = LogArgument::TYPE_SIGNED; argument.signed_value = value; return argument; }
+inline LogArgument MakeLogArgument(long long value) { LogArgument argument; argument.type = LogArgument::TYPE_SIGNED; argument.signed_value = value; return argument; }
+inline LogArgument MakeLogArgument(unsigned int value) { LogArgument argument; argument.type = LogArgument::TYPE_UNSIGNED; argument.unsigned_value = value; return argument; }
+inline LogArgument MakeLogArgument(unsigned long value) { LogArgument argument; argument.type = LogArgument::TYPE_UNSIGNED; argument.unsigned_value = value; return argument; }
+inline LogArgument MakeLogArgument(unsigned long long value) { LogArgument argument; argument.type = LogArgument::TYPE_UNSIGNED; argument.unsigned_value = value; return argument; }
+inline LogArgument MakeLogArgument(double value) { LogArgument argument; argument.type = LogArgument::TYPE_DOUBLE; argument.double_value = value; return argument; }
+inline LogArgument MakeLogArgument(const void* value) { LogArgument argument; argument.type = LogArgument::TYPE_POINTER; argument.pointer_value = value; return argument; }
+inline LogArgument MakeLogArgument(const char* value) { LogArgument argument; argument.type = LogArgument::TYPE_STRING; argument.string_value = value; return argument; }
+
+// A fixed-size binary log record. Real-time records carry a format string (which doubles as the format ID, since it's a literal with static lifetime) and its arguments.
+// Text records carry a preformatted line; they come from the non-real-time Log() frontend.
+struct LogRecord
+{
+	static const size_t max_arguments = 6;
+	static const size_t max_text_length = 191;
+
+	LogLevel level;
+	long long timestamp_us;
+	// nullptr for text records.
+	const char* format;
+	size_t argument_count;
+	union
+	{
+		LogArgument arguments[max_arguments];
+		char text[max_text_length + 1];
+	};
+};
+
+// Process-wide logger. Records are pushed into a preallocated lock-free ring and formatted/written by a background thread, so that pushing a record never allocates, locks or calls into the kernel.
+// The ring is a bounded multi-producer, single-consumer queue (Vyukov-style: each cell carries a sequence number that tells producers and the consumer whose turn it is).
+// If the ring is full the record is dropped and counted; the writer thread reports the number of dropped records the next time it runs.
+class Logger
+{
+	public:
+		static Logger& Get();
+
+		bool IsEnabled(LogLevel level) const { return level != LOG_LEVEL_OFF && level <= this->level.load(std::memory_order_relaxed); }
+		LogLevel GetLevel() const { return this->level.load(std::memory_order_relaxed); }
+		void SetLevel(LogLevel level) { this->level.store(level, std::memory_order_relaxed); }
+		// A null sink restores the default (debug output) sink.
+		void SetSink(std::unique_ptr<LogSink> sink);
+
+		// Real-time safe. "{}" placeholders in the format string are replaced by the arguments, in order.
+		template <typename... Arguments> void Push(LogLevel level, const char* format, Arguments... arguments)
+		{
+			static_assert(sizeof...(Arguments) <= LogRecord::max_arguments, "too many log arguments");
+			const LogArgument packed_arguments[] = { MakeLogArgument(arguments)..., LogArgument() };
+			PushRecord(level, format, packed_arguments, sizeof...(Arguments));
+		}
+
+		// Not real-time safe: may take a lock. Lines longer than LogRecord::max_text_length are truncated.
+		void Write(LogLevel level, const std::string& text);
+
+		// The writer thread runs for as long as there is at least one reference (see LoggerReference).
+		// Without a writer thread, text records are written synchronously and real-time records wait in the ring.
+		void Start();
+		// Same, but the first reference also sets the level and the sink (see CreateLogSink()). Later ones leave them alone, so that a driver instance created while another one is running (e.g. by a host that is only listing drivers) doesn't take the log away from it.
+		void Start(LogLevel level, const std::string& sink_name, const std::string& sink_file);
+		void Stop();
+
+	private:
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			LogRecord record;
+		};
+
+		static const size_t ring_size = 1024;
+
+		Logger();
+		~Logger();
+		Logger(const Logger&);
+		Logger& operator=(const Logger&);
+
+		// Both must be called with the mutex held.
+		void ReplaceSink(std::unique_ptr<LogSink> sink);
+		void StartWriter();
+
+		void PushRecord(LogLevel level, const char* format, const LogArgument* arguments, size_t argument_count);
+		Cell* Claim(size_t& position);
+		void Publish(Cell* cell, size_t position) { cell->sequence.store(position + 1, std::memory_order_release); }
+		// Must be called with the mutex held.
+		void Drain();
+		void WriteLine(const LogRecord& record);
+		void Run();
+
+		std::atomic<LogLevel> level;
+		std::unique_ptr<Cell[]> cells;
+		std::atomic<size_t> enqueue_position;
+		size_t dequeue_position;
+		std::atomic<unsigned long> dropped_records;
+
+		// Serializes Start() and Stop(), which release the main mutex while joining the writer thread.
+		std::mutex lifecycle_mutex;
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		std::unique_ptr<LogSink> sink;
+		std::thread thread;
+		size_t references;
+		bool stopping;
+};
+
+// Keeps the logger writer thread alive for the lifetime of the object.
+class LoggerReference
+{
+	public:
+		LoggerReference() { Logger::Get().Start(); }
+		// Configures the logger if there is no other reference (see Logger::Start()).
+		LoggerReference(LogLevel level, const std::string& sink_name, const std::string& sink_file) { Logger::Get().Start(level, sink_name, sink_file); }
+		~LoggerReference() { Logger::Get().Stop(); }
+
+	private:
+		LoggerReference(const LoggerReference&);
+		LoggerReference& operator=(const LoggerReference&);
+};
+
+// Real-time logging entry point. Only scalars and static strings can be passed; the check below makes the call essentially free when the level is disabled.
+template <typename... Arguments> void RealtimeLog(LogLevel level, const char* format, Arguments... arguments)
+{
+	Logger& logger = Logger::Get();
+	if (logger.IsEnabled(level))
+		logger.Push(level, format, arguments...);
+}
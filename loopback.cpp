@@ -0,0 +1,173 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "loopback.h"
+
+#include <cstring>
+#include <new>
+
+#include "util.h"
+
+namespace {
+// About a third of a second at 48 kHz. The rings are sized independently of the sample rate, so that the layout doesn't change when the host changes it.
+const unsigned long loopback_capacity = 16384;
+}
+
+Loopback::Loopback(const std::string& name, long input_channel_count, long output_channel_count) : mapping(NULL), private_data(NULL), section(nullptr)
+{
+	const size_t size = LoopbackSection::GetSize(loopback_capacity, output_channel_count, input_channel_count);
+	if (!OpenSharedMemory(name, size, input_channel_count, output_channel_count))
+	{
+		private_data = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (!private_data)
+			throw std::bad_alloc();
+		section = static_cast<LoopbackSection*>(private_data);
+	}
+
+	// A new section is all zeroes. An existing one has been checked by OpenSharedMemory(): it was left over by a previous instance, and kept alive by clients that still have it open, which can carry on if we pick it up as it is.
+	if (mapping && memcmp(section->magic, "FlexASIO", sizeof(section->magic)) == 0)
+		Log() << "Taking over existing loopback section " << shared_memory_name;
+	else
+	{
+		section = new (section) LoopbackSection;
+		memcpy(section->magic, "FlexASIO", sizeof(section->magic));
+		section->version = LoopbackSection::current_version;
+		section->size = static_cast<unsigned long>(size);
+		section->sample_rate.store(0);
+		section->capacity = loopback_capacity;
+		section->to_client_channel_count = output_channel_count;
+		section->from_client_channel_count = input_channel_count;
+		LoopbackRing* const rings[] = { &section->to_client, &section->from_client };
+		for (size_t ring_index = 0; ring_index < 2; ++ring_index)
+		{
+			rings[ring_index]->write_position.store(0);
+			rings[ring_index]->read_position.store(0);
+			rings[ring_index]->client_attached.store(0);
+			rings[ring_index]->underrun_count.store(0);
+			rings[ring_index]->overrun_count.store(0);
+		}
+	}
+	section->driver_process_id.store(mapping ? GetCurrentProcessId() : 0);
+}
+
+Loopback::~Loopback()
+{
+	if (mapping)
+	{
+		section->driver_process_id.store(0);
+		UnmapViewOfFile(section);
+		CloseHandle(mapping);
+	}
+	else
+		VirtualFree(private_data, 0, MEM_RELEASE);
+}
+
+bool Loopback::OpenSharedMemory(const std::string& name, size_t size, long input_channel_count, long output_channel_count)
+{
+	const std::string section_name = "Local\\FlexASIO-Loopback-" + name;
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, static_cast<DWORD>(size), section_name.c_str());
+	if (!mapping)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to create loopback section " << section_name << ", loopback channels will be silent";
+		return false;
+	}
+	const bool existing = GetLastError() == ERROR_ALREADY_EXISTS;
+	section = static_cast<LoopbackSection*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+	if (!section)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to map loopback section " << section_name << ", loopback channels will be silent";
+		CloseHandle(mapping);
+		mapping = NULL;
+		return false;
+	}
+
+	if (existing)
+	{
+		// An existing section is at least as large as we asked for, otherwise the view couldn't have been mapped.
+		const DWORD owner_process_id = section->driver_process_id.load();
+		const bool compatible = memcmp(section->magic, "FlexASIO", sizeof(section->magic)) == 0 && section->version == LoopbackSection::current_version && section->size == size &&
+			section->from_client_channel_count == static_cast<unsigned long>(input_channel_count) && section->to_client_channel_count == static_cast<unsigned long>(output_channel_count);
+		const bool in_use = owner_process_id != 0 && (owner_process_id == GetCurrentProcessId() || IsProcessRunning(owner_process_id));
+		if (!compatible || in_use)
+		{
+			Log(LOG_LEVEL_ERROR) << "Loopback section " << section_name << " is " << (in_use ? "already used by another driver instance" : "left over from a different configuration, and still open in some client") << "; loopback channels will be silent";
+			UnmapViewOfFile(section);
+			CloseHandle(mapping);
+			mapping = NULL;
+			section = nullptr;
+			return false;
+		}
+	}
+
+	shared_memory_name = section_name;
+	return true;
+}
+
+Loopback::Status Loopback::GetStatus() const
+{
+	Status status;
+	status.input_client_attached = section->from_client.client_attached.load() != 0;
+	status.output_client_attached = section->to_client.client_attached.load() != 0;
+	status.input_level = static_cast<size_t>(section->from_client.write_position.load() - section->from_client.read_position.load());
+	status.output_level = static_cast<size_t>(section->to_client.write_position.load() - section->to_client.read_position.load());
+	status.input_underrun_count = section->from_client.underrun_count.load();
+	status.output_overrun_count = section->to_client.overrun_count.load();
+	return status;
+}
+
+void Loopback::PullInput(float* const* channels, size_t frames)
+{
+	const unsigned long channel_count = section->from_client_channel_count;
+	LoopbackRing& ring = section->from_client;
+	size_t available_frames = 0;
+	if (ring.client_attached.load(std::memory_order_acquire))
+	{
+		const unsigned long long read_position = ring.read_position.load(std::memory_order_relaxed);
+		available_frames = static_cast<size_t>((std::min)(static_cast<unsigned long long>(frames), ring.write_position.load(std::memory_order_acquire) - read_position));
+		section->VisitRegions(read_position, available_frames, [&](size_t ring_offset, size_t frame_offset, size_t frame_count) {
+			for (unsigned long channel = 0; channel < channel_count; ++channel)
+				memcpy(channels[channel] + frame_offset, section->GetFromClientChannel(channel) + ring_offset, frame_count * sizeof(float));
+		});
+		ring.read_position.store(read_position + available_frames, std::memory_order_release);
+		if (available_frames < frames)
+			ring.underrun_count.store(ring.underrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+	if (available_frames < frames)
+		for (unsigned long channel = 0; channel < channel_count; ++channel)
+			memset(channels[channel] + available_frames, 0, (frames - available_frames) * sizeof(float));
+}
+
+void Loopback::PushOutput(const float* const* channels, size_t frames)
+{
+	const unsigned long channel_count = section->to_client_channel_count;
+	LoopbackRing& ring = section->to_client;
+	if (!ring.client_attached.load(std::memory_order_acquire))
+		return;
+
+	const unsigned long long write_position = ring.write_position.load(std::memory_order_relaxed);
+	const size_t free_frames = static_cast<size_t>(section->capacity - (write_position - ring.read_position.load(std::memory_order_acquire)));
+	const size_t written_frames = (std::min)(frames, free_frames);
+	section->VisitRegions(write_position, written_frames, [&](size_t ring_offset, size_t frame_offset, size_t frame_count) {
+		for (unsigned long channel = 0; channel < channel_count; ++channel)
+			memcpy(section->GetToClientChannel(channel) + ring_offset, channels[channel] + frame_offset, frame_count * sizeof(float));
+	});
+	ring.write_position.store(write_position + written_frames, std::memory_order_release);
+	if (written_frames < frames)
+		ring.overrun_count.store(ring.overrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
@@ -0,0 +1,128 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <windows.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+// Loopback sections let other processes on the same machine exchange audio with the driver through extra device channels (see Config::loopback_input_channels), without a separate virtual cable.
+// A section is a named file mapping, "Local\FlexASIO-Loopback-<name>", which holds a LoopbackSection followed by the samples. Clients should check magic, version and size first (LoopbackClient does).
+// Each direction is a single-producer, single-consumer ring with the same protocol as SampleRing: positions are free-running frame counters, each advanced by one side only, so neither side ever waits for the other.
+
+// Calls function(ring_offset, frame_offset, frame_count) for each contiguous region (there are at most two) of the frames starting at position, in a ring of capacity frames.
+template <typename Function> void VisitRingRegions(size_t capacity, unsigned long long position, size_t frames, Function function)
+{
+	const size_t ring_offset = static_cast<size_t>(position % capacity);
+	const size_t first_frames = (std::min)(frames, capacity - ring_offset);
+	if (first_frames > 0)
+		function(ring_offset, 0, first_frames);
+	if (first_frames < frames)
+		function(0, first_frames, frames - first_frames);
+}
+
+struct LoopbackRing
+{
+	// In frames. Each side gets its own cache line, so that they don't slow each other down.
+	alignas(64) std::atomic<unsigned long long> write_position;
+	alignas(64) std::atomic<unsigned long long> read_position;
+	// Non-zero while a client is attached to its end of the ring. The driver doesn't touch the ring otherwise, so that a client can pick up from the driver's position when it attaches.
+	alignas(64) std::atomic<unsigned long> client_attached;
+	// Times the consumer needed more frames than there were, and times the producer couldn't write everything because the ring was full. Each is written by its own side.
+	std::atomic<unsigned long long> underrun_count;
+	std::atomic<unsigned long long> overrun_count;
+};
+
+struct LoopbackSection
+{
+	static const unsigned long current_version = 1;
+
+	// "FlexASIO", not null-terminated.
+	char magic[8];
+	unsigned long version;
+	// Of the whole section, samples included (see GetSize()).
+	unsigned long size;
+	// The driver process that currently owns the section, 0 if none.
+	std::atomic<unsigned long> driver_process_id;
+	// The rate of the frames in the rings, i.e. the rate the devices run at. Changes when the host changes the sample rate; 0 until the first stream.
+	std::atomic<double> sample_rate;
+	// In frames, for both rings.
+	unsigned long capacity;
+	// Driver output channels, which clients read, and driver input channels, which clients write.
+	unsigned long to_client_channel_count;
+	unsigned long from_client_channel_count;
+	LoopbackRing to_client;
+	LoopbackRing from_client;
+
+	static size_t GetSize(unsigned long capacity, unsigned long to_client_channel_count, unsigned long from_client_channel_count) { return sizeof(LoopbackSection) + (to_client_channel_count + from_client_channel_count) * capacity * sizeof(float); }
+	// The samples follow this header, non-interleaved: capacity frames for each to_client channel, then for each from_client channel.
+	float* GetToClientChannel(unsigned long channel) { return reinterpret_cast<float*>(this + 1) + channel * capacity; }
+	float* GetFromClientChannel(unsigned long channel) { return reinterpret_cast<float*>(this + 1) + (to_client_channel_count + channel) * capacity; }
+
+	template <typename Function> void VisitRegions(unsigned long long position, size_t frames, Function function) const { VisitRingRegions(capacity, position, frames, function); }
+};
+
+// The driver side of a loopback section. It is clocked by the stream callback: input is pulled from clients and output is pushed to them once per callback, at the device sample rate.
+// If the section can't be created (e.g. another driver instance is using the same name), the channels still exist, but they live in private memory and no client can attach.
+class Loopback
+{
+	public:
+		struct Status
+		{
+			bool input_client_attached;
+			bool output_client_attached;
+			// Frames currently waiting in each ring.
+			size_t input_level;
+			size_t output_level;
+			// Callbacks for which the input client hadn't written enough, and for which the output client hadn't read enough to make room.
+			unsigned long long input_underrun_count;
+			unsigned long long output_overrun_count;
+		};
+
+		Loopback(const std::string& name, long input_channel_count, long output_channel_count);
+		~Loopback();
+
+		long GetInputChannelCount() const { return static_cast<long>(section->from_client_channel_count); }
+		long GetOutputChannelCount() const { return static_cast<long>(section->to_client_channel_count); }
+		// Empty if the section is in private memory.
+		const std::string& GetSharedMemoryName() const { return shared_memory_name; }
+		void SetSampleRate(double sample_rate) { section->sample_rate.store(sample_rate); }
+		// Can be called from any thread.
+		Status GetStatus() const;
+
+		// Real-time safe, called from the stream callback. Frames the input client didn't provide are silent; frames the output client doesn't have room for are dropped.
+		void PullInput(float* const* channels, size_t frames);
+		void PushOutput(const float* const* channels, size_t frames);
+
+	private:
+		Loopback(const Loopback&);
+		Loopback& operator=(const Loopback&);
+
+		// Leaves section null and returns false if the section can't be used.
+		bool OpenSharedMemory(const std::string& name, size_t size, long input_channel_count, long output_channel_count);
+
+		HANDLE mapping;
+		std::string shared_memory_name;
+		// Page-aligned, as the section would be if it were mapped.
+		void* private_data;
+		LoopbackSection* section;
+};
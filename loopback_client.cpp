@@ -0,0 +1,111 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "loopback_client.h"
+
+#include <cstring>
+
+LoopbackClient::LoopbackClient() : mapping(NULL), section(nullptr), reading(false), writing(false) { }
+
+LoopbackClient::~LoopbackClient()
+{
+	Disconnect();
+}
+
+bool LoopbackClient::Connect(const std::string& name, bool read, bool write)
+{
+	Disconnect();
+	const std::string section_name = "Local\\FlexASIO-Loopback-" + name;
+	mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, section_name.c_str());
+	if (!mapping)
+		return false;
+	// Map the header first, to find out how large the section is.
+	LoopbackSection* header = static_cast<LoopbackSection*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(LoopbackSection)));
+	const bool compatible = header && memcmp(header->magic, "FlexASIO", sizeof(header->magic)) == 0 && header->version == LoopbackSection::current_version &&
+		header->size == LoopbackSection::GetSize(header->capacity, header->to_client_channel_count, header->from_client_channel_count);
+	const size_t size = compatible ? header->size : 0;
+	if (header)
+		UnmapViewOfFile(header);
+	section = compatible ? static_cast<LoopbackSection*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size)) : nullptr;
+	if (!section)
+	{
+		CloseHandle(mapping);
+		mapping = NULL;
+		return false;
+	}
+
+	// Each side only ever moves its own position, so we start from wherever the driver is: nothing to read yet, and nothing written ahead.
+	if (read)
+	{
+		section->to_client.read_position.store(section->to_client.write_position.load());
+		section->to_client.client_attached.store(1);
+		reading = true;
+	}
+	if (write)
+	{
+		section->from_client.write_position.store(section->from_client.read_position.load());
+		section->from_client.client_attached.store(1);
+		writing = true;
+	}
+	return true;
+}
+
+void LoopbackClient::Disconnect()
+{
+	if (!section)
+		return;
+	if (reading)
+		section->to_client.client_attached.store(0);
+	if (writing)
+		section->from_client.client_attached.store(0);
+	reading = false;
+	writing = false;
+	UnmapViewOfFile(section);
+	CloseHandle(mapping);
+	section = nullptr;
+	mapping = NULL;
+}
+
+size_t LoopbackClient::Read(float* const* channels, size_t frames)
+{
+	const size_t read_frames = (std::min)(frames, GetReadAvailable());
+	const size_t channel_count = GetReadChannelCount();
+	VisitRead(read_frames, [&](size_t ring_offset, size_t frame_offset, size_t frame_count) {
+		for (size_t channel = 0; channel < channel_count; ++channel)
+			memcpy(channels[channel] + frame_offset, GetReadChannel(channel) + ring_offset, frame_count * sizeof(float));
+	});
+	CommitRead(read_frames);
+	if (read_frames < frames)
+		section->to_client.underrun_count.store(section->to_client.underrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	return read_frames;
+}
+
+size_t LoopbackClient::Write(const float* const* channels, size_t frames)
+{
+	const size_t written_frames = (std::min)(frames, GetWriteAvailable());
+	const size_t channel_count = GetWriteChannelCount();
+	VisitWrite(written_frames, [&](size_t ring_offset, size_t frame_offset, size_t frame_count) {
+		for (size_t channel = 0; channel < channel_count; ++channel)
+			memcpy(GetWriteChannel(channel) + ring_offset, channels[channel] + frame_offset, frame_count * sizeof(float));
+	});
+	CommitWrite(written_frames);
+	if (written_frames < frames)
+		section->from_client.overrun_count.store(section->from_client.overrun_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	return written_frames;
+}
@@ -0,0 +1,76 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <string>
+
+#include "loopback.h"
+
+// Lets another process exchange audio with a running FlexASIO instance through its loopback channels (see Config::loopback_input_channels).
+// This only depends on loopback.h and loopback_client.cpp, so that client programs can compile it in without the rest of the driver.
+// A client can attach to either direction, or both; there can only be one client per direction at a time. Samples are read and written in place in the shared memory section.
+// The rings are clocked by the driver, and there is no wakeup: clients are expected to poll, typically every millisecond or so.
+class LoopbackClient
+{
+	public:
+		LoopbackClient();
+		// Detaches.
+		~LoopbackClient();
+
+		// name is the LoopbackName of the driver instance. read attaches to the driver outputs, write to the driver inputs.
+		// Returns false if the driver hasn't created the section yet (that happens in createBuffers()), or if it is not compatible with this client.
+		bool Connect(const std::string& name, bool read, bool write);
+		void Disconnect();
+
+		// The rate the frames flow at. Can change while connected, if the host changes the sample rate; 0 while the driver has never run a stream.
+		double GetSampleRate() const { return section->sample_rate.load(); }
+		// In frames, for both directions.
+		size_t GetCapacity() const { return section->capacity; }
+		// False once the driver instance is gone. The section stays valid, and a new driver instance with the same configuration picks it up.
+		bool IsDriverRunning() const { return section->driver_process_id.load() != 0; }
+
+		// Read side: driver outputs.
+		size_t GetReadChannelCount() const { return section->to_client_channel_count; }
+		size_t GetReadAvailable() const { return static_cast<size_t>(section->to_client.write_position.load(std::memory_order_acquire) - section->to_client.read_position.load(std::memory_order_relaxed)); }
+		const float* GetReadChannel(size_t channel) const { return section->GetToClientChannel(static_cast<unsigned long>(channel)); }
+		// Calls function(ring_offset, frame_offset, frame_count) for each contiguous region of the next frames to read, which are at GetReadChannel(channel) + ring_offset.
+		template <typename Function> void VisitRead(size_t frames, Function function) const { section->VisitRegions(section->to_client.read_position.load(std::memory_order_relaxed), frames, function); }
+		void CommitRead(size_t frames) { section->to_client.read_position.store(section->to_client.read_position.load(std::memory_order_relaxed) + frames, std::memory_order_release); }
+		// Copies up to frames frames to channels[channel], and returns how many. Counts an underrun if there weren't enough.
+		size_t Read(float* const* channels, size_t frames);
+
+		// Write side: driver inputs.
+		size_t GetWriteChannelCount() const { return section->from_client_channel_count; }
+		size_t GetWriteAvailable() const { return static_cast<size_t>(section->capacity - (section->from_client.write_position.load(std::memory_order_relaxed) - section->from_client.read_position.load(std::memory_order_acquire))); }
+		float* GetWriteChannel(size_t channel) { return section->GetFromClientChannel(static_cast<unsigned long>(channel)); }
+		template <typename Function> void VisitWrite(size_t frames, Function function) const { section->VisitRegions(section->from_client.write_position.load(std::memory_order_relaxed), frames, function); }
+		void CommitWrite(size_t frames) { section->from_client.write_position.store(section->from_client.write_position.load(std::memory_order_relaxed) + frames, std::memory_order_release); }
+		// Copies up to frames frames from channels[channel], and returns how many. Counts an overrun if they didn't all fit.
+		size_t Write(const float* const* channels, size_t frames);
+
+	private:
+		LoopbackClient(const LoopbackClient&);
+		LoopbackClient& operator=(const LoopbackClient&);
+
+		HANDLE mapping;
+		LoopbackSection* section;
+		bool reading;
+		bool writing;
+};
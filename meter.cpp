@@ -0,0 +1,198 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "meter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <sstream>
+
+#include "meter_kernels.h"
+
+namespace {
+const MeterKernels& GetMeterKernels(InstructionSet instruction_set)
+{
+	switch (instruction_set)
+	{
+#ifdef FLEXASIO_X86
+		case INSTRUCTION_SET_AVX2: return avx2_meter_kernels;
+		case INSTRUCTION_SET_SSE2: return sse2_meter_kernels;
+#endif
+		default: return scalar_meter_kernels;
+	}
+}
+}
+
+void MeasureSamplesScalar(const float* samples, size_t count, SampleLevels* levels)
+{
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+	{
+		const float magnitude = std::fabs(samples[sample_index]);
+		if (magnitude > levels->peak)
+			levels->peak = magnitude;
+		levels->sum_of_squares += samples[sample_index] * samples[sample_index];
+		if (magnitude >= 1.0f)
+			++levels->clip_count;
+	}
+}
+
+const MeterKernels scalar_meter_kernels = { MeasureSamplesScalar };
+
+Meters::Meters(long input_channel_count, long output_channel_count, InstructionSet instruction_set) :
+	mapping(NULL), private_data(NULL), data(nullptr), levels(new SampleLevels[input_channel_count + output_channel_count]), measured_frames(0)
+{
+	if (instruction_set > GetBestInstructionSet())
+		instruction_set = GetBestInstructionSet();
+	measure = GetMeterKernels(instruction_set).measure;
+
+	const size_t size = MeterData::GetSize(input_channel_count, output_channel_count);
+	std::stringstream name;
+	name << "Local\\FlexASIO-Meters-" << GetCurrentProcessId();
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, static_cast<DWORD>(size), name.str().c_str());
+	// If the section already exists, it belongs to another instance of the driver in this process, which is still using it.
+	if (mapping && GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		CloseHandle(mapping);
+		mapping = NULL;
+	}
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : nullptr;
+	if (view)
+		shared_memory_name = name.str();
+	else
+	{
+		if (mapping)
+		{
+			CloseHandle(mapping);
+			mapping = NULL;
+		}
+		private_data = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (!private_data)
+			throw std::bad_alloc();
+		view = private_data;
+	}
+
+	data = new (view) MeterData;
+	memcpy(data->magic, "FlexASIO", sizeof(data->magic));
+	data->version = MeterData::current_version;
+	data->size = static_cast<unsigned long>(size);
+	data->input_channel_count = input_channel_count;
+	data->output_channel_count = output_channel_count;
+	data->sequence.store(0);
+	for (long channel = 0; channel < input_channel_count + output_channel_count; ++channel)
+		new (data->GetChannels() + channel) MeterChannel;
+	Reset();
+}
+
+Meters::~Meters()
+{
+	if (mapping)
+	{
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+	}
+	else
+		VirtualFree(private_data, 0, MEM_RELEASE);
+}
+
+void Meters::Reset()
+{
+	const size_t channel_count = data->input_channel_count + data->output_channel_count;
+	const unsigned long sequence = data->sequence.load(std::memory_order_relaxed);
+	data->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (size_t channel = 0; channel < channel_count; ++channel)
+	{
+		MeterChannel& meter_channel = data->GetChannels()[channel];
+		meter_channel.peak.store(0, std::memory_order_relaxed);
+		meter_channel.rms.store(0, std::memory_order_relaxed);
+		meter_channel.max_peak.store(0, std::memory_order_relaxed);
+		meter_channel.clip_count.store(0, std::memory_order_relaxed);
+		const SampleLevels empty_levels = { 0, 0, 0 };
+		levels[channel] = empty_levels;
+	}
+	data->update_count.store(0, std::memory_order_relaxed);
+	data->sequence.store(sequence + 2, std::memory_order_release);
+	measured_frames = 0;
+}
+
+void Meters::Measure(const float* const* input, const float* const* output, size_t frames)
+{
+	const unsigned long input_channel_count = data->input_channel_count;
+	const unsigned long output_channel_count = data->output_channel_count;
+	if (input)
+		for (unsigned long channel = 0; channel < input_channel_count; ++channel)
+			measure(input[channel], frames, &levels[channel]);
+	if (output)
+		for (unsigned long channel = 0; channel < output_channel_count; ++channel)
+			measure(output[channel], frames, &levels[input_channel_count + channel]);
+	measured_frames += frames;
+}
+
+void Meters::Publish()
+{
+	if (measured_frames == 0)
+		return;
+	const size_t channel_count = data->input_channel_count + data->output_channel_count;
+	const unsigned long sequence = data->sequence.load(std::memory_order_relaxed);
+	// An odd sequence number tells readers a write is in progress.
+	data->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (size_t channel = 0; channel < channel_count; ++channel)
+	{
+		MeterChannel& meter_channel = data->GetChannels()[channel];
+		SampleLevels& channel_levels = levels[channel];
+		meter_channel.peak.store(channel_levels.peak, std::memory_order_relaxed);
+		meter_channel.rms.store(std::sqrt(channel_levels.sum_of_squares / measured_frames), std::memory_order_relaxed);
+		if (channel_levels.peak > meter_channel.max_peak.load(std::memory_order_relaxed))
+			meter_channel.max_peak.store(channel_levels.peak, std::memory_order_relaxed);
+		if (channel_levels.clip_count > 0)
+			meter_channel.clip_count.store(meter_channel.clip_count.load(std::memory_order_relaxed) + channel_levels.clip_count, std::memory_order_relaxed);
+		const SampleLevels empty_levels = { 0, 0, 0 };
+		channel_levels = empty_levels;
+	}
+	data->update_count.store(data->update_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	data->sequence.store(sequence + 2, std::memory_order_release);
+	measured_frames = 0;
+}
+
+unsigned long long Meters::GetLevels(Levels* input_levels, size_t input_count, Levels* output_levels, size_t output_count) const
+{
+	const size_t input_channel_count = data->input_channel_count;
+	input_count = (std::min)(input_count, input_channel_count);
+	output_count = (std::min)(output_count, static_cast<size_t>(data->output_channel_count));
+	for (;;)
+	{
+		const unsigned long sequence_before = data->sequence.load(std::memory_order_acquire);
+		for (size_t channel = 0; channel < input_count + output_count; ++channel)
+		{
+			const MeterChannel& meter_channel = data->GetChannels()[channel < input_count ? channel : input_channel_count + channel - input_count];
+			Levels& channel_levels = channel < input_count ? input_levels[channel] : output_levels[channel - input_count];
+			channel_levels.peak = meter_channel.peak.load(std::memory_order_relaxed);
+			channel_levels.rms = meter_channel.rms.load(std::memory_order_relaxed);
+			channel_levels.max_peak = meter_channel.max_peak.load(std::memory_order_relaxed);
+			channel_levels.clip_count = meter_channel.clip_count.load(std::memory_order_relaxed);
+		}
+		const unsigned long long update_count = data->update_count.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if ((sequence_before & 1) == 0 && data->sequence.load(std::memory_order_relaxed) == sequence_before)
+			return update_count;
+	}
+}
@@ -0,0 +1,111 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <windows.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "convert.h"
+
+struct SampleLevels;
+
+// Levels of one device channel, as published by Meters.
+struct MeterChannel
+{
+	// Largest absolute sample value, and RMS level, over the last callback. Full scale is 1.
+	std::atomic<float> peak;
+	std::atomic<float> rms;
+	// Largest peak, and samples at or beyond full scale, since the meters were last reset.
+	std::atomic<float> max_peak;
+	std::atomic<unsigned long long> clip_count;
+};
+
+// Per-channel levels of the device channels, as they cross the stream callback. This is laid out so that it can live in shared memory and be read directly by other processes (see Meters); readers should check magic, version and size first.
+// The channels follow this header: inputs, then outputs, aggregate devices and loopback channels included.
+// The audio thread updates all channels at once under sequence, with the same protocol as SeqLock: readers retry if sequence was odd, or changed while they were reading.
+struct MeterData
+{
+	static const unsigned long current_version = 1;
+
+	// "FlexASIO", not null-terminated.
+	char magic[8];
+	unsigned long version;
+	// Of the whole block, channels included (see GetSize()).
+	unsigned long size;
+	unsigned long input_channel_count;
+	unsigned long output_channel_count;
+	std::atomic<unsigned long> sequence;
+	// Callbacks measured so far. Readers can tell from this whether the levels are fresh.
+	std::atomic<unsigned long long> update_count;
+
+	static size_t GetSize(unsigned long input_channel_count, unsigned long output_channel_count) { return sizeof(MeterData) + (input_channel_count + output_channel_count) * sizeof(MeterChannel); }
+	MeterChannel* GetChannels() { return reinterpret_cast<MeterChannel*>(this + 1); }
+	const MeterChannel* GetChannels() const { return reinterpret_cast<const MeterChannel*>(this + 1); }
+};
+
+// Owns the MeterData of a driver instance (see Config::metering). As with StreamStatistics, the data is placed in a named shared memory section, "Local\FlexASIO-Meters-<process ID>", so that level meters can run outside the host, or in private memory if that's not possible.
+class Meters
+{
+	public:
+		struct Levels
+		{
+			float peak;
+			float rms;
+			float max_peak;
+			unsigned long long clip_count;
+		};
+
+		Meters(long input_channel_count, long output_channel_count, InstructionSet instruction_set = GetBestInstructionSet());
+		~Meters();
+
+		long GetInputChannelCount() const { return static_cast<long>(data->input_channel_count); }
+		long GetOutputChannelCount() const { return static_cast<long>(data->output_channel_count); }
+		// Empty if the meters are not in shared memory.
+		const std::string& GetSharedMemoryName() const { return shared_memory_name; }
+		// Only safe while the audio thread is not running.
+		void Reset();
+
+		// Real-time safe, and must be called from a single thread. Measure() adds frames to the current callback, which can be measured in several pieces; Publish() then makes the levels of the whole callback visible.
+		// input and output are null if there are no channels in that direction.
+		void Measure(const float* const* input, const float* const* output, size_t frames);
+		void Publish();
+
+		// Can be called from any thread. Fills up to input_count and output_count channels, and returns the update count (see MeterData).
+		unsigned long long GetLevels(Levels* input_levels, size_t input_count, Levels* output_levels, size_t output_count) const;
+
+	private:
+		Meters(const Meters&);
+		Meters& operator=(const Meters&);
+
+		// See meter_kernels.h.
+		typedef void (*MeasureSamplesFunction)(const float* samples, size_t count, SampleLevels* levels);
+
+		HANDLE mapping;
+		std::string shared_memory_name;
+		void* private_data;
+		MeterData* data;
+		MeasureSamplesFunction measure;
+		// Accumulated over the current callback, inputs then outputs.
+		std::unique_ptr<SampleLevels[]> levels;
+		size_t measured_frames;
+};
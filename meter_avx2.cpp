@@ -0,0 +1,72 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// These kernels must only be called after checking for CPU support, which Meters takes care of.
+// As with convert_avx2.cpp, this file is deliberately *not* built with /arch:AVX2.
+
+#include "meter_kernels.h"
+
+#ifdef FLEXASIO_X86
+
+#if defined(__GNUC__) && !defined(__AVX2__)
+#pragma GCC target("avx2")
+#endif
+
+#include <immintrin.h>
+
+namespace {
+void MeasureSamples(const float* samples, size_t count, SampleLevels* levels)
+{
+	const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+	const __m256 full_scale = _mm256_set1_ps(1.0f);
+	__m256 peaks = _mm256_setzero_ps();
+	__m256 sums = _mm256_setzero_ps();
+	// Comparisons give all ones, i.e. -1, for each sample that clips.
+	__m256i clip_counts = _mm256_setzero_si256();
+	size_t sample_index = 0;
+	for (; sample_index + 8 <= count; sample_index += 8)
+	{
+		const __m256 values = _mm256_loadu_ps(samples + sample_index);
+		const __m256 magnitudes = _mm256_andnot_ps(sign_mask, values);
+		// As in the SSE2 kernel, NaN samples are ignored.
+		peaks = _mm256_max_ps(magnitudes, peaks);
+		sums = _mm256_add_ps(sums, _mm256_mul_ps(values, values));
+		clip_counts = _mm256_sub_epi32(clip_counts, _mm256_castps_si256(_mm256_cmp_ps(magnitudes, full_scale, _CMP_GE_OQ)));
+	}
+
+	float peak_lanes[8];
+	float sum_lanes[8];
+	unsigned int clip_count_lanes[8];
+	_mm256_storeu_ps(peak_lanes, peaks);
+	_mm256_storeu_ps(sum_lanes, sums);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(clip_count_lanes), clip_counts);
+	for (size_t lane = 0; lane < 8; ++lane)
+	{
+		if (peak_lanes[lane] > levels->peak)
+			levels->peak = peak_lanes[lane];
+		levels->sum_of_squares += sum_lanes[lane];
+		levels->clip_count += clip_count_lanes[lane];
+	}
+	MeasureSamplesScalar(samples + sample_index, count - sample_index, levels);
+}
+}
+
+const MeterKernels avx2_meter_kernels = { MeasureSamples };
+
+#endif
@@ -0,0 +1,57 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// Internal to the meters. Use meter.h instead.
+
+#include <cstddef>
+
+#include "convert.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FLEXASIO_X86 1
+#endif
+
+// Running measurements of a channel, which the kernels add to.
+struct SampleLevels
+{
+	// Largest absolute sample value.
+	float peak;
+	float sum_of_squares;
+	// Samples at or beyond full scale.
+	unsigned long clip_count;
+};
+
+// Adds count samples to *levels.
+typedef void (*MeasureSamplesFunction)(const float* samples, size_t count, SampleLevels* levels);
+
+// Unlike the conversion and mixing kernels, these are not bit-exact across instruction sets: the vectorized kernels add up squares in a different order. Peaks and clip counts are exact.
+struct MeterKernels
+{
+	MeasureSamplesFunction measure;
+};
+
+extern const MeterKernels scalar_meter_kernels;
+#ifdef FLEXASIO_X86
+extern const MeterKernels sse2_meter_kernels;
+extern const MeterKernels avx2_meter_kernels;
+#endif
+
+void MeasureSamplesScalar(const float* samples, size_t count, SampleLevels* levels);
@@ -0,0 +1,65 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "meter_kernels.h"
+
+#ifdef FLEXASIO_X86
+
+#include <emmintrin.h>
+
+namespace {
+void MeasureSamples(const float* samples, size_t count, SampleLevels* levels)
+{
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	const __m128 full_scale = _mm_set1_ps(1.0f);
+	__m128 peaks = _mm_setzero_ps();
+	__m128 sums = _mm_setzero_ps();
+	// Comparisons give all ones, i.e. -1, for each sample that clips.
+	__m128i clip_counts = _mm_setzero_si128();
+	size_t sample_index = 0;
+	for (; sample_index + 4 <= count; sample_index += 4)
+	{
+		const __m128 values = _mm_loadu_ps(samples + sample_index);
+		const __m128 magnitudes = _mm_andnot_ps(sign_mask, values);
+		// maxps returns its second operand if either is NaN, so NaN samples are ignored, as in the scalar kernel.
+		peaks = _mm_max_ps(magnitudes, peaks);
+		sums = _mm_add_ps(sums, _mm_mul_ps(values, values));
+		clip_counts = _mm_sub_epi32(clip_counts, _mm_castps_si128(_mm_cmpge_ps(magnitudes, full_scale)));
+	}
+
+	float peak_lanes[4];
+	float sum_lanes[4];
+	unsigned int clip_count_lanes[4];
+	_mm_storeu_ps(peak_lanes, peaks);
+	_mm_storeu_ps(sum_lanes, sums);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(clip_count_lanes), clip_counts);
+	for (size_t lane = 0; lane < 4; ++lane)
+	{
+		if (peak_lanes[lane] > levels->peak)
+			levels->peak = peak_lanes[lane];
+		levels->sum_of_squares += sum_lanes[lane];
+		levels->clip_count += clip_count_lanes[lane];
+	}
+	MeasureSamplesScalar(samples + sample_index, count - sample_index, levels);
+}
+}
+
+const MeterKernels sse2_meter_kernels = { MeasureSamples };
+
+#endif
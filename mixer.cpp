@@ -0,0 +1,173 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "mixer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <locale>
+#include <sstream>
+
+#include "mixer_kernels.h"
+
+namespace {
+const MixKernels& GetMixKernels(InstructionSet instruction_set)
+{
+	switch (instruction_set)
+	{
+#ifdef FLEXASIO_X86
+		case INSTRUCTION_SET_AVX2: return avx2_mix_kernels;
+		case INSTRUCTION_SET_SSE2: return sse2_mix_kernels;
+#endif
+		default: return scalar_mix_kernels;
+	}
+}
+
+bool ParseGain(const std::string& text, float* gain)
+{
+	// The host might have changed the C locale, and a comma decimal separator would be ambiguous here anyway.
+	std::istringstream stream(text);
+	stream.imbue(std::locale::classic());
+	stream >> *gain;
+	if (stream.fail())
+		return false;
+	stream >> std::ws;
+	return stream.eof();
+}
+}
+
+void ScaleSamplesScalar(float* destination, const float* source, float gain, size_t count)
+{
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+		destination[sample_index] = gain * source[sample_index];
+}
+
+void MultiplyAddSamplesScalar(float* destination, const float* source, float gain, size_t count)
+{
+	for (size_t sample_index = 0; sample_index < count; ++sample_index)
+		destination[sample_index] = destination[sample_index] + gain * source[sample_index];
+}
+
+const MixKernels scalar_mix_kernels = { ScaleSamplesScalar, MultiplyAddSamplesScalar };
+
+bool ParseMixingMatrix(const std::string& text, MixingMatrix* matrix)
+{
+	matrix->clear();
+	std::istringstream rows(text);
+	std::string row_text;
+	while (std::getline(rows, row_text, ';'))
+	{
+		std::vector<float> row;
+		std::istringstream gains(row_text);
+		std::string gain_text;
+		while (std::getline(gains, gain_text, ','))
+		{
+			float gain;
+			if (!ParseGain(gain_text, &gain))
+				return false;
+			row.push_back(gain);
+		}
+		matrix->push_back(row);
+	}
+
+	size_t column_count = 0;
+	for (MixingMatrix::const_iterator row = matrix->begin(); row != matrix->end(); ++row)
+		column_count = (std::max)(column_count, row->size());
+	for (MixingMatrix::iterator row = matrix->begin(); row != matrix->end(); ++row)
+		row->resize(column_count, 0);
+	return true;
+}
+
+MixingMatrix TransposeMixingMatrix(const MixingMatrix& matrix, size_t column_count)
+{
+	MixingMatrix transposed(column_count, std::vector<float>(matrix.size(), 0));
+	for (size_t row = 0; row < matrix.size(); ++row)
+		for (size_t column = 0; column < column_count && column < matrix[row].size(); ++column)
+			transposed[column][row] = matrix[row][column];
+	return transposed;
+}
+
+bool IsIdentityMixingMatrix(const MixingMatrix& matrix, size_t channel_count)
+{
+	if (matrix.size() != channel_count)
+		return false;
+	for (size_t row = 0; row < matrix.size(); ++row)
+	{
+		if (row >= matrix[row].size())
+			return false;
+		for (size_t column = 0; column < matrix[row].size(); ++column)
+			if (matrix[row][column] != (row == column ? 1 : 0))
+				return false;
+	}
+	return true;
+}
+
+MultiplyAddFunction GetMultiplyAddFunction(InstructionSet instruction_set)
+{
+	if (instruction_set > GetBestInstructionSet())
+		instruction_set = GetBestInstructionSet();
+	return GetMixKernels(instruction_set).multiply_add;
+}
+
+ChannelMixer::ChannelMixer(const MixingMatrix& matrix, size_t source_count, InstructionSet instruction_set) : source_count(source_count)
+{
+	if (instruction_set > GetBestInstructionSet())
+		instruction_set = GetBestInstructionSet();
+	const MixKernels& kernels = GetMixKernels(instruction_set);
+	scale = kernels.scale;
+	multiply_add = kernels.multiply_add;
+
+	row_begin.push_back(0);
+	for (MixingMatrix::const_iterator row = matrix.begin(); row != matrix.end(); ++row)
+	{
+		for (size_t source = 0; source < source_count && source < row->size(); ++source)
+			if ((*row)[source] != 0)
+			{
+				const Term term = { source, (*row)[source] };
+				terms.push_back(term);
+			}
+		row_begin.push_back(terms.size());
+	}
+}
+
+void ChannelMixer::Mix(const float* const* sources, size_t source_offset, float* const* destinations, size_t destination_offset, size_t frames) const
+{
+	const size_t destination_count = GetDestinationCount();
+	for (size_t destination_index = 0; destination_index < destination_count; ++destination_index)
+	{
+		float* destination = destinations[destination_index] + destination_offset;
+		const size_t begin = row_begin[destination_index];
+		const size_t end = row_begin[destination_index + 1];
+		if (begin == end)
+		{
+			memset(destination, 0, frames * sizeof(float));
+			continue;
+		}
+
+		// The first term initializes the destination, which saves clearing it beforehand. A plain unity-gain route is just a copy.
+		const Term& first_term = terms[begin];
+		const float* first_source = sources[first_term.source] + source_offset;
+		if (first_term.gain == 1)
+			memcpy(destination, first_source, frames * sizeof(float));
+		else
+			scale(destination, first_source, first_term.gain, frames);
+		for (size_t term_index = begin + 1; term_index < end; ++term_index)
+			multiply_add(destination, sources[terms[term_index].source] + source_offset, terms[term_index].gain, frames);
+	}
+}
@@ -0,0 +1,74 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "convert.h"
+
+// A gain matrix, one row per destination channel and one gain per source channel.
+typedef std::vector<std::vector<float>> MixingMatrix;
+
+// Parses a matrix written as rows separated by semicolons, each row being comma-separated gains (e.g. "1,0;0,1;0.5,0.5").
+// Short rows are padded with zeroes. Returns false if the text is malformed.
+bool ParseMixingMatrix(const std::string& text, MixingMatrix* matrix);
+MixingMatrix TransposeMixingMatrix(const MixingMatrix& matrix, size_t column_count);
+// True if the matrix maps each of the first channel_count sources to the same destination with unity gain, i.e. mixing would be a no-op.
+bool IsIdentityMixingMatrix(const MixingMatrix& matrix, size_t channel_count);
+
+// destination[i] += gain * source[i]. Real-time safe.
+typedef void (*MultiplyAddFunction)(float* destination, const float* source, float gain, size_t count);
+// The vectorized kernel behind ChannelMixer, for callers whose sources don't fit a fixed matrix (e.g. the engine, which mixes straight out of its rings).
+MultiplyAddFunction GetMultiplyAddFunction(InstructionSet instruction_set = GetBestInstructionSet());
+
+// Mixes a set of source channels into a set of destination channels according to a MixingMatrix.
+// Zero gains are skipped entirely, so sparse matrices (e.g. simple routing or fan-out) cost little more than a copy, while dense ones still go through vectorized multiply-accumulate kernels.
+class ChannelMixer
+{
+	public:
+		// Gains for sources beyond source_count are ignored.
+		ChannelMixer(const MixingMatrix& matrix, size_t source_count, InstructionSet instruction_set = GetBestInstructionSet());
+
+		size_t GetSourceCount() const { return source_count; }
+		size_t GetDestinationCount() const { return row_begin.size() - 1; }
+
+		// Real-time safe. For each destination channel: destinations[d][destination_offset + i] = sum over s of gain(d, s) * sources[s][source_offset + i].
+		// Destinations must not overlap sources.
+		void Mix(const float* const* sources, size_t source_offset, float* const* destinations, size_t destination_offset, size_t frames) const;
+
+	private:
+		struct Term
+		{
+			size_t source;
+			float gain;
+		};
+
+		// See mixer_kernels.h.
+		typedef void (*MixSamplesFunction)(float* destination, const float* source, float gain, size_t count);
+
+		const size_t source_count;
+		// The non-zero terms of destination d are terms[row_begin[d]] to terms[row_begin[d + 1] - 1].
+		std::vector<Term> terms;
+		std::vector<size_t> row_begin;
+		MixSamplesFunction scale;
+		MixSamplesFunction multiply_add;
+};
@@ -0,0 +1,61 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// These kernels must only be called after checking for CPU support, which ChannelMixer takes care of.
+// As with convert_avx2.cpp, this file is deliberately *not* built with /arch:AVX2. Only AVX instructions are actually needed here, but AVX2 is what we detect.
+
+#include "mixer_kernels.h"
+
+#ifdef FLEXASIO_X86
+
+#if defined(__GNUC__) && !defined(__AVX2__)
+#pragma GCC target("avx2")
+#endif
+
+#include <immintrin.h>
+
+namespace {
+void ScaleSamples(float* destination, const float* source, float gain, size_t count)
+{
+	const __m256 gains = _mm256_set1_ps(gain);
+	size_t sample_index = 0;
+	for (; sample_index + 16 <= count; sample_index += 16)
+	{
+		_mm256_storeu_ps(destination + sample_index, _mm256_mul_ps(gains, _mm256_loadu_ps(source + sample_index)));
+		_mm256_storeu_ps(destination + sample_index + 8, _mm256_mul_ps(gains, _mm256_loadu_ps(source + sample_index + 8)));
+	}
+	ScaleSamplesScalar(destination + sample_index, source + sample_index, gain, count - sample_index);
+}
+
+void MultiplyAddSamples(float* destination, const float* source, float gain, size_t count)
+{
+	const __m256 gains = _mm256_set1_ps(gain);
+	size_t sample_index = 0;
+	for (; sample_index + 16 <= count; sample_index += 16)
+	{
+		_mm256_storeu_ps(destination + sample_index, _mm256_add_ps(_mm256_loadu_ps(destination + sample_index), _mm256_mul_ps(gains, _mm256_loadu_ps(source + sample_index))));
+		_mm256_storeu_ps(destination + sample_index + 8, _mm256_add_ps(_mm256_loadu_ps(destination + sample_index + 8), _mm256_mul_ps(gains, _mm256_loadu_ps(source + sample_index + 8))));
+	}
+	MultiplyAddSamplesScalar(destination + sample_index, source + sample_index, gain, count - sample_index);
+}
+}
+
+const MixKernels avx2_mix_kernels = { ScaleSamples, MultiplyAddSamples };
+
+#endif
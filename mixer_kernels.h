@@ -0,0 +1,51 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// Internal to the channel mixer. Use mixer.h instead.
+
+#include <cstddef>
+
+#include "convert.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FLEXASIO_X86 1
+#endif
+
+// destination[i] = gain * source[i]
+typedef void (*ScaleSamplesFunction)(float* destination, const float* source, float gain, size_t count);
+// destination[i] += gain * source[i]
+typedef void (*MultiplyAddSamplesFunction)(float* destination, const float* source, float gain, size_t count);
+
+// Like the conversion kernels, all mixing kernels produce bit-exact results regardless of the instruction set: there is no fused multiply-add, and the operations happen in the same order.
+struct MixKernels
+{
+	ScaleSamplesFunction scale;
+	MultiplyAddSamplesFunction multiply_add;
+};
+
+extern const MixKernels scalar_mix_kernels;
+#ifdef FLEXASIO_X86
+extern const MixKernels sse2_mix_kernels;
+extern const MixKernels avx2_mix_kernels;
+#endif
+
+void ScaleSamplesScalar(float* destination, const float* source, float gain, size_t count);
+void MultiplyAddSamplesScalar(float* destination, const float* source, float gain, size_t count);
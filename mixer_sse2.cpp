@@ -0,0 +1,54 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "mixer_kernels.h"
+
+#ifdef FLEXASIO_X86
+
+#include <emmintrin.h>
+
+namespace {
+void ScaleSamples(float* destination, const float* source, float gain, size_t count)
+{
+	const __m128 gains = _mm_set1_ps(gain);
+	size_t sample_index = 0;
+	for (; sample_index + 8 <= count; sample_index += 8)
+	{
+		_mm_storeu_ps(destination + sample_index, _mm_mul_ps(gains, _mm_loadu_ps(source + sample_index)));
+		_mm_storeu_ps(destination + sample_index + 4, _mm_mul_ps(gains, _mm_loadu_ps(source + sample_index + 4)));
+	}
+	ScaleSamplesScalar(destination + sample_index, source + sample_index, gain, count - sample_index);
+}
+
+void MultiplyAddSamples(float* destination, const float* source, float gain, size_t count)
+{
+	const __m128 gains = _mm_set1_ps(gain);
+	size_t sample_index = 0;
+	for (; sample_index + 8 <= count; sample_index += 8)
+	{
+		_mm_storeu_ps(destination + sample_index, _mm_add_ps(_mm_loadu_ps(destination + sample_index), _mm_mul_ps(gains, _mm_loadu_ps(source + sample_index))));
+		_mm_storeu_ps(destination + sample_index + 4, _mm_add_ps(_mm_loadu_ps(destination + sample_index + 4), _mm_mul_ps(gains, _mm_loadu_ps(source + sample_index + 4))));
+	}
+	MultiplyAddSamplesScalar(destination + sample_index, source + sample_index, gain, count - sample_index);
+}
+}
+
+const MixKernels sse2_mix_kernels = { ScaleSamples, MultiplyAddSamples };
+
+#endif
@@ -0,0 +1,110 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "monitor.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const float half_pi = 1.57079632679f;
+
+// The gain of ASIO channel asio_channel on device channel device_channel, given a matrix in the Config layout.
+float GetMatrixGain(const MixingMatrix& matrix, size_t asio_channel, size_t device_channel)
+{
+	if (matrix.empty())
+		return asio_channel == device_channel ? 1.0f : 0.0f;
+	return device_channel < matrix[asio_channel].size() ? matrix[asio_channel][device_channel] : 0.0f;
+}
+}
+
+InputMonitor::InputMonitor(const MixingMatrix& input_matrix, const MixingMatrix& output_matrix, size_t device_input_channel_count, size_t device_output_channel_count, size_t asio_input_channel_count, size_t asio_output_channel_count) :
+	input_matrix(input_matrix), output_matrix(output_matrix), device_input_channel_count(device_input_channel_count), device_output_channel_count(device_output_channel_count), asio_output_channel_count(asio_output_channel_count),
+	multiply_add(GetMultiplyAddFunction()), gains(device_input_channel_count * device_output_channel_count, 0), middle(1), back_index(0), front_index(2)
+{
+	const Route route = { false, 0, 1, 0.5f };
+	routes.assign(asio_input_channel_count, route);
+	const Term term = { 0, 0, 0 };
+	for (size_t list_index = 0; list_index < 3; ++list_index)
+	{
+		lists[list_index].terms.assign(gains.size(), term);
+		lists[list_index].term_count = 0;
+	}
+}
+
+bool InputMonitor::Set(long input, long output, float gain, float pan, bool enabled)
+{
+	if (input < -1 || input >= static_cast<long>(routes.size()) || (enabled && (output < 0 || output >= static_cast<long>(asio_output_channel_count))))
+		return false;
+	const Route route = { enabled, output, gain, (std::min)(1.0f, (std::max)(0.0f, pan)) };
+	if (input == -1)
+		std::fill(routes.begin(), routes.end(), route);
+	else
+		routes[input] = route;
+	Publish();
+	return true;
+}
+
+void InputMonitor::Publish()
+{
+	std::fill(gains.begin(), gains.end(), 0.0f);
+	for (size_t asio_input = 0; asio_input < routes.size(); ++asio_input)
+	{
+		const Route& route = routes[asio_input];
+		if (!route.enabled || route.gain == 0)
+			continue;
+		const size_t left = static_cast<size_t>(route.output);
+		const bool stereo = left + 1 < asio_output_channel_count;
+		const float left_gain = stereo ? route.gain * std::cos(route.pan * half_pi) : route.gain;
+		const float right_gain = stereo ? route.gain * std::sin(route.pan * half_pi) : 0.0f;
+		for (size_t source = 0; source < device_input_channel_count; ++source)
+		{
+			const float input_gain = GetMatrixGain(input_matrix, asio_input, source);
+			if (input_gain == 0)
+				continue;
+			for (size_t destination = 0; destination < device_output_channel_count; ++destination)
+				gains[destination * device_input_channel_count + source] += input_gain * (left_gain * GetMatrixGain(output_matrix, left, destination) + (stereo ? right_gain * GetMatrixGain(output_matrix, left + 1, destination) : 0.0f));
+		}
+	}
+
+	TermList& list = lists[back_index];
+	list.term_count = 0;
+	for (size_t destination = 0; destination < device_output_channel_count; ++destination)
+		for (size_t source = 0; source < device_input_channel_count; ++source)
+		{
+			const float gain = gains[destination * device_input_channel_count + source];
+			if (gain == 0)
+				continue;
+			const Term term = { source, destination, gain };
+			list.terms[list.term_count++] = term;
+		}
+	back_index = middle.exchange(back_index | fresh_flag, std::memory_order_acq_rel) & ~fresh_flag;
+}
+
+void InputMonitor::Process(const float* const* input, float* const* output, size_t frames)
+{
+	if (middle.load(std::memory_order_relaxed) & fresh_flag)
+		front_index = middle.exchange(front_index, std::memory_order_acq_rel) & ~fresh_flag;
+	const TermList& list = lists[front_index];
+	for (size_t term_index = 0; term_index < list.term_count; ++term_index)
+	{
+		const Term& term = list.terms[term_index];
+		multiply_add(output[term.destination], input[term.source], term.gain, frames);
+	}
+}
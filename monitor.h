@@ -0,0 +1,86 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "mixer.h"
+
+// Direct input monitoring (kAsioSetInputMonitor): the host asks for an ASIO input to be heard on a pair of ASIO outputs, and the stream callback adds it to the device output straight from the device input, without going through the host.
+// Routes are set in terms of ASIO channels, and resolved through the input and output matrices (if any) into a list of device input to device output gains.
+// The audio thread picks up new lists through a triple buffer: neither side ever waits for the other, and the audio thread always sees a complete list.
+class InputMonitor
+{
+	public:
+		// Matrices are in the Config::input_matrix and Config::output_matrix layout: one row per ASIO channel, one gain per device channel. An empty matrix maps ASIO channels 1:1 to device channels.
+		InputMonitor(const MixingMatrix& input_matrix, const MixingMatrix& output_matrix, size_t device_input_channel_count, size_t device_output_channel_count, size_t asio_input_channel_count, size_t asio_output_channel_count);
+
+		// Must only be called from one thread at a time. Monitors the ASIO input (or all of them if it is -1) on output and output + 1, or turns it off if enabled is false.
+		// gain is linear; pan goes from 0 (left, i.e. output) to 1 (right, i.e. output + 1), with a constant-power law. If output is the last channel, the input is sent there alone.
+		// Returns false if a channel is out of range.
+		bool Set(long input, long output, float gain, float pan, bool enabled);
+
+		// Real-time safe. Adds the monitored device inputs to the device outputs.
+		void Process(const float* const* input, float* const* output, size_t frames);
+
+	private:
+		struct Route
+		{
+			bool enabled;
+			long output;
+			float gain;
+			float pan;
+		};
+		struct Term
+		{
+			size_t source;
+			size_t destination;
+			float gain;
+		};
+		// Preallocated for every possible term, so that publishing a list never allocates.
+		struct TermList
+		{
+			std::vector<Term> terms;
+			size_t term_count;
+		};
+
+		static const unsigned fresh_flag = 4;
+
+		void Publish();
+
+		const MixingMatrix input_matrix;
+		const MixingMatrix output_matrix;
+		const size_t device_input_channel_count;
+		const size_t device_output_channel_count;
+		const size_t asio_output_channel_count;
+		const MultiplyAddFunction multiply_add;
+		// One per ASIO input. Only touched by the writer.
+		std::vector<Route> routes;
+		// Device output x device input gains, rebuilt by the writer for every change.
+		std::vector<float> gains;
+
+		// The writer fills lists[back_index], then swaps it with the middle list, whose index is in middle (along with fresh_flag if the reader hasn't seen it yet). The reader swaps front_index with the middle list when it is fresh.
+		TermList lists[3];
+		std::atomic<unsigned> middle;
+		unsigned back_index;
+		unsigned front_index;
+};
@@ -0,0 +1,269 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "ring.h"
+#include "util.h"
+#include "wav.h"
+
+namespace {
+// How much audio the ring can hold, in seconds, i.e. how long the disk can stall before audio gets dropped.
+const double ring_duration = 2;
+// How often the writer drains the ring. Tap() never wakes it up, as that wouldn't be real-time safe.
+const std::chrono::milliseconds writer_period(50);
+// Size of each write to the file, in bytes. The file is unbuffered, so each of these goes straight to the OS.
+const size_t write_size = 1 << 20;
+}
+
+class Recorder::Session
+{
+	public:
+		// Takes ownership of file, which must be positioned right after the header.
+		Session(FILE* file, double sample_rate, const std::vector<size_t>& input_channels, const std::vector<size_t>& output_channels);
+		~Session();
+
+		// Flushes the ring to disk and finalizes the header. Tap() must not be called anymore.
+		void Close();
+		Status GetStatus() const;
+		void Tap(const float* const* input, const float* const* output, size_t frames) throw();
+
+	private:
+		Session(const Session&);
+		Session& operator=(const Session&);
+
+		void Run();
+		void Drain();
+
+		FILE* file;
+		const double sample_rate;
+		const std::vector<size_t> input_channels;
+		const std::vector<size_t> output_channels;
+		SampleRing ring;
+		std::vector<const float*> ring_channels;
+		// Interleaved samples on their way to the file. Writer thread only.
+		std::vector<float> write_buffer;
+		std::atomic<unsigned long long> frames_written;
+		std::atomic<unsigned long long> overrun_count;
+		std::atomic<unsigned long long> dropped_frame_count;
+		std::atomic<bool> write_error;
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool stopping;
+		std::thread thread;
+};
+
+Recorder::Session::Session(FILE* file, double sample_rate, const std::vector<size_t>& input_channels, const std::vector<size_t>& output_channels) :
+	file(file), sample_rate(sample_rate), input_channels(input_channels), output_channels(output_channels),
+	ring(input_channels.size() + output_channels.size(), static_cast<size_t>(std::ceil(sample_rate * ring_duration))),
+	write_buffer((std::max)(write_size / (ring.GetChannelCount() * sizeof(float)), static_cast<size_t>(1)) * ring.GetChannelCount()),
+	frames_written(0), overrun_count(0), dropped_frame_count(0), write_error(false), stopping(false)
+{
+	for (size_t channel = 0; channel < ring.GetChannelCount(); ++channel)
+		ring_channels.push_back(ring.GetChannel(channel));
+	thread = std::thread(&Session::Run, this);
+}
+
+Recorder::Session::~Session()
+{
+	Close();
+}
+
+void Recorder::Session::Close()
+{
+	if (!thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	thread.join();
+
+	if (!WriteWaveHeader(file, ring.GetChannelCount(), sample_rate, frames_written.load() * ring.GetChannelCount() * sizeof(float)))
+		write_error.store(true);
+	if (fclose(file) != 0)
+		write_error.store(true);
+	file = NULL;
+}
+
+Recorder::Status Recorder::Session::GetStatus() const
+{
+	Status status;
+	status.recording = thread.joinable();
+	status.frames_written = frames_written.load(std::memory_order_relaxed);
+	status.overrun_count = overrun_count.load(std::memory_order_relaxed);
+	status.dropped_frame_count = dropped_frame_count.load(std::memory_order_relaxed);
+	status.write_error = write_error.load(std::memory_order_relaxed);
+	return status;
+}
+
+void Recorder::Session::Tap(const float* const* input, const float* const* output, size_t frames) throw()
+{
+	// All or nothing, so that the file never contains part of a callback.
+	if (ring.GetWriteAvailable() < frames)
+	{
+		overrun_count.fetch_add(1, std::memory_order_relaxed);
+		dropped_frame_count.fetch_add(frames, std::memory_order_relaxed);
+		return;
+	}
+
+	ring.VisitWrite(frames, [&](size_t ring_offset, size_t frame_offset, size_t frame_count) {
+		const auto copy = [&](const float* source, size_t ring_channel) {
+			float* destination = ring.GetChannel(ring_channel) + ring_offset;
+			if (source)
+				memcpy(destination, source + frame_offset, frame_count * sizeof(float));
+			else
+				memset(destination, 0, frame_count * sizeof(float));
+		};
+		size_t ring_channel = 0;
+		for (std::vector<size_t>::const_iterator channel = input_channels.begin(); channel != input_channels.end(); ++channel)
+			copy(input ? input[*channel] : NULL, ring_channel++);
+		for (std::vector<size_t>::const_iterator channel = output_channels.begin(); channel != output_channels.end(); ++channel)
+			copy(output ? output[*channel] : NULL, ring_channel++);
+	});
+	ring.CommitWrite(frames);
+}
+
+void Recorder::Session::Run()
+{
+	for (;;)
+	{
+		bool stop;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait_for(lock, writer_period, [this] { return stopping; });
+			stop = stopping;
+		}
+		Drain();
+		if (stop)
+			return;
+	}
+}
+
+void Recorder::Session::Drain()
+{
+	const size_t channel_count = ring.GetChannelCount();
+	const size_t buffer_frames = write_buffer.size() / channel_count;
+	for (;;)
+	{
+		const size_t frames = (std::min)(ring.GetReadAvailable(), buffer_frames);
+		if (frames == 0)
+			return;
+
+		ring.VisitRead(frames, [&](size_t ring_offset, size_t frame_offset, size_t frame_count) {
+			InterleaveSamples(write_buffer.data() + frame_offset * channel_count, ring_channels.data(), ring_offset, channel_count, frame_count);
+		});
+		ring.CommitRead(frames);
+
+		// After an error, keep draining anyway, so that it doesn't show up as overruns as well.
+		if (write_error.load(std::memory_order_relaxed))
+			continue;
+		if (fwrite(write_buffer.data(), channel_count * sizeof(float), frames, file) != frames)
+		{
+			Log(LOG_LEVEL_ERROR) << "Unable to write to recording file, discarding the rest of the recording";
+			write_error.store(true, std::memory_order_relaxed);
+			continue;
+		}
+		frames_written.fetch_add(frames, std::memory_order_relaxed);
+	}
+}
+
+Recorder::Recorder() : active_session(NULL), tapping(false)
+{
+	memset(&last_status, 0, sizeof(last_status));
+}
+
+Recorder::~Recorder()
+{
+	Stop();
+}
+
+bool Recorder::Start(const std::wstring& path, double sample_rate, const std::vector<size_t>& input_channels, const std::vector<size_t>& output_channels)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	StopLocked();
+
+	const size_t channel_count = input_channels.size() + output_channels.size();
+	FILE* const file = _wfopen(path.c_str(), L"wb");
+	if (!file)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to create recording file";
+		return false;
+	}
+	// Writes are large enough already; going through the CRT buffer would only add a copy.
+	setvbuf(file, NULL, _IONBF, 0);
+	if (!WriteWaveHeader(file, channel_count, sample_rate, 0))
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to write recording file header";
+		fclose(file);
+		return false;
+	}
+
+	session.reset(new Session(file, sample_rate, input_channels, output_channels));
+	active_session.store(session.get());
+	Log() << "Recording " << input_channels.size() << " input channels and " << output_channels.size() << " output channels at " << sample_rate << " Hz";
+	return true;
+}
+
+void Recorder::Stop()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	StopLocked();
+}
+
+void Recorder::StopLocked()
+{
+	if (!session)
+		return;
+
+	active_session.store(NULL);
+	// Tap() might still be using the session it saw before it was cleared.
+	while (tapping.load())
+		std::this_thread::yield();
+
+	session->Close();
+	last_status = session->GetStatus();
+	session.reset();
+	Log() << "Stopped recording: " << last_status.frames_written << " frames written, " << last_status.overrun_count << " overruns (" << last_status.dropped_frame_count << " frames dropped)" << (last_status.write_error ? ", write errors" : "");
+}
+
+Recorder::Status Recorder::GetStatus() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return session ? session->GetStatus() : last_status;
+}
+
+void Recorder::Tap(const float* const* input, const float* const* output, size_t frames) throw()
+{
+	// Both this and StopLocked() use sequentially consistent operations: either Stop() sees tapping, or Tap() sees the cleared session.
+	tapping.store(true);
+	Session* const current_session = active_session.load();
+	if (current_session)
+		current_session->Tap(input, output, frames);
+	tapping.store(false);
+}
@@ -0,0 +1,73 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Records selected channels of the audio going through the driver to a 32-bit float WAV file (which turns into RF64 if it grows past 4 GB), to help track down glitches.
+// Tap() runs on the audio thread and never blocks: samples go through a lock-free ring which a background thread drains to disk. If the writer falls behind, audio is dropped and counted instead.
+// Start(), Stop() and GetStatus() can be called from any thread, while Tap() is running or not.
+class Recorder
+{
+	public:
+		struct Status
+		{
+			bool recording;
+			unsigned long long frames_written;
+			// Tap() calls whose audio didn't fit in the ring, and how many frames were lost as a result.
+			unsigned long long overrun_count;
+			unsigned long long dropped_frame_count;
+			bool write_error;
+		};
+
+		Recorder();
+		~Recorder();
+
+		// input_channels and output_channels are indices into the channels passed to Tap(); the file contains the selected input channels followed by the selected output channels.
+		// Stops the current recording, if any. Returns false if the file cannot be created.
+		bool Start(const std::wstring& path, double sample_rate, const std::vector<size_t>& input_channels, const std::vector<size_t>& output_channels);
+		// Waits for the writer to flush everything to disk. Does nothing if not recording.
+		void Stop();
+		// While not recording, returns the status of the last recording.
+		Status GetStatus() const;
+
+		// Real-time safe. Does nothing if not recording.
+		void Tap(const float* const* input, const float* const* output, size_t frames) throw();
+
+	private:
+		class Session;
+
+		Recorder(const Recorder&);
+		Recorder& operator=(const Recorder&);
+
+		void StopLocked();
+
+		// Serializes Start() and Stop().
+		mutable std::mutex mutex;
+		std::unique_ptr<Session> session;
+		// What Tap() sees. Stop() clears it, then waits for tapping to go false before destroying the session.
+		std::atomic<Session*> active_session;
+		std::atomic<bool> tapping;
+		Status last_status;
+};
@@ -0,0 +1,100 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+// Lock-free, single-producer single-consumer ring buffer of non-interleaved float samples.
+// Positions are free-running frame counters: only the producer advances write_position, and only the consumer advances read_position.
+class SampleRing
+{
+	public:
+		// capacity is in frames.
+		SampleRing(size_t channel_count, size_t capacity) :
+			channel_count(channel_count), capacity(capacity), samples(channel_count * capacity), read_position(0), write_position(0) { }
+
+		size_t GetChannelCount() const { return channel_count; }
+		size_t GetCapacity() const { return capacity; }
+		// Consumer side.
+		size_t GetReadAvailable() const { return write_position.load(std::memory_order_acquire) - read_position.load(std::memory_order_relaxed); }
+		// Producer side.
+		size_t GetWriteAvailable() const { return capacity - (write_position.load(std::memory_order_relaxed) - read_position.load(std::memory_order_acquire)); }
+		// Only safe while neither the producer nor the consumer is running.
+		void Reset() { read_position.store(0); write_position.store(0); }
+
+		float* GetChannel(size_t channel) { return samples.data() + channel * capacity; }
+		const float* GetChannel(size_t channel) const { return samples.data() + channel * capacity; }
+
+		// Calls function(ring_offset, frame_offset, frame_count) for each contiguous region (there are at most two) of the next frames to read or write.
+		// This is how callers can convert samples straight into and out of the ring without going through an intermediate buffer.
+		template <typename Function> void VisitRead(size_t frames, Function function) const { VisitRegions(read_position.load(std::memory_order_relaxed), frames, function); }
+		template <typename Function> void VisitWrite(size_t frames, Function function) const { VisitRegions(write_position.load(std::memory_order_relaxed), frames, function); }
+		void CommitRead(size_t frames) { read_position.store(read_position.load(std::memory_order_relaxed) + frames, std::memory_order_release); }
+		void CommitWrite(size_t frames) { write_position.store(write_position.load(std::memory_order_relaxed) + frames, std::memory_order_release); }
+
+		// Copies frames from channels[channel] + offset. If channels is null, writes silence.
+		void Write(const float* const* channels, size_t offset, size_t frames)
+		{
+			VisitWrite(frames, [&](size_t ring_offset, size_t frame_offset, size_t frame_count) {
+				for (size_t channel = 0; channel < channel_count; ++channel)
+				{
+					float* destination = GetChannel(channel) + ring_offset;
+					if (channels)
+						memcpy(destination, channels[channel] + offset + frame_offset, frame_count * sizeof(float));
+					else
+						memset(destination, 0, frame_count * sizeof(float));
+				}
+			});
+			CommitWrite(frames);
+		}
+
+		// Copies frames to channels[channel] + offset.
+		void Read(float* const* channels, size_t offset, size_t frames)
+		{
+			VisitRead(frames, [&](size_t ring_offset, size_t frame_offset, size_t frame_count) {
+				for (size_t channel = 0; channel < channel_count; ++channel)
+					memcpy(channels[channel] + offset + frame_offset, GetChannel(channel) + ring_offset, frame_count * sizeof(float));
+			});
+			CommitRead(frames);
+		}
+
+	private:
+		SampleRing(const SampleRing&);
+		SampleRing& operator=(const SampleRing&);
+
+		template <typename Function> void VisitRegions(size_t position, size_t frames, Function function) const
+		{
+			const size_t ring_offset = position % capacity;
+			const size_t first_frames = (std::min)(frames, capacity - ring_offset);
+			if (first_frames > 0)
+				function(ring_offset, 0, first_frames);
+			if (first_frames < frames)
+				function(0, first_frames, frames - first_frames);
+		}
+
+		const size_t channel_count;
+		const size_t capacity;
+		std::vector<float> samples;
+		std::atomic<size_t> read_position;
+		std::atomic<size_t> write_position;
+};
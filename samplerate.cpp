@@ -0,0 +1,274 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "samplerate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "samplerate_kernels.h"
+
+namespace {
+// A ratio that needs more phases than this (e.g. 44.1 kHz to 44.1001 kHz) would need an unreasonably large coefficient table.
+const long long max_interpolation = 2048;
+
+const double pi = 3.14159265358979323846;
+
+struct ResamplerQualityInfo
+{
+	ResamplerQuality quality;
+	const char* name;
+	// Stopband attenuation, in dB.
+	double attenuation;
+	// Passband edge, as a fraction of the lower Nyquist frequency of the two rates. The stopband starts at that Nyquist frequency, so nothing ever aliases back.
+	double passband;
+};
+
+const ResamplerQualityInfo resampler_qualities[] = {
+	{ RESAMPLER_QUALITY_LOW, "low", 60, 0.8 },
+	{ RESAMPLER_QUALITY_MEDIUM, "medium", 90, 0.9 },
+	{ RESAMPLER_QUALITY_HIGH, "high", 120, 0.95 },
+};
+
+const SampleRateKernels& GetSampleRateKernels(InstructionSet instruction_set)
+{
+	switch (instruction_set)
+	{
+#ifdef FLEXASIO_X86
+		case INSTRUCTION_SET_AVX2: return avx2_sample_rate_kernels;
+		case INSTRUCTION_SET_SSE2: return sse2_sample_rate_kernels;
+#endif
+		default: return scalar_sample_rate_kernels;
+	}
+}
+
+bool GetIntegerSampleRate(double sample_rate, long long* integer_sample_rate)
+{
+	*integer_sample_rate = static_cast<long long>(std::floor(sample_rate + 0.5));
+	return *integer_sample_rate > 0 && std::abs(sample_rate - *integer_sample_rate) < 1e-6;
+}
+
+long long GreatestCommonDivisor(long long a, long long b)
+{
+	while (b != 0)
+	{
+		const long long remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+	return a;
+}
+
+// Zeroth-order modified Bessel function of the first kind, for the Kaiser window.
+double BesselI0(double x)
+{
+	double sum = 1;
+	double term = 1;
+	for (int k = 1; k < 50; ++k)
+	{
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+}
+
+float DotProductScalar(const float* a, const float* b, size_t count)
+{
+	float sum = 0;
+	for (size_t index = 0; index < count; ++index)
+		sum += a[index] * b[index];
+	return sum;
+}
+
+const SampleRateKernels scalar_sample_rate_kernels = { DotProductScalar };
+
+const char* GetResamplerQualityName(ResamplerQuality quality)
+{
+	return resampler_qualities[quality].name;
+}
+
+bool ParseResamplerQuality(const std::string& name, ResamplerQuality* quality)
+{
+	for (size_t quality_index = 0; quality_index < RESAMPLER_QUALITY_COUNT; ++quality_index)
+		if (name == resampler_qualities[quality_index].name)
+		{
+			*quality = resampler_qualities[quality_index].quality;
+			return true;
+		}
+	return false;
+}
+
+bool SampleRateConverter::IsSupported(double input_sample_rate, double output_sample_rate)
+{
+	long long input_rate, output_rate;
+	if (!GetIntegerSampleRate(input_sample_rate, &input_rate) || !GetIntegerSampleRate(output_sample_rate, &output_rate))
+		return false;
+	return output_rate / GreatestCommonDivisor(input_rate, output_rate) <= max_interpolation;
+}
+
+SampleRateConverter::SampleRateConverter(size_t channel_count, double input_sample_rate, double output_sample_rate, ResamplerQuality quality, size_t max_input_frames, InstructionSet instruction_set) :
+	channel_count(channel_count), max_input_frames(max_input_frames), output_available(0), next_input(0), phase(0)
+{
+	if (instruction_set > GetBestInstructionSet())
+		instruction_set = GetBestInstructionSet();
+	dot_product = GetSampleRateKernels(instruction_set).dot_product;
+
+	long long input_rate, output_rate;
+	GetIntegerSampleRate(input_sample_rate, &input_rate);
+	GetIntegerSampleRate(output_sample_rate, &output_rate);
+	const long long divisor = GreatestCommonDivisor(input_rate, output_rate);
+	interpolation = static_cast<size_t>(output_rate / divisor);
+	decimation = static_cast<size_t>(input_rate / divisor);
+
+	// Kaiser window design. Everything is in the upsampled domain, where the filter runs at interpolation * input_rate.
+	const ResamplerQualityInfo& quality_info = resampler_qualities[quality];
+	const double nyquist = (std::min)(input_rate, output_rate) / 2.0;
+	const double transition = (1 - quality_info.passband) * nyquist;
+	const double cutoff = (1 + quality_info.passband) / 2 * nyquist / (static_cast<double>(interpolation) * input_rate);
+	const double beta = 0.1102 * (quality_info.attenuation - 8.7);
+	// The length estimate is (attenuation - 7.95) / (14.36 * transition / upsampled_rate) taps, spread across interpolation phases.
+	// Rounding up to a multiple of 8 keeps the SIMD kernels on their fast path.
+	tap_count = static_cast<size_t>(std::ceil((quality_info.attenuation - 7.95) * input_rate / (14.36 * transition)));
+	tap_count = (tap_count + 7) / 8 * 8;
+	const size_t length = interpolation * tap_count;
+	const double center = (length - 1) / 2.0;
+	delay = center / (static_cast<double>(interpolation) * input_rate);
+
+	std::vector<double> prototype(length);
+	const double window_normalization = BesselI0(beta);
+	for (size_t index = 0; index < length; ++index)
+	{
+		const double x = index - center;
+		const double sinc = x == 0 ? 2 * cutoff : std::sin(2 * pi * cutoff * x) / (pi * x);
+		const double window_position = 2 * x / (length - 1);
+		prototype[index] = sinc * BesselI0(beta * std::sqrt((std::max)(0.0, 1 - window_position * window_position))) / window_normalization;
+	}
+
+	// Phase p uses prototype[p], prototype[p + L], prototype[p + 2L]... on the current input frame and the ones before it.
+	// Each phase is normalized to unity gain at DC, otherwise the L phases would all have slightly different gains and modulate the signal.
+	coefficients.resize(length);
+	for (size_t phase_index = 0; phase_index < interpolation; ++phase_index)
+	{
+		double sum = 0;
+		for (size_t tap = 0; tap < tap_count; ++tap)
+			sum += prototype[phase_index + tap * interpolation];
+		for (size_t tap = 0; tap < tap_count; ++tap)
+			coefficients[phase_index * tap_count + (tap_count - 1 - tap)] = static_cast<float>(prototype[phase_index + tap * interpolation] / sum);
+	}
+
+	history_stride = tap_count - 1 + max_input_frames;
+	history.assign(channel_count * history_stride, 0);
+	// Leftovers from a previous Write() (see GetInputFrames()), plus a full Write().
+	output_capacity = 2 * (GetOutputFrames(max_input_frames) + interpolation / decimation + 2);
+	output.assign(channel_count * output_capacity, 0);
+}
+
+void SampleRateConverter::Reset()
+{
+	std::fill(history.begin(), history.end(), 0.0f);
+	output_available = 0;
+	next_input = 0;
+	phase = 0;
+}
+
+size_t SampleRateConverter::GetOutputFrames(size_t input_frames) const
+{
+	// The next output frame is at position next_input * L + phase in the upsampled domain, and then every M. It can be produced once its input frame has been written.
+	const unsigned long long position = static_cast<unsigned long long>(next_input) * interpolation + phase;
+	const unsigned long long end = static_cast<unsigned long long>(input_frames) * interpolation;
+	if (end <= position)
+		return 0;
+	return static_cast<size_t>((end - position + decimation - 1) / decimation);
+}
+
+size_t SampleRateConverter::GetInputFrames(size_t output_frames) const
+{
+	if (output_frames <= output_available)
+		return 0;
+	const unsigned long long position = static_cast<unsigned long long>(next_input) * interpolation + phase;
+	const unsigned long long last_position = position + static_cast<unsigned long long>(output_frames - output_available - 1) * decimation;
+	return static_cast<size_t>(last_position / interpolation + 1);
+}
+
+void SampleRateConverter::Write(const float* const* channels, size_t offset, size_t frames)
+{
+	frames = (std::min)(frames, max_input_frames);
+	size_t output_frames = GetOutputFrames(frames);
+	if (output_available + output_frames > output_capacity)
+	{
+		// The caller is not reading what it should. Drop the oldest frames rather than overflow.
+		const size_t dropped_frames = output_available + output_frames - output_capacity;
+		for (size_t channel = 0; channel < channel_count; ++channel)
+			memmove(output.data() + channel * output_capacity, output.data() + channel * output_capacity + dropped_frames, (output_available - dropped_frames) * sizeof(float));
+		output_available -= dropped_frames;
+	}
+
+	const size_t history_frames = tap_count - 1;
+	size_t final_next_input = next_input;
+	size_t final_phase = phase;
+	for (size_t channel = 0; channel < channel_count; ++channel)
+	{
+		float* channel_history = history.data() + channel * history_stride;
+		memcpy(channel_history + history_frames, channels[channel] + offset, frames * sizeof(float));
+		float* channel_output = output.data() + channel * output_capacity + output_available;
+
+		// The window for input frame i is history[i] to history[i + tap_count - 1], i.e. the frame itself and the tap_count - 1 before it.
+		size_t channel_next_input = next_input;
+		size_t channel_phase = phase;
+		for (size_t output_index = 0; output_index < output_frames; ++output_index)
+		{
+			channel_output[output_index] = dot_product(coefficients.data() + channel_phase * tap_count, channel_history + channel_next_input, tap_count);
+			channel_phase += decimation;
+			channel_next_input += channel_phase / interpolation;
+			channel_phase %= interpolation;
+		}
+
+		memmove(channel_history, channel_history + frames, history_frames * sizeof(float));
+		final_next_input = channel_next_input;
+		final_phase = channel_phase;
+	}
+
+	// With no channels, the state still needs to move forward.
+	if (channel_count == 0)
+	{
+		const unsigned long long position = static_cast<unsigned long long>(next_input) * interpolation + phase + static_cast<unsigned long long>(output_frames) * decimation;
+		final_next_input = static_cast<size_t>(position / interpolation);
+		final_phase = static_cast<size_t>(position % interpolation);
+	}
+	next_input = final_next_input - frames;
+	phase = final_phase;
+	output_available += output_frames;
+}
+
+void SampleRateConverter::Read(float* const* channels, size_t offset, size_t frames)
+{
+	const size_t read_frames = (std::min)(frames, output_available);
+	for (size_t channel = 0; channel < channel_count; ++channel)
+	{
+		float* channel_output = output.data() + channel * output_capacity;
+		memcpy(channels[channel] + offset, channel_output, read_frames * sizeof(float));
+		memset(channels[channel] + offset + read_frames, 0, (frames - read_frames) * sizeof(float));
+		memmove(channel_output, channel_output + read_frames, (output_available - read_frames) * sizeof(float));
+	}
+	output_available -= read_frames;
+}
@@ -0,0 +1,92 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "convert.h"
+
+// Trade-offs between conversion quality, latency and CPU usage. Higher qualities have a flatter passband and more stopband attenuation, which means longer filters.
+enum ResamplerQuality
+{
+	RESAMPLER_QUALITY_LOW,
+	RESAMPLER_QUALITY_MEDIUM,
+	RESAMPLER_QUALITY_HIGH,
+	RESAMPLER_QUALITY_COUNT,
+};
+
+const char* GetResamplerQualityName(ResamplerQuality quality);
+bool ParseResamplerQuality(const std::string& name, ResamplerQuality* quality);
+
+// Converts between two fixed sample rates with a polyphase windowed-sinc FIR filter.
+// The rate ratio is reduced to L/M: conceptually, the input is upsampled by L, low-pass filtered, and decimated by M. Only the L filter phases that are actually needed are ever computed.
+// Unlike AdaptiveResampler, this is meant for large, fixed ratios (e.g. 44.1 kHz to 48 kHz), and does proper anti-aliasing.
+class SampleRateConverter
+{
+	public:
+		// Both rates must be whole numbers, and their reduced ratio must not need an unreasonable number of filter phases.
+		static bool IsSupported(double input_sample_rate, double output_sample_rate);
+
+		// Write() never takes more than max_input_frames at a time.
+		SampleRateConverter(size_t channel_count, double input_sample_rate, double output_sample_rate, ResamplerQuality quality, size_t max_input_frames, InstructionSet instruction_set = GetBestInstructionSet());
+
+		// Clears the filter history and any frames waiting to be read.
+		void Reset();
+
+		size_t GetTapCount() const { return tap_count; }
+		// Group delay of the filter, in seconds.
+		double GetDelay() const { return delay; }
+		// How many output frames the next Write() of input_frames will produce. The count depends on where we are in the L/M cycle, but never drifts: after N input frames, exactly ceil(N * L / M) output frames have been produced.
+		size_t GetOutputFrames(size_t input_frames) const;
+		// The smallest number of input frames to Write() for GetReadAvailable() to reach output_frames.
+		size_t GetInputFrames(size_t output_frames) const;
+
+		// Real-time safe.
+		void Write(const float* const* channels, size_t offset, size_t frames);
+		size_t GetReadAvailable() const { return output_available; }
+		// channels[channel] + offset receive the frames. If fewer frames are available, the rest is silence.
+		void Read(float* const* channels, size_t offset, size_t frames);
+
+	private:
+		// See samplerate_kernels.h.
+		typedef float (*DotProductFunction)(const float* a, const float* b, size_t count);
+
+		const size_t channel_count;
+		size_t interpolation;
+		size_t decimation;
+		size_t tap_count;
+		double delay;
+		// tap_count coefficients per phase, in reverse order so that they line up with the input frames in memory.
+		std::vector<float> coefficients;
+		const size_t max_input_frames;
+		// Per channel: tap_count - 1 frames of history, followed by room for the new input frames.
+		std::vector<float> history;
+		size_t history_stride;
+		// Per channel: output frames waiting to be read, starting at the beginning of the channel.
+		std::vector<float> output;
+		size_t output_capacity;
+		size_t output_available;
+		// Where the next output frame falls, in the upsampled domain: after input frame next_input (relative to the next frame to be written), phase L-th of a frame in.
+		size_t next_input;
+		size_t phase;
+		DotProductFunction dot_product;
+};
@@ -0,0 +1,54 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// These kernels must only be called after checking for CPU support, which SampleRateConverter takes care of.
+// As with convert_avx2.cpp, this file is deliberately *not* built with /arch:AVX2.
+
+#include "samplerate_kernels.h"
+
+#ifdef FLEXASIO_X86
+
+#if defined(__GNUC__) && !defined(__AVX2__)
+#pragma GCC target("avx2")
+#endif
+
+#include <immintrin.h>
+
+namespace {
+float DotProduct(const float* a, const float* b, size_t count)
+{
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	size_t index = 0;
+	for (; index + 16 <= count; index += 16)
+	{
+		sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_loadu_ps(a + index), _mm256_loadu_ps(b + index)));
+		sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_loadu_ps(a + index + 8), _mm256_loadu_ps(b + index + 8)));
+	}
+	const __m256 sum256 = _mm256_add_ps(sum0, sum1);
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum256), _mm256_extractf128_ps(sum256, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum) + DotProductScalar(a + index, b + index, count - index);
+}
+}
+
+const SampleRateKernels avx2_sample_rate_kernels = { DotProduct };
+
+#endif
@@ -0,0 +1,48 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// Internal to the sample rate converter. Use samplerate.h instead.
+
+#include <cstddef>
+
+#include "convert.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FLEXASIO_X86 1
+#endif
+
+// Returns the sum of a[i] * b[i].
+typedef float (*DotProductFunction)(const float* a, const float* b, size_t count);
+
+// Unlike the conversion and mixing kernels, these are not bit-exact across instruction sets: each one accumulates in as many lanes as it has, which changes the order of the additions.
+// The difference is far below the noise floor of the filters themselves.
+struct SampleRateKernels
+{
+	DotProductFunction dot_product;
+};
+
+extern const SampleRateKernels scalar_sample_rate_kernels;
+#ifdef FLEXASIO_X86
+extern const SampleRateKernels sse2_sample_rate_kernels;
+extern const SampleRateKernels avx2_sample_rate_kernels;
+#endif
+
+float DotProductScalar(const float* a, const float* b, size_t count);
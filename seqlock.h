@@ -0,0 +1,72 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+
+// Single-writer sequence lock. The writer never waits; readers retry until they get a copy that wasn't torn by a concurrent write.
+// The value is stored as an array of atomic words so that concurrent access is well-defined, which also means T has to be trivially copyable.
+template <typename T> class SeqLock
+{
+	public:
+		SeqLock() : sequence(0)
+		{
+			for (size_t word = 0; word < word_count; ++word)
+				words[word].store(0);
+		}
+
+		// Real-time safe. Must only be called from one thread at a time.
+		void Store(const T& value)
+		{
+			unsigned long new_words[word_count] = { 0 };
+			memcpy(new_words, &value, sizeof(value));
+			const unsigned long current_sequence = sequence.load(std::memory_order_relaxed);
+			// An odd sequence number tells readers a write is in progress.
+			sequence.store(current_sequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			for (size_t word = 0; word < word_count; ++word)
+				words[word].store(new_words[word], std::memory_order_relaxed);
+			sequence.store(current_sequence + 2, std::memory_order_release);
+		}
+
+		T Load() const
+		{
+			unsigned long current_words[word_count];
+			for (;;)
+			{
+				const unsigned long sequence_before = sequence.load(std::memory_order_acquire);
+				for (size_t word = 0; word < word_count; ++word)
+					current_words[word] = words[word].load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if ((sequence_before & 1) == 0 && sequence.load(std::memory_order_relaxed) == sequence_before)
+					break;
+			}
+			T value;
+			memcpy(&value, current_words, sizeof(value));
+			return value;
+		}
+
+	private:
+		static const size_t word_count = (sizeof(T) + sizeof(unsigned long) - 1) / sizeof(unsigned long);
+
+		std::atomic<unsigned long> sequence;
+		std::atomic<unsigned long> words[word_count];
+};
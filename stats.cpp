@@ -0,0 +1,252 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <sstream>
+
+void DurationHistogram::Reset()
+{
+	for (int bucket = 0; bucket < bucket_count; ++bucket)
+		buckets[bucket].store(0);
+	count.store(0);
+	total.store(0);
+	max.store(0);
+}
+
+int DurationHistogram::GetBucket(double duration)
+{
+	// Everything below 1 microsecond goes into the first octave.
+	if (duration < 1)
+		duration = 1;
+	int exponent;
+	// mantissa is in [0.5, 1).
+	const double mantissa = frexp(duration, &exponent);
+	const int octave = exponent - 1;
+	if (octave >= octave_count)
+		return bucket_count - 1;
+	const int sub_bucket = static_cast<int>((mantissa * 2 - 1) * sub_bucket_count);
+	return octave * sub_bucket_count + sub_bucket;
+}
+
+double DurationHistogram::GetBucketUpperBound(int bucket)
+{
+	const int octave = bucket / sub_bucket_count;
+	const int sub_bucket = bucket % sub_bucket_count;
+	return ldexp(1 + static_cast<double>(sub_bucket + 1) / sub_bucket_count, octave);
+}
+
+void DurationHistogram::Record(double duration)
+{
+	std::atomic<unsigned long long>& bucket = buckets[GetBucket(duration)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	total.store(total.load(std::memory_order_relaxed) + duration, std::memory_order_relaxed);
+	if (duration > max.load(std::memory_order_relaxed))
+		max.store(duration, std::memory_order_relaxed);
+}
+
+double DurationHistogram::GetPercentile(double fraction) const
+{
+	unsigned long long counts[bucket_count];
+	unsigned long long total_count = 0;
+	for (int bucket = 0; bucket < bucket_count; ++bucket)
+	{
+		counts[bucket] = buckets[bucket].load(std::memory_order_relaxed);
+		total_count += counts[bucket];
+	}
+	if (total_count == 0)
+		return 0;
+
+	const unsigned long long rank = (std::max)(1ULL, static_cast<unsigned long long>(ceil(fraction * total_count)));
+	unsigned long long cumulative_count = 0;
+	for (int bucket = 0; bucket < bucket_count; ++bucket)
+	{
+		cumulative_count += counts[bucket];
+		// The bucket bound can overshoot the actual maximum, which would look silly.
+		if (cumulative_count >= rank)
+			return (std::min)(GetBucketUpperBound(bucket), GetMax());
+	}
+	return GetMax();
+}
+
+StreamStatistics::StreamStatistics() : mapping(NULL), data(nullptr)
+{
+	std::stringstream name;
+	name << "Local\\FlexASIO-Statistics-" << GetCurrentProcessId();
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(StatisticsData), name.str().c_str());
+	// If the section already exists, it belongs to another instance of the driver in this process, which is still using it.
+	if (mapping && GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		CloseHandle(mapping);
+		mapping = NULL;
+	}
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(StatisticsData)) : nullptr;
+	if (view)
+	{
+		shared_memory_name = name.str();
+		data = new (view) StatisticsData;
+	}
+	else
+	{
+		if (mapping)
+		{
+			CloseHandle(mapping);
+			mapping = NULL;
+		}
+		private_data.reset(new StatisticsData);
+		data = private_data.get();
+	}
+
+	data->version = StatisticsData::current_version;
+	data->size = sizeof(StatisticsData);
+	data->sequence.store(0);
+	Reset();
+	// Readers that see the magic must also see everything else.
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(data->magic, "FlexASIO", sizeof(data->magic));
+}
+
+StreamStatistics::~StreamStatistics()
+{
+	if (mapping)
+	{
+		data->~StatisticsData();
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+	}
+}
+
+void StreamStatistics::BeginWrite()
+{
+	data->sequence.store(data->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void StreamStatistics::EndWrite()
+{
+	data->sequence.store(data->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void StreamStatistics::Reset()
+{
+	BeginWrite();
+	data->callback_count.store(0);
+	data->input_overflow_count.store(0);
+	data->input_underflow_count.store(0);
+	data->output_overflow_count.store(0);
+	data->output_underflow_count.store(0);
+	data->deadline_miss_count.store(0);
+	data->host_overload_count.store(0);
+	data->total_period.store(0);
+	data->max_load.store(0);
+	data->stall_count.store(0);
+	data->failed_recovery_count.store(0);
+	data->late_buffer_count.store(0);
+	data->callback_duration.Reset();
+	data->callback_jitter.Reset();
+	data->host_duration.Reset();
+	data->copy_duration.Reset();
+	data->recovery_duration.Reset();
+	EndWrite();
+}
+
+void StreamStatistics::RecordCallback(double duration, double period, double host_duration)
+{
+	BeginWrite();
+	Increment(data->callback_count);
+	if (duration > period)
+		Increment(data->deadline_miss_count);
+	data->total_period.store(data->total_period.load(std::memory_order_relaxed) + period, std::memory_order_relaxed);
+	if (period > 0 && duration / period > data->max_load.load(std::memory_order_relaxed))
+		data->max_load.store(duration / period, std::memory_order_relaxed);
+	data->callback_duration.Record(duration);
+	data->copy_duration.Record((std::max)(0.0, duration - host_duration));
+	EndWrite();
+}
+
+StreamStatistics::DurationSummary StreamStatistics::Summarize(const DurationHistogram& histogram)
+{
+	DurationSummary summary;
+	summary.median = histogram.GetPercentile(0.5);
+	summary.p99 = histogram.GetPercentile(0.99);
+	summary.max = histogram.GetMax();
+	return summary;
+}
+
+StreamStatistics::Summary StreamStatistics::GetSummary() const
+{
+	return Summarize(*data);
+}
+
+bool StreamStatistics::ReadSharedMemory(const void* view, size_t view_size, Summary* summary)
+{
+	if (!view || view_size < sizeof(StatisticsData))
+		return false;
+	const StatisticsData& data = *static_cast<const StatisticsData*>(view);
+	if (memcmp(data.magic, "FlexASIO", sizeof(data.magic)) != 0)
+		return false;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (data.version != StatisticsData::current_version || data.size != sizeof(StatisticsData))
+		return false;
+	*summary = Summarize(data);
+	return true;
+}
+
+StreamStatistics::Summary StreamStatistics::Summarize(const StatisticsData& data)
+{
+	Summary summary;
+	unsigned long sequence_before;
+	do
+	{
+		sequence_before = data.sequence.load(std::memory_order_acquire);
+		summary = SummarizeUnlocked(data);
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((sequence_before & 1) != 0 || data.sequence.load(std::memory_order_relaxed) != sequence_before);
+	return summary;
+}
+
+StreamStatistics::Summary StreamStatistics::SummarizeUnlocked(const StatisticsData& data)
+{
+	Summary summary;
+	summary.callback_count = data.callback_count.load(std::memory_order_relaxed);
+	summary.input_overflow_count = data.input_overflow_count.load(std::memory_order_relaxed);
+	summary.input_underflow_count = data.input_underflow_count.load(std::memory_order_relaxed);
+	summary.output_overflow_count = data.output_overflow_count.load(std::memory_order_relaxed);
+	summary.output_underflow_count = data.output_underflow_count.load(std::memory_order_relaxed);
+	summary.deadline_miss_count = data.deadline_miss_count.load(std::memory_order_relaxed);
+	summary.host_overload_count = data.host_overload_count.load(std::memory_order_relaxed);
+	summary.stall_count = data.stall_count.load(std::memory_order_relaxed);
+	summary.failed_recovery_count = data.failed_recovery_count.load(std::memory_order_relaxed);
+	summary.late_buffer_count = data.late_buffer_count.load(std::memory_order_relaxed);
+	summary.deadline_miss_percentage = summary.callback_count > 0 ? 100.0 * summary.deadline_miss_count / summary.callback_count : 0;
+	const double total_period = data.total_period.load(std::memory_order_relaxed);
+	summary.average_load = total_period > 0 ? data.callback_duration.GetTotal() / total_period : 0;
+	summary.max_load = data.max_load.load(std::memory_order_relaxed);
+	summary.callback_duration = Summarize(data.callback_duration);
+	summary.callback_jitter = Summarize(data.callback_jitter);
+	summary.host_duration = Summarize(data.host_duration);
+	summary.copy_duration = Summarize(data.copy_duration);
+	summary.recovery_duration = Summarize(data.recovery_duration);
+	return summary;
+}
@@ -0,0 +1,185 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <windows.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+// Log-scale histogram of durations, in microseconds: each power of two is split into sub_bucket_count linear sub-buckets, so percentiles are accurate to within 1/sub_bucket_count of an octave.
+// Written by a single thread without locking; can be read from any thread (or process) at any time.
+class DurationHistogram
+{
+	public:
+		static const int sub_bucket_count = 8;
+		static const int octave_count = 24;
+		static const int bucket_count = octave_count * sub_bucket_count;
+
+		void Reset();
+		// Real-time safe.
+		void Record(double duration);
+
+		unsigned long long GetCount() const { return count.load(std::memory_order_relaxed); }
+		double GetTotal() const { return total.load(std::memory_order_relaxed); }
+		double GetMax() const { return max.load(std::memory_order_relaxed); }
+		double GetPercentile(double fraction) const;
+
+	private:
+		static int GetBucket(double duration);
+		static double GetBucketUpperBound(int bucket);
+
+		std::atomic<unsigned long long> buckets[bucket_count];
+		std::atomic<unsigned long long> count;
+		std::atomic<double> total;
+		std::atomic<double> max;
+};
+
+// Everything the audio thread measures about the stream.
+// This is laid out so that it can live in shared memory and be read directly by other processes (see StreamStatistics::ReadSharedMemory()), which must check magic, version and size first.
+// Each field has a single writer. The fields that RecordCallback() updates together are written under sequence, so that readers get a consistent copy of them; the others might be very slightly inconsistent with each other when read while the stream is running, which doesn't matter here.
+struct StatisticsData
+{
+	static const unsigned long current_version = 4;
+
+	// "FlexASIO", not null-terminated. Written last, once the rest of the section is ready.
+	char magic[8];
+	unsigned long version;
+	// sizeof(StatisticsData).
+	unsigned long size;
+	// Same protocol as SeqLock: odd while the audio thread is updating callback_count, deadline_miss_count, total_period, max_load, callback_duration and copy_duration. Readers retry if it was odd, or changed while they were reading.
+	std::atomic<unsigned long> sequence;
+
+	std::atomic<unsigned long long> callback_count;
+	std::atomic<unsigned long long> input_overflow_count;
+	std::atomic<unsigned long long> input_underflow_count;
+	std::atomic<unsigned long long> output_overflow_count;
+	std::atomic<unsigned long long> output_underflow_count;
+	// Callbacks that took longer than the audio they processed.
+	std::atomic<unsigned long long> deadline_miss_count;
+	// Times the host repeatedly took more than the configured share of the buffer period (see Config::overload_threshold).
+	std::atomic<unsigned long long> host_overload_count;
+	// Total duration of the audio processed by all callbacks, in microseconds.
+	std::atomic<double> total_period;
+	std::atomic<double> max_load;
+	// Written by the stall watchdog thread: times the stream stopped calling back, and attempts to reopen it that failed.
+	std::atomic<unsigned long long> stall_count;
+	std::atomic<unsigned long long> failed_recovery_count;
+	// Only with the host thread (see Config::host_thread_buffers): times the audio thread found that the host thread hadn't produced the output in time, or hadn't taken the input, because the host fell further behind than the lookahead.
+	std::atomic<unsigned long long> late_buffer_count;
+
+	// From entering the PortAudio callback to returning from it.
+	DurationHistogram callback_duration;
+	// Difference between the time elapsed since the previous callback and the duration of the audio that callback processed.
+	DurationHistogram callback_jitter;
+	// Time spent in the host's bufferSwitch(), per ASIO buffer.
+	DurationHistogram host_duration;
+	// Time spent in the callback outside of the host (format conversion, copying, resampling), per callback.
+	DurationHistogram copy_duration;
+	// From noticing a stall to the stream running again, per successful recovery. Written by the stall watchdog thread.
+	DurationHistogram recovery_duration;
+};
+
+// Owns the StatisticsData for a stream. The data is placed in a named shared memory section, "Local\FlexASIO-Statistics-<process ID>", so that monitoring tools can read it without going through the host.
+// If that's not possible (e.g. another driver instance in the same process already owns the section), the data lives in private memory instead.
+class StreamStatistics
+{
+	public:
+		// In microseconds.
+		struct DurationSummary
+		{
+			double median;
+			double p99;
+			double max;
+		};
+
+		struct Summary
+		{
+			unsigned long long callback_count;
+			unsigned long long input_overflow_count;
+			unsigned long long input_underflow_count;
+			unsigned long long output_overflow_count;
+			unsigned long long output_underflow_count;
+			unsigned long long deadline_miss_count;
+			unsigned long long host_overload_count;
+			unsigned long long stall_count;
+			unsigned long long failed_recovery_count;
+			unsigned long long late_buffer_count;
+			// In percent of callbacks.
+			double deadline_miss_percentage;
+			// Time spent in the callback, divided by the duration of the audio processed.
+			double average_load;
+			double max_load;
+			DurationSummary callback_duration;
+			DurationSummary callback_jitter;
+			DurationSummary host_duration;
+			DurationSummary copy_duration;
+			DurationSummary recovery_duration;
+		};
+
+		StreamStatistics();
+		~StreamStatistics();
+
+		// Only safe while the audio thread is not running.
+		void Reset();
+
+		// The following are real-time safe and must be called from a single thread, except for the overflow and underflow counters which can be updated from any thread.
+		// With the host thread, RecordHost() and RecordHostOverload() are called from that thread instead of the audio thread.
+		// All durations are in microseconds. period is the duration of the audio processed by the callback; host_duration is the time spent in the host during the callback.
+		void RecordCallback(double duration, double period, double host_duration);
+		void RecordJitter(double jitter) { data->callback_jitter.Record(jitter); }
+		void RecordHost(double duration) { data->host_duration.Record(duration); }
+		void RecordHostOverload() { Increment(data->host_overload_count); }
+		void RecordInputOverflow() { data->input_overflow_count.fetch_add(1, std::memory_order_relaxed); }
+		void RecordInputUnderflow() { data->input_underflow_count.fetch_add(1, std::memory_order_relaxed); }
+		void RecordOutputOverflow() { data->output_overflow_count.fetch_add(1, std::memory_order_relaxed); }
+		void RecordOutputUnderflow() { data->output_underflow_count.fetch_add(1, std::memory_order_relaxed); }
+		void RecordLateBuffer() { Increment(data->late_buffer_count); }
+		// Called from the stall watchdog thread (see StallWatchdog).
+		void RecordStall() { Increment(data->stall_count); }
+		void RecordFailedRecovery() { Increment(data->failed_recovery_count); }
+		void RecordRecovery(double duration) { data->recovery_duration.Record(duration); }
+
+		Summary GetSummary() const;
+		// For monitoring tools: summarizes the StatisticsData that another process published in the given view of its shared memory section.
+		// Returns false if the view doesn't hold StatisticsData in the layout this code understands (yet), e.g. because the section is still being set up, or comes from a different version of FlexASIO.
+		static bool ReadSharedMemory(const void* view, size_t view_size, Summary* summary);
+		// Empty if the statistics are not in shared memory.
+		const std::string& GetSharedMemoryName() const { return shared_memory_name; }
+
+	private:
+		StreamStatistics(const StreamStatistics&);
+		StreamStatistics& operator=(const StreamStatistics&);
+
+		// There is only one writer, so there's no need for the cost of a locked read-modify-write.
+		static void Increment(std::atomic<unsigned long long>& counter) { counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+		static DurationSummary Summarize(const DurationHistogram& histogram);
+		// Retries until it gets a copy of the fields written under StatisticsData::sequence that wasn't torn by a concurrent RecordCallback().
+		static Summary Summarize(const StatisticsData& data);
+		static Summary SummarizeUnlocked(const StatisticsData& data);
+		void BeginWrite();
+		void EndWrite();
+
+		HANDLE mapping;
+		std::string shared_memory_name;
+		std::unique_ptr<StatisticsData> private_data;
+		StatisticsData* data;
+};
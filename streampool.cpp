@@ -0,0 +1,130 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "streampool.h"
+
+#include "util.h"
+
+StreamPool::StreamPool(std::chrono::milliseconds idle_timeout) :
+	idle_timeout(idle_timeout), parked(false), parked_sample_rate(0), stopping(false) { }
+
+StreamPool::~StreamPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		CloseParked();
+	}
+	wakeup.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+void StreamPool::Park(double sample_rate, Streams* streams)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	CloseParked();
+	parked_streams.stream = streams->stream;
+	parked_streams.input_stream = streams->input_stream;
+	parked_streams.aggregate_members = std::move(streams->aggregate_members);
+	streams->stream = NULL;
+	streams->input_stream = NULL;
+	streams->aggregate_members.clear();
+	parked = true;
+	parked_sample_rate = sample_rate;
+	if (idle_timeout.count() == 0)
+	{
+		CloseParked();
+		return;
+	}
+
+	Log() << "Keeping the PortAudio streams open for " << idle_timeout.count() << " ms in case they can be reused";
+	deadline = std::chrono::steady_clock::now() + idle_timeout;
+	if (!thread.joinable())
+		thread = std::thread(&StreamPool::Run, this);
+	wakeup.notify_all();
+}
+
+bool StreamPool::Take(double sample_rate, Streams* streams)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!parked)
+		return false;
+	if (parked_sample_rate != sample_rate)
+	{
+		Log() << "The parked PortAudio streams run at " << parked_sample_rate << " Hz instead of " << sample_rate << " Hz, closing them";
+		CloseParked();
+		return false;
+	}
+
+	streams->stream = parked_streams.stream;
+	streams->input_stream = parked_streams.input_stream;
+	streams->aggregate_members = std::move(parked_streams.aggregate_members);
+	parked_streams.stream = NULL;
+	parked_streams.input_stream = NULL;
+	parked_streams.aggregate_members.clear();
+	parked = false;
+	return true;
+}
+
+void StreamPool::Clear()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	CloseParked();
+}
+
+void StreamPool::CloseParked()
+{
+	if (!parked)
+		return;
+
+	Log() << "Closing the parked PortAudio streams";
+	if (parked_streams.stream)
+	{
+		const PaError error = Pa_CloseStream(parked_streams.stream);
+		if (error != paNoError)
+			Log(LOG_LEVEL_WARNING) << "Unable to close PortAudio stream: " << Pa_GetErrorText(error);
+	}
+	if (parked_streams.input_stream)
+	{
+		const PaError error = Pa_CloseStream(parked_streams.input_stream);
+		if (error != paNoError)
+			Log(LOG_LEVEL_WARNING) << "Unable to close PortAudio input stream: " << Pa_GetErrorText(error);
+	}
+	// The members close their own streams.
+	parked_streams.aggregate_members.clear();
+	parked_streams.stream = NULL;
+	parked_streams.input_stream = NULL;
+	parked = false;
+}
+
+void StreamPool::Run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping)
+	{
+		if (!parked)
+			wakeup.wait(lock);
+		else if (wakeup.wait_until(lock, deadline) == std::cv_status::timeout && parked && std::chrono::steady_clock::now() >= deadline)
+		{
+			Log() << "The parked PortAudio streams were not reused in time";
+			CloseParked();
+		}
+	}
+}
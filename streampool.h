@@ -0,0 +1,80 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "aggregate.h"
+#include "portaudio.h"
+
+// Keeps the PortAudio streams of the previous buffers open after disposeBuffers(), so that the next createBuffers() can reuse them instead of opening the devices again.
+// Opening a WASAPI stream often takes 100 ms or more, and hosts dispose and recreate their buffers whenever anything changes (buffer size, transport, reset requests).
+// FlexASIO always opens every channel of the devices and lets PortAudio pick its own buffer size, so the only thing that can make parked streams unusable is the sample rate.
+// Streams that are not reused within the idle timeout are closed on a background thread. All methods are thread-safe, but streams must not be running when they are parked.
+class StreamPool
+{
+	public:
+		// Everything createBuffers() opens for a given sample rate. Any of it can be null (or empty) if it isn't used.
+		struct Streams
+		{
+			Streams() : stream(NULL), input_stream(NULL) { }
+
+			PaStream* stream;
+			PaStream* input_stream;
+			std::vector<std::unique_ptr<AggregateMember>> aggregate_members;
+		};
+
+		// An idle timeout of zero disables pooling: parked streams are closed right away.
+		explicit StreamPool(std::chrono::milliseconds idle_timeout);
+		// Closes the parked streams, if any. PortAudio must still be initialized.
+		~StreamPool();
+
+		// Takes ownership of *streams, and closes whatever was parked before.
+		void Park(double sample_rate, Streams* streams);
+		// If streams are parked at sample_rate, moves them to *streams and returns true.
+		// Otherwise closes them, as a device can't be opened twice, and returns false.
+		bool Take(double sample_rate, Streams* streams);
+		// Closes the parked streams, if any.
+		void Clear();
+
+	private:
+		StreamPool(const StreamPool&);
+		StreamPool& operator=(const StreamPool&);
+
+		// Must be called with the mutex held.
+		void CloseParked();
+		void Run();
+
+		const std::chrono::milliseconds idle_timeout;
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		bool parked;
+		double parked_sample_rate;
+		Streams parked_streams;
+		std::chrono::steady_clock::time_point deadline;
+		bool stopping;
+		// Closes idle streams. Only started once something is parked.
+		std::thread thread;
+};
@@ -0,0 +1,235 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Deterministic simulation of an AggregateMember running on its own device clock, next to a master stream on another clock that drifts by up to +/- 200 ppm.
+// The device callback (DeviceCallback()) and the master side (PullInput(), PushOutput()) are called in the order the two clocks dictate, with a 1 kHz tone going through each direction.
+// Checks that neither direction ever underruns or overruns, that the measured drift matches the actual one, and that the tone comes out on the other side without any discontinuity, on the right channels.
+
+#include "../aggregate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+const double sample_rate = 48000;
+const double simulated_seconds = 300;
+const double settled_after_seconds = 150;
+const double tone_frequency = 1000;
+const float tone_level = 0.5f;
+const double pi = 3.14159265358979323846;
+// The tone can't change by more than this from one sample to the next, plus some slack for interpolation. Dropping or repeating even a single frame makes it jump by up to twice as much.
+const double max_step = 1.2 * 2 * pi * tone_frequency / sample_rate * tone_level;
+
+struct Scenario
+{
+	double drift_ppm;
+	size_t master_frames;
+	size_t device_frames;
+	long input_channel_count;
+	long output_channel_count;
+};
+
+// Generates the tone on channel 0, and its opposite on channel 1 (if any), so that swapped or misaligned channels show up.
+class ToneGenerator
+{
+	public:
+		void Generate(std::vector<float*>& channels, size_t frames)
+		{
+			for (size_t frame = 0; frame < frames; ++frame)
+			{
+				const float sample = static_cast<float>(tone_level * sin(2 * pi * tone_frequency * position++ / sample_rate));
+				for (size_t channel = 0; channel < channels.size(); ++channel)
+					channels[channel][frame] = channel == 1 ? -sample : sample;
+			}
+		}
+
+	private:
+		uint64_t position = 0;
+};
+
+// Checks that the tone comes out continuous, once the compensator has settled.
+class ToneChecker
+{
+	public:
+		explicit ToneChecker(const char* direction) : direction(direction) { }
+
+		void Check(const std::vector<float*>& channels, size_t frames, bool settled)
+		{
+			for (size_t frame = 0; frame < frames; ++frame)
+			{
+				const float sample = channels[0][frame];
+				if (settled && has_previous)
+				{
+					if (std::abs(sample - previous) > max_step)
+						++discontinuity_count;
+					if (channels.size() > 1 && channels[1][frame] != -sample)
+						++channel_mismatch_count;
+					peak = (std::max)(peak, std::abs(sample));
+				}
+				previous = sample;
+				has_previous = true;
+			}
+		}
+
+		void Report()
+		{
+			printf("  %s: %lu discontinuities, %lu channel mismatches, peak %.3f\n", direction, discontinuity_count, channel_mismatch_count, peak);
+			CHECK(discontinuity_count == 0);
+			CHECK(channel_mismatch_count == 0);
+			// The tone actually made it through, at the right level.
+			CHECK(std::abs(peak - tone_level) < 0.01);
+		}
+
+	private:
+		const char* const direction;
+		float previous = 0;
+		bool has_previous = false;
+		unsigned long discontinuity_count = 0;
+		unsigned long channel_mismatch_count = 0;
+		float peak = 0;
+};
+
+std::vector<float*> MakeChannels(std::vector<float>& storage, long channel_count, size_t frames)
+{
+	storage.assign(channel_count * frames, 0);
+	std::vector<float*> channels(channel_count);
+	for (long channel = 0; channel < channel_count; ++channel)
+		channels[channel] = storage.data() + channel * frames;
+	return channels;
+}
+
+void RunScenario(const Scenario& scenario)
+{
+	printf("Drift %+.0f ppm, master %zu frames, device %zu frames, %ld in, %ld out:\n", scenario.drift_ppm, scenario.master_frames, scenario.device_frames, scenario.input_channel_count, scenario.output_channel_count);
+	AggregateMember member("Fake member", scenario.input_channel_count, scenario.output_channel_count, sample_rate);
+	CHECK(member.GetInputChannelCount() == scenario.input_channel_count);
+	CHECK(member.GetOutputChannelCount() == scenario.output_channel_count);
+
+	// Callbacks come with 5% timing jitter on both sides.
+	std::mt19937 random(static_cast<unsigned int>(scenario.master_frames * 1000 + scenario.device_frames));
+	std::uniform_real_distribution<double> jitter(-0.05, 0.05);
+	const double device_period = scenario.device_frames / (sample_rate * (1 + scenario.drift_ppm * 1e-6));
+	const double master_period = scenario.master_frames / sample_rate;
+
+	std::vector<float> device_input_storage, device_output_storage, master_input_storage, master_output_storage;
+	std::vector<float*> device_input = MakeChannels(device_input_storage, scenario.input_channel_count, scenario.device_frames);
+	std::vector<float*> device_output = MakeChannels(device_output_storage, scenario.output_channel_count, scenario.device_frames);
+	std::vector<float*> master_input = MakeChannels(master_input_storage, scenario.input_channel_count, scenario.master_frames);
+	std::vector<float*> master_output = MakeChannels(master_output_storage, scenario.output_channel_count, scenario.master_frames);
+	ToneGenerator device_tone, master_tone;
+	ToneChecker input_checker("input"), output_checker("output");
+
+	uint64_t device_count = 0;
+	uint64_t master_count = 0;
+	double next_device = 0;
+	double next_master = 0;
+	double input_drift_sum = 0;
+	double output_drift_sum = 0;
+	uint64_t settled_count = 0;
+	for (;;)
+	{
+		const bool device = next_device <= next_master;
+		const double now = device ? next_device : next_master;
+		if (now >= simulated_seconds)
+			break;
+		const bool settled = now >= settled_after_seconds;
+
+		if (device)
+		{
+			device_tone.Generate(device_input, scenario.device_frames);
+			member.DeviceCallback(device_input.empty() ? nullptr : device_input.data(), device_output.empty() ? nullptr : device_output.data(), scenario.device_frames);
+			if (!device_output.empty())
+				output_checker.Check(device_output, scenario.device_frames, settled);
+			++device_count;
+			next_device = (device_count + jitter(random)) * device_period;
+		}
+		else
+		{
+			member.PullInput(master_input.data(), 0, scenario.master_frames);
+			if (!master_input.empty())
+				input_checker.Check(master_input, scenario.master_frames, settled);
+			master_tone.Generate(master_output, scenario.master_frames);
+			member.PushOutput(master_output.data(), scenario.master_frames);
+			++master_count;
+			next_master = (master_count + jitter(random)) * master_period;
+			if (settled)
+			{
+				const AggregateMember::Status status = member.GetStatus();
+				input_drift_sum += status.input_drift;
+				output_drift_sum += status.output_drift;
+				++settled_count;
+			}
+		}
+	}
+
+	const AggregateMember::Status status = member.GetStatus();
+	const double input_drift_ppm = input_drift_sum / settled_count * 1e6;
+	const double output_drift_ppm = output_drift_sum / settled_count * 1e6;
+	printf("  underruns %lu, overruns %lu, input drift %+.2f ppm, output drift %+.2f ppm, latency %zu in, %zu out\n",
+		status.underrun_count, status.overrun_count, input_drift_ppm, output_drift_ppm, member.GetInputLatency(), member.GetOutputLatency());
+	CHECK(status.underrun_count == 0);
+	CHECK(status.overrun_count == 0);
+	if (scenario.input_channel_count > 0)
+	{
+		input_checker.Report();
+		// Positive input drift means the device is faster than the master.
+		CHECK(std::abs(input_drift_ppm - scenario.drift_ppm) < 10);
+		CHECK(member.GetInputLatency() >= scenario.master_frames + scenario.device_frames);
+	}
+	else
+		CHECK(member.GetInputLatency() == 0 && status.input_drift == 0);
+	if (scenario.output_channel_count > 0)
+	{
+		output_checker.Report();
+		// Positive output drift means the device is slower than the master.
+		CHECK(std::abs(output_drift_ppm + scenario.drift_ppm) < 10);
+		CHECK(member.GetOutputLatency() >= scenario.master_frames + scenario.device_frames);
+	}
+	else
+		CHECK(member.GetOutputLatency() == 0 && status.output_drift == 0);
+
+	// After a reset, the member starts over from an empty ring.
+	member.Reset();
+	CHECK(member.GetStatus().input_level == 0 && member.GetStatus().output_level == 0);
+}
+
+}
+
+int main()
+{
+	// Equal callback sizes on both sides with a slow drift make the ratio wander for minutes at a time (see drift_test.cpp), more than this shorter run can average out, so those are left to drift_test.
+	const Scenario scenarios[] = {
+		{ -200, 480, 441, 2, 2 },
+		{ +200, 480, 441, 2, 2 },
+		{ -200, 128, 1024, 2, 2 },
+		{ +200, 1024, 128, 2, 2 },
+		{ +50, 512, 480, 2, 2 },
+		{ -200, 480, 480, 2, 0 },
+		{ +200, 480, 480, 0, 2 },
+	};
+	for (const Scenario& scenario : scenarios)
+		RunScenario(scenario);
+	return TestResult();
+}
@@ -0,0 +1,202 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Compares the ASIO buffer layout that createBuffers() uses (Buffers on top of BufferArena: 64-byte aligned, padded channels, prefaulted and locked) with what it replaced (a single value-initialized new Sample[] blob, channels packed back to back), and with the same blob left uninitialized (not prefaulted).
+// For each layout, reports how long it takes to allocate, how long the first simulated callback takes (converting every input channel to the host format and every output channel from it, as the stream callback does), and the median of the following ones.
+// Run with --quick (as CTest does) for a small subset that also checks the arena's alignment and zeroing.
+
+#include "../arena.h"
+#include "../convert.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "test.h"
+
+namespace {
+
+enum LayoutKind
+{
+	LAYOUT_ARENA,
+	LAYOUT_VALUE_INITIALIZED,
+	LAYOUT_UNINITIALIZED,
+};
+
+const char* GetLayoutName(LayoutKind kind)
+{
+	switch (kind)
+	{
+		case LAYOUT_ARENA: return "arena";
+		case LAYOUT_VALUE_INITIALIZED: return "new[]()";
+		case LAYOUT_UNINITIALIZED: return "new[]";
+	}
+	return "?";
+}
+
+// Two halves of input and output channel buffers, laid out like Buffers::getBuffer().
+class Layout
+{
+	public:
+		Layout(LayoutKind kind, size_t channel_count, size_t buffer_size, size_t sample_size) : channel_count(channel_count)
+		{
+			if (kind == LAYOUT_ARENA)
+			{
+				channel_stride = BufferArena::Align(buffer_size * sample_size);
+				arena.reset(new BufferArena(2 * channel_count * channel_stride, false));
+				base = static_cast<char*>(arena->Allocate(2 * channel_count * channel_stride));
+			}
+			else
+			{
+				channel_stride = buffer_size * sample_size;
+				blob.reset(kind == LAYOUT_VALUE_INITIALIZED ? new char[2 * channel_count * channel_stride]() : new char[2 * channel_count * channel_stride]);
+				base = blob.get();
+			}
+		}
+		char* GetBuffer(size_t half, size_t channel) const { return base + (half * channel_count + channel) * channel_stride; }
+		size_t GetSize() const { return 2 * channel_count * channel_stride; }
+
+	private:
+		const size_t channel_count;
+		size_t channel_stride;
+		std::unique_ptr<BufferArena> arena;
+		std::unique_ptr<char[]> blob;
+		char* base;
+};
+
+double GetMicroseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+// What the stream callback does to the ASIO buffers of one half: inputs are encoded into the host format, outputs decoded from it.
+void SimulateCallback(const Layout& layout, size_t half, const SampleConverter& converter, size_t channels, size_t buffer_size, const std::vector<float>& device_input, std::vector<float>& device_output)
+{
+	for (size_t channel = 0; channel < channels; ++channel)
+		converter.encode(layout.GetBuffer(half, channel), device_input.data() + channel * buffer_size, buffer_size);
+	for (size_t channel = 0; channel < channels; ++channel)
+		converter.decode(device_output.data() + channel * buffer_size, layout.GetBuffer(half, channels + channel), buffer_size);
+}
+
+struct Result
+{
+	double allocation = 0;
+	double first_callback = 0;
+	double steady_callback = 0;
+};
+
+double Median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+Result Measure(LayoutKind kind, SampleFormat format, size_t channels, size_t buffer_size, int trials, int steady_callbacks)
+{
+	const SampleConverter converter = GetSampleConverter(format);
+	std::vector<float> device_input(channels * buffer_size), device_output(channels * buffer_size);
+	for (size_t index = 0; index < device_input.size(); ++index)
+		device_input[index] = static_cast<float>((index % 97) / 97.0 - 0.5);
+
+	std::vector<double> allocation, first_callback, steady_callback;
+	for (int trial = 0; trial < trials; ++trial)
+	{
+		auto start = std::chrono::steady_clock::now();
+		Layout layout(kind, 2 * channels, buffer_size, converter.sample_size);
+		allocation.push_back(GetMicroseconds(start));
+
+		start = std::chrono::steady_clock::now();
+		SimulateCallback(layout, 0, converter, channels, buffer_size, device_input, device_output);
+		first_callback.push_back(GetMicroseconds(start));
+
+		for (int callback = 1; callback <= steady_callbacks; ++callback)
+		{
+			start = std::chrono::steady_clock::now();
+			SimulateCallback(layout, callback % 2, converter, channels, buffer_size, device_input, device_output);
+			steady_callback.push_back(GetMicroseconds(start));
+		}
+	}
+	Result result;
+	result.allocation = Median(allocation);
+	result.first_callback = Median(first_callback);
+	result.steady_callback = Median(steady_callback);
+	return result;
+}
+
+void CheckArena()
+{
+	BufferArena arena(10000, false);
+	printf("Arena: %s, %s\n", arena.IsLocked() ? "locked" : "not locked", arena.UsesLargePages() ? "large pages" : "small pages");
+	size_t total = 0;
+	for (const size_t size : { size_t(1), size_t(63), size_t(64), size_t(65), size_t(1000) })
+	{
+		char* const allocation = static_cast<char*>(arena.Allocate(size));
+		if (!CHECK(allocation != nullptr)) continue;
+		CHECK(reinterpret_cast<uintptr_t>(allocation) % BufferArena::alignment == 0);
+		CHECK(std::all_of(allocation, allocation + size, [](char value) { return value == 0; }));
+		memset(allocation, 0xFF, size);
+		total += BufferArena::Align(size);
+	}
+	// Capacity is rounded up to whole pages, but never handed out beyond that.
+	CHECK(arena.Allocate(1 << 20) == nullptr);
+
+	const Layout layout(LAYOUT_ARENA, 6, 33, 3);
+	for (size_t half = 0; half < 2; ++half)
+		for (size_t channel = 0; channel < 6; ++channel)
+			CHECK(reinterpret_cast<uintptr_t>(layout.GetBuffer(half, channel)) % BufferArena::alignment == 0);
+}
+
+void Run(SampleFormat format, const std::vector<size_t>& channel_counts, const std::vector<size_t>& buffer_sizes, int trials, int steady_callbacks)
+{
+	printf("%s, %d trials, median of each, in microseconds:\n", GetSampleFormatName(format), trials);
+	printf("%8s %8s %9s | %10s %10s %10s\n", "channels", "buffer", "layout", "allocate", "first cb", "steady cb");
+	for (const size_t channels : channel_counts)
+		for (const size_t buffer_size : buffer_sizes)
+			for (const LayoutKind kind : { LAYOUT_VALUE_INITIALIZED, LAYOUT_UNINITIALIZED, LAYOUT_ARENA })
+			{
+				const Result result = Measure(kind, format, channels, buffer_size, trials, steady_callbacks);
+				printf("%8zu %8zu %9s | %10.2f %10.2f %10.2f\n", channels, buffer_size, GetLayoutName(kind), result.allocation, result.first_callback, result.steady_callback);
+			}
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+#ifdef __GLIBC__
+	// Otherwise glibc raises its mmap threshold as soon as the first large blob is freed, and serves every later trial from heap pages the previous trial already faulted in, which hides the cost of touching fresh memory.
+	mallopt(M_MMAP_THRESHOLD, 64 * 1024);
+#endif
+	printf("Conversion kernels: %s\n", GetInstructionSetName(GetBestInstructionSet()));
+	CheckArena();
+	if (quick)
+		Run(SAMPLE_FORMAT_INT24, { 8 }, { 256 }, 3, 10);
+	else
+		for (const SampleFormat format : { SAMPLE_FORMAT_FLOAT32, SAMPLE_FORMAT_INT24 })
+			Run(format, { 2, 8, 32, 64 }, { 64, 256, 1024, 4096 }, 25, 200);
+	return TestResult();
+}
@@ -0,0 +1,169 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Walks the buffer size tuning through the sessions a user would go through: settling down from twice the device period until a size glitches, backing off from glitches and jitter, ignoring sessions too short to tell, and starting over when the device period changes.
+
+#include "../buffersize.h"
+
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+const double sample_rate = 48000;
+
+BufferSizeSession MakeSession(long buffer_size, long device_period, double duration, unsigned long long glitch_count = 0, double jitter = 0.1)
+{
+	BufferSizeSession session;
+	session.buffer_size = buffer_size;
+	session.device_period = device_period;
+	session.duration = duration;
+	session.glitch_count = glitch_count;
+	session.jitter = jitter;
+	return session;
+}
+
+void TestCandidates()
+{
+	const std::vector<long> candidates = GetBufferSizeCandidates(480, sample_rate);
+	CHECK(!candidates.empty() && candidates.front() == 480);
+	// Up to about a second's worth, and never past it by more than one step.
+	CHECK(!candidates.empty() && candidates.back() <= sample_rate);
+	for (size_t index = 1; index < candidates.size(); ++index)
+		CHECK(candidates[index] > candidates[index - 1] && candidates[index] % 480 == 0);
+	CHECK(GetBufferSizeCandidates(0, sample_rate).empty());
+	// A period longer than a second still gets one candidate.
+	CHECK(GetBufferSizeCandidates(96000, sample_rate) == std::vector<long>(1, 96000));
+}
+
+void TestSettle()
+{
+	BufferSizeTuning tuning;
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 0);
+
+	// The first session tells us the period, and then we start at twice that.
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(512, 128, 60)));
+	CHECK(tuning.device_period == 128);
+	CHECK(tuning.smallest_stable_size == 512);
+	// 512 ran cleanly: try the next smaller candidate, 384, then 256, then 128.
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 384);
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(384, 128, 60)));
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 256);
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(256, 128, 60)));
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 128);
+	// 128 glitches: settle on 256, and stay there.
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(128, 128, 60, 3)));
+	CHECK(tuning.largest_unstable_size == 128);
+	CHECK(tuning.smallest_stable_size == 256);
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 256);
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(256, 128, 60)));
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 256);
+
+	// From scratch, with no size known to work yet, the first suggestion is twice the period.
+	BufferSizeTuning fresh;
+	fresh.device_period = 128;
+	CHECK(GetPreferredBufferSize(fresh, sample_rate) == 256);
+}
+
+void TestBackOff()
+{
+	BufferSizeTuning tuning;
+	tuning.device_period = 128;
+	// A glitch at the suggested size: go to the next candidate up.
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(256, 128, 60, 1)));
+	CHECK(tuning.largest_unstable_size == 256);
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 384);
+	// Glitches count even in a short session.
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(384, 128, 1, 1)));
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 512);
+	// So does jitter that eats into the host's margin, without any glitch.
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(512, 128, 60, 0, 0.8)));
+	CHECK(tuning.largest_unstable_size == 512);
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 768);
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(768, 128, 60)));
+	CHECK(tuning.smallest_stable_size == 768);
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 768);
+
+	// A size that used to work glitches: forget it, and go above.
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(768, 128, 60, 2)));
+	CHECK(tuning.smallest_stable_size == 0);
+	CHECK(tuning.largest_unstable_size == 768);
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 1024);
+
+	// Later, a smaller size runs cleanly after all: whatever made it glitch is gone.
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(256, 128, 60)));
+	CHECK(tuning.smallest_stable_size == 256);
+	CHECK(tuning.largest_unstable_size == 0);
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 128);
+
+	// Everything glitches: suggest the largest candidate.
+	BufferSizeTuning hopeless;
+	hopeless.device_period = 128;
+	hopeless.largest_unstable_size = 1 << 20;
+	CHECK(GetPreferredBufferSize(hopeless, sample_rate) == GetBufferSizeCandidates(128, sample_rate).back());
+}
+
+void TestShortSession()
+{
+	BufferSizeTuning tuning;
+	tuning.device_period = 128;
+	tuning.smallest_stable_size = 512;
+	// A clean session under 30 s tells nothing, and nothing changes.
+	CHECK(!RecordBufferSizeSession(&tuning, MakeSession(384, 128, 10)));
+	CHECK(tuning.device_period == 128);
+	CHECK(tuning.smallest_stable_size == 512);
+	CHECK(tuning.largest_unstable_size == 0);
+}
+
+void TestPeriodChange()
+{
+	BufferSizeTuning tuning;
+	tuning.device_period = 128;
+	tuning.smallest_stable_size = 256;
+	tuning.largest_unstable_size = 128;
+
+	// A short clean session at a new period still resets what we know, and says so, so that it gets saved.
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(960, 480, 5)));
+	CHECK(tuning.device_period == 480);
+	CHECK(tuning.smallest_stable_size == 0);
+	CHECK(tuning.largest_unstable_size == 0);
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 960);
+	// Once it is saved, another short session at the same period is back to telling nothing.
+	CHECK(!RecordBufferSizeSession(&tuning, MakeSession(960, 480, 5)));
+
+	// A long session at a new period starts over from what it tells.
+	CHECK(RecordBufferSizeSession(&tuning, MakeSession(512, 256, 60, 1)));
+	CHECK(tuning.device_period == 256);
+	CHECK(tuning.smallest_stable_size == 0);
+	CHECK(tuning.largest_unstable_size == 512);
+	CHECK(GetPreferredBufferSize(tuning, sample_rate) == 768);
+}
+
+}
+
+int main()
+{
+	TestCandidates();
+	TestSettle();
+	TestBackOff();
+	TestShortSession();
+	TestPeriodChange();
+	return TestResult();
+}
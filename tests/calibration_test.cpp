@@ -0,0 +1,189 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Checks GenerateMaximumLengthSequence() and DetectDelay() against synthetic recordings: a known delay, a signal buried in noise, inverted polarity, and recordings that are too short or contain no signal at all.
+// Also runs LatencyCalibration end to end through a simulated round trip.
+
+#include "../calibration.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+// Same as in calibration.cpp.
+const float signal_level = 0.25f;
+
+std::vector<float> GetReference()
+{
+	std::vector<float> reference = GenerateMaximumLengthSequence(15);
+	for (float& sample : reference)
+		sample *= signal_level;
+	return reference;
+}
+
+// The reference, scaled by gain, starting at delay in a recording of the given size, plus white Gaussian noise.
+std::vector<float> MakeRecording(const std::vector<float>& reference, size_t size, size_t delay, float gain, double noise_rms, unsigned int seed)
+{
+	std::vector<float> recording(size);
+	for (size_t index = 0; index < reference.size() && delay + index < size; ++index)
+		recording[delay + index] = gain * reference[index];
+	if (noise_rms > 0)
+	{
+		std::mt19937 random(seed);
+		std::normal_distribution<double> noise(0, noise_rms);
+		for (float& sample : recording)
+			sample += static_cast<float>(noise(random));
+	}
+	return recording;
+}
+
+void CheckMaximumLengthSequences()
+{
+	for (int order = 2; order <= 16; ++order)
+	{
+		const std::vector<float> sequence = GenerateMaximumLengthSequence(order);
+		CHECK(sequence.size() == (size_t(1) << order) - 1);
+		// A maximum length sequence has exactly one more 1 than -1...
+		double sum = 0;
+		for (const float sample : sequence)
+		{
+			CHECK(sample == 1.0f || sample == -1.0f);
+			sum += sample;
+		}
+		CHECK(sum == 1);
+		// ...and its circular autocorrelation is the length at lag 0 and -1 everywhere else. That's what makes it a maximum length sequence, as opposed to a shorter cycle of the same LFSR.
+		if (order > 12) continue;
+		for (size_t lag = 0; lag < sequence.size(); ++lag)
+		{
+			double correlation = 0;
+			for (size_t index = 0; index < sequence.size(); ++index)
+				correlation += sequence[index] * sequence[(index + lag) % sequence.size()];
+			if (!CHECK(correlation == (lag == 0 ? double(sequence.size()) : -1.0)))
+			{
+				printf("Order %d: autocorrelation %g at lag %zu\n", order, correlation, lag);
+				break;
+			}
+		}
+	}
+}
+
+void CheckDelay(const char* name, const std::vector<float>& reference, const std::vector<float>& recording, size_t expected_delay)
+{
+	size_t delay = 0;
+	double peak_to_noise_ratio = 0;
+	const bool found = DetectDelay(reference, recording, &delay, &peak_to_noise_ratio);
+	printf("%s: %s, delay %zu (expected %zu), peak to noise ratio %.1f\n", name, found ? "found" : "not found", delay, expected_delay, peak_to_noise_ratio);
+	CHECK(found);
+	CHECK(delay == expected_delay);
+}
+
+void CheckNotFound(const char* name, const std::vector<float>& reference, const std::vector<float>& recording)
+{
+	size_t delay = 0;
+	double peak_to_noise_ratio = 0;
+	const bool found = DetectDelay(reference, recording, &delay, &peak_to_noise_ratio);
+	printf("%s: %s, peak to noise ratio %.1f\n", name, found ? "found" : "not found", peak_to_noise_ratio);
+	CHECK(!found);
+}
+
+void CheckDetectDelay()
+{
+	const std::vector<float> reference = GetReference();
+	const size_t size = reference.size() + 48000;
+
+	for (const size_t delay : { size_t(0), size_t(1), size_t(4800), size_t(12345), size - reference.size() })
+		CheckDelay("Clean", reference, MakeRecording(reference, size, delay, 1, 0, 0), delay);
+	// The gain doesn't matter, only how the signal compares to the noise.
+	CheckDelay("Attenuated by 40 dB", reference, MakeRecording(reference, size, 9876, 0.01f, 0, 0), 9876);
+	CheckDelay("Inverted polarity", reference, MakeRecording(reference, size, 9876, -1, 0, 0), 9876);
+	CheckDelay("Inverted polarity, attenuated", reference, MakeRecording(reference, size, 9876, -0.5f, 0, 0), 9876);
+
+	// The signal RMS is signal_level; put it 24 dB below the noise.
+	const double noise_rms_24db = signal_level * pow(10, 24.0 / 20);
+	for (unsigned int seed = 1; seed <= 16; ++seed)
+		CheckDelay("-24 dB SNR", reference, MakeRecording(reference, size, 1000 * seed + 7, 1, noise_rms_24db, seed), 1000 * seed + 7);
+	CheckDelay("-24 dB SNR, inverted polarity", reference, MakeRecording(reference, size, 31337, -1, noise_rms_24db, 5), 31337);
+
+	for (unsigned int seed = 100; seed < 104; ++seed)
+		CheckNotFound("Noise only", reference, MakeRecording(reference, size, 0, 0, noise_rms_24db, seed));
+	CheckNotFound("Silence", reference, std::vector<float>(size));
+	// The whole reference must fit in the recording: a recording that is shorter can't be searched, and one that cuts the signal off can't give a reliable answer.
+	CheckNotFound("Recording shorter than the reference", reference, MakeRecording(reference, reference.size() - 1, 0, 1, 0, 0));
+	CheckNotFound("Empty recording", reference, std::vector<float>());
+	CheckNotFound("Empty reference", std::vector<float>(), MakeRecording(reference, size, 0, 1, 0, 0));
+	// With a single possible lag, there is nothing to compare the peak against, so it can't be told apart from noise.
+	CheckNotFound("Recording exactly as long as the reference", reference, MakeRecording(reference, reference.size(), 0, 1, 0, 0));
+}
+
+// Runs LatencyCalibration through a simulated device whose input is its output delayed by round_trip frames, attenuated, and with some noise.
+void CheckCalibration(size_t round_trip, size_t frames_per_callback)
+{
+	const double sample_rate = 48000;
+	LatencyCalibration calibration(1, 0, sample_rate);
+	std::vector<float> delay_line(round_trip);
+	size_t delay_line_position = 0;
+	std::vector<float> input(frames_per_callback), output_left(frames_per_callback), output_right(frames_per_callback);
+	std::mt19937 random(static_cast<unsigned int>(round_trip));
+	std::normal_distribution<double> noise(0, 0.01);
+
+	size_t callback_count = 0;
+	while (!calibration.IsComplete() && callback_count < 1000000)
+	{
+		const float* const inputs[] = { input.data() };
+		float* const outputs[] = { output_left.data(), output_right.data() };
+		calibration.Process(inputs, outputs, 2, frames_per_callback);
+		++callback_count;
+		for (const float sample : output_left)
+			CHECK(sample == 0);
+		// What the device plays now comes back round_trip frames later.
+		for (size_t frame = 0; frame < frames_per_callback; ++frame)
+		{
+			float& delayed = round_trip > 0 ? delay_line[delay_line_position] : output_right[frame];
+			input[frame] = static_cast<float>(0.5 * delayed + noise(random));
+			if (round_trip == 0) continue;
+			delayed = output_right[frame];
+			delay_line_position = (delay_line_position + 1) % round_trip;
+		}
+	}
+	CHECK(calibration.IsComplete());
+
+	size_t measured = 0;
+	double peak_to_noise_ratio = 0;
+	const bool found = calibration.Analyze(&measured, &peak_to_noise_ratio);
+	printf("Calibration with a %zu frame round trip, %zu frames per callback: %s, %zu frames, peak to noise ratio %.1f\n", round_trip, frames_per_callback, found ? "found" : "not found", measured, peak_to_noise_ratio);
+	CHECK(found);
+	// The input of each callback is computed after its output, so the simulated device adds exactly one callback of latency on top of the delay line.
+	CHECK(measured == round_trip + frames_per_callback);
+}
+
+}
+
+int main()
+{
+	CheckMaximumLengthSequences();
+	CheckDetectDelay();
+	CheckCalibration(0, 480);
+	CheckCalibration(1234, 480);
+	CheckCalibration(20000, 64);
+	return TestResult();
+}
@@ -0,0 +1,175 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Saves the capability cache from several instances, the way concurrent driver instances would: checks that what each of them learned ends up in the file, that an instance's own values win over those it loaded, and that concurrent saves never lose or tear the file.
+
+#include "../capabilities.h"
+#include "../log.h"
+
+#include <windows.h>
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+DeviceCapabilities MakeCapabilities(long channel_count)
+{
+	DeviceCapabilities capabilities;
+	capabilities.input_channel_count = channel_count;
+	capabilities.output_channel_count = channel_count;
+	capabilities.input_default_sample_rate = 48000;
+	capabilities.output_default_sample_rate = 48000;
+	return capabilities;
+}
+
+BufferSizeTuning MakeTuning(long smallest_stable_size)
+{
+	BufferSizeTuning tuning;
+	tuning.device_period = 128;
+	tuning.smallest_stable_size = smallest_stable_size;
+	return tuning;
+}
+
+void TestMerge(const std::string& path)
+{
+	remove(path.c_str());
+	CapabilityCache first(path);
+	CapabilityCache second(path);
+	first.Load();
+	second.Load();
+
+	DeviceCapabilities capabilities = MakeCapabilities(2);
+	first.Validate("devices", &capabilities);
+	first.SetLatencyCorrection("devices", 48000, 0.01);
+	first.SetSampleRate("devices", 44100, true);
+	first.Save();
+	// The second instance loaded the cache before the first one saved, and learns something else.
+	capabilities = MakeCapabilities(2);
+	second.Validate("devices", &capabilities);
+	second.SetBufferSizeTuning("devices", 48000, MakeTuning(256));
+	second.SetSampleRate("devices", 96000, false);
+	DeviceCapabilities other_capabilities = MakeCapabilities(8);
+	second.Validate("other devices", &other_capabilities);
+	second.Save();
+
+	CapabilityCache reader(path);
+	reader.Load();
+	double correction = 0;
+	CHECK(reader.GetLatencyCorrection("devices", 48000, &correction) && correction == 0.01);
+	BufferSizeTuning tuning;
+	CHECK(reader.GetBufferSizeTuning("devices", 48000, &tuning) && tuning.smallest_stable_size == 256);
+	bool supported = false;
+	CHECK(reader.GetSampleRate("devices", 44100, &supported) && supported);
+	CHECK(reader.GetSampleRate("devices", 96000, &supported) && !supported);
+	DeviceCapabilities read_capabilities = MakeCapabilities(8);
+	reader.Validate("other devices", &read_capabilities);
+	CHECK(read_capabilities.last_used != 0);
+
+	// Saving merged the first instance's values into the second one's copy too.
+	CHECK(second.GetLatencyCorrection("devices", 48000, &correction) && correction == 0.01);
+}
+
+void TestPrecedence(const std::string& path)
+{
+	remove(path.c_str());
+	CapabilityCache first(path);
+	CapabilityCache second(path);
+	first.Load();
+	second.Load();
+	DeviceCapabilities capabilities = MakeCapabilities(2);
+	first.Validate("devices", &capabilities);
+	capabilities = MakeCapabilities(2);
+	second.Validate("devices", &capabilities);
+
+	// Both learn a correction for the same rate: the one saved last was measured last, and wins.
+	second.SetLatencyCorrection("devices", 48000, 0.02);
+	second.Save();
+	first.SetLatencyCorrection("devices", 48000, 0.03);
+	first.Save();
+	double correction = 0;
+	CapabilityCache reader(path);
+	reader.Load();
+	CHECK(reader.GetLatencyCorrection("devices", 48000, &correction) && correction == 0.03);
+
+	// The second instance still has its own 0.02, but has nothing new about it: saving something else must not bring it back.
+	second.SetBufferSizeTuning("devices", 48000, MakeTuning(512));
+	second.Save();
+	reader.Load();
+	CHECK(reader.GetLatencyCorrection("devices", 48000, &correction) && correction == 0.03);
+	BufferSizeTuning tuning;
+	CHECK(reader.GetBufferSizeTuning("devices", 48000, &tuning) && tuning.smallest_stable_size == 512);
+
+	// Devices whose format changed start over, whatever the file had for them.
+	DeviceCapabilities changed_capabilities = MakeCapabilities(4);
+	first.Validate("devices", &changed_capabilities);
+	CHECK(changed_capabilities.latency_corrections.empty());
+	first.Save();
+	reader.Load();
+	CHECK(!reader.GetLatencyCorrection("devices", 48000, &correction));
+	CHECK(!reader.GetBufferSizeTuning("devices", 48000, &tuning));
+}
+
+void TestConcurrentSaves(const std::string& path)
+{
+	remove(path.c_str());
+	const int instance_count = 8;
+	for (int round = 0; round < 10; ++round)
+	{
+		std::vector<std::thread> threads;
+		for (int instance = 0; instance < instance_count; ++instance)
+			threads.emplace_back([&path, instance, round] {
+				CapabilityCache cache(path);
+				cache.Load();
+				DeviceCapabilities capabilities = MakeCapabilities(2);
+				const std::string key = "devices " + std::to_string(instance);
+				cache.Validate(key, &capabilities);
+				cache.SetLatencyCorrection(key, 48000 + round, instance / 1000.0);
+				cache.Save();
+			});
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	CapabilityCache reader(path);
+	reader.Load();
+	for (int instance = 0; instance < instance_count; ++instance)
+		for (int round = 0; round < 10; ++round)
+		{
+			double correction = -1;
+			CHECK(reader.GetLatencyCorrection("devices " + std::to_string(instance), 48000 + round, &correction) && correction == instance / 1000.0);
+		}
+}
+
+}
+
+int main()
+{
+	Logger::Get().SetLevel(LOG_LEVEL_WARNING);
+	const std::string path = "/tmp/flexasio_capabilities_test_" + std::to_string(GetCurrentProcessId()) + ".bin";
+	TestMerge(path);
+	TestPrecedence(path);
+	TestConcurrentSaves(path);
+	remove(path.c_str());
+	return TestResult();
+}
@@ -0,0 +1,55 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <atlbase.h>
+
+#include <atomic>
+
+// COM maps, registration and class factories don't mean anything here: objects are created directly through CComObject.
+#define BEGIN_COM_MAP(x)
+#define COM_INTERFACE_ENTRY(x)
+#define END_COM_MAP()
+#define DECLARE_REGISTRY_RESOURCEID(x)
+#define OBJECT_ENTRY_AUTO(clsid, class)
+
+template <class T, const CLSID* clsid> class CComCoClass { };
+
+// Implements IUnknown on top of Base, like ATL does. Starts with one reference, which the caller owns.
+template <class Base> class CComObject : public Base
+{
+	public:
+		HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, void** object) override
+		{
+			*object = nullptr;
+			return E_NOINTERFACE;
+		}
+		ULONG STDMETHODCALLTYPE AddRef() override { return ++references; }
+		ULONG STDMETHODCALLTYPE Release() override
+		{
+			const ULONG remaining = --references;
+			if (remaining == 0)
+				delete this;
+			return remaining;
+		}
+
+	private:
+		std::atomic<ULONG> references{ 1 };
+};
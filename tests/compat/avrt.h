@@ -0,0 +1,28 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <windows.h>
+
+// MMCSS doesn't exist outside of Windows. Failing makes the driver fall back to SetThreadPriority().
+inline HANDLE AvSetMmThreadCharacteristicsA(LPCSTR, DWORD*) { SetLastError(ERROR_FILE_NOT_FOUND); return NULL; }
+inline BOOL AvRevertMmThreadCharacteristics(HANDLE) { return TRUE; }
+enum AVRT_PRIORITY { AVRT_PRIORITY_VERYLOW = -2, AVRT_PRIORITY_LOW, AVRT_PRIORITY_NORMAL, AVRT_PRIORITY_HIGH, AVRT_PRIORITY_CRITICAL };
+inline BOOL AvSetMmThreadPriority(HANDLE, AVRT_PRIORITY) { return FALSE; }
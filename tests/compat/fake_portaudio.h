@@ -0,0 +1,98 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include "portaudio.h"
+
+#include <windows.h>
+
+#include <string>
+#include <vector>
+
+// Controls the fake PortAudio backend behind the compat portaudio.h. There is a single host API, which reports itself as WASAPI, with the devices below.
+// Input channels carry a quiet sine wave (a different frequency on each channel), so that there is something to meter and record.
+
+struct FakeDevice
+{
+	std::string name = "Fake device";
+	int input_channels = 2;
+	int output_channels = 2;
+	double default_sample_rate = 48000;
+	// Sample rates streams can be opened at. Empty means any.
+	std::vector<double> sample_rates;
+	// Frames per callback for streams opened with paFramesPerBufferUnspecified, like WASAPI in shared mode.
+	unsigned long period_frames = 480;
+	// In seconds, as reported by Pa_GetDeviceInfo() and Pa_GetStreamInfo(), and used for callback timestamps.
+	double latency = 0.01;
+	// As reported by PaWasapi_GetDeviceDefaultFormat(). 32 bits means float.
+	DWORD channel_mask = 0;
+	int bits_per_sample = 32;
+	// Relative clock rate error of the device, e.g. 100e-6 for a device that runs 100 ppm fast. Only affects FAKE_CLOCK_REALTIME.
+	double clock_drift = 0;
+};
+
+enum FakeClock
+{
+	// Callbacks are paced by the steady clock, like a real device. A callback that returns after the next one is due is an xrun: the next callback gets paOutputUnderflow and paInputOverflow (as appropriate), and periods that were missed entirely are skipped.
+	FAKE_CLOCK_REALTIME,
+	// Callbacks run back-to-back, as fast as the driver can go, and stream time advances by one period per callback. Useful to measure CPU cost.
+	FAKE_CLOCK_VIRTUAL,
+	// Nothing calls back on its own: the test calls RunFakeStreamCallbacks().
+	FAKE_CLOCK_MANUAL,
+};
+
+struct FakePortAudioConfig
+{
+	std::vector<FakeDevice> devices = std::vector<FakeDevice>(1);
+	PaDeviceIndex default_input_device = 0;
+	PaDeviceIndex default_output_device = 0;
+	FakeClock clock = FAKE_CLOCK_REALTIME;
+	// If non-zero, every stream stops calling back after that many callbacks, like a device that stalls, until it is stopped or aborted.
+	unsigned long stall_after_callbacks = 0;
+	// Simulated cost of the corresponding PortAudio calls, in milliseconds, to make startup measurements meaningful.
+	double initialize_delay_ms = 0;
+	double open_stream_delay_ms = 0;
+	double start_stream_delay_ms = 0;
+};
+
+// Takes effect for the next Pa_Initialize(). Also resets the statistics.
+void ConfigureFakePortAudio(const FakePortAudioConfig& config);
+
+struct FakeStreamStatistics
+{
+	unsigned long long callback_count = 0;
+	unsigned long long xrun_count = 0;
+	// How long each callback took, in microseconds, in order.
+	std::vector<double> callback_durations;
+	// Thread CPU time spent in callbacks, in microseconds.
+	double callback_cpu_time = 0;
+	// From Pa_StartStream() to the end of the first callback, in milliseconds, for the most recently started stream. Negative if it hasn't called back yet.
+	double first_callback_delay_ms = -1;
+	// Pa_Initialize() calls that actually initialized PortAudio, as opposed to just adding a reference.
+	unsigned long initializations = 0;
+	unsigned long streams_opened = 0;
+	unsigned long streams_started = 0;
+};
+
+// For all the streams since ConfigureFakePortAudio() or the last reset.
+FakeStreamStatistics GetFakeStreamStatistics(bool reset = false);
+
+// FAKE_CLOCK_MANUAL only: runs count callbacks of every started stream, on the calling thread. Returns the number of streams that were run.
+size_t RunFakeStreamCallbacks(unsigned long count);
@@ -0,0 +1,30 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <windows.h>
+
+#include <string>
+
+// Values returned by the registry functions in the compat <windows.h>, keyed by subkey path (relative to HKEY_CURRENT_USER, e.g. "Software\\FlexASIO") and value name.
+// A subkey exists as soon as it has a value. Not thread-safe: set everything up before creating the objects that read the registry.
+void SetFakeRegistryValue(const std::string& key, const std::string& name, DWORD value);
+void SetFakeRegistryValue(const std::string& key, const std::string& name, const std::string& value);
+void ClearFakeRegistry();
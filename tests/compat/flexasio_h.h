@@ -0,0 +1,96 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// What MIDL generates from flexasio.idl, written by hand so that the tests don't need MIDL. Keep it in sync with flexasio.idl. Only used when not building on Windows.
+
+#include <windows.h>
+
+typedef struct FlexASIOStatistics
+{
+	uint64_t callbackCount;
+	uint64_t inputOverflowCount;
+	uint64_t inputUnderflowCount;
+	uint64_t outputOverflowCount;
+	uint64_t outputUnderflowCount;
+	uint64_t deadlineMissCount;
+	uint64_t hostOverloadCount;
+	double deadlineMissPercentage;
+	double averageLoad;
+	double maxLoad;
+	double callbackDurationMedian;
+	double callbackDurationP99;
+	double callbackDurationMax;
+	double callbackJitterMedian;
+	double callbackJitterP99;
+	double callbackJitterMax;
+	double hostDurationMedian;
+	double hostDurationP99;
+	double hostDurationMax;
+	double copyDurationMedian;
+	double copyDurationP99;
+	double copyDurationMax;
+	uint64_t stallCount;
+	uint64_t failedRecoveryCount;
+	double recoveryDurationMedian;
+	double recoveryDurationP99;
+	double recoveryDurationMax;
+	uint64_t lateBufferCount;
+} FlexASIOStatistics;
+
+typedef struct FlexASIORecordingStatus
+{
+	LONG recording;
+	uint64_t framesWritten;
+	uint64_t overrunCount;
+	uint64_t droppedFrameCount;
+	LONG writeError;
+} FlexASIORecordingStatus;
+
+typedef struct FlexASIOLoopbackStatus
+{
+	LONG inputClientAttached;
+	LONG outputClientAttached;
+	ULONG inputLevel;
+	ULONG outputLevel;
+	uint64_t inputUnderrunCount;
+	uint64_t outputOverrunCount;
+} FlexASIOLoopbackStatus;
+
+typedef struct FlexASIOChannelLevels
+{
+	float peak;
+	float rms;
+	float maxPeak;
+	uint64_t clipCount;
+} FlexASIOChannelLevels;
+
+interface IFlexASIO : public IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE GetStatistics(FlexASIOStatistics* statistics) = 0;
+	virtual HRESULT STDMETHODCALLTYPE ResetStatistics() = 0;
+	virtual HRESULT STDMETHODCALLTYPE StartRecording(LPCWSTR path, unsigned long inputChannelCount, const unsigned long* inputChannels, unsigned long outputChannelCount, const unsigned long* outputChannels) = 0;
+	virtual HRESULT STDMETHODCALLTYPE StopRecording() = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetRecordingStatus(FlexASIORecordingStatus* status) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetLoopbackStatus(FlexASIOLoopbackStatus* status) = 0;
+	virtual HRESULT STDMETHODCALLTYPE GetChannelLevels(unsigned long* inputChannelCount, FlexASIOChannelLevels* inputLevels, unsigned long* outputChannelCount, FlexASIOChannelLevels* outputLevels) = 0;
+};
+
+class CFlexASIO;
@@ -0,0 +1,216 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// The parts of the ASIO SDK interface (asio.h and iasiodrv.h) that the driver uses, declared from the public API so that the tests don't depend on the SDK. Only used when not building on Windows.
+// Note that long is 64 bits wide on most non-Windows platforms; nothing here depends on it being 32 bits.
+
+#include <windows.h>
+
+typedef long ASIOBool;
+enum { ASIOFalse = 0, ASIOTrue = 1 };
+
+typedef long ASIOError;
+enum
+{
+	ASE_OK = 0,
+	ASE_SUCCESS = 0x3f4847a0,
+	ASE_NotPresent = -1000,
+	ASE_HWMalfunction,
+	ASE_InvalidParameter,
+	ASE_InvalidMode,
+	ASE_SPNotAdvancing,
+	ASE_NoClock,
+	ASE_NoMemory,
+};
+
+typedef double ASIOSampleRate;
+
+typedef struct ASIOSamples
+{
+	unsigned long hi;
+	unsigned long lo;
+} ASIOSamples;
+
+typedef struct ASIOTimeStamp
+{
+	unsigned long hi;
+	unsigned long lo;
+} ASIOTimeStamp;
+
+typedef long ASIOSampleType;
+enum
+{
+	ASIOSTInt16MSB = 0,
+	ASIOSTInt24MSB = 1,
+	ASIOSTInt32MSB = 2,
+	ASIOSTFloat32MSB = 3,
+	ASIOSTFloat64MSB = 4,
+	ASIOSTInt16LSB = 16,
+	ASIOSTInt24LSB = 17,
+	ASIOSTInt32LSB = 18,
+	ASIOSTFloat32LSB = 19,
+	ASIOSTFloat64LSB = 20,
+};
+
+typedef struct ASIOClockSource
+{
+	long index;
+	long associatedChannel;
+	long associatedGroup;
+	ASIOBool isCurrentSource;
+	char name[32];
+} ASIOClockSource;
+
+typedef struct ASIOChannelInfo
+{
+	long channel;
+	ASIOBool isInput;
+	ASIOBool isActive;
+	long channelGroup;
+	ASIOSampleType type;
+	char name[32];
+} ASIOChannelInfo;
+
+typedef struct ASIOBufferInfo
+{
+	ASIOBool isInput;
+	long channelNum;
+	void* buffers[2];
+} ASIOBufferInfo;
+
+typedef struct AsioTimeInfo
+{
+	double speed;
+	ASIOTimeStamp systemTime;
+	ASIOSamples samplePosition;
+	ASIOSampleRate sampleRate;
+	unsigned long flags;
+	char reserved[12];
+} AsioTimeInfo;
+
+enum AsioTimeInfoFlags
+{
+	kSystemTimeValid = 1,
+	kSamplePositionValid = 1 << 1,
+	kSampleRateValid = 1 << 2,
+	kSpeedValid = 1 << 3,
+	kSampleRateChanged = 1 << 4,
+	kClockSourceChanged = 1 << 5,
+};
+
+typedef struct ASIOTimeCode
+{
+	double speed;
+	ASIOSamples timeCodeSamples;
+	unsigned long flags;
+	char future[64];
+} ASIOTimeCode;
+
+typedef struct ASIOTime
+{
+	long reserved[4];
+	struct AsioTimeInfo timeInfo;
+	struct ASIOTimeCode timeCode;
+} ASIOTime;
+
+typedef struct ASIOCallbacks
+{
+	void (*bufferSwitch)(long doubleBufferIndex, ASIOBool directProcess);
+	void (*sampleRateDidChange)(ASIOSampleRate sRate);
+	long (*asioMessage)(long selector, long value, void* message, double* opt);
+	ASIOTime* (*bufferSwitchTimeInfo)(ASIOTime* params, long doubleBufferIndex, ASIOBool directProcess);
+} ASIOCallbacks;
+
+// asioMessage() selectors.
+enum
+{
+	kAsioSelectorSupported = 1,
+	kAsioEngineVersion,
+	kAsioResetRequest,
+	kAsioBufferSizeChange,
+	kAsioResyncRequest,
+	kAsioLatenciesChanged,
+	kAsioSupportsTimeInfo,
+	kAsioSupportsTimeCode,
+	kAsioMMCCommand,
+	kAsioSupportsInputMonitor,
+	kAsioSupportsInputGain,
+	kAsioSupportsInputMeter,
+	kAsioSupportsOutputGain,
+	kAsioSupportsOutputMeter,
+	kAsioOverload,
+	kAsioNumMessageSelectors,
+};
+
+// future() selectors.
+enum
+{
+	kAsioEnableTimeCodeRead = 1,
+	kAsioDisableTimeCodeRead,
+	kAsioSetInputMonitor,
+	kAsioTransport,
+	kAsioSetInputGain,
+	kAsioGetInputMeter,
+	kAsioSetOutputGain,
+	kAsioGetOutputMeter,
+	kAsioCanInputMonitor,
+	kAsioCanTimeInfo,
+	kAsioCanTimeCode,
+	kAsioCanTransport,
+	kAsioCanInputGain,
+	kAsioCanInputMeter,
+	kAsioCanOutputGain,
+	kAsioCanOutputMeter,
+};
+
+typedef struct ASIOInputMonitor
+{
+	long input;
+	long output;
+	long gain;
+	ASIOBool state;
+	long pan;
+} ASIOInputMonitor;
+
+interface IASIO : public IUnknown
+{
+	virtual ASIOBool init(void* sysHandle) = 0;
+	virtual void getDriverName(char* name) = 0;
+	virtual long getDriverVersion() = 0;
+	virtual void getErrorMessage(char* string) = 0;
+	virtual ASIOError start() = 0;
+	virtual ASIOError stop() = 0;
+	virtual ASIOError getChannels(long* numInputChannels, long* numOutputChannels) = 0;
+	virtual ASIOError getLatencies(long* inputLatency, long* outputLatency) = 0;
+	virtual ASIOError getBufferSize(long* minSize, long* maxSize, long* preferredSize, long* granularity) = 0;
+	virtual ASIOError canSampleRate(ASIOSampleRate sampleRate) = 0;
+	virtual ASIOError getSampleRate(ASIOSampleRate* sampleRate) = 0;
+	virtual ASIOError setSampleRate(ASIOSampleRate sampleRate) = 0;
+	virtual ASIOError getClockSources(ASIOClockSource* clocks, long* numSources) = 0;
+	virtual ASIOError setClockSource(long reference) = 0;
+	virtual ASIOError getSamplePosition(ASIOSamples* sPos, ASIOTimeStamp* tStamp) = 0;
+	virtual ASIOError getChannelInfo(ASIOChannelInfo* info) = 0;
+	virtual ASIOError createBuffers(ASIOBufferInfo* bufferInfos, long numChannels, long bufferSize, ASIOCallbacks* callbacks) = 0;
+	virtual ASIOError disposeBuffers() = 0;
+	virtual ASIOError controlPanel() = 0;
+	virtual ASIOError future(long selector, void* opt) = 0;
+	virtual ASIOError outputReady() = 0;
+};
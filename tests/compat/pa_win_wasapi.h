@@ -0,0 +1,52 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// See portaudio.h. The fake backend reports itself as WASAPI, so that the driver takes the same paths as on Windows.
+
+#include "portaudio.h"
+
+#include <windows.h>
+
+typedef enum PaWasapiFlags
+{
+	paWinWasapiExclusive = 1,
+	paWinWasapiRedirectHostProcessor = 2,
+	paWinWasapiUseChannelMask = 4,
+	paWinWasapiPolling = 8,
+	paWinWasapiThreadPriority = 16,
+} PaWasapiFlags;
+
+typedef DWORD PaWinWaveFormatChannelMask;
+
+typedef struct PaWasapiStreamInfo
+{
+	unsigned long size;
+	PaHostApiTypeId hostApiType;
+	unsigned long version;
+	unsigned long flags;
+	PaWinWaveFormatChannelMask channelMask;
+	void* hostProcessorOutput;
+	void* hostProcessorInput;
+	int threadPriority;
+} PaWasapiStreamInfo;
+
+// Fills format (a WAVEFORMATEXTENSIBLE) with the shared mode format of the device. Returns the number of bytes written, or an error.
+int PaWasapi_GetDeviceDefaultFormat(void* format, unsigned int formatSize, PaDeviceIndex device);
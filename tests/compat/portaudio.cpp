@@ -0,0 +1,490 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// The fake PortAudio backend. See fake_portaudio.h.
+
+#include "fake_portaudio.h"
+#include "pa_win_wasapi.h"
+
+#include <MMReg.h>
+#include <ksmedia.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+
+double GetThreadCpuMicroseconds()
+{
+	timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+double GetMilliseconds(std::chrono::steady_clock::duration duration)
+{
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void SimulateDelay(double milliseconds)
+{
+	if (milliseconds > 0)
+		std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(milliseconds));
+}
+
+struct FakeStream
+{
+	PaStreamCallback* callback = nullptr;
+	void* user_data = nullptr;
+	const FakeDevice* device = nullptr;
+	int input_channel_count = 0;
+	int output_channel_count = 0;
+	double sample_rate = 0;
+	unsigned long frames_per_buffer = 0;
+	PaStreamInfo info = {};
+
+	std::vector<float> input_buffer;
+	std::vector<float> output_buffer;
+	std::vector<float*> input_channels;
+	std::vector<float*> output_channels;
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable stopping_condition;
+	bool stopping = false;
+	std::atomic<bool> active{ false };
+
+	// Only touched by whoever runs the callbacks.
+	unsigned long long callback_count = 0;
+	long long frame_position = 0;
+	PaStreamCallbackFlags pending_flags = 0;
+	std::chrono::steady_clock::time_point start_time;
+
+	double GetPeriod() const { return frames_per_buffer / sample_rate; }
+	bool ShouldStall() const;
+	// Returns false if the callback asked to stop.
+	bool RunCallback(PaTime time);
+	void Run();
+};
+
+std::mutex fake_mutex;
+FakePortAudioConfig fake_config;
+// What Pa_Initialize() took from fake_config, so that the pointers handed out stay valid until Pa_Terminate().
+FakePortAudioConfig active_config;
+std::vector<PaDeviceInfo> device_infos;
+PaHostApiInfo host_api_info;
+int initialize_count = 0;
+std::vector<FakeStream*> started_streams;
+FakeStreamStatistics statistics;
+
+PaTime GetSteadyTime()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool FakeStream::ShouldStall() const
+{
+	return active_config.stall_after_callbacks != 0 && callback_count >= active_config.stall_after_callbacks;
+}
+
+bool FakeStream::RunCallback(PaTime time)
+{
+	for (int channel = 0; channel < input_channel_count; ++channel)
+	{
+		const double frequency = 440.0 + 110.0 * channel;
+		for (unsigned long frame = 0; frame < frames_per_buffer; ++frame)
+			input_channels[channel][frame] = static_cast<float>(0.25 * std::sin(2 * pi * frequency * (frame_position + frame) / sample_rate));
+	}
+
+	PaStreamCallbackTimeInfo time_info;
+	time_info.currentTime = time;
+	time_info.inputBufferAdcTime = time - info.inputLatency;
+	time_info.outputBufferDacTime = time + info.outputLatency;
+	const PaStreamCallbackFlags flags = pending_flags;
+	pending_flags = 0;
+
+	const double cpu_start = GetThreadCpuMicroseconds();
+	const std::chrono::steady_clock::time_point callback_start = std::chrono::steady_clock::now();
+	const int result = callback(input_channel_count > 0 ? input_channels.data() : nullptr, output_channel_count > 0 ? output_channels.data() : nullptr, frames_per_buffer, &time_info, flags, user_data);
+	const std::chrono::steady_clock::time_point callback_end = std::chrono::steady_clock::now();
+	const double cpu_time = GetThreadCpuMicroseconds() - cpu_start;
+
+	++callback_count;
+	frame_position += frames_per_buffer;
+	{
+		std::lock_guard<std::mutex> lock(fake_mutex);
+		++statistics.callback_count;
+		statistics.callback_durations.push_back(std::chrono::duration<double, std::micro>(callback_end - callback_start).count());
+		statistics.callback_cpu_time += cpu_time;
+		if (callback_count == 1)
+			statistics.first_callback_delay_ms = GetMilliseconds(callback_end - start_time);
+	}
+	return result == paContinue;
+}
+
+void FakeStream::Run()
+{
+	const double period = GetPeriod();
+	const auto device_period = std::chrono::duration<double>(period / (1 + device->clock_drift));
+	std::chrono::steady_clock::time_point next_callback = start_time;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (ShouldStall())
+				stopping_condition.wait(lock, [&] { return stopping; });
+			else if (active_config.clock == FAKE_CLOCK_REALTIME)
+				stopping_condition.wait_until(lock, next_callback, [&] { return stopping; });
+			if (stopping)
+				break;
+		}
+
+		const PaTime time = active_config.clock == FAKE_CLOCK_REALTIME ? GetSteadyTime() : frame_position / sample_rate;
+		const bool keep_going = RunCallback(time);
+		if (active_config.clock == FAKE_CLOCK_REALTIME)
+		{
+			next_callback += std::chrono::duration_cast<std::chrono::steady_clock::duration>(device_period);
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (now > next_callback)
+			{
+				// The device needed the next buffer before this one was done.
+				pending_flags |= (output_channel_count > 0 ? paOutputUnderflow : 0) | (input_channel_count > 0 ? paInputOverflow : 0);
+				std::lock_guard<std::mutex> lock(fake_mutex);
+				++statistics.xrun_count;
+				// Periods that went by entirely are lost; the device doesn't wait.
+				while (next_callback + device_period < now)
+				{
+					next_callback += std::chrono::duration_cast<std::chrono::steady_clock::duration>(device_period);
+					frame_position += frames_per_buffer;
+				}
+			}
+		}
+		if (!keep_going)
+			break;
+	}
+	active.store(false);
+}
+
+FakeStream* GetStream(PaStream* stream) { return static_cast<FakeStream*>(stream); }
+
+PaError StopStream(PaStream* stream)
+{
+	FakeStream* const fake_stream = GetStream(stream);
+	if (!fake_stream)
+		return paBadStreamPtr;
+	{
+		std::lock_guard<std::mutex> lock(fake_mutex);
+		const auto started_stream = std::find(started_streams.begin(), started_streams.end(), fake_stream);
+		if (started_stream == started_streams.end())
+			return paStreamIsStopped;
+		started_streams.erase(started_stream);
+	}
+	{
+		std::lock_guard<std::mutex> lock(fake_stream->mutex);
+		fake_stream->stopping = true;
+	}
+	fake_stream->stopping_condition.notify_all();
+	if (fake_stream->thread.joinable())
+		fake_stream->thread.join();
+	fake_stream->active.store(false);
+	return paNoError;
+}
+
+}
+
+void ConfigureFakePortAudio(const FakePortAudioConfig& config)
+{
+	std::lock_guard<std::mutex> lock(fake_mutex);
+	fake_config = config;
+	statistics = FakeStreamStatistics();
+}
+
+FakeStreamStatistics GetFakeStreamStatistics(bool reset)
+{
+	std::lock_guard<std::mutex> lock(fake_mutex);
+	FakeStreamStatistics result = statistics;
+	if (reset)
+		statistics = FakeStreamStatistics();
+	return result;
+}
+
+size_t RunFakeStreamCallbacks(unsigned long count)
+{
+	std::vector<FakeStream*> streams;
+	{
+		std::lock_guard<std::mutex> lock(fake_mutex);
+		streams = started_streams;
+	}
+	for (unsigned long callback = 0; callback < count; ++callback)
+		for (FakeStream* stream : streams)
+			if (stream->active.load() && !stream->ShouldStall() && !stream->RunCallback(stream->frame_position / stream->sample_rate))
+				stream->active.store(false);
+	return streams.size();
+}
+
+const char* Pa_GetErrorText(PaError errorCode)
+{
+	switch (errorCode)
+	{
+		case paNoError: return "Success";
+		case paNotInitialized: return "PortAudio not initialized";
+		case paInvalidChannelCount: return "Invalid number of channels";
+		case paInvalidSampleRate: return "Invalid sample rate";
+		case paInvalidDevice: return "Invalid device";
+		case paBadStreamPtr: return "Invalid stream pointer";
+		case paStreamIsStopped: return "Stream is stopped";
+		case paStreamIsNotStopped: return "Stream is not stopped";
+		case paHostApiNotFound: return "Host API not found";
+		default: return "Fake PortAudio error";
+	}
+}
+
+PaError Pa_Initialize(void)
+{
+	std::lock_guard<std::mutex> lock(fake_mutex);
+	if (initialize_count++ > 0)
+		return paNoError;
+	SimulateDelay(fake_config.initialize_delay_ms);
+	++statistics.initializations;
+	active_config = fake_config;
+	device_infos.clear();
+	for (const FakeDevice& device : active_config.devices)
+	{
+		PaDeviceInfo info = {};
+		info.structVersion = 2;
+		info.name = device.name.c_str();
+		info.hostApi = 0;
+		info.maxInputChannels = device.input_channels;
+		info.maxOutputChannels = device.output_channels;
+		info.defaultLowInputLatency = info.defaultHighInputLatency = device.latency;
+		info.defaultLowOutputLatency = info.defaultHighOutputLatency = device.latency;
+		info.defaultSampleRate = device.default_sample_rate;
+		device_infos.push_back(info);
+	}
+	host_api_info.structVersion = 1;
+	host_api_info.type = paWASAPI;
+	host_api_info.name = "Windows WASAPI";
+	host_api_info.deviceCount = static_cast<int>(device_infos.size());
+	host_api_info.defaultInputDevice = active_config.default_input_device;
+	host_api_info.defaultOutputDevice = active_config.default_output_device;
+	return paNoError;
+}
+
+PaError Pa_Terminate(void)
+{
+	std::lock_guard<std::mutex> lock(fake_mutex);
+	if (initialize_count == 0)
+		return paNotInitialized;
+	--initialize_count;
+	return paNoError;
+}
+
+PaHostApiIndex Pa_GetHostApiCount(void) { return 1; }
+PaHostApiIndex Pa_GetDefaultHostApi(void) { return 0; }
+const PaHostApiInfo* Pa_GetHostApiInfo(PaHostApiIndex hostApi) { return hostApi == 0 ? &host_api_info : nullptr; }
+PaHostApiIndex Pa_HostApiTypeIdToHostApiIndex(PaHostApiTypeId type) { return type == paWASAPI ? 0 : paHostApiNotFound; }
+
+PaDeviceIndex Pa_HostApiDeviceIndexToDeviceIndex(PaHostApiIndex hostApi, int hostApiDeviceIndex)
+{
+	if (hostApi != 0)
+		return paInvalidHostApi;
+	if (hostApiDeviceIndex < 0 || hostApiDeviceIndex >= static_cast<int>(device_infos.size()))
+		return paInvalidDevice;
+	return hostApiDeviceIndex;
+}
+
+PaDeviceIndex Pa_GetDeviceCount(void) { return static_cast<PaDeviceIndex>(device_infos.size()); }
+PaDeviceIndex Pa_GetDefaultInputDevice(void) { return host_api_info.defaultInputDevice; }
+PaDeviceIndex Pa_GetDefaultOutputDevice(void) { return host_api_info.defaultOutputDevice; }
+
+const PaDeviceInfo* Pa_GetDeviceInfo(PaDeviceIndex device)
+{
+	if (device < 0 || device >= static_cast<PaDeviceIndex>(device_infos.size()))
+		return nullptr;
+	return &device_infos[device];
+}
+
+namespace {
+PaError CheckParameters(const PaStreamParameters* parameters, bool input, double sampleRate)
+{
+	if (!parameters)
+		return paNoError;
+	if (parameters->device < 0 || parameters->device >= static_cast<PaDeviceIndex>(active_config.devices.size()))
+		return paInvalidDevice;
+	const FakeDevice& device = active_config.devices[parameters->device];
+	if (parameters->channelCount <= 0 || parameters->channelCount > (input ? device.input_channels : device.output_channels))
+		return paInvalidChannelCount;
+	if (!device.sample_rates.empty() && std::find(device.sample_rates.begin(), device.sample_rates.end(), sampleRate) == device.sample_rates.end())
+		return paInvalidSampleRate;
+	if ((parameters->sampleFormat & ~paNonInterleaved) != paFloat32 || !(parameters->sampleFormat & paNonInterleaved))
+		return paSampleFormatNotSupported;
+	return paNoError;
+}
+}
+
+PaError Pa_IsFormatSupported(const PaStreamParameters* inputParameters, const PaStreamParameters* outputParameters, double sampleRate)
+{
+	PaError error = CheckParameters(inputParameters, true, sampleRate);
+	if (error == paNoError)
+		error = CheckParameters(outputParameters, false, sampleRate);
+	return error;
+}
+
+PaError Pa_OpenStream(PaStream** stream, const PaStreamParameters* inputParameters, const PaStreamParameters* outputParameters, double sampleRate, unsigned long framesPerBuffer, PaStreamFlags, PaStreamCallback* streamCallback, void* userData)
+{
+	if (initialize_count == 0)
+		return paNotInitialized;
+	if (!streamCallback)
+		return paNullCallback;
+	if (!inputParameters && !outputParameters)
+		return paInvalidDevice;
+	const PaError error = Pa_IsFormatSupported(inputParameters, outputParameters, sampleRate);
+	if (error != paNoError)
+		return error;
+	SimulateDelay(active_config.open_stream_delay_ms);
+
+	std::unique_ptr<FakeStream> fake_stream(new FakeStream);
+	fake_stream->callback = streamCallback;
+	fake_stream->user_data = userData;
+	// A full-duplex stream follows the clock of its output device.
+	fake_stream->device = &active_config.devices[outputParameters ? outputParameters->device : inputParameters->device];
+	fake_stream->input_channel_count = inputParameters ? inputParameters->channelCount : 0;
+	fake_stream->output_channel_count = outputParameters ? outputParameters->channelCount : 0;
+	fake_stream->sample_rate = sampleRate;
+	fake_stream->frames_per_buffer = framesPerBuffer != paFramesPerBufferUnspecified ? framesPerBuffer : fake_stream->device->period_frames;
+	fake_stream->info.structVersion = 1;
+	fake_stream->info.inputLatency = inputParameters ? fake_stream->device->latency : 0;
+	fake_stream->info.outputLatency = outputParameters ? fake_stream->device->latency : 0;
+	fake_stream->info.sampleRate = sampleRate;
+	fake_stream->input_buffer.resize(fake_stream->input_channel_count * fake_stream->frames_per_buffer);
+	fake_stream->output_buffer.resize(fake_stream->output_channel_count * fake_stream->frames_per_buffer);
+	for (int channel = 0; channel < fake_stream->input_channel_count; ++channel)
+		fake_stream->input_channels.push_back(fake_stream->input_buffer.data() + channel * fake_stream->frames_per_buffer);
+	for (int channel = 0; channel < fake_stream->output_channel_count; ++channel)
+		fake_stream->output_channels.push_back(fake_stream->output_buffer.data() + channel * fake_stream->frames_per_buffer);
+	*stream = fake_stream.release();
+	std::lock_guard<std::mutex> lock(fake_mutex);
+	++statistics.streams_opened;
+	return paNoError;
+}
+
+PaError Pa_CloseStream(PaStream* stream)
+{
+	if (!stream)
+		return paBadStreamPtr;
+	StopStream(stream);
+	delete GetStream(stream);
+	return paNoError;
+}
+
+PaError Pa_StartStream(PaStream* stream)
+{
+	FakeStream* const fake_stream = GetStream(stream);
+	if (!fake_stream)
+		return paBadStreamPtr;
+	{
+		std::lock_guard<std::mutex> lock(fake_mutex);
+		if (std::find(started_streams.begin(), started_streams.end(), fake_stream) != started_streams.end())
+			return paStreamIsNotStopped;
+	}
+	SimulateDelay(active_config.start_stream_delay_ms);
+	fake_stream->stopping = false;
+	fake_stream->callback_count = 0;
+	fake_stream->pending_flags = 0;
+	fake_stream->start_time = std::chrono::steady_clock::now();
+	fake_stream->active.store(true);
+	{
+		std::lock_guard<std::mutex> lock(fake_mutex);
+		started_streams.push_back(fake_stream);
+		++statistics.streams_started;
+		statistics.first_callback_delay_ms = -1;
+	}
+	if (active_config.clock != FAKE_CLOCK_MANUAL)
+		fake_stream->thread = std::thread([fake_stream] { fake_stream->Run(); });
+	return paNoError;
+}
+
+PaError Pa_StopStream(PaStream* stream) { return StopStream(stream); }
+PaError Pa_AbortStream(PaStream* stream) { return StopStream(stream); }
+
+PaError Pa_IsStreamStopped(PaStream* stream)
+{
+	std::lock_guard<std::mutex> lock(fake_mutex);
+	return std::find(started_streams.begin(), started_streams.end(), GetStream(stream)) == started_streams.end() ? 1 : 0;
+}
+
+PaError Pa_IsStreamActive(PaStream* stream)
+{
+	return GetStream(stream)->active.load() ? 1 : 0;
+}
+
+const PaStreamInfo* Pa_GetStreamInfo(PaStream* stream)
+{
+	return stream ? &GetStream(stream)->info : nullptr;
+}
+
+PaTime Pa_GetStreamTime(PaStream* stream)
+{
+	const FakeStream* const fake_stream = GetStream(stream);
+	if (active_config.clock == FAKE_CLOCK_REALTIME)
+		return GetSteadyTime();
+	return fake_stream->frame_position / fake_stream->sample_rate;
+}
+
+int PaWasapi_GetDeviceDefaultFormat(void* format, unsigned int formatSize, PaDeviceIndex device)
+{
+	if (device < 0 || device >= static_cast<PaDeviceIndex>(active_config.devices.size()))
+		return paInvalidDevice;
+	if (formatSize < sizeof(WAVEFORMATEXTENSIBLE))
+		return paBufferTooSmall;
+	const FakeDevice& fake_device = active_config.devices[device];
+	WAVEFORMATEXTENSIBLE waveformat = {};
+	waveformat.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+	waveformat.Format.nChannels = static_cast<WORD>((std::max)(fake_device.input_channels, fake_device.output_channels));
+	waveformat.Format.nSamplesPerSec = static_cast<DWORD>(fake_device.default_sample_rate);
+	waveformat.Format.wBitsPerSample = static_cast<WORD>(fake_device.bits_per_sample);
+	waveformat.Format.nBlockAlign = static_cast<WORD>(waveformat.Format.nChannels * fake_device.bits_per_sample / 8);
+	waveformat.Format.nAvgBytesPerSec = waveformat.Format.nSamplesPerSec * waveformat.Format.nBlockAlign;
+	waveformat.Format.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+	waveformat.Samples.wValidBitsPerSample = waveformat.Format.wBitsPerSample;
+	waveformat.dwChannelMask = fake_device.channel_mask;
+	waveformat.SubFormat = fake_device.bits_per_sample == 32 ? KSDATAFORMAT_SUBTYPE_IEEE_FLOAT : KSDATAFORMAT_SUBTYPE_PCM;
+	memcpy(format, &waveformat, sizeof(waveformat));
+	return sizeof(waveformat);
+}
+
+// The Windows audio endpoints are the fake devices, which is what the real PortAudio WASAPI backend would report.
+#include "../../endpoint.h"
+
+bool GetDefaultEndpointName(bool input, std::string* name)
+{
+	std::lock_guard<std::mutex> lock(fake_mutex);
+	const PaDeviceIndex device = input ? fake_config.default_input_device : fake_config.default_output_device;
+	*name = device >= 0 && device < static_cast<PaDeviceIndex>(fake_config.devices.size()) ? fake_config.devices[device].name : std::string();
+	return true;
+}
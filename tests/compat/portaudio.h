@@ -0,0 +1,192 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// The parts of the PortAudio API that the driver uses, declared from the public API. Only used when not building on Windows.
+// They are implemented by a fake backend (see fake_portaudio.h) that calls the stream callbacks from a thread, so that the driver can run without any audio hardware.
+
+typedef int PaError;
+typedef enum PaErrorCode
+{
+	paNoError = 0,
+	paNotInitialized = -10000,
+	paUnanticipatedHostError,
+	paInvalidChannelCount,
+	paInvalidSampleRate,
+	paInvalidDevice,
+	paInvalidFlag,
+	paSampleFormatNotSupported,
+	paBadIODeviceCombination,
+	paInsufficientMemory,
+	paBufferTooBig,
+	paBufferTooSmall,
+	paNullCallback,
+	paBadStreamPtr,
+	paTimedOut,
+	paInternalError,
+	paDeviceUnavailable,
+	paIncompatibleHostApiSpecificStreamInfo,
+	paStreamIsStopped,
+	paStreamIsNotStopped,
+	paInputOverflowed,
+	paOutputUnderflowed,
+	paHostApiNotFound,
+	paInvalidHostApi,
+	paCanNotReadFromACallbackStream,
+	paCanNotWriteToACallbackStream,
+	paCanNotReadFromAnOutputOnlyStream,
+	paCanNotWriteToAnInputOnlyStream,
+	paIncompatibleStreamHostApi,
+	paBadBufferPtr,
+} PaErrorCode;
+
+const char* Pa_GetErrorText(PaError errorCode);
+PaError Pa_Initialize(void);
+PaError Pa_Terminate(void);
+
+typedef int PaDeviceIndex;
+#define paNoDevice ((PaDeviceIndex)-1)
+#define paUseHostApiSpecificDeviceSpecification ((PaDeviceIndex)-2)
+
+typedef int PaHostApiIndex;
+typedef enum PaHostApiTypeId
+{
+	paInDevelopment = 0,
+	paDirectSound = 1,
+	paMME = 2,
+	paASIO = 3,
+	paSoundManager = 4,
+	paCoreAudio = 5,
+	paOSS = 7,
+	paALSA = 8,
+	paAL = 9,
+	paBeOS = 10,
+	paWDMKS = 11,
+	paJACK = 12,
+	paWASAPI = 13,
+	paAudioScienceHPI = 14,
+} PaHostApiTypeId;
+
+typedef struct PaHostApiInfo
+{
+	int structVersion;
+	PaHostApiTypeId type;
+	const char* name;
+	int deviceCount;
+	PaDeviceIndex defaultInputDevice;
+	PaDeviceIndex defaultOutputDevice;
+} PaHostApiInfo;
+
+PaHostApiIndex Pa_GetHostApiCount(void);
+PaHostApiIndex Pa_GetDefaultHostApi(void);
+const PaHostApiInfo* Pa_GetHostApiInfo(PaHostApiIndex hostApi);
+PaHostApiIndex Pa_HostApiTypeIdToHostApiIndex(PaHostApiTypeId type);
+PaDeviceIndex Pa_HostApiDeviceIndexToDeviceIndex(PaHostApiIndex hostApi, int hostApiDeviceIndex);
+
+typedef double PaTime;
+
+typedef unsigned long PaSampleFormat;
+#define paFloat32 ((PaSampleFormat)0x00000001)
+#define paInt32 ((PaSampleFormat)0x00000002)
+#define paInt24 ((PaSampleFormat)0x00000004)
+#define paInt16 ((PaSampleFormat)0x00000008)
+#define paNonInterleaved ((PaSampleFormat)0x80000000)
+
+typedef struct PaDeviceInfo
+{
+	int structVersion;
+	const char* name;
+	PaHostApiIndex hostApi;
+	int maxInputChannels;
+	int maxOutputChannels;
+	PaTime defaultLowInputLatency;
+	PaTime defaultLowOutputLatency;
+	PaTime defaultHighInputLatency;
+	PaTime defaultHighOutputLatency;
+	double defaultSampleRate;
+} PaDeviceInfo;
+
+PaDeviceIndex Pa_GetDeviceCount(void);
+PaDeviceIndex Pa_GetDefaultInputDevice(void);
+PaDeviceIndex Pa_GetDefaultOutputDevice(void);
+const PaDeviceInfo* Pa_GetDeviceInfo(PaDeviceIndex device);
+
+typedef struct PaStreamParameters
+{
+	PaDeviceIndex device;
+	int channelCount;
+	PaSampleFormat sampleFormat;
+	PaTime suggestedLatency;
+	void* hostApiSpecificStreamInfo;
+} PaStreamParameters;
+
+#define paFormatIsSupported (0)
+PaError Pa_IsFormatSupported(const PaStreamParameters* inputParameters, const PaStreamParameters* outputParameters, double sampleRate);
+
+typedef void PaStream;
+
+#define paFramesPerBufferUnspecified (0)
+
+typedef unsigned long PaStreamFlags;
+#define paNoFlag ((PaStreamFlags)0)
+#define paClipOff ((PaStreamFlags)0x00000001)
+#define paDitherOff ((PaStreamFlags)0x00000002)
+
+typedef struct PaStreamCallbackTimeInfo
+{
+	PaTime inputBufferAdcTime;
+	PaTime currentTime;
+	PaTime outputBufferDacTime;
+} PaStreamCallbackTimeInfo;
+
+typedef unsigned long PaStreamCallbackFlags;
+#define paInputUnderflow ((PaStreamCallbackFlags)0x00000001)
+#define paInputOverflow ((PaStreamCallbackFlags)0x00000002)
+#define paOutputUnderflow ((PaStreamCallbackFlags)0x00000004)
+#define paOutputOverflow ((PaStreamCallbackFlags)0x00000008)
+#define paPrimingOutput ((PaStreamCallbackFlags)0x00000010)
+
+typedef enum PaStreamCallbackResult
+{
+	paContinue = 0,
+	paComplete = 1,
+	paAbort = 2,
+} PaStreamCallbackResult;
+
+typedef int PaStreamCallback(const void* input, void* output, unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData);
+
+PaError Pa_OpenStream(PaStream** stream, const PaStreamParameters* inputParameters, const PaStreamParameters* outputParameters, double sampleRate, unsigned long framesPerBuffer, PaStreamFlags streamFlags, PaStreamCallback* streamCallback, void* userData);
+PaError Pa_CloseStream(PaStream* stream);
+PaError Pa_StartStream(PaStream* stream);
+PaError Pa_StopStream(PaStream* stream);
+PaError Pa_AbortStream(PaStream* stream);
+PaError Pa_IsStreamStopped(PaStream* stream);
+PaError Pa_IsStreamActive(PaStream* stream);
+
+typedef struct PaStreamInfo
+{
+	int structVersion;
+	PaTime inputLatency;
+	PaTime outputLatency;
+	double sampleRate;
+} PaStreamInfo;
+
+const PaStreamInfo* Pa_GetStreamInfo(PaStream* stream);
+PaTime Pa_GetStreamTime(PaStream* stream);
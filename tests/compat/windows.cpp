@@ -0,0 +1,730 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// POSIX implementation of the compat <windows.h>. See there.
+
+#include <windows.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "fake_registry.h"
+
+const GUID compat_null_guid = { 0, 0, 0, { 0, 0, 0, 0, 0, 0, 0, 0 } };
+
+namespace {
+
+thread_local DWORD last_error = ERROR_SUCCESS;
+
+struct CompatHandle
+{
+	virtual ~CompatHandle() { }
+	virtual DWORD Wait(DWORD milliseconds) { (void)milliseconds; return WAIT_FAILED; }
+};
+
+// "Local\FlexASIO-Foo" becomes "/FlexASIO-Foo".
+std::string GetSharedMemoryName(const char* name)
+{
+	std::string result(name);
+	for (const char* prefix : { "Local\\", "Global\\" })
+		if (result.compare(0, strlen(prefix), prefix) == 0)
+			result.erase(0, strlen(prefix));
+	for (char& character : result)
+		if (character == '\\' || character == '/')
+			character = '_';
+	return "/" + result;
+}
+
+// Opens the named shared memory object, creating it with the given size if it doesn't exist. Sets *created accordingly.
+int OpenSharedMemory(const std::string& name, size_t size, bool create, bool* created)
+{
+	*created = false;
+	if (create)
+	{
+		const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd >= 0)
+		{
+			if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+			{
+				close(fd);
+				shm_unlink(name.c_str());
+				return -1;
+			}
+			*created = true;
+			return fd;
+		}
+		if (errno != EEXIST)
+			return -1;
+	}
+	return shm_open(name.c_str(), O_RDWR, 0600);
+}
+
+size_t GetFileSize(int fd)
+{
+	struct stat file_stat;
+	return fstat(fd, &file_stat) == 0 ? static_cast<size_t>(file_stat.st_size) : 0;
+}
+
+// Views and VirtualAlloc() allocations, so that they can be unmapped and queried.
+std::mutex regions_mutex;
+std::map<const char*, size_t> regions;
+
+void AddRegion(void* address, size_t size)
+{
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	regions[static_cast<const char*>(address)] = size;
+}
+
+bool RemoveRegion(const void* address, size_t* size)
+{
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	const auto region = regions.find(static_cast<const char*>(address));
+	if (region == regions.end())
+		return false;
+	*size = region->second;
+	regions.erase(region);
+	return true;
+}
+
+struct EventState
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t condition;
+	int signaled;
+	int manual_reset;
+	std::atomic<int> ready;
+};
+
+struct EventHandle : CompatHandle
+{
+	EventState* state = nullptr;
+	// Empty for unnamed events, which live on the heap.
+	std::string shared_memory_name;
+	bool owner = false;
+
+	~EventHandle() override
+	{
+		if (shared_memory_name.empty())
+		{
+			pthread_cond_destroy(&state->condition);
+			pthread_mutex_destroy(&state->mutex);
+			delete state;
+			return;
+		}
+		munmap(state, sizeof(EventState));
+		if (owner)
+			shm_unlink(shared_memory_name.c_str());
+	}
+
+	DWORD Wait(DWORD milliseconds) override
+	{
+		timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += milliseconds / 1000;
+		deadline.tv_nsec += static_cast<long>(milliseconds % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000)
+		{
+			++deadline.tv_sec;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_mutex_lock(&state->mutex);
+		while (!state->signaled)
+		{
+			const int result = milliseconds == INFINITE ? pthread_cond_wait(&state->condition, &state->mutex) : pthread_cond_timedwait(&state->condition, &state->mutex, &deadline);
+			if (result == ETIMEDOUT)
+				break;
+		}
+		const bool signaled = state->signaled != 0;
+		if (signaled && !state->manual_reset)
+			state->signaled = 0;
+		pthread_mutex_unlock(&state->mutex);
+		return signaled ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+	}
+};
+
+void InitializeEventState(EventState* state, bool manual_reset, bool initial_state)
+{
+	pthread_mutexattr_t mutex_attributes;
+	pthread_mutexattr_init(&mutex_attributes);
+	pthread_mutexattr_setpshared(&mutex_attributes, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&state->mutex, &mutex_attributes);
+	pthread_mutexattr_destroy(&mutex_attributes);
+	pthread_condattr_t condition_attributes;
+	pthread_condattr_init(&condition_attributes);
+	pthread_condattr_setpshared(&condition_attributes, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&condition_attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&state->condition, &condition_attributes);
+	pthread_condattr_destroy(&condition_attributes);
+	state->signaled = initial_state;
+	state->manual_reset = manual_reset;
+	state->ready.store(1, std::memory_order_release);
+}
+
+HANDLE OpenNamedEvent(const char* name, bool create, bool manual_reset, bool initial_state)
+{
+	const std::string shared_memory_name = GetSharedMemoryName(name) + "-event";
+	bool created;
+	const int fd = OpenSharedMemory(shared_memory_name, sizeof(EventState), create, &created);
+	if (fd < 0)
+	{
+		last_error = ERROR_FILE_NOT_FOUND;
+		return NULL;
+	}
+	void* const view = mmap(nullptr, sizeof(EventState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED)
+	{
+		last_error = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+	EventHandle* const event = new EventHandle;
+	event->state = static_cast<EventState*>(view);
+	event->shared_memory_name = shared_memory_name;
+	event->owner = created;
+	if (created)
+		InitializeEventState(event->state, manual_reset, initial_state);
+	else
+		// The creator might still be initializing it.
+		while (event->state->ready.load(std::memory_order_acquire) == 0)
+			std::this_thread::yield();
+	last_error = created ? ERROR_SUCCESS : ERROR_ALREADY_EXISTS;
+	return event;
+}
+
+// An flock() on a shared memory object, which the kernel releases if the owner dies, like an abandoned mutex.
+// The object is never unlinked, as a process opening it anew would then lock a different one.
+struct MutexHandle : CompatHandle
+{
+	int fd = -1;
+
+	~MutexHandle() override { close(fd); }
+
+	DWORD Wait(DWORD milliseconds) override
+	{
+		if (milliseconds == INFINITE)
+			return flock(fd, LOCK_EX) == 0 ? WAIT_OBJECT_0 : WAIT_FAILED;
+		const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+		for (;;)
+		{
+			if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+				return WAIT_OBJECT_0;
+			if (errno != EWOULDBLOCK)
+				return WAIT_FAILED;
+			if (std::chrono::steady_clock::now() >= deadline)
+				return WAIT_TIMEOUT;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+};
+
+struct MappingHandle : CompatHandle
+{
+	int fd = -1;
+	size_t size = 0;
+	std::string shared_memory_name;
+	bool owner = false;
+
+	~MappingHandle() override
+	{
+		close(fd);
+		if (owner)
+			shm_unlink(shared_memory_name.c_str());
+	}
+};
+
+struct FileHandle : CompatHandle
+{
+	int fd = -1;
+	~FileHandle() override { close(fd); }
+};
+
+// Process IDs are only used to check whether the process is still there.
+struct ProcessHandle : CompatHandle
+{
+	pid_t process_id = 0;
+
+	bool IsRunning() const
+	{
+		std::ifstream stat("/proc/" + std::to_string(process_id) + "/stat");
+		std::string pid, command, state;
+		if (!(stat >> pid >> command >> state))
+			return kill(process_id, 0) == 0 || errno == EPERM;
+		// Zombies have exited already.
+		return state != "Z" && state != "X";
+	}
+
+	DWORD Wait(DWORD milliseconds) override
+	{
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+		while (IsRunning())
+		{
+			if (milliseconds != INFINITE && std::chrono::steady_clock::now() >= deadline)
+				return WAIT_TIMEOUT;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return WAIT_OBJECT_0;
+	}
+};
+
+struct ThreadHandle : CompatHandle { };
+ThreadHandle current_thread;
+
+struct FakeRegistryKey
+{
+	std::string path;
+};
+
+struct FakeRegistryValue
+{
+	DWORD type;
+	std::string data;
+};
+
+std::map<std::pair<std::string, std::string>, FakeRegistryValue>& GetFakeRegistry()
+{
+	static std::map<std::pair<std::string, std::string>, FakeRegistryValue> registry;
+	return registry;
+}
+
+}
+
+struct CompatRegistryKey : FakeRegistryKey { };
+
+void SetFakeRegistryValue(const std::string& key, const std::string& name, DWORD value)
+{
+	FakeRegistryValue& entry = GetFakeRegistry()[std::make_pair(key, name)];
+	entry.type = REG_DWORD;
+	entry.data.assign(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void SetFakeRegistryValue(const std::string& key, const std::string& name, const std::string& value)
+{
+	FakeRegistryValue& entry = GetFakeRegistry()[std::make_pair(key, name)];
+	entry.type = REG_SZ;
+	entry.data.assign(value.c_str(), value.size() + 1);
+}
+
+void ClearFakeRegistry()
+{
+	GetFakeRegistry().clear();
+}
+
+DWORD GetLastError() { return last_error; }
+void SetLastError(DWORD error) { last_error = error; }
+
+BOOL CloseHandle(HANDLE handle)
+{
+	if (handle == NULL || handle == INVALID_HANDLE_VALUE || handle == &current_thread || handle == GetCurrentProcess())
+		return FALSE;
+	delete static_cast<CompatHandle*>(handle);
+	return TRUE;
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds)
+{
+	if (handle == NULL || handle == INVALID_HANDLE_VALUE)
+	{
+		last_error = ERROR_INVALID_HANDLE;
+		return WAIT_FAILED;
+	}
+	return static_cast<CompatHandle*>(handle)->Wait(milliseconds);
+}
+
+HANDLE CreateEventA(LPSECURITY_ATTRIBUTES, BOOL manual_reset, BOOL initial_state, LPCSTR name)
+{
+	if (name)
+		return OpenNamedEvent(name, true, manual_reset != FALSE, initial_state != FALSE);
+	EventHandle* const event = new EventHandle;
+	event->state = new EventState;
+	InitializeEventState(event->state, manual_reset != FALSE, initial_state != FALSE);
+	last_error = ERROR_SUCCESS;
+	return event;
+}
+
+HANDLE OpenEventA(DWORD, BOOL, LPCSTR name)
+{
+	return OpenNamedEvent(name, false, false, false);
+}
+
+BOOL SetEvent(HANDLE handle)
+{
+	EventState* const state = static_cast<EventHandle*>(static_cast<CompatHandle*>(handle))->state;
+	pthread_mutex_lock(&state->mutex);
+	state->signaled = 1;
+	if (state->manual_reset)
+		pthread_cond_broadcast(&state->condition);
+	else
+		pthread_cond_signal(&state->condition);
+	pthread_mutex_unlock(&state->mutex);
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE handle)
+{
+	EventState* const state = static_cast<EventHandle*>(static_cast<CompatHandle*>(handle))->state;
+	pthread_mutex_lock(&state->mutex);
+	state->signaled = 0;
+	pthread_mutex_unlock(&state->mutex);
+	return TRUE;
+}
+
+HANDLE CreateMutexA(LPSECURITY_ATTRIBUTES, BOOL initial_owner, LPCSTR name)
+{
+	if (!name)
+	{
+		last_error = ERROR_INVALID_PARAMETER;
+		return NULL;
+	}
+	bool created;
+	const int fd = OpenSharedMemory(GetSharedMemoryName(name) + "-mutex", 0, true, &created);
+	if (fd < 0)
+	{
+		last_error = ERROR_ACCESS_DENIED;
+		return NULL;
+	}
+	MutexHandle* const mutex = new MutexHandle;
+	mutex->fd = fd;
+	if (initial_owner)
+		mutex->Wait(INFINITE);
+	last_error = created ? ERROR_SUCCESS : ERROR_ALREADY_EXISTS;
+	return mutex;
+}
+
+BOOL ReleaseMutex(HANDLE handle)
+{
+	return flock(static_cast<MutexHandle*>(static_cast<CompatHandle*>(handle))->fd, LOCK_UN) == 0;
+}
+
+HANDLE CreateFileMappingA(HANDLE file, LPSECURITY_ATTRIBUTES, DWORD, DWORD maximum_size_high, DWORD maximum_size_low, LPCSTR name)
+{
+	const size_t size = static_cast<size_t>(maximum_size_high) << 32 | maximum_size_low;
+	MappingHandle* const mapping = new MappingHandle;
+	last_error = ERROR_SUCCESS;
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		mapping->fd = dup(static_cast<FileHandle*>(static_cast<CompatHandle*>(file))->fd);
+		mapping->size = size != 0 ? size : GetFileSize(mapping->fd);
+	}
+	else if (name)
+	{
+		mapping->shared_memory_name = GetSharedMemoryName(name);
+		mapping->fd = OpenSharedMemory(mapping->shared_memory_name, size, true, &mapping->owner);
+		mapping->size = GetFileSize(mapping->fd);
+		if (!mapping->owner)
+			last_error = ERROR_ALREADY_EXISTS;
+	}
+	else
+	{
+		char anonymous_name[64];
+		snprintf(anonymous_name, sizeof(anonymous_name), "/FlexASIO-compat-%d-%p", static_cast<int>(getpid()), static_cast<void*>(mapping));
+		bool created;
+		mapping->fd = OpenSharedMemory(anonymous_name, size, true, &created);
+		shm_unlink(anonymous_name);
+		mapping->size = size;
+	}
+	if (mapping->fd < 0)
+	{
+		delete mapping;
+		last_error = ERROR_ACCESS_DENIED;
+		return NULL;
+	}
+	return mapping;
+}
+
+HANDLE OpenFileMappingA(DWORD, BOOL, LPCSTR name)
+{
+	MappingHandle* const mapping = new MappingHandle;
+	mapping->fd = shm_open(GetSharedMemoryName(name).c_str(), O_RDWR, 0600);
+	if (mapping->fd < 0)
+	{
+		delete mapping;
+		last_error = ERROR_FILE_NOT_FOUND;
+		return NULL;
+	}
+	mapping->size = GetFileSize(mapping->fd);
+	return mapping;
+}
+
+LPVOID MapViewOfFile(HANDLE handle, DWORD access, DWORD offset_high, DWORD offset_low, SIZE_T size)
+{
+	const MappingHandle* const mapping = static_cast<MappingHandle*>(static_cast<CompatHandle*>(handle));
+	const size_t offset = static_cast<size_t>(offset_high) << 32 | offset_low;
+	if (size == 0)
+		size = mapping->size - offset;
+	const int protection = access == FILE_MAP_READ ? PROT_READ : PROT_READ | PROT_WRITE;
+	void* const view = mmap(nullptr, size, protection, MAP_SHARED, mapping->fd, static_cast<off_t>(offset));
+	if (view == MAP_FAILED)
+	{
+		last_error = ERROR_ACCESS_DENIED;
+		return NULL;
+	}
+	AddRegion(view, size);
+	return view;
+}
+
+BOOL UnmapViewOfFile(LPCVOID address)
+{
+	size_t size;
+	if (!RemoveRegion(address, &size))
+		return FALSE;
+	return munmap(const_cast<void*>(address), size) == 0;
+}
+
+LPVOID VirtualAlloc(LPVOID, SIZE_T size, DWORD allocation_type, DWORD)
+{
+	if (allocation_type & MEM_LARGE_PAGES)
+	{
+		last_error = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+	void* const memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		last_error = ERROR_NOT_ENOUGH_MEMORY;
+		return NULL;
+	}
+	AddRegion(memory, size);
+	return memory;
+}
+
+BOOL VirtualFree(LPVOID address, SIZE_T, DWORD)
+{
+	return UnmapViewOfFile(address);
+}
+
+BOOL VirtualLock(LPVOID address, SIZE_T size) { return mlock(address, size) == 0; }
+BOOL VirtualUnlock(LPVOID address, SIZE_T size) { return munlock(address, size) == 0; }
+
+SIZE_T VirtualQuery(LPCVOID address, MEMORY_BASIC_INFORMATION* information, SIZE_T length)
+{
+	if (length < sizeof(MEMORY_BASIC_INFORMATION))
+		return 0;
+	std::lock_guard<std::mutex> lock(regions_mutex);
+	auto region = regions.upper_bound(static_cast<const char*>(address));
+	if (region == regions.begin())
+		return 0;
+	--region;
+	if (static_cast<const char*>(address) >= region->first + region->second)
+		return 0;
+	memset(information, 0, sizeof(*information));
+	information->BaseAddress = const_cast<void*>(address);
+	information->AllocationBase = const_cast<char*>(region->first);
+	information->RegionSize = region->first + region->second - static_cast<const char*>(address);
+	information->State = MEM_COMMIT;
+	information->Protect = PAGE_READWRITE;
+	return sizeof(MEMORY_BASIC_INFORMATION);
+}
+
+SIZE_T GetLargePageMinimum() { return 0; }
+
+void GetSystemInfo(SYSTEM_INFO* system_info)
+{
+	memset(system_info, 0, sizeof(*system_info));
+	system_info->dwPageSize = static_cast<DWORD>(sysconf(_SC_PAGESIZE));
+	// Same as Windows. This is what MapViewOfFile() offsets must be a multiple of, which also works for mmap().
+	system_info->dwAllocationGranularity = 65536;
+	system_info->dwNumberOfProcessors = static_cast<DWORD>(sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+HANDLE GetCurrentProcess() { return reinterpret_cast<HANDLE>(static_cast<intptr_t>(-1)); }
+DWORD GetCurrentProcessId() { return static_cast<DWORD>(getpid()); }
+
+HANDLE OpenProcess(DWORD, BOOL, DWORD process_id)
+{
+	if (kill(static_cast<pid_t>(process_id), 0) != 0 && errno != EPERM)
+	{
+		last_error = ERROR_INVALID_PARAMETER;
+		return NULL;
+	}
+	ProcessHandle* const process = new ProcessHandle;
+	process->process_id = static_cast<pid_t>(process_id);
+	return process;
+}
+
+// Locking memory is done with mlock() and the RLIMIT_MEMLOCK limit; there is no privilege to enable.
+BOOL OpenProcessToken(HANDLE, DWORD, HANDLE*)
+{
+	last_error = ERROR_ACCESS_DENIED;
+	return FALSE;
+}
+
+BOOL LookupPrivilegeValueA(LPCSTR, LPCSTR, LUID*) { return FALSE; }
+BOOL AdjustTokenPrivileges(HANDLE, BOOL, TOKEN_PRIVILEGES*, DWORD, TOKEN_PRIVILEGES*, DWORD*) { return FALSE; }
+
+BOOL GetProcessWorkingSetSize(HANDLE, SIZE_T* minimum, SIZE_T* maximum)
+{
+	*minimum = 200 * 4096;
+	*maximum = 1380 * 4096;
+	return TRUE;
+}
+
+BOOL SetProcessWorkingSetSize(HANDLE, SIZE_T, SIZE_T) { return TRUE; }
+
+HANDLE GetCurrentThread() { return &current_thread; }
+// Real-time priorities need privileges that tests don't have. The driver copes with this failing.
+BOOL SetThreadPriority(HANDLE, int) { return FALSE; }
+void Sleep(DWORD milliseconds) { std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds)); }
+
+HANDLE CreateFileA(LPCSTR path, DWORD access, DWORD, LPSECURITY_ATTRIBUTES, DWORD, DWORD, HANDLE)
+{
+	const int fd = open(path, (access & GENERIC_WRITE) ? O_RDWR : O_RDONLY);
+	if (fd < 0)
+	{
+		last_error = ERROR_FILE_NOT_FOUND;
+		return INVALID_HANDLE_VALUE;
+	}
+	FileHandle* const file = new FileHandle;
+	file->fd = fd;
+	return file;
+}
+
+BOOL GetFileSizeEx(HANDLE handle, LARGE_INTEGER* size)
+{
+	struct stat file_stat;
+	if (fstat(static_cast<FileHandle*>(static_cast<CompatHandle*>(handle))->fd, &file_stat) != 0)
+		return FALSE;
+	size->QuadPart = file_stat.st_size;
+	return TRUE;
+}
+
+BOOL CreateDirectoryA(LPCSTR path, LPSECURITY_ATTRIBUTES) { return mkdir(path, 0700) == 0; }
+BOOL DeleteFileA(LPCSTR path) { return unlink(path) == 0; }
+BOOL MoveFileExA(LPCSTR existing_path, LPCSTR new_path, DWORD) { return rename(existing_path, new_path) == 0; }
+
+DWORD GetEnvironmentVariableA(LPCSTR name, LPSTR buffer, DWORD size)
+{
+	const char* const value = getenv(name);
+	if (!value)
+	{
+		last_error = ERROR_FILE_NOT_FOUND;
+		return 0;
+	}
+	const size_t length = strlen(value);
+	if (length + 1 > size)
+		return static_cast<DWORD>(length + 1);
+	memcpy(buffer, value, length + 1);
+	return static_cast<DWORD>(length);
+}
+
+namespace {
+std::atomic<PHANDLER_ROUTINE> console_control_handler{ nullptr };
+
+void HandleSignal(int signal_number)
+{
+	const PHANDLER_ROUTINE handler = console_control_handler.load();
+	if (handler)
+		handler(signal_number == SIGINT ? CTRL_C_EVENT : CTRL_BREAK_EVENT);
+}
+}
+
+BOOL SetConsoleCtrlHandler(PHANDLER_ROUTINE handler, BOOL add)
+{
+	console_control_handler.store(add ? handler : nullptr);
+	signal(SIGINT, add ? HandleSignal : SIG_DFL);
+	signal(SIGTERM, add ? HandleSignal : SIG_DFL);
+	return TRUE;
+}
+
+DWORD timeGetTime()
+{
+	return static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void GetSystemTimeAsFileTime(FILETIME* file_time)
+{
+	// FILETIME counts 100 ns intervals since 1601-01-01.
+	const uint64_t unix_epoch_offset = 116444736000000000ULL;
+	const uint64_t intervals = unix_epoch_offset + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count() / 100;
+	file_time->dwLowDateTime = static_cast<DWORD>(intervals);
+	file_time->dwHighDateTime = static_cast<DWORD>(intervals >> 32);
+}
+
+void OutputDebugStringA(LPCSTR string) { fputs(string, stderr); }
+
+LONG RegOpenKeyExA(HKEY key, LPCSTR sub_key, DWORD, REGSAM, HKEY* result)
+{
+	if (key != HKEY_CURRENT_USER)
+		return ERROR_INVALID_HANDLE;
+	for (const auto& entry : GetFakeRegistry())
+		if (entry.first.first == sub_key)
+		{
+			CompatRegistryKey* const opened = new CompatRegistryKey;
+			opened->path = sub_key;
+			*result = opened;
+			return ERROR_SUCCESS;
+		}
+	return ERROR_FILE_NOT_FOUND;
+}
+
+LONG RegQueryValueExA(HKEY key, LPCSTR name, DWORD*, DWORD* type, BYTE* data, DWORD* size)
+{
+	const auto entry = GetFakeRegistry().find(std::make_pair(key->path, std::string(name ? name : "")));
+	if (entry == GetFakeRegistry().end())
+		return ERROR_FILE_NOT_FOUND;
+	const FakeRegistryValue& value = entry->second;
+	if (type)
+		*type = value.type;
+	if (data)
+	{
+		if (!size || *size < value.data.size())
+		{
+			if (size)
+				*size = static_cast<DWORD>(value.data.size());
+			// ERROR_MORE_DATA
+			return 234L;
+		}
+		memcpy(data, value.data.data(), value.data.size());
+	}
+	if (size)
+		*size = static_cast<DWORD>(value.data.size());
+	return ERROR_SUCCESS;
+}
+
+LONG RegCloseKey(HKEY key)
+{
+	delete key;
+	return ERROR_SUCCESS;
+}
+
+FILE* _wfopen(const wchar_t* path, const wchar_t* mode)
+{
+	// Paths in tests are plain ASCII.
+	std::string narrow_path, narrow_mode;
+	for (const wchar_t* character = path; *character; ++character)
+		narrow_path += static_cast<char>(*character);
+	for (const wchar_t* character = mode; *character; ++character)
+		narrow_mode += static_cast<char>(*character);
+	return fopen(narrow_path.c_str(), narrow_mode.c_str());
+}
@@ -0,0 +1,282 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// Just enough of the Windows API to build the driver on other platforms, for the tests and benchmarks in this directory. Only used when not building on Windows.
+// Handles are real: named file mappings and events are backed by POSIX shared memory, so that they work across processes like they do on Windows.
+// The registry is an in-process fake that tests fill in (see fake_registry.h).
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef int BOOL;
+typedef unsigned int UINT;
+typedef size_t SIZE_T;
+typedef uintptr_t DWORD_PTR;
+typedef uintptr_t ULONG_PTR;
+typedef void* HANDLE;
+typedef void* HINSTANCE;
+typedef void* HMODULE;
+typedef void* HWND;
+typedef void* LPVOID;
+typedef const void* LPCVOID;
+typedef char* LPSTR;
+typedef const char* LPCSTR;
+typedef wchar_t WCHAR;
+typedef const wchar_t* LPCWSTR;
+typedef int32_t HRESULT;
+typedef struct CompatRegistryKey* HKEY;
+typedef DWORD REGSAM;
+
+#define TRUE 1
+#define FALSE 0
+#define WINAPI
+#define CALLBACK
+#define STDMETHODCALLTYPE
+#define STDAPI extern "C" HRESULT
+#define STDMETHOD(method) virtual HRESULT STDMETHODCALLTYPE method
+#define STDMETHOD_(type, method) virtual type STDMETHODCALLTYPE method
+#define interface struct
+#define MAX_PATH 260
+
+#define SUCCEEDED(hr) (static_cast<HRESULT>(hr) >= 0)
+#define FAILED(hr) (static_cast<HRESULT>(hr) < 0)
+#define S_OK static_cast<HRESULT>(0)
+#define S_FALSE static_cast<HRESULT>(1)
+#define E_NOTIMPL static_cast<HRESULT>(0x80004001)
+#define E_NOINTERFACE static_cast<HRESULT>(0x80004002)
+#define E_POINTER static_cast<HRESULT>(0x80004003)
+#define E_FAIL static_cast<HRESULT>(0x80004005)
+#define E_OUTOFMEMORY static_cast<HRESULT>(0x8007000E)
+#define E_INVALIDARG static_cast<HRESULT>(0x80070057)
+#define E_ILLEGAL_METHOD_CALL static_cast<HRESULT>(0x8000000E)
+
+#define ERROR_SUCCESS 0L
+#define ERROR_FILE_NOT_FOUND 2L
+#define ERROR_ACCESS_DENIED 5L
+#define ERROR_INVALID_HANDLE 6L
+#define ERROR_NOT_ENOUGH_MEMORY 8L
+#define ERROR_INVALID_PARAMETER 87L
+#define ERROR_ALREADY_EXISTS 183L
+#define ERROR_NOT_ALL_ASSIGNED 1300L
+
+#define INVALID_HANDLE_VALUE (reinterpret_cast<HANDLE>(static_cast<intptr_t>(-1)))
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0x00000000L
+#define WAIT_ABANDONED 0x00000080L
+#define WAIT_TIMEOUT 0x00000102L
+#define WAIT_FAILED 0xFFFFFFFF
+#define SYNCHRONIZE 0x00100000L
+#define EVENT_ALL_ACCESS 0x001F0003L
+
+#define MEM_COMMIT 0x00001000
+#define MEM_RESERVE 0x00002000
+#define MEM_RELEASE 0x00008000
+#define MEM_LARGE_PAGES 0x20000000
+#define PAGE_READONLY 0x02
+#define PAGE_READWRITE 0x04
+#define FILE_MAP_WRITE 0x0002
+#define FILE_MAP_READ 0x0004
+#define FILE_MAP_ALL_ACCESS 0x000F001F
+
+#define GENERIC_READ 0x80000000
+#define GENERIC_WRITE 0x40000000
+#define FILE_SHARE_READ 0x00000001
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x00000080
+#define FILE_FLAG_SEQUENTIAL_SCAN 0x08000000
+#define MOVEFILE_REPLACE_EXISTING 0x00000001
+
+#define HKEY_CURRENT_USER (reinterpret_cast<HKEY>(static_cast<uintptr_t>(0x80000001)))
+#define KEY_READ 0x20019
+#define REG_SZ 1
+#define REG_DWORD 4
+
+#define TOKEN_ADJUST_PRIVILEGES 0x0020
+#define TOKEN_QUERY 0x0008
+#define SE_PRIVILEGE_ENABLED 0x00000002L
+
+#define THREAD_PRIORITY_TIME_CRITICAL 15
+
+typedef union _LARGE_INTEGER
+{
+	struct { DWORD LowPart; LONG HighPart; };
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _FILETIME
+{
+	DWORD dwLowDateTime;
+	DWORD dwHighDateTime;
+} FILETIME;
+
+typedef struct _SYSTEM_INFO
+{
+	DWORD dwPageSize;
+	LPVOID lpMinimumApplicationAddress;
+	LPVOID lpMaximumApplicationAddress;
+	DWORD_PTR dwActiveProcessorMask;
+	DWORD dwNumberOfProcessors;
+	DWORD dwProcessorType;
+	DWORD dwAllocationGranularity;
+	WORD wProcessorLevel;
+	WORD wProcessorRevision;
+} SYSTEM_INFO;
+
+typedef struct _MEMORY_BASIC_INFORMATION
+{
+	LPVOID BaseAddress;
+	LPVOID AllocationBase;
+	DWORD AllocationProtect;
+	SIZE_T RegionSize;
+	DWORD State;
+	DWORD Protect;
+	DWORD Type;
+} MEMORY_BASIC_INFORMATION;
+
+typedef struct _LUID
+{
+	DWORD LowPart;
+	LONG HighPart;
+} LUID;
+
+typedef struct _LUID_AND_ATTRIBUTES
+{
+	LUID Luid;
+	DWORD Attributes;
+} LUID_AND_ATTRIBUTES;
+
+typedef struct _TOKEN_PRIVILEGES
+{
+	DWORD PrivilegeCount;
+	LUID_AND_ATTRIBUTES Privileges[1];
+} TOKEN_PRIVILEGES;
+
+typedef struct _SECURITY_ATTRIBUTES* LPSECURITY_ATTRIBUTES;
+
+typedef struct _GUID
+{
+	uint32_t Data1;
+	uint16_t Data2;
+	uint16_t Data3;
+	uint8_t Data4[8];
+} GUID;
+typedef GUID IID;
+typedef GUID CLSID;
+typedef const GUID& REFGUID;
+typedef const IID& REFIID;
+typedef const CLSID& REFCLSID;
+
+inline bool IsEqualGUID(REFGUID first, REFGUID second) { return memcmp(&first, &second, sizeof(GUID)) == 0; }
+inline bool operator==(REFGUID first, REFGUID second) { return IsEqualGUID(first, second); }
+
+// There is no such thing as interface IDs attached to types outside of MSVC. Every type gets the null GUID, which is fine as nothing here goes through QueryInterface().
+extern const GUID compat_null_guid;
+#define __uuidof(type) compat_null_guid
+
+interface IUnknown
+{
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) = 0;
+	virtual ULONG STDMETHODCALLTYPE AddRef() = 0;
+	virtual ULONG STDMETHODCALLTYPE Release() = 0;
+	virtual ~IUnknown() { }
+};
+
+DWORD GetLastError();
+void SetLastError(DWORD error);
+BOOL CloseHandle(HANDLE handle);
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+
+HANDLE CreateEventA(LPSECURITY_ATTRIBUTES attributes, BOOL manual_reset, BOOL initial_state, LPCSTR name);
+HANDLE OpenEventA(DWORD access, BOOL inherit, LPCSTR name);
+BOOL SetEvent(HANDLE event);
+BOOL ResetEvent(HANDLE event);
+
+// Named mutexes only. Wait for them with WaitForSingleObject(). Not recursive, unlike the real thing.
+HANDLE CreateMutexA(LPSECURITY_ATTRIBUTES attributes, BOOL initial_owner, LPCSTR name);
+BOOL ReleaseMutex(HANDLE mutex);
+
+HANDLE CreateFileMappingA(HANDLE file, LPSECURITY_ATTRIBUTES attributes, DWORD protect, DWORD maximum_size_high, DWORD maximum_size_low, LPCSTR name);
+HANDLE OpenFileMappingA(DWORD access, BOOL inherit, LPCSTR name);
+LPVOID MapViewOfFile(HANDLE mapping, DWORD access, DWORD offset_high, DWORD offset_low, SIZE_T size);
+BOOL UnmapViewOfFile(LPCVOID address);
+
+LPVOID VirtualAlloc(LPVOID address, SIZE_T size, DWORD allocation_type, DWORD protect);
+BOOL VirtualFree(LPVOID address, SIZE_T size, DWORD free_type);
+BOOL VirtualLock(LPVOID address, SIZE_T size);
+BOOL VirtualUnlock(LPVOID address, SIZE_T size);
+SIZE_T VirtualQuery(LPCVOID address, MEMORY_BASIC_INFORMATION* information, SIZE_T length);
+SIZE_T GetLargePageMinimum();
+void GetSystemInfo(SYSTEM_INFO* system_info);
+
+HANDLE GetCurrentProcess();
+DWORD GetCurrentProcessId();
+HANDLE OpenProcess(DWORD access, BOOL inherit, DWORD process_id);
+BOOL OpenProcessToken(HANDLE process, DWORD access, HANDLE* token);
+BOOL LookupPrivilegeValueA(LPCSTR system_name, LPCSTR name, LUID* luid);
+BOOL AdjustTokenPrivileges(HANDLE token, BOOL disable_all, TOKEN_PRIVILEGES* new_state, DWORD buffer_length, TOKEN_PRIVILEGES* previous_state, DWORD* return_length);
+BOOL GetProcessWorkingSetSize(HANDLE process, SIZE_T* minimum, SIZE_T* maximum);
+BOOL SetProcessWorkingSetSize(HANDLE process, SIZE_T minimum, SIZE_T maximum);
+
+HANDLE GetCurrentThread();
+BOOL SetThreadPriority(HANDLE thread, int priority);
+void Sleep(DWORD milliseconds);
+
+HANDLE CreateFileA(LPCSTR path, DWORD access, DWORD share_mode, LPSECURITY_ATTRIBUTES attributes, DWORD creation_disposition, DWORD flags, HANDLE template_file);
+BOOL GetFileSizeEx(HANDLE file, LARGE_INTEGER* size);
+BOOL CreateDirectoryA(LPCSTR path, LPSECURITY_ATTRIBUTES attributes);
+BOOL DeleteFileA(LPCSTR path);
+BOOL MoveFileExA(LPCSTR existing_path, LPCSTR new_path, DWORD flags);
+DWORD GetEnvironmentVariableA(LPCSTR name, LPSTR buffer, DWORD size);
+
+#define CTRL_C_EVENT 0
+#define CTRL_BREAK_EVENT 1
+typedef BOOL (WINAPI *PHANDLER_ROUTINE)(DWORD control_type);
+// The handler is called on SIGINT and SIGTERM (from the signal handler, so it must only touch atomics).
+BOOL SetConsoleCtrlHandler(PHANDLER_ROUTINE handler, BOOL add);
+
+DWORD timeGetTime();
+void GetSystemTimeAsFileTime(FILETIME* file_time);
+void OutputDebugStringA(LPCSTR string);
+
+LONG RegOpenKeyExA(HKEY key, LPCSTR sub_key, DWORD options, REGSAM access, HKEY* result);
+LONG RegQueryValueExA(HKEY key, LPCSTR name, DWORD* reserved, DWORD* type, BYTE* data, DWORD* size);
+LONG RegCloseKey(HKEY key);
+
+// Bits of the MSVC runtime.
+FILE* _wfopen(const wchar_t* path, const wchar_t* mode);
+inline int strcpy_s(char* destination, size_t size, const char* source)
+{
+	if (size == 0)
+		return 1;
+	strncpy(destination, source, size - 1);
+	destination[size - 1] = 0;
+	return 0;
+}
@@ -0,0 +1,156 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Checks that all the conversion kernels agree bit for bit with the scalar ones, for every format, on lengths that exercise the vector loop tails, on unaligned buffers, and on special values (NaN, infinities, out of range, rounding ties).
+
+#include "../convert.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+const size_t max_length = 1031;
+// One sample of offset into the buffers makes the vector loads and stores unaligned.
+const size_t misalignment = 1;
+
+std::vector<float> GenerateFloats(std::mt19937& random, size_t count)
+{
+	static const float special_values[] = {
+		0.0f, -0.0f, 1.0f, -1.0f, 1.5f, -1.5f, 0.5f / 32768.0f, 1.5f / 32768.0f, -0.5f / 32768.0f, 0.5f / 8388608.0f,
+		0.99999994f, -0.99999994f, 1.0000001f, -1.0000001f, 1e30f, -1e30f, std::numeric_limits<float>::denorm_min(), -std::numeric_limits<float>::denorm_min(),
+		std::numeric_limits<float>::quiet_NaN(), -std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+	};
+	const size_t special_value_count = sizeof(special_values) / sizeof(special_values[0]);
+	std::uniform_real_distribution<float> regular(-1.25f, 1.25f);
+	std::uniform_int_distribution<size_t> pick(0, special_value_count * 4);
+	std::vector<float> values(count);
+	for (size_t index = 0; index < count; ++index)
+	{
+		// Roughly one value out of five is special, at varying positions so that they land in both the vector loops and the tails.
+		const size_t special_index = pick(random);
+		values[index] = special_index < special_value_count ? special_values[special_index] : regular(random);
+	}
+	return values;
+}
+
+// Random bytes are a valid input for every format. For floats, this also produces NaNs with random payloads, infinities and denormals.
+std::vector<uint8_t> GenerateBytes(std::mt19937& random, size_t count)
+{
+	std::uniform_int_distribution<int> byte(0, 255);
+	std::vector<uint8_t> bytes(count);
+	for (size_t index = 0; index < count; ++index)
+		bytes[index] = static_cast<uint8_t>(byte(random));
+	return bytes;
+}
+
+void CheckEncode(SampleFormat format, const SampleConverter& reference, const SampleConverter& candidate, const std::vector<float>& source, size_t length)
+{
+	std::vector<uint8_t> expected((length + misalignment) * reference.sample_size + 1, 0xAA);
+	std::vector<uint8_t> actual(expected.size(), 0xAA);
+	reference.encode(expected.data() + misalignment * reference.sample_size, source.data() + misalignment, length);
+	candidate.encode(actual.data() + misalignment * candidate.sample_size, source.data() + misalignment, length);
+	// Comparing the whole buffer also catches writes past the end.
+	if (!CHECK(expected == actual))
+		fprintf(stderr, "  encode %s, %s, length %zu\n", GetSampleFormatName(format), GetInstructionSetName(candidate.instruction_set), length);
+}
+
+void CheckDecode(SampleFormat format, const SampleConverter& reference, const SampleConverter& candidate, const std::vector<uint8_t>& source, size_t length)
+{
+	std::vector<float> expected(length + misalignment + 1, 42.0f);
+	std::vector<float> actual(expected.size(), 42.0f);
+	reference.decode(expected.data() + misalignment, source.data() + misalignment * reference.sample_size, length);
+	candidate.decode(actual.data() + misalignment, source.data() + misalignment * candidate.sample_size, length);
+	if (!CHECK(memcmp(expected.data(), actual.data(), expected.size() * sizeof(float)) == 0))
+		fprintf(stderr, "  decode %s, %s, length %zu\n", GetSampleFormatName(format), GetInstructionSetName(candidate.instruction_set), length);
+}
+
+void CheckAgreement(InstructionSet instruction_set)
+{
+	if (instruction_set > GetBestInstructionSet())
+	{
+		printf("Skipping %s: not supported by this CPU\n", GetInstructionSetName(instruction_set));
+		return;
+	}
+	printf("Checking %s against scalar\n", GetInstructionSetName(instruction_set));
+	std::mt19937 random(1234);
+	for (size_t format_index = 0; format_index < SAMPLE_FORMAT_COUNT; ++format_index)
+	{
+		const SampleFormat format = static_cast<SampleFormat>(format_index);
+		const SampleConverter reference = GetSampleConverter(format, INSTRUCTION_SET_SCALAR);
+		const SampleConverter candidate = GetSampleConverter(format, instruction_set);
+		CHECK(candidate.instruction_set == instruction_set);
+		for (size_t length = 0; length <= max_length; length = length < 70 ? length + 1 : length * 2 + 1)
+		{
+			CheckEncode(format, reference, candidate, GenerateFloats(random, length + misalignment), length);
+			CheckDecode(format, reference, candidate, GenerateBytes(random, (length + misalignment) * reference.sample_size), length);
+		}
+	}
+}
+
+// Pins down the scalar semantics the vector kernels are compared against.
+void CheckScalarValues()
+{
+	const float nan = std::numeric_limits<float>::quiet_NaN();
+	const float source[] = { 0.0f, 1.0f, -1.0f, 2.0f, -2.0f, nan, 0.5f / 32768.0f, 1.5f / 32768.0f };
+	const size_t count = sizeof(source) / sizeof(source[0]);
+
+	int16_t int16_samples[count];
+	GetSampleConverter(SAMPLE_FORMAT_INT16, INSTRUCTION_SET_SCALAR).encode(int16_samples, source, count);
+	const int16_t expected_int16[count] = { 0, 32767, -32768, 32767, -32768, -32768, 0, 2 };
+	CHECK(memcmp(int16_samples, expected_int16, sizeof(expected_int16)) == 0);
+
+	int32_t int32_samples[count];
+	GetSampleConverter(SAMPLE_FORMAT_INT32, INSTRUCTION_SET_SCALAR).encode(int32_samples, source, count);
+	CHECK(int32_samples[1] == 2147483520);
+	CHECK(int32_samples[2] == std::numeric_limits<int32_t>::min());
+	CHECK(int32_samples[5] == std::numeric_limits<int32_t>::min());
+
+	uint8_t int24_samples[count * 3];
+	GetSampleConverter(SAMPLE_FORMAT_INT24, INSTRUCTION_SET_SCALAR).encode(int24_samples, source, count);
+	const uint8_t expected_int24[6] = { 0x00, 0x00, 0x00, 0xFF, 0xFF, 0x7F };
+	CHECK(memcmp(int24_samples, expected_int24, sizeof(expected_int24)) == 0);
+
+	float decoded[count];
+	GetSampleConverter(SAMPLE_FORMAT_INT16, INSTRUCTION_SET_SCALAR).decode(decoded, expected_int16, count);
+	CHECK(decoded[2] == -1.0f);
+	CHECK(decoded[1] == 32767.0f / 32768.0f);
+
+	double float64_samples[count];
+	GetSampleConverter(SAMPLE_FORMAT_FLOAT64, INSTRUCTION_SET_SCALAR).encode(float64_samples, source, count);
+	CHECK(float64_samples[3] == 2.0);
+	CHECK(std::isnan(float64_samples[5]));
+}
+
+}
+
+int main()
+{
+	printf("Best instruction set: %s\n", GetInstructionSetName(GetBestInstructionSet()));
+	CheckScalarValues();
+	CheckAgreement(INSTRUCTION_SET_SSE2);
+	CheckAgreement(INSTRUCTION_SET_AVX2);
+	return TestResult();
+}
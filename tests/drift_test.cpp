@@ -0,0 +1,157 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Deterministic simulation of DriftCompensator with a producer and a consumer running on clocks that drift apart by up to +/- 200 ppm.
+// Checks that the ring never runs dry nor overflows once primed, that its level converges to the target, and that the ratio converges to the actual drift.
+
+#include "../drift.h"
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+const double sample_rate = 48000;
+const size_t channel_count = 2;
+const double simulated_seconds = 600;
+// The loop time constant is about 10 seconds (see natural_frequency in drift.cpp); by then it must have long settled.
+const double settled_after_seconds = 300;
+
+struct Scenario
+{
+	double drift_ppm;
+	size_t push_frames;
+	size_t pull_frames;
+	// Callback timing jitter, as a fraction of the callback period.
+	double jitter;
+};
+
+void RunScenario(const Scenario& scenario)
+{
+	printf("Drift %+.0f ppm, push %zu frames, pull %zu frames, jitter %.0f%%: ", scenario.drift_ppm, scenario.push_frames, scenario.pull_frames, scenario.jitter * 100);
+	DriftCompensator compensator(channel_count, sample_rate, 8 * (scenario.push_frames + scenario.pull_frames));
+	std::mt19937 random(static_cast<unsigned int>(scenario.push_frames * 1000 + scenario.pull_frames));
+	std::uniform_real_distribution<double> jitter(-scenario.jitter, scenario.jitter);
+
+	// The producer runs on a clock that is off by drift_ppm relative to the consumer clock, which is the time reference.
+	const double producer_rate = sample_rate * (1 + scenario.drift_ppm * 1e-6);
+	const double push_period = scenario.push_frames / producer_rate;
+	const double pull_period = scenario.pull_frames / sample_rate;
+
+	std::vector<float> push_buffer(channel_count * scenario.push_frames);
+	std::vector<float> pull_buffer(channel_count * scenario.pull_frames);
+	std::vector<float*> push_channels(channel_count);
+	std::vector<float*> pull_channels(channel_count);
+	for (size_t channel = 0; channel < channel_count; ++channel)
+	{
+		push_channels[channel] = push_buffer.data() + channel * scenario.push_frames;
+		pull_channels[channel] = pull_buffer.data() + channel * scenario.pull_frames;
+	}
+
+	// Both sides start at the same time; ties go to the producer, like a real full-duplex device would.
+	uint64_t push_count = 0;
+	uint64_t pull_count = 0;
+	double next_push = 0;
+	double next_pull = 0;
+	double level_sum = 0;
+	uint64_t level_count = 0;
+	double ratio_sum = 0;
+	size_t min_level = SIZE_MAX;
+	size_t max_level = 0;
+	unsigned long settled_underruns = 0;
+	unsigned long settled_overruns = 0;
+	bool settled = false;
+	for (;;)
+	{
+		const bool push = next_push <= next_pull;
+		const double now = push ? next_push : next_pull;
+		if (now >= simulated_seconds)
+			break;
+		if (!settled && now >= settled_after_seconds)
+		{
+			settled = true;
+			settled_underruns = compensator.GetUnderrunCount();
+			settled_overruns = compensator.GetOverrunCount();
+		}
+
+		if (push)
+		{
+			compensator.Push(push_channels.data(), scenario.push_frames);
+			++push_count;
+			next_push = (push_count + jitter(random)) * push_period;
+		}
+		else
+		{
+			const size_t level = compensator.GetLevel();
+			compensator.Pull(pull_channels.data(), 0, scenario.pull_frames);
+			++pull_count;
+			next_pull = (pull_count + jitter(random)) * pull_period;
+			if (settled)
+			{
+				level_sum += level;
+				++level_count;
+				ratio_sum += compensator.GetRatio();
+				min_level = (std::min)(min_level, level);
+				max_level = (std::max)(max_level, level);
+			}
+		}
+	}
+
+	const double target_level = static_cast<double>(compensator.GetTargetLevel());
+	const double mean_level = level_sum / level_count;
+	const double mean_ratio_ppm = (ratio_sum / level_count - 1) * 1e6;
+	printf("underruns %lu, overruns %lu, target level %.0f, settled level %.1f (min %zu, max %zu), ratio %+.2f ppm\n",
+		compensator.GetUnderrunCount(), compensator.GetOverrunCount(), target_level, mean_level, min_level, max_level, mean_ratio_ppm);
+
+	CHECK(compensator.GetUnderrunCount() == 0);
+	CHECK(compensator.GetOverrunCount() == 0);
+	CHECK(compensator.GetUnderrunCount() == settled_underruns);
+	CHECK(compensator.GetOverrunCount() == settled_overruns);
+	CHECK(target_level >= scenario.push_frames + scenario.pull_frames);
+	// The level is sampled just before each pull, so it should hover around the target, within a fraction of a callback.
+	CHECK(std::abs(mean_level - target_level) < 0.1 * (std::min)(scenario.push_frames, scenario.pull_frames));
+	// Once settled, the level never comes close to running dry.
+	CHECK(min_level >= scenario.pull_frames);
+	// The ratio is the producer rate relative to the consumer rate. When both sides use the same callback size, the level seen by the consumer jumps by a whole callback every time the (slowly sliding) callback order flips, which makes the loop wander by a few ppm.
+	CHECK(std::abs(mean_ratio_ppm - scenario.drift_ppm) < 10);
+}
+
+}
+
+int main()
+{
+	const double drifts_ppm[] = { -200, -50, 0, 50, 200 };
+	const Scenario timings[] = {
+		{ 0, 480, 480, 0.05 },
+		{ 0, 441, 512, 0.05 },
+		{ 0, 1024, 128, 0.05 },
+		{ 0, 128, 1024, 0.05 },
+	};
+	for (double drift_ppm : drifts_ppm)
+		for (Scenario scenario : timings)
+		{
+			scenario.drift_ppm = drift_ppm;
+			RunScenario(scenario);
+		}
+	return TestResult();
+}
@@ -0,0 +1,295 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Measures the engine (see engine.h) with 1 to 16 clients, each a whole driver instance with a fake host, in a process of its own, as with real ASIO hosts.
+// The engine stream is simulated in this process: a thread calls EngineServer::Process() once per period, in real time, in place of the PortAudio callback of FlexASIOEngine.exe.
+// Every 213 ms, the first engine input channel carries a pulse, which every host copies to its first output, so the engine output gets one pulse back per client, each 1/16 of full scale, so that they add up exactly.
+// Reports, for each number of clients and channels:
+//  - the engine CPU time per period (thread CPU time spent in EngineServer::Process());
+//  - the latency the clients add, from the pulse going in to each copy of it coming back, which includes the client's ASIO buffers and the engine rings but no device;
+//  - the underruns and overruns the engine counted.
+// Run with --quick (as CTest does) for a two client smoke test with a single channel count, which checks that every pulse comes back from every client.
+// The client side runs as "engine_benchmark --client <name> <buffer size>", until its standard input is closed.
+
+#include "fake_host.h"
+#include "fake_portaudio.h"
+#include "fake_registry.h"
+
+#include "../engine.h"
+#include "../flexasio.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+
+namespace {
+
+const double sample_rate = 48000;
+const size_t engine_period = 256;
+const long client_buffer_size = 256;
+// About 200 ms, in whole periods, so that the pulses start a period.
+const size_t pulse_interval = 40 * engine_period;
+const float pulse_level = 1.0f / EngineSection::max_clients;
+
+double Percentile(std::vector<double> values, double percentile)
+{
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, static_cast<size_t>(percentile / 100 * values.size()))];
+}
+
+double GetThreadCpuMicroseconds()
+{
+	timespec time;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+	return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+// The client process: a driver instance connected to the engine, and a host that copies its inputs to its outputs. Returns the process exit code.
+int RunClient(const std::string& name, long buffer_size)
+{
+	ResetFakeDriverConfig();
+	SetFakeRegistryValue("Software\\FlexASIO", "EngineName", name);
+	int result = 1;
+	CComObject<CFlexASIO>* const driver = new CComObject<CFlexASIO>;
+	{
+		FakeHost host(driver, FakeHostConfig());
+		if (host.Open(buffer_size) && host.Start())
+		{
+			// Runs until the benchmark closes our standard input.
+			char byte;
+			while (read(0, &byte, 1) > 0) { }
+			if (host.Stop())
+				result = 0;
+		}
+		host.Close();
+	}
+	driver->Release();
+	return result;
+}
+
+struct Client
+{
+	pid_t pid;
+	// The write end of the client's standard input.
+	int input;
+};
+
+bool StartClient(const std::string& name, Client* client)
+{
+	int pipe_fds[2];
+	// Close-on-exec, so that the other clients don't inherit the write end and keep the input open.
+	if (pipe2(pipe_fds, O_CLOEXEC) != 0)
+		return false;
+	posix_spawn_file_actions_t file_actions;
+	posix_spawn_file_actions_init(&file_actions);
+	posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[0], 0);
+	posix_spawn_file_actions_addclose(&file_actions, pipe_fds[1]);
+	const std::string buffer_size = std::to_string(client_buffer_size);
+	const char* const arguments[] = { "engine_benchmark", "--client", name.c_str(), buffer_size.c_str(), nullptr };
+	const bool started = posix_spawn(&client->pid, "/proc/self/exe", &file_actions, nullptr, const_cast<char* const*>(arguments), environ) == 0;
+	posix_spawn_file_actions_destroy(&file_actions);
+	close(pipe_fds[0]);
+	client->input = pipe_fds[1];
+	if (!started)
+		close(client->input);
+	return started;
+}
+
+bool StopClient(const Client& client)
+{
+	close(client.input);
+	int status;
+	return waitpid(client.pid, &status, 0) == client.pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Stands in for the engine stream: feeds the pulses in, and times their return.
+class EngineStream
+{
+	public:
+		EngineStream(EngineServer& server, long channel_count) :
+			server(server), inputs(channel_count, std::vector<float>(engine_period)), outputs(channel_count, std::vector<float>(engine_period))
+		{
+			for (std::vector<float>& input : inputs)
+				input_channels.push_back(input.data());
+			for (std::vector<float>& output : outputs)
+				output_channels.push_back(output.data());
+		}
+
+		// Runs for the given number of periods, paced in real time. Only the last measured_periods are measured.
+		void Run(size_t periods, size_t measured_periods)
+		{
+			std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now();
+			const std::chrono::steady_clock::duration period_duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(engine_period / sample_rate));
+			for (size_t period = 0; period < periods; ++period)
+			{
+				const bool measuring = period >= periods - measured_periods;
+				std::fill(inputs[0].begin(), inputs[0].end(), 0.0f);
+				const unsigned long long period_start = frame;
+				if (period_start % pulse_interval == 0)
+				{
+					inputs[0][0] = pulse_level;
+					pulse_frame = period_start;
+					if (measuring)
+						++pulse_count;
+				}
+
+				const double cpu_start = GetThreadCpuMicroseconds();
+				server.Process(input_channels.data(), output_channels.data(), engine_period);
+				if (measuring)
+					cpu_times.push_back(GetThreadCpuMicroseconds() - cpu_start);
+
+				for (size_t index = 0; index < engine_period; ++index)
+				{
+					const float sample = outputs[0][index];
+					if (sample == 0 || !measuring)
+						continue;
+					const double copies = sample / pulse_level;
+					returned_pulses += copies;
+					for (int copy = 0; copy < static_cast<int>(copies + 0.5); ++copy)
+						latencies_ms.push_back((period_start + index - pulse_frame) * 1000 / sample_rate);
+				}
+				frame += engine_period;
+
+				deadline += period_duration;
+				std::this_thread::sleep_until(deadline);
+			}
+		}
+
+		std::vector<double> cpu_times;
+		std::vector<double> latencies_ms;
+		unsigned long long pulse_count = 0;
+		double returned_pulses = 0;
+
+	private:
+		EngineServer& server;
+		std::vector<std::vector<float>> inputs;
+		std::vector<std::vector<float>> outputs;
+		std::vector<const float*> input_channels;
+		std::vector<float*> output_channels;
+		unsigned long long frame = 0;
+		unsigned long long pulse_frame = 0;
+};
+
+void Run(size_t client_count, long channel_count, double seconds, bool check)
+{
+	const std::string name = "benchmark-" + std::to_string(getpid()) + "-" + std::to_string(client_count) + "-" + std::to_string(channel_count);
+	EngineServer server;
+	CHECK(server.Open(name, sample_rate, channel_count, channel_count));
+	EngineStream stream(server, channel_count);
+
+	std::vector<Client> clients;
+	for (size_t index = 0; index < client_count; ++index)
+	{
+		Client client;
+		if (StartClient(name, &client))
+			clients.push_back(client);
+	}
+	CHECK(clients.size() == client_count);
+
+	// The clients only start getting callbacks once the engine runs, so run it until they are all started, and then some, before measuring.
+	const std::chrono::steady_clock::time_point start_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+	size_t running_count = 0;
+	while (std::chrono::steady_clock::now() < start_deadline)
+	{
+		const std::vector<EngineServer::ClientStatus> status = server.GetClientStatus();
+		running_count = std::count_if(status.begin(), status.end(), [](const EngineServer::ClientStatus& client) { return client.running; });
+		if (running_count == client_count)
+			break;
+		stream.Run(4, 0);
+	}
+	CHECK(running_count == client_count);
+	stream.Run(static_cast<size_t>(0.5 * sample_rate / engine_period), 0);
+
+	unsigned long long underruns_before = 0, overruns_before = 0;
+	for (const EngineServer::ClientStatus& client : server.GetClientStatus())
+	{
+		underruns_before += client.underrun_count;
+		overruns_before += client.overrun_count;
+	}
+	const size_t measured_periods = static_cast<size_t>(seconds * sample_rate / engine_period);
+	stream.Run(measured_periods, measured_periods);
+	unsigned long long underruns = 0, overruns = 0;
+	for (const EngineServer::ClientStatus& client : server.GetClientStatus())
+	{
+		underruns += client.underrun_count;
+		overruns += client.overrun_count;
+	}
+	underruns -= underruns_before;
+	overruns -= overruns_before;
+
+	// The clients need the engine to keep running until they have stopped.
+	std::atomic<bool> stopping(false);
+	std::thread keep_running([&] {
+		while (!stopping.load())
+			stream.Run(1, 0);
+	});
+	bool clients_succeeded = true;
+	for (const Client& client : clients)
+		clients_succeeded = StopClient(client) && clients_succeeded;
+	stopping.store(true);
+	keep_running.join();
+	CHECK(clients_succeeded);
+
+	const double expected_pulses = static_cast<double>(stream.pulse_count) * client_count;
+	printf("  %2zu clients x %2ld channels: engine CPU %6.1f us (median) %6.1f us (99th percentile) per %zu frame period; added latency %5.2f ms (median) %5.2f ms (max); %.0f/%.0f pulses back; %llu underruns, %llu overruns\n",
+		client_count, channel_count, Percentile(stream.cpu_times, 50), Percentile(stream.cpu_times, 99), engine_period,
+		Percentile(stream.latencies_ms, 50), Percentile(stream.latencies_ms, 100), stream.returned_pulses, expected_pulses, underruns, overruns);
+	fflush(stdout);
+	if (check)
+	{
+		// A pulse in flight when the measurement starts or ends can be counted on either side.
+		CHECK(stream.returned_pulses >= expected_pulses - client_count);
+		CHECK(stream.returned_pulses <= expected_pulses + client_count);
+	}
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	if (argc == 4 && strcmp(argv[1], "--client") == 0)
+		return RunClient(argv[2], atol(argv[3]));
+
+	const bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+	printf("Engine at %.0f Hz, %zu frame periods, clients with %ld frame ASIO buffers:\n", sample_rate, engine_period, client_buffer_size);
+	fflush(stdout);
+	if (quick)
+		Run(2, 8, 1, true);
+	else
+		for (const long channel_count : { 8, 64 })
+			for (const size_t client_count : { 1, 2, 4, 8, 16 })
+				Run(client_count, channel_count, 3, false);
+	return TestResult();
+}
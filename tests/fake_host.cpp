@@ -0,0 +1,260 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "fake_host.h"
+
+#include "fake_registry.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+FakeHost* current_host = nullptr;
+
+bool CheckResult(ASIOError result, const char* call)
+{
+	if (result == ASE_OK || result == ASE_SUCCESS)
+		return true;
+	fprintf(stderr, "FakeHost: %s failed with ASIO error %ld\n", call, static_cast<long>(result));
+	return false;
+}
+
+size_t GetASIOSampleSize(ASIOSampleType type)
+{
+	switch (type)
+	{
+		case ASIOSTInt16LSB: return 2;
+		case ASIOSTInt24LSB: return 3;
+		case ASIOSTFloat64LSB: return 8;
+		default: return 4;
+	}
+}
+
+long long GetASIOSamples(const ASIOSamples& samples)
+{
+	return static_cast<long long>(static_cast<unsigned long long>(samples.hi & 0xFFFFFFFF) << 32 | (samples.lo & 0xFFFFFFFF));
+}
+
+}
+
+void ResetFakeDriverConfig()
+{
+	ClearFakeRegistry();
+	const char* const log_level = getenv("FLEXASIO_TEST_LOG_LEVEL");
+	SetFakeRegistryValue("Software\\FlexASIO", "LogLevel", std::string(log_level ? log_level : "warning"));
+	SetFakeRegistryValue("Software\\FlexASIO", "CapabilityCache", DWORD(0));
+}
+
+FakeHost::FakeHost(IASIO* driver, const FakeHostConfig& config) :
+	driver(driver), config(config), input_channel_count(0), output_channel_count(0), buffer_size(0), buffers_created(false), started(false), buffer_switch_count(0), previous_position(-1)
+{
+	callbacks.bufferSwitch = &FakeHost::StaticBufferSwitch;
+	callbacks.sampleRateDidChange = &FakeHost::StaticSampleRateDidChange;
+	callbacks.asioMessage = &FakeHost::StaticAsioMessage;
+	callbacks.bufferSwitchTimeInfo = &FakeHost::StaticBufferSwitchTimeInfo;
+	current_host = this;
+}
+
+FakeHost::~FakeHost()
+{
+	if (started)
+		Stop();
+	if (buffers_created)
+		Close();
+	current_host = nullptr;
+}
+
+bool FakeHost::Init()
+{
+	if (driver->init(nullptr))
+		return true;
+	char message[124] = {};
+	driver->getErrorMessage(message);
+	fprintf(stderr, "FakeHost: init() failed: %s\n", message);
+	return false;
+}
+
+bool FakeHost::CreateBuffers(long buffer_size, long input_channels, long output_channels)
+{
+	long available_inputs, available_outputs;
+	if (!CheckResult(driver->getChannels(&available_inputs, &available_outputs), "getChannels()"))
+		return false;
+	input_channel_count = input_channels < 0 ? available_inputs : (std::min)(input_channels, available_inputs);
+	output_channel_count = output_channels < 0 ? available_outputs : (std::min)(output_channels, available_outputs);
+
+	buffer_infos.clear();
+	channel_infos.clear();
+	for (long channel = 0; channel < input_channel_count + output_channel_count; ++channel)
+	{
+		ASIOBufferInfo buffer_info = {};
+		buffer_info.isInput = channel < input_channel_count ? ASIOTrue : ASIOFalse;
+		buffer_info.channelNum = channel < input_channel_count ? channel : channel - input_channel_count;
+		buffer_infos.push_back(buffer_info);
+		ASIOChannelInfo channel_info = {};
+		channel_info.channel = buffer_info.channelNum;
+		channel_info.isInput = buffer_info.isInput;
+		if (!CheckResult(driver->getChannelInfo(&channel_info), "getChannelInfo()"))
+			return false;
+		channel_infos.push_back(channel_info);
+	}
+	this->buffer_size = buffer_size;
+	if (!CheckResult(driver->createBuffers(buffer_infos.data(), static_cast<long>(buffer_infos.size()), buffer_size, &callbacks), "createBuffers()"))
+		return false;
+	buffers_created = true;
+	return true;
+}
+
+bool FakeHost::Start()
+{
+	previous_position = -1;
+	previous_buffer_switch = std::chrono::steady_clock::time_point();
+	started = CheckResult(driver->start(), "start()");
+	return started;
+}
+
+bool FakeHost::Stop()
+{
+	started = false;
+	return CheckResult(driver->stop(), "stop()");
+}
+
+bool FakeHost::Close()
+{
+	buffers_created = false;
+	return CheckResult(driver->disposeBuffers(), "disposeBuffers()");
+}
+
+bool FakeHost::WaitForBufferSwitches(unsigned long long count, std::chrono::milliseconds timeout) const
+{
+	const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+	while (buffer_switch_count.load() < count)
+	{
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+FakeHostStatistics FakeHost::GetStatistics(bool reset)
+{
+	std::lock_guard<std::mutex> lock(statistics_mutex);
+	FakeHostStatistics result = statistics;
+	if (reset)
+		statistics = FakeHostStatistics();
+	return result;
+}
+
+void FakeHost::StaticBufferSwitch(long index, ASIOBool)
+{
+	current_host->ProcessBuffer(index, nullptr);
+}
+
+void FakeHost::StaticSampleRateDidChange(ASIOSampleRate) { }
+
+long FakeHost::StaticAsioMessage(long selector, long value, void*, double*)
+{
+	return current_host->HandleMessage(selector, value);
+}
+
+ASIOTime* FakeHost::StaticBufferSwitchTimeInfo(ASIOTime* params, long index, ASIOBool)
+{
+	current_host->ProcessBuffer(index, params);
+	return nullptr;
+}
+
+long FakeHost::HandleMessage(long selector, long value)
+{
+	// Like real hosts, ask for the latencies again right away, from the thread that sent the message. The message is counted first, so that a test can tell the host is handling it.
+	if (selector == kAsioResyncRequest || selector == kAsioLatenciesChanged)
+	{
+		{
+			std::lock_guard<std::mutex> lock(statistics_mutex);
+			++(selector == kAsioResyncRequest ? statistics.resync_request_count : statistics.latencies_changed_count);
+		}
+		if (selector == kAsioLatenciesChanged && config.latencies_changed_delay_ms > 0)
+			std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(config.latencies_changed_delay_ms));
+		long input_latency, output_latency;
+		if (driver->getLatencies(&input_latency, &output_latency) != ASE_OK)
+		{
+			std::lock_guard<std::mutex> lock(statistics_mutex);
+			++statistics.failed_latency_query_count;
+		}
+		return 1;
+	}
+
+	std::lock_guard<std::mutex> lock(statistics_mutex);
+	switch (selector)
+	{
+		case kAsioSelectorSupported:
+			return value == kAsioEngineVersion || value == kAsioSupportsTimeInfo ||
+				(config.optional_messages && (value == kAsioResetRequest || value == kAsioResyncRequest || value == kAsioLatenciesChanged || value == kAsioOverload)) ? 1 : 0;
+		case kAsioEngineVersion: return 2;
+		case kAsioSupportsTimeInfo: return config.time_info ? 1 : 0;
+		case kAsioResetRequest: ++statistics.reset_request_count; return 1;
+		case kAsioOverload: ++statistics.overload_count; return 1;
+		default: return 0;
+	}
+}
+
+void FakeHost::ProcessBuffer(long index, const ASIOTime* time)
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Copy inputs to outputs, channel for channel, like a monitoring host would (unless told not to). Extra outputs get silence.
+	for (long output = 0; output < output_channel_count; ++output)
+	{
+		const ASIOChannelInfo& output_info = channel_infos[input_channel_count + output];
+		const size_t size = GetASIOSampleSize(output_info.type) * buffer_size;
+		void* const destination = buffer_infos[input_channel_count + output].buffers[index];
+		if (config.copy_inputs && output < input_channel_count && channel_infos[output].type == output_info.type)
+			memcpy(destination, buffer_infos[output].buffers[index], size);
+		else
+			memset(destination, 0, size);
+	}
+	const bool spike = config.spike_interval > 0 && buffer_switch_count.load() % config.spike_interval == config.spike_interval - 1;
+	const double busy_us = spike ? config.spike_us : config.processing_us;
+	if (busy_us > 0)
+	{
+		const std::chrono::steady_clock::time_point deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::micro>(busy_us));
+		while (std::chrono::steady_clock::now() < deadline) { }
+	}
+
+	const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(statistics_mutex);
+		++statistics.buffer_switch_count;
+		statistics.buffer_switch_durations.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+		if (previous_buffer_switch != std::chrono::steady_clock::time_point())
+			statistics.max_buffer_switch_interval_ms = (std::max)(statistics.max_buffer_switch_interval_ms, std::chrono::duration<double, std::milli>(start - previous_buffer_switch).count());
+		if (time && (time->timeInfo.flags & kSamplePositionValid))
+		{
+			const long long position = GetASIOSamples(time->timeInfo.samplePosition);
+			if (previous_position >= 0 && position != previous_position + buffer_size)
+				++statistics.position_discontinuity_count;
+			previous_position = position;
+		}
+	}
+	previous_buffer_switch = start;
+	buffer_switch_count.fetch_add(1);
+}
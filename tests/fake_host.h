@@ -0,0 +1,121 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// A scripted ASIO host, for driving CFlexASIO (or any IASIO) in tests and benchmarks the way a real host would: it negotiates the channels and buffers, starts the driver, and processes every buffer it is handed.
+// ASIO callbacks carry no context, so there can only be one FakeHost at a time.
+
+#include "iasiodrv.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// Clears the fake registry and sets it up for a hermetic test: the capability cache is disabled, and the log level is taken from the FLEXASIO_TEST_LOG_LEVEL environment variable ("warning" by default).
+// The registry is only read when a driver instance is created, and the logger is only configured by the first one in the process.
+void ResetFakeDriverConfig();
+
+struct FakeHostConfig
+{
+	// Whether the host copies its inputs to its outputs. If not, it outputs silence, which leaves the driver's own contribution (e.g. input monitoring) alone in the output.
+	bool copy_inputs = true;
+	// Busy work per buffer, in microseconds, on top of filling the outputs. Simulates the host's own processing.
+	double processing_us = 0;
+	// If non-zero, every spike_interval-th buffer takes spike_us instead of processing_us, like a host that runs into a slow plugin or a page fault now and then.
+	unsigned long spike_interval = 0;
+	double spike_us = 0;
+	// Whether the host answers yes to kAsioSupportsTimeInfo, in which case the driver calls bufferSwitchTimeInfo() instead of bufferSwitch().
+	bool time_info = true;
+	// Whether the host claims to handle the optional messages (kAsioResyncRequest, kAsioLatenciesChanged, kAsioOverload, kAsioResetRequest).
+	bool optional_messages = true;
+	// How long the host takes to act on kAsioLatenciesChanged before it asks for the new latencies, in milliseconds, like a host that reconfigures its delay compensation first. Whichever thread sent the message waits meanwhile.
+	double latencies_changed_delay_ms = 0;
+};
+
+struct FakeHostStatistics
+{
+	unsigned long long buffer_switch_count = 0;
+	// How long each buffer switch took, in microseconds, in order.
+	std::vector<double> buffer_switch_durations;
+	// Largest gap between two buffer switches, in milliseconds.
+	double max_buffer_switch_interval_ms = 0;
+	// Sample positions that didn't advance by exactly one buffer from one switch to the next (with time info only).
+	unsigned long long position_discontinuity_count = 0;
+	unsigned long long reset_request_count = 0;
+	unsigned long long resync_request_count = 0;
+	unsigned long long latencies_changed_count = 0;
+	unsigned long long overload_count = 0;
+	// getLatencies() calls that failed, out of those made in response to kAsioResyncRequest and kAsioLatenciesChanged.
+	unsigned long long failed_latency_query_count = 0;
+};
+
+class FakeHost
+{
+	public:
+		FakeHost(IASIO* driver, const FakeHostConfig& config);
+		~FakeHost();
+
+		// init(), then getChannels(), getChannelInfo() and createBuffers() for up to the given number of channels each way (all of them if negative).
+		// Returns false (and logs why to stderr) if any of the calls fails.
+		bool Open(long buffer_size, long input_channels = -1, long output_channels = -1) { return Init() && CreateBuffers(buffer_size, input_channels, output_channels); }
+		// The two halves of Open(), for hosts that initialize the driver and create the buffers at different times.
+		bool Init();
+		bool CreateBuffers(long buffer_size, long input_channels = -1, long output_channels = -1);
+		bool Start();
+		bool Stop();
+		// disposeBuffers().
+		bool Close();
+
+		long GetInputChannelCount() const { return input_channel_count; }
+		long GetOutputChannelCount() const { return output_channel_count; }
+		long GetBufferSize() const { return buffer_size; }
+		// Waits (in real time) until the driver has switched buffers at least count times in total, or the timeout expires.
+		bool WaitForBufferSwitches(unsigned long long count, std::chrono::milliseconds timeout) const;
+		FakeHostStatistics GetStatistics(bool reset = false);
+
+	private:
+		FakeHost(const FakeHost&);
+		FakeHost& operator=(const FakeHost&);
+
+		static void StaticBufferSwitch(long index, ASIOBool direct_process);
+		static void StaticSampleRateDidChange(ASIOSampleRate sample_rate);
+		static long StaticAsioMessage(long selector, long value, void* message, double* opt);
+		static ASIOTime* StaticBufferSwitchTimeInfo(ASIOTime* params, long index, ASIOBool direct_process);
+		void ProcessBuffer(long index, const ASIOTime* time);
+		long HandleMessage(long selector, long value);
+
+		IASIO* const driver;
+		const FakeHostConfig config;
+		ASIOCallbacks callbacks;
+		std::vector<ASIOBufferInfo> buffer_infos;
+		std::vector<ASIOChannelInfo> channel_infos;
+		long input_channel_count;
+		long output_channel_count;
+		long buffer_size;
+		bool buffers_created;
+		bool started;
+
+		std::atomic<unsigned long long> buffer_switch_count;
+		std::mutex statistics_mutex;
+		FakeHostStatistics statistics;
+		std::chrono::steady_clock::time_point previous_buffer_switch;
+		long long previous_position;
+};
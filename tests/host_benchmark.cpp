@@ -0,0 +1,270 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Drives the whole driver (CFlexASIO on top of the fake PortAudio) with a fake ASIO host, for a matrix of channel counts and buffer sizes, and reports:
+//  - with a virtual clock (callbacks back to back): how long FlexASIO's stream callback takes, as percentiles, and the CPU time it uses per buffer, with a host that does nothing but copy inputs to outputs;
+//  - with a real-time clock and a host that uses half of each buffer period: how many buffers were late;
+//  - with a virtual clock, 64 channels and 64 frame buffers: what metering (Config::metering) adds to the stream callback;
+//  - with a virtual clock, 32 channels at 48 kHz and 64 frame buffers: what recording every channel (IFlexASIO::StartRecording()) adds to the stream callback;
+//  - with a real-time clock and a host that now and then takes three buffer periods: how many buffers were late with the host in the stream callback, and with the host thread (Config::host_thread_buffers) at each depth, and whether the reported output latency held.
+// The driver's own statistics (IFlexASIO::GetStatistics()) are printed next to the fake stream's, and checked against them.
+// These numbers measure FlexASIO's own overhead on this machine; they don't include WASAPI, the audio engine or real hardware.
+// Run with --quick (as CTest does) for a small subset that just checks everything holds together.
+
+#include "fake_host.h"
+#include "fake_portaudio.h"
+#include "fake_registry.h"
+
+#include "../flexasio.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "test.h"
+
+namespace {
+
+struct Percentiles
+{
+	double median = 0;
+	double p99 = 0;
+	double max = 0;
+};
+
+Percentiles GetPercentiles(std::vector<double> values)
+{
+	Percentiles percentiles;
+	if (values.empty())
+		return percentiles;
+	std::sort(values.begin(), values.end());
+	const auto at = [&](double fraction) { return values[std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()))]; };
+	percentiles.median = at(0.5);
+	percentiles.p99 = at(0.99);
+	percentiles.max = values.back();
+	return percentiles;
+}
+
+struct RunResult
+{
+	bool ok = false;
+	FakeStreamStatistics stream;
+	FakeHostStatistics host;
+	FlexASIOStatistics driver = {};
+	// As reported by getLatencies() right after createBuffers(), and after stop().
+	long output_latency_at_open = 0;
+	long output_latency_at_stop = 0;
+	// With recording_path, after the recording is stopped.
+	FlexASIORecordingStatus recording = {};
+};
+
+// With spike_us, one buffer in every 100 takes that long instead of processing_us. With recording_path, every input and output channel is recorded there from start() to stop().
+RunResult Run(FakeClock clock, int channels, long buffer_size, double processing_us, unsigned long long buffer_switches, bool metering = false, DWORD host_thread_buffers = 0, double spike_us = 0, const std::string& recording_path = std::string())
+{
+	RunResult result;
+	ResetFakeDriverConfig();
+	SetFakeRegistryValue("Software\\FlexASIO", "Metering", DWORD(metering ? 1 : 0));
+	SetFakeRegistryValue("Software\\FlexASIO", "HostThreadBuffers", host_thread_buffers);
+	FakePortAudioConfig fake_config;
+	fake_config.clock = clock;
+	fake_config.devices[0].input_channels = channels;
+	fake_config.devices[0].output_channels = channels;
+	// Make the device period match the ASIO buffer size, as in the common case where the host picks the preferred size.
+	fake_config.devices[0].period_frames = static_cast<unsigned long>(buffer_size);
+	ConfigureFakePortAudio(fake_config);
+
+	CComObject<CFlexASIO>* const driver = new CComObject<CFlexASIO>;
+	{
+		FakeHostConfig host_config;
+		host_config.processing_us = processing_us;
+		if (spike_us > 0)
+		{
+			host_config.spike_interval = 100;
+			host_config.spike_us = spike_us;
+		}
+		FakeHost host(driver, host_config);
+		const double buffer_ms = 1000.0 * buffer_size / fake_config.devices[0].default_sample_rate;
+		const std::chrono::milliseconds timeout(static_cast<long long>(10000 + 4 * buffer_switches * buffer_ms));
+		long input_latency = 0;
+		result.ok = host.Open(buffer_size) && driver->getLatencies(&input_latency, &result.output_latency_at_open) == ASE_OK;
+		if (result.ok && !recording_path.empty())
+		{
+			std::vector<unsigned long> recorded_channels(channels);
+			for (int channel = 0; channel < channels; ++channel)
+				recorded_channels[channel] = channel;
+			const std::wstring path(recording_path.begin(), recording_path.end());
+			result.ok = driver->StartRecording(path.c_str(), channels, recorded_channels.data(), channels, recorded_channels.data()) == S_OK;
+		}
+		result.ok = result.ok && host.Start() && host.WaitForBufferSwitches(buffer_switches, timeout) && host.Stop() &&
+			driver->getLatencies(&input_latency, &result.output_latency_at_stop) == ASE_OK;
+		if (!recording_path.empty())
+		{
+			driver->StopRecording();
+			driver->GetRecordingStatus(&result.recording);
+		}
+		result.host = host.GetStatistics();
+		result.stream = GetFakeStreamStatistics();
+		driver->GetStatistics(&result.driver);
+	}
+	driver->Release();
+	return result;
+}
+
+void RunVirtualClock(const std::vector<int>& channel_counts, const std::vector<long>& buffer_sizes, unsigned long long buffer_switches)
+{
+	printf("Virtual clock, host copies inputs to outputs, %llu buffers per run. Durations in microseconds.\n", buffer_switches);
+	printf("%8s %8s | %9s %9s %9s %9s | %9s %9s %9s\n", "channels", "buffer", "cb p50", "cb p99", "cb max", "cpu/buf", "drv p50", "drv p99", "copy p50");
+	for (const int channels : channel_counts)
+		for (const long buffer_size : buffer_sizes)
+		{
+			const RunResult result = Run(FAKE_CLOCK_VIRTUAL, channels, buffer_size, 0, buffer_switches);
+			CHECK(result.ok);
+			if (!result.ok) continue;
+			const Percentiles callback = GetPercentiles(result.stream.callback_durations);
+			printf("%8d %8ld | %9.2f %9.2f %9.2f %9.2f | %9.2f %9.2f %9.2f\n", channels, buffer_size,
+				callback.median, callback.p99, callback.max, result.stream.callback_cpu_time / result.stream.callback_count,
+				result.driver.callbackDurationMedian, result.driver.callbackDurationP99, result.driver.copyDurationMedian);
+			// One callback per buffer switch, and the driver saw exactly the callbacks the stream made.
+			CHECK(result.host.buffer_switch_count == result.stream.callback_count);
+			CHECK(result.driver.callbackCount == result.stream.callback_count);
+			CHECK(result.host.position_discontinuity_count == 0);
+			CHECK(result.stream.xrun_count == 0);
+		}
+}
+
+void RunRealtimeClock(const std::vector<int>& channel_counts, const std::vector<long>& buffer_sizes, double seconds)
+{
+	printf("Real-time clock, host busy for 50%% of each buffer period, %.1f s per run.\n", seconds);
+	printf("%8s %8s | %8s %8s %8s | %8s %8s %8s\n", "channels", "buffer", "buffers", "xruns", "xrun %", "drv miss", "drv undr", "max gap ms");
+	for (const int channels : channel_counts)
+		for (const long buffer_size : buffer_sizes)
+		{
+			const double buffer_us = 1e6 * buffer_size / 48000;
+			const unsigned long long buffer_switches = static_cast<unsigned long long>(seconds * 1e6 / buffer_us) + 1;
+			const RunResult result = Run(FAKE_CLOCK_REALTIME, channels, buffer_size, buffer_us / 2, buffer_switches);
+			CHECK(result.ok);
+			if (!result.ok) continue;
+			printf("%8d %8ld | %8llu %8llu %8.3f | %8llu %8llu %8.2f\n", channels, buffer_size,
+				result.stream.callback_count, result.stream.xrun_count, 100.0 * result.stream.xrun_count / result.stream.callback_count,
+				static_cast<unsigned long long>(result.driver.deadlineMissCount), static_cast<unsigned long long>(result.driver.outputUnderflowCount),
+				result.host.max_buffer_switch_interval_ms);
+			CHECK(result.driver.callbackCount == result.stream.callback_count);
+		}
+}
+
+void RunMetering(unsigned long long buffer_switches)
+{
+	const int channels = 64;
+	const long buffer_size = 64;
+	printf("Virtual clock, %d channels, %ld frame buffers, %llu buffers per run, with and without metering. Durations in microseconds.\n", channels, buffer_size, buffer_switches);
+	printf("%8s | %9s %9s %9s\n", "metering", "cb p50", "cpu/buf", "% period");
+	double cpu_per_buffer[2] = {};
+	for (const bool metering : { false, true })
+	{
+		const RunResult result = Run(FAKE_CLOCK_VIRTUAL, channels, buffer_size, 0, buffer_switches, metering);
+		CHECK(result.ok);
+		if (!result.ok) continue;
+		cpu_per_buffer[metering] = result.stream.callback_cpu_time / result.stream.callback_count;
+		printf("%8s | %9.2f %9.2f %9.3f\n", metering ? "on" : "off", GetPercentiles(result.stream.callback_durations).median, cpu_per_buffer[metering], cpu_per_buffer[metering] / (1e6 * buffer_size / 48000) * 100);
+	}
+	printf("Metering adds %.2f us per buffer, %.3f%% of the buffer period\n", cpu_per_buffer[1] - cpu_per_buffer[0], (cpu_per_buffer[1] - cpu_per_buffer[0]) / (1e6 * buffer_size / 48000) * 100);
+}
+
+// The stream runs back to back, far faster than real time, so the number of buffers must keep the whole run within the recorder's ring (2 seconds): otherwise the writer can't keep up, and what gets measured is dropping callbacks rather than recording them.
+void RunRecording(unsigned long long buffer_switches)
+{
+	const int channels = 32;
+	const long buffer_size = 64;
+	const std::string path = "/tmp/flexasio-host-benchmark-" + std::to_string(getpid()) + ".wav";
+	printf("Virtual clock, %d channels at 48 kHz, %ld frame buffers, %llu buffers per run, with and without recording every channel. Durations in microseconds.\n", channels, buffer_size, buffer_switches);
+	printf("%9s | %9s %9s %9s\n", "recording", "cb p50", "cpu/buf", "% period");
+	double cpu_per_buffer[2] = {};
+	for (const bool recording : { false, true })
+	{
+		const RunResult result = Run(FAKE_CLOCK_VIRTUAL, channels, buffer_size, 0, buffer_switches, false, 0, 0, recording ? path : std::string());
+		CHECK(result.ok);
+		if (!result.ok) continue;
+		cpu_per_buffer[recording] = result.stream.callback_cpu_time / result.stream.callback_count;
+		printf("%9s | %9.2f %9.2f %9.3f\n", recording ? "on" : "off", GetPercentiles(result.stream.callback_durations).median, cpu_per_buffer[recording], cpu_per_buffer[recording] / (1e6 * buffer_size / 48000) * 100);
+		if (!recording) continue;
+		// Every callback made it to the file.
+		CHECK(result.recording.overrunCount == 0);
+		CHECK(result.recording.framesWritten == result.stream.callback_count * buffer_size);
+		CHECK(!result.recording.writeError);
+	}
+	remove(path.c_str());
+	printf("Recording adds %.2f us per buffer, %.3f%% of the buffer period\n", cpu_per_buffer[1] - cpu_per_buffer[0], (cpu_per_buffer[1] - cpu_per_buffer[0]) / (1e6 * buffer_size / 48000) * 100);
+}
+
+void RunHostThreadJitter(long buffer_size, double seconds)
+{
+	const int channels = 2;
+	const double buffer_us = 1e6 * buffer_size / 48000;
+	const unsigned long long buffer_switches = static_cast<unsigned long long>(seconds * 1e6 / buffer_us) + 1;
+	printf("Real-time clock, %d channels, %ld frame buffers, host busy for 25%% of each buffer period and 300%% of every 100th, %.1f s per run. Latencies in frames.\n", channels, buffer_size, seconds);
+	printf("%8s | %8s %8s %8s %8s | %8s %8s %8s\n", "depth", "buffers", "xruns", "late", "late %", "lat open", "lat stop", "lat chg");
+	for (const DWORD depth : { 0, 2, 3, 4, 5, 6, 7, 8 })
+	{
+		const RunResult result = Run(FAKE_CLOCK_REALTIME, channels, buffer_size, buffer_us / 4, buffer_switches, false, depth, 3 * buffer_us);
+		CHECK(result.ok);
+		if (!result.ok) continue;
+		// In the stream callback, a late host is a late callback; on the host thread, it is a late buffer.
+		const unsigned long long late_count = depth == 0 ? result.driver.deadlineMissCount : result.driver.lateBufferCount;
+		printf("%8lu | %8llu %8llu %8llu %8.3f | %8ld %8ld %8llu\n", static_cast<unsigned long>(depth),
+			result.stream.callback_count, result.stream.xrun_count, late_count, 100.0 * late_count / result.stream.callback_count,
+			result.output_latency_at_open, result.output_latency_at_stop, result.host.latencies_changed_count);
+		if (depth == 0) continue;
+		// However late the host thread gets, the frames in flight are put back to the lookahead, so the latency the host was told about still holds.
+		CHECK(result.output_latency_at_stop == result.output_latency_at_open);
+		CHECK(result.host.latencies_changed_count == 0);
+		// The lookahead is the depth minus one buffer.
+		CHECK(result.output_latency_at_open >= static_cast<long>(depth - 1) * buffer_size);
+	}
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+	if (quick)
+	{
+		RunVirtualClock({ 2, 64 }, { 32, 512 }, 200);
+		RunRealtimeClock({ 2 }, { 256 }, 0.5);
+		RunMetering(200);
+		RunRecording(200);
+		RunHostThreadJitter(64, 1);
+	}
+	else
+	{
+		const std::vector<int> channel_counts = { 2, 8, 32, 64 };
+		const std::vector<long> buffer_sizes = { 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+		RunVirtualClock(channel_counts, buffer_sizes, 5000);
+		RunRealtimeClock(channel_counts, buffer_sizes, 2);
+		RunMetering(20000);
+		RunRecording(1200);
+		RunHostThreadJitter(64, 10);
+		RunHostThreadJitter(256, 10);
+	}
+	return TestResult();
+}
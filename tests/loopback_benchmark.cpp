@@ -0,0 +1,210 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Measures the loopback channels end to end, with the client in a separate process, as it would be in practice: the client writes frames to the driver inputs, the host copies its inputs to its outputs, and the client reads them back from the driver outputs.
+// Each frame carries its own index on the first channel, so the client knows when it wrote every frame it reads back, and notices frames that were dropped on the way.
+//  - latency: the fake device runs in real time, and the client polls every 0.2 ms, keeping one device period written ahead. Reports the round trip as the client sees it, per device period size.
+//  - throughput: the fake device runs as fast as the driver can go, and the client polls continuously. Reports how many frames per second make it through, and how many were lost.
+// Run with --quick (as CTest does) for shorter runs, which still check that the frames make it back in order.
+// The client side runs as "loopback_benchmark --client <name> <mode> <seconds> <period>".
+
+#include "fake_host.h"
+#include "fake_portaudio.h"
+#include "fake_registry.h"
+
+#include "../flexasio.h"
+#include "../loopback_client.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test.h"
+
+namespace {
+
+const long loopback_channel_count = 8;
+// Frame indices are sent as index / 2^24, which a float holds exactly, and which stays below full scale.
+const double index_scale = 1 << 24;
+// How far back the client remembers when it wrote each frame. Anything slower than that is not going to make it back anyway.
+const size_t write_time_capacity = 1 << 18;
+
+double Percentile(std::vector<double> values, double percentile)
+{
+	if (values.empty())
+		return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, static_cast<size_t>(percentile / 100 * values.size()))];
+}
+
+double GetSeconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The client process. Returns the process exit code.
+int RunClient(const std::string& name, bool realtime, double seconds, size_t period)
+{
+	LoopbackClient client;
+	const std::chrono::steady_clock::time_point connect_start = std::chrono::steady_clock::now();
+	while (!client.Connect(name, true, true))
+	{
+		if (GetSeconds(connect_start) > 10)
+		{
+			fprintf(stderr, "Client: unable to connect to loopback section %s\n", name.c_str());
+			return 1;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	const size_t read_channel_count = client.GetReadChannelCount();
+	const size_t write_channel_count = client.GetWriteChannelCount();
+	const size_t block_frames = 4096;
+	std::vector<std::vector<float>> read_buffers(read_channel_count, std::vector<float>(block_frames));
+	std::vector<std::vector<float>> write_buffers(write_channel_count, std::vector<float>(block_frames));
+	std::vector<float*> read_channels, write_channels;
+	for (std::vector<float>& buffer : read_buffers)
+		read_channels.push_back(buffer.data());
+	for (std::vector<float>& buffer : write_buffers)
+		write_channels.push_back(buffer.data());
+
+	std::vector<double> write_times(write_time_capacity);
+	std::vector<double> latencies;
+	// Frame 0 would look like the silence the driver plays when the client falls behind.
+	unsigned long long next_write_index = 1;
+	unsigned long long expected_read_index = 0;
+	unsigned long long frames_read = 0, frames_lost = 0, silent_frames = 0;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double now;
+	while ((now = GetSeconds(start)) < seconds)
+	{
+		// Keeping more than that written ahead would only add latency.
+		const size_t write_level = client.GetCapacity() - client.GetWriteAvailable();
+		const size_t target_level = realtime ? period : client.GetCapacity() / 2;
+		if (write_level < target_level)
+		{
+			const size_t frames = (std::min)(target_level - write_level, block_frames);
+			for (size_t frame = 0; frame < frames; ++frame)
+			{
+				const unsigned long long index = next_write_index++ % (1 << 24);
+				write_times[index % write_time_capacity] = now;
+				for (float* channel : write_channels)
+					channel[frame] = static_cast<float>(index / index_scale);
+			}
+			client.Write(write_channels.data(), frames);
+		}
+
+		const size_t frames = (std::min)(client.GetReadAvailable(), block_frames);
+		client.Read(read_channels.data(), frames);
+		for (size_t frame = 0; frame < frames; ++frame)
+		{
+			const unsigned long long index = static_cast<unsigned long long>(std::lround(read_channels[0][frame] * index_scale));
+			if (index == 0)
+			{
+				++silent_frames;
+				continue;
+			}
+			++frames_read;
+			if (expected_read_index != 0 && index != expected_read_index)
+				frames_lost += (index - expected_read_index) % (1 << 24);
+			expected_read_index = (index + 1) % (1 << 24);
+			if (realtime)
+				latencies.push_back((now - write_times[index % write_time_capacity]) * 1000);
+		}
+
+		if (realtime)
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+
+	if (realtime)
+		printf("  %4zu frame periods: round trip %6.2f ms (median), %6.2f ms (99th percentile), %6.2f ms (max); %llu frames, %llu lost, %llu silent\n",
+			period, Percentile(latencies, 50), Percentile(latencies, 99), Percentile(latencies, 100), frames_read, frames_lost, silent_frames);
+	else
+		printf("  %ld channels each way: %.2f Mframes/s (%.0f MB/s each way); %llu frames, %llu lost, %llu silent\n",
+			loopback_channel_count, frames_read / seconds / 1e6, frames_read * write_channel_count * sizeof(float) / seconds / 1e6, frames_read, frames_lost, silent_frames);
+	fflush(stdout);
+	return frames_read > 0 ? 0 : 1;
+}
+
+// Runs the driver with the given device period, and a client process next to it. Returns whether the client succeeded.
+bool Run(bool realtime, double seconds, long period)
+{
+	const std::string name = "benchmark-" + std::to_string(getpid());
+	ResetFakeDriverConfig();
+	SetFakeRegistryValue("Software\\FlexASIO", "LoopbackInputChannels", DWORD(loopback_channel_count));
+	SetFakeRegistryValue("Software\\FlexASIO", "LoopbackOutputChannels", DWORD(loopback_channel_count));
+	SetFakeRegistryValue("Software\\FlexASIO", "LoopbackName", name);
+	FakePortAudioConfig fake_config;
+	fake_config.clock = realtime ? FAKE_CLOCK_REALTIME : FAKE_CLOCK_VIRTUAL;
+	fake_config.devices[0].period_frames = period;
+	ConfigureFakePortAudio(fake_config);
+
+	bool succeeded = false;
+	CComObject<CFlexASIO>* const driver = new CComObject<CFlexASIO>;
+	{
+		FakeHost host(driver, FakeHostConfig());
+		// The host copies its inputs to its outputs, channel for channel, and the loopback channels come after the same number of device channels on both sides.
+		if (host.Open(period) && host.Start())
+		{
+			const std::string seconds_argument = std::to_string(seconds);
+			const std::string period_argument = std::to_string(period);
+			const char* const arguments[] = { "loopback_benchmark", "--client", name.c_str(), realtime ? "latency" : "throughput", seconds_argument.c_str(), period_argument.c_str(), nullptr };
+			pid_t client_pid;
+			if (posix_spawn(&client_pid, "/proc/self/exe", nullptr, nullptr, const_cast<char* const*>(arguments), environ) != 0)
+				fprintf(stderr, "Unable to start the client process\n");
+			else
+			{
+				int status;
+				succeeded = waitpid(client_pid, &status, 0) == client_pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+			}
+			host.Stop();
+		}
+		host.Close();
+	}
+	driver->Release();
+	return succeeded;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	if (argc == 6 && strcmp(argv[1], "--client") == 0)
+		return RunClient(argv[2], strcmp(argv[3], "latency") == 0, atof(argv[4]), static_cast<size_t>(atol(argv[5])));
+
+	const bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+	printf("Latency, %ld loopback channels each way, real-time device:\n", loopback_channel_count);
+	fflush(stdout);
+	for (const long period : { 64, 256, 1024 })
+		CHECK(Run(true, quick ? 0.5 : 5, period));
+	printf("Throughput, device running as fast as possible with 256 frame periods:\n");
+	fflush(stdout);
+	CHECK(Run(false, quick ? 0.5 : 5, 256));
+	return TestResult();
+}
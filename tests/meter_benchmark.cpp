@@ -0,0 +1,101 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Measures what metering (see Config::metering) costs the stream callback, for each instruction set: Meters::Measure() on every input and output channel, then Meters::Publish(), for 64 channels each way and callbacks of 32 to 512 frames.
+// Reports the time per callback, per sample, and as a share of the callback period at 48 kHz. The goal is under 2% of the period at 64 channels and 64 frames, which --quick (as CTest runs it) checks for the best instruction set.
+// For the cost in context, with the rest of the driver, see host_benchmark.
+
+#include "../meter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+const long channel_count = 64;
+const double sample_rate = 48000;
+
+// Returns the median time per callback, in microseconds.
+double Run(InstructionSet instruction_set, size_t frames, double seconds)
+{
+	Meters meters(channel_count, channel_count, instruction_set);
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+	std::vector<float> samples(2 * channel_count * frames);
+	for (float& sample : samples)
+		sample = noise(random);
+	std::vector<const float*> input(channel_count), output(channel_count);
+	for (long channel = 0; channel < channel_count; ++channel)
+	{
+		input[channel] = samples.data() + channel * frames;
+		output[channel] = samples.data() + (channel_count + channel) * frames;
+	}
+
+	// Timed in batches, as a single callback can be too short for the clock; the median batch leaves out the ones that were interrupted.
+	const size_t batch_callbacks = (std::max)(size_t(1), 8192 / frames);
+	std::vector<double> batch_times;
+	const auto start = std::chrono::steady_clock::now();
+	while (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds || batch_times.size() < 5)
+	{
+		const auto batch_start = std::chrono::steady_clock::now();
+		for (size_t callback = 0; callback < batch_callbacks; ++callback)
+		{
+			meters.Measure(input.data(), output.data(), frames);
+			meters.Publish();
+		}
+		batch_times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - batch_start).count() / batch_callbacks);
+	}
+	std::sort(batch_times.begin(), batch_times.end());
+	return batch_times[batch_times.size() / 2];
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+	const double seconds = quick ? 0.05 : 1;
+	printf("Metering %ld input and %ld output channels, median time per callback:\n", channel_count, channel_count);
+	printf("%8s %8s | %10s %10s %10s\n", "isa", "frames", "us", "ns/sample", "% period");
+	for (const InstructionSet instruction_set : { INSTRUCTION_SET_SCALAR, INSTRUCTION_SET_SSE2, INSTRUCTION_SET_AVX2 })
+	{
+		if (instruction_set > GetBestInstructionSet())
+		{
+			printf("%8s: not supported by this CPU\n", GetInstructionSetName(instruction_set));
+			continue;
+		}
+		for (const size_t frames : { 32, 64, 128, 256, 512 })
+		{
+			if (quick && frames != 64)
+				continue;
+			const double callback_us = Run(instruction_set, frames, seconds);
+			const double period_share = callback_us / (1e6 * frames / sample_rate);
+			printf("%8s %8zu | %10.2f %10.3f %10.3f\n", GetInstructionSetName(instruction_set), frames, callback_us, callback_us * 1000 / (2 * channel_count * frames), period_share * 100);
+			if (quick && instruction_set == GetBestInstructionSet())
+				CHECK(period_share < 0.02);
+		}
+	}
+	return TestResult();
+}
@@ -0,0 +1,187 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Checks that the vectorized meter kernels agree with the scalar one: peaks and clip counts exactly, sums of squares up to rounding (they are added up in a different order), on lengths that exercise the vector loop tails, on unaligned buffers, and on special values (NaN, infinities, full scale).
+// Then checks the levels Meters publishes for known signals, measured in one piece or several.
+
+#include "../meter.h"
+#include "../meter_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+const size_t max_length = 1031;
+// One sample of offset into the buffer makes the vector loads unaligned.
+const size_t misalignment = 1;
+const double pi = 3.14159265358979323846;
+
+const MeterKernels* GetKernels(InstructionSet instruction_set)
+{
+	switch (instruction_set)
+	{
+#ifdef FLEXASIO_X86
+		case INSTRUCTION_SET_AVX2: return &avx2_meter_kernels;
+		case INSTRUCTION_SET_SSE2: return &sse2_meter_kernels;
+#endif
+		case INSTRUCTION_SET_SCALAR: return &scalar_meter_kernels;
+		default: return nullptr;
+	}
+}
+
+std::vector<float> GenerateSamples(std::mt19937& random, size_t count, bool special_values)
+{
+	static const float special_value_list[] = {
+		0.0f, -0.0f, 1.0f, -1.0f, 0.99999994f, -0.99999994f, 1.0000001f, 1e30f, -1e30f, std::numeric_limits<float>::denorm_min(),
+		std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+	};
+	const size_t special_value_count = sizeof(special_value_list) / sizeof(special_value_list[0]);
+	std::uniform_real_distribution<float> regular(-1.25f, 1.25f);
+	std::uniform_int_distribution<size_t> pick(0, special_value_count * 8);
+	std::vector<float> samples(count);
+	for (size_t index = 0; index < count; ++index)
+	{
+		const size_t special_index = special_values ? pick(random) : special_value_count;
+		samples[index] = special_index < special_value_count ? special_value_list[special_index] : regular(random);
+	}
+	return samples;
+}
+
+bool SumsAgree(float expected, float actual)
+{
+	if (std::isnan(expected) || std::isinf(expected))
+		return std::isnan(expected) ? std::isnan(actual) : expected == actual;
+	return std::fabs(expected - actual) <= 1e-5f * std::fabs(expected) + 1e-30f;
+}
+
+void CheckAgreement(InstructionSet instruction_set)
+{
+	if (instruction_set > GetBestInstructionSet())
+	{
+		printf("Skipping %s: not supported by this CPU\n", GetInstructionSetName(instruction_set));
+		return;
+	}
+	printf("Checking %s against scalar\n", GetInstructionSetName(instruction_set));
+	const MeterKernels* const candidate = GetKernels(instruction_set);
+	std::mt19937 random(1234);
+	for (const bool special_values : { false, true })
+		for (size_t length = 0; length <= max_length; length = length < 70 ? length + 1 : length * 2 + 1)
+		{
+			const std::vector<float> samples = GenerateSamples(random, length + misalignment, special_values);
+			// The kernels add to whatever was measured before, e.g. an earlier piece of the same callback.
+			const SampleLevels initial_levels = { 0.75f, 2.0f, 3 };
+			SampleLevels expected = initial_levels;
+			SampleLevels actual = initial_levels;
+			scalar_meter_kernels.measure(samples.data() + misalignment, length, &expected);
+			candidate->measure(samples.data() + misalignment, length, &actual);
+			const bool peaks_agree = CHECK(expected.peak == actual.peak);
+			const bool clip_counts_agree = CHECK(expected.clip_count == actual.clip_count);
+			const bool sums_agree = CHECK(SumsAgree(expected.sum_of_squares, actual.sum_of_squares));
+			if (!peaks_agree || !clip_counts_agree || !sums_agree)
+				fprintf(stderr, "  %s, length %zu%s: peak %g/%g, clip count %lu/%lu, sum of squares %g/%g\n", GetInstructionSetName(instruction_set), length, special_values ? " with special values" : "",
+					expected.peak, actual.peak, expected.clip_count, actual.clip_count, expected.sum_of_squares, actual.sum_of_squares);
+		}
+}
+
+// Pins down the scalar semantics the vector kernels are compared against.
+void CheckScalarValues()
+{
+	const float samples[] = { 0.5f, -0.75f, std::numeric_limits<float>::quiet_NaN(), 1.0f, -1.0f, 0.25f, -1.5f };
+	SampleLevels levels = { 0, 0, 0 };
+	MeasureSamplesScalar(samples, 2, &levels);
+	CHECK(levels.peak == 0.75f);
+	CHECK(levels.sum_of_squares == 0.5f * 0.5f + 0.75f * 0.75f);
+	CHECK(levels.clip_count == 0);
+	// NaN is ignored by the peak, but not by the sum; full scale counts as clipping, in either direction.
+	levels = SampleLevels{ 0, 0, 0 };
+	MeasureSamplesScalar(samples + 2, 5, &levels);
+	CHECK(levels.peak == 1.5f);
+	CHECK(std::isnan(levels.sum_of_squares));
+	CHECK(levels.clip_count == 3);
+}
+
+void CheckMeters(InstructionSet instruction_set)
+{
+	if (instruction_set > GetBestInstructionSet())
+		return;
+	const size_t frames = 480;
+	const size_t callbacks = 10;
+	std::vector<float> sine(frames), clipping(frames, 0.0f), silence(frames, 0.0f);
+	// A whole number of cycles, so that the RMS is exactly amplitude / sqrt(2).
+	for (size_t frame = 0; frame < frames; ++frame)
+		sine[frame] = static_cast<float>(0.5 * sin(2 * pi * 10 * frame / frames));
+	clipping[100] = 1.0f;
+	clipping[200] = -1.25f;
+
+	Meters meters(2, 1, instruction_set);
+	for (size_t callback = 0; callback < callbacks; ++callback)
+	{
+		// Every other callback is measured in uneven pieces, as when the driver splits a callback.
+		const size_t pieces[] = { 1, 37, frames - 38 };
+		const size_t piece_count = callback % 2 == 0 ? 1 : 3;
+		size_t offset = 0;
+		for (size_t piece = 0; piece < piece_count; ++piece)
+		{
+			const size_t piece_frames = piece_count == 1 ? frames : pieces[piece];
+			const float* const input[] = { sine.data() + offset, silence.data() + offset };
+			const float* const output[] = { clipping.data() + offset };
+			meters.Measure(input, output, piece_frames);
+			offset += piece_frames;
+		}
+		meters.Publish();
+	}
+
+	Meters::Levels input_levels[2], output_levels[1];
+	CHECK(meters.GetLevels(input_levels, 2, output_levels, 1) == callbacks);
+	float sine_peak = 0;
+	for (const float sample : sine)
+		sine_peak = std::max(sine_peak, std::fabs(sample));
+	CHECK(input_levels[0].peak == sine_peak);
+	CHECK(std::fabs(input_levels[0].rms - 0.5f / std::sqrt(2.0f)) < 1e-5f);
+	CHECK(input_levels[0].max_peak == sine_peak);
+	CHECK(input_levels[0].clip_count == 0);
+	CHECK(input_levels[1].peak == 0 && input_levels[1].rms == 0);
+	CHECK(output_levels[0].peak == 1.25f);
+	CHECK(std::fabs(output_levels[0].rms - std::sqrt((1.0f + 1.25f * 1.25f) / frames)) < 1e-6f);
+	CHECK(output_levels[0].clip_count == 2 * callbacks);
+
+	meters.Reset();
+	CHECK(meters.GetLevels(input_levels, 2, output_levels, 1) == 0);
+	CHECK(input_levels[0].max_peak == 0);
+	CHECK(output_levels[0].clip_count == 0);
+}
+
+}
+
+int main()
+{
+	printf("Best instruction set: %s\n", GetInstructionSetName(GetBestInstructionSet()));
+	CheckScalarValues();
+	CheckAgreement(INSTRUCTION_SET_SSE2);
+	CheckAgreement(INSTRUCTION_SET_AVX2);
+	for (const InstructionSet instruction_set : { INSTRUCTION_SET_SCALAR, INSTRUCTION_SET_SSE2, INSTRUCTION_SET_AVX2 })
+		CheckMeters(instruction_set);
+	return TestResult();
+}
@@ -0,0 +1,264 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Checks that the mixing kernels agree bit for bit with the scalar ones, on lengths that exercise the vector loop tails and on unaligned buffers, and that ChannelMixer does the same with every instruction set: sparse and dense rows, all-zero rows, and gains for sources it was told to ignore.
+// Also pins down how mixing matrices are parsed (whatever the locale), transposed and recognized as the identity.
+
+#include "../mixer.h"
+#include "../mixer_kernels.h"
+
+#include <cstring>
+#include <limits>
+#include <locale>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+const size_t max_length = 1031;
+// One sample of offset into the buffers makes the vector loads and stores unaligned.
+const size_t misalignment = 1;
+const float gains[] = { 1.0f, -1.0f, 0.5f, -1.25f, 0.70710677f, 3.0f, 1e-30f };
+
+std::vector<float> GenerateFloats(std::mt19937& random, size_t count)
+{
+	// A single NaN bit pattern: with two NaN operands, which payload comes out depends on the operand order, which the compiler is free to swap for the scalar kernels.
+	static const float special_values[] = {
+		0.0f, -0.0f, 1.0f, -1.0f, 1e30f, -1e30f, std::numeric_limits<float>::denorm_min(), -std::numeric_limits<float>::denorm_min(),
+		std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+	};
+	const size_t special_value_count = sizeof(special_values) / sizeof(special_values[0]);
+	std::uniform_real_distribution<float> regular(-1.25f, 1.25f);
+	std::uniform_int_distribution<size_t> pick(0, special_value_count * 4);
+	std::vector<float> values(count);
+	for (size_t index = 0; index < count; ++index)
+	{
+		const size_t special_index = pick(random);
+		values[index] = special_index < special_value_count ? special_values[special_index] : regular(random);
+	}
+	return values;
+}
+
+bool SameBits(const std::vector<float>& expected, const std::vector<float>& actual)
+{
+	return expected.size() == actual.size() && memcmp(expected.data(), actual.data(), expected.size() * sizeof(float)) == 0;
+}
+
+const MixKernels& GetKernels(InstructionSet instruction_set)
+{
+#ifdef FLEXASIO_X86
+	if (instruction_set == INSTRUCTION_SET_AVX2) return avx2_mix_kernels;
+	if (instruction_set == INSTRUCTION_SET_SSE2) return sse2_mix_kernels;
+#endif
+	return scalar_mix_kernels;
+}
+
+void CheckKernelAgreement(InstructionSet instruction_set)
+{
+	if (instruction_set > GetBestInstructionSet())
+	{
+		printf("Skipping %s: not supported by this CPU\n", GetInstructionSetName(instruction_set));
+		return;
+	}
+	printf("Checking %s kernels against scalar\n", GetInstructionSetName(instruction_set));
+	const MixKernels& candidate = GetKernels(instruction_set);
+	CHECK(GetMultiplyAddFunction(instruction_set) == candidate.multiply_add);
+	std::mt19937 random(1234);
+	for (size_t length = 0; length <= max_length; length = length < 70 ? length + 1 : length * 2 + 1)
+		for (const float gain : gains)
+		{
+			// One more sample than needed on each side, which the kernels must leave alone.
+			const std::vector<float> source = GenerateFloats(random, length + misalignment + 1);
+			const std::vector<float> destination = GenerateFloats(random, length + misalignment + 1);
+
+			std::vector<float> expected = destination;
+			std::vector<float> actual = destination;
+			scalar_mix_kernels.scale(expected.data() + misalignment, source.data() + misalignment, gain, length);
+			candidate.scale(actual.data() + misalignment, source.data() + misalignment, gain, length);
+			if (!CHECK(SameBits(expected, actual)))
+				fprintf(stderr, "  scale, %s, gain %g, length %zu\n", GetInstructionSetName(instruction_set), gain, length);
+
+			expected = destination;
+			actual = destination;
+			scalar_mix_kernels.multiply_add(expected.data() + misalignment, source.data() + misalignment, gain, length);
+			candidate.multiply_add(actual.data() + misalignment, source.data() + misalignment, gain, length);
+			if (!CHECK(SameBits(expected, actual)))
+				fprintf(stderr, "  multiply-add, %s, gain %g, length %zu\n", GetInstructionSetName(instruction_set), gain, length);
+		}
+}
+
+// Pins down the scalar semantics the vector kernels are compared against: no fused multiply-add.
+void CheckScalarKernels()
+{
+	const float source[] = { 1.0f + 1.0f / 4096, -2.0f, 0.0f };
+	float destination[] = { -(1.0f + 1.0f / 2048), 1.0f, 5.0f };
+	MultiplyAddSamplesScalar(destination, source, 1.0f + 1.0f / 4096, 3);
+	// (1 + 2^-12)^2 = 1 + 2^-11 + 2^-24 rounds to 1 + 2^-11 in single precision, so the sum is exactly 0. With a fused multiply-add, it would be 2^-24.
+	CHECK(destination[0] == 0.0f);
+	CHECK(destination[1] == 1.0f - 2.0f * (1.0f + 1.0f / 4096));
+	CHECK(destination[2] == 5.0f);
+	float scaled[3];
+	ScaleSamplesScalar(scaled, source, -0.5f, 3);
+	CHECK(scaled[1] == 1.0f);
+	CHECK(scaled[2] == 0.0f);
+}
+
+// Computes the mix the slow way, in the order ChannelMixer is documented to: the first non-zero term initializes the destination, the others are added in source order.
+std::vector<float> ReferenceMix(const MixingMatrix& matrix, size_t source_count, const std::vector<std::vector<float>>& sources, size_t destination, size_t source_offset, size_t frames)
+{
+	std::vector<float> result(frames, 0.0f);
+	bool first = true;
+	for (size_t source = 0; source < source_count && source < matrix[destination].size(); ++source)
+	{
+		const float gain = matrix[destination][source];
+		if (gain == 0)
+			continue;
+		for (size_t frame = 0; frame < frames; ++frame)
+		{
+			const float sample = sources[source][source_offset + frame];
+			result[frame] = first ? (gain == 1 ? sample : gain * sample) : result[frame] + gain * sample;
+		}
+		first = false;
+	}
+	return result;
+}
+
+void CheckChannelMixer(InstructionSet instruction_set)
+{
+	if (instruction_set > GetBestInstructionSet())
+		return;
+	printf("Checking ChannelMixer with %s\n", GetInstructionSetName(instruction_set));
+	// 3 sources, 5 destinations: a unity route (a copy), a scaled route, an all-zero row, a dense row, and a row whose only non-zero gain is for a fourth source the mixer is told to ignore.
+	const size_t source_count = 3;
+	const MixingMatrix matrix = {
+		{ 0, 1, 0, 0 },
+		{ 0, 0, -0.5f, 0 },
+		{ 0, 0, 0, 0 },
+		{ 0.25f, 1, 0.70710677f, 0.5f },
+		{ 0, 0, 0, 1 },
+	};
+	const ChannelMixer mixer(matrix, source_count, instruction_set);
+	CHECK(mixer.GetSourceCount() == source_count);
+	CHECK(mixer.GetDestinationCount() == matrix.size());
+
+	std::mt19937 random(4321);
+	for (size_t frames = 0; frames <= max_length; frames = frames < 40 ? frames + 1 : frames * 2 + 1)
+	{
+		const size_t source_offset = misalignment;
+		const size_t destination_offset = 2 * misalignment;
+		std::vector<std::vector<float>> sources;
+		std::vector<const float*> source_pointers;
+		for (size_t source = 0; source < source_count; ++source)
+		{
+			sources.push_back(GenerateFloats(random, source_offset + frames));
+			source_pointers.push_back(sources.back().data());
+		}
+		// Garbage, which every destination sample must be overwritten, and nothing around them.
+		const float garbage = 42.0f;
+		std::vector<std::vector<float>> destinations(matrix.size(), std::vector<float>(destination_offset + frames + 1, garbage));
+		std::vector<float*> destination_pointers;
+		for (std::vector<float>& destination : destinations)
+			destination_pointers.push_back(destination.data());
+		mixer.Mix(source_pointers.data(), source_offset, destination_pointers.data(), destination_offset, frames);
+
+		for (size_t destination = 0; destination < matrix.size(); ++destination)
+		{
+			std::vector<float> expected(destination_offset, garbage);
+			const std::vector<float> mixed = ReferenceMix(matrix, source_count, sources, destination, source_offset, frames);
+			expected.insert(expected.end(), mixed.begin(), mixed.end());
+			expected.push_back(garbage);
+			if (!CHECK(SameBits(expected, destinations[destination])))
+				fprintf(stderr, "  destination %zu, %s, %zu frames\n", destination, GetInstructionSetName(instruction_set), frames);
+		}
+	}
+}
+
+// Like a host in a country that uses a comma as the decimal separator.
+struct CommaDecimalPoint : std::numpunct<char>
+{
+	char do_decimal_point() const override { return ','; }
+};
+
+void CheckParse()
+{
+	MixingMatrix matrix;
+	CHECK(ParseMixingMatrix("1,0;0,1", &matrix));
+	CHECK(matrix == MixingMatrix({ { 1, 0 }, { 0, 1 } }));
+	// Short rows are padded with zeroes, and whitespace around gains is fine.
+	CHECK(ParseMixingMatrix(" 0.5 ;0.25, -1e-1 ,2", &matrix));
+	CHECK(matrix == MixingMatrix({ { 0.5f, 0, 0 }, { 0.25f, -0.1f, 2 } }));
+	CHECK(ParseMixingMatrix("", &matrix));
+	CHECK(matrix.empty());
+
+	for (const char* malformed : { "1,,0", "a", ",1", "1;b", "0.5x", "1 2", "0.5.5", "--1" })
+		if (!CHECK(!ParseMixingMatrix(malformed, &matrix)))
+			fprintf(stderr, "  parsed \"%s\"\n", malformed);
+
+	// The decimal separator is always a dot, whatever locale the host set: a comma always separates gains.
+	const std::locale previous_locale = std::locale::global(std::locale(std::locale::classic(), new CommaDecimalPoint));
+	CHECK(ParseMixingMatrix("0.5,0,5", &matrix));
+	CHECK(matrix == MixingMatrix({ { 0.5f, 0, 5 } }));
+	CHECK(ParseMixingMatrix("0,5.0,5;1", &matrix));
+	CHECK(matrix == MixingMatrix({ { 0, 5, 5 }, { 1, 0, 0 } }));
+	CHECK(!ParseMixingMatrix("0,5,,5", &matrix));
+	std::locale::global(previous_locale);
+}
+
+void CheckTranspose()
+{
+	const MixingMatrix matrix = { { 1, 2, 3 }, { 4, 5, 6 } };
+	CHECK(TransposeMixingMatrix(matrix, 3) == MixingMatrix({ { 1, 4 }, { 2, 5 }, { 3, 6 } }));
+	// Columns past the end of the rows are zero, and those past column_count are dropped.
+	CHECK(TransposeMixingMatrix(matrix, 4) == MixingMatrix({ { 1, 4 }, { 2, 5 }, { 3, 6 }, { 0, 0 } }));
+	CHECK(TransposeMixingMatrix(matrix, 1) == MixingMatrix({ { 1, 4 } }));
+	CHECK(TransposeMixingMatrix(MixingMatrix(), 2) == MixingMatrix({ {}, {} }));
+}
+
+void CheckIdentity()
+{
+	CHECK(IsIdentityMixingMatrix({ { 1, 0 }, { 0, 1 } }, 2));
+	// Extra zero columns don't change anything, but extra rows or non-zero columns do.
+	CHECK(IsIdentityMixingMatrix({ { 1, 0, 0 }, { 0, 1, 0 } }, 2));
+	CHECK(!IsIdentityMixingMatrix({ { 1, 0, 1 }, { 0, 1, 0 } }, 2));
+	CHECK(!IsIdentityMixingMatrix({ { 1, 0 }, { 0, 1 } }, 3));
+	CHECK(!IsIdentityMixingMatrix({ { 1, 0 }, { 0, 0.5f } }, 2));
+	CHECK(!IsIdentityMixingMatrix({ { 0, 1 }, { 1, 0 } }, 2));
+	// A row too short to have its diagonal.
+	CHECK(!IsIdentityMixingMatrix({ { 1 }, { 0 } }, 2));
+	CHECK(IsIdentityMixingMatrix(MixingMatrix(), 0));
+}
+
+}
+
+int main()
+{
+	printf("Best instruction set: %s\n", GetInstructionSetName(GetBestInstructionSet()));
+	CheckScalarKernels();
+	CheckKernelAgreement(INSTRUCTION_SET_SSE2);
+	CheckKernelAgreement(INSTRUCTION_SET_AVX2);
+	for (const InstructionSet instruction_set : { INSTRUCTION_SET_SCALAR, INSTRUCTION_SET_SSE2, INSTRUCTION_SET_AVX2 })
+		CheckChannelMixer(instruction_set);
+	CheckParse();
+	CheckTranspose();
+	CheckIdentity();
+	return TestResult();
+}
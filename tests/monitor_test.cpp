@@ -0,0 +1,284 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Checks direct input monitoring (kAsioSetInputMonitor): InputMonitor on its own with known gains and matrices, and then through the whole driver, with the virtual device and a host that outputs silence, so that the output file holds nothing but the monitored input.
+
+#include "fake_host.h"
+#include "fake_registry.h"
+#include "wav_file.h"
+
+#include "../flexasio.h"
+#include "../monitor.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "test.h"
+
+namespace {
+
+const float half_pi = 1.57079632679f;
+const size_t frames = 64;
+
+// Runs InputMonitor::Process() over inputs that are each a constant, and returns the first sample of every output (they are all constant too).
+std::vector<float> Process(InputMonitor& monitor, const std::vector<float>& input_values, size_t output_count)
+{
+	std::vector<std::vector<float>> inputs, outputs(output_count, std::vector<float>(frames, 0.0f));
+	std::vector<const float*> input_pointers;
+	std::vector<float*> output_pointers;
+	for (const float value : input_values)
+		inputs.push_back(std::vector<float>(frames, value));
+	for (const std::vector<float>& input : inputs)
+		input_pointers.push_back(input.data());
+	for (std::vector<float>& output : outputs)
+		output_pointers.push_back(output.data());
+	monitor.Process(input_pointers.data(), output_pointers.data(), frames);
+	std::vector<float> result;
+	for (const std::vector<float>& output : outputs)
+	{
+		for (const float sample : output)
+			CHECK(sample == output[0]);
+		result.push_back(output[0]);
+	}
+	return result;
+}
+
+bool Near(float value, float expected) { return std::fabs(value - expected) <= 1e-6f; }
+
+void TestPanLaw()
+{
+	InputMonitor monitor(MixingMatrix(), MixingMatrix(), 2, 2, 2, 2);
+	for (const float pan : { 0.0f, 0.25f, 0.5f, 0.75f, 1.0f })
+	{
+		CHECK(monitor.Set(0, 0, 0.5f, pan, true));
+		const std::vector<float> output = Process(monitor, { 1, 0 }, 2);
+		CHECK(Near(output[0], 0.5f * std::cos(pan * half_pi)));
+		CHECK(Near(output[1], 0.5f * std::sin(pan * half_pi)));
+		// Constant power: the total is the same wherever the input is panned.
+		CHECK(Near(output[0] * output[0] + output[1] * output[1], 0.25f));
+	}
+	// The extremes send the input to one side only, and the pan is clamped.
+	CHECK(monitor.Set(0, 0, 1, -3, true));
+	CHECK(Process(monitor, { 1, 0 }, 2) == std::vector<float>({ 1, 0 }));
+	CHECK(monitor.Set(0, 0, 1, 3, true));
+	const std::vector<float> right = Process(monitor, { 1, 0 }, 2);
+	CHECK(Near(right[0], 0) && Near(right[1], 1));
+}
+
+void TestMonoFallback()
+{
+	InputMonitor monitor(MixingMatrix(), MixingMatrix(), 2, 3, 2, 3);
+	// Output 2 is the last channel, so there is no output 3 to pan to: the input goes there alone, at full gain, whatever the pan.
+	CHECK(monitor.Set(1, 2, 0.5f, 0.5f, true));
+	CHECK(Process(monitor, { 1, 2 }, 3) == std::vector<float>({ 0, 0, 1 }));
+	CHECK(monitor.Set(1, 2, 0.5f, 1, true));
+	CHECK(Process(monitor, { 1, 2 }, 3) == std::vector<float>({ 0, 0, 1 }));
+	// One before the last is still a stereo pair.
+	CHECK(monitor.Set(1, 2, 0, 0, false));
+	CHECK(monitor.Set(1, 1, 0.5f, 0, true));
+	CHECK(Process(monitor, { 1, 2 }, 3) == std::vector<float>({ 0, 1, 0 }));
+}
+
+void TestMatrices()
+{
+	// One ASIO input mixed from two device inputs; two ASIO outputs, the second of which also feeds device output 2.
+	const MixingMatrix input_matrix = { { 0.5f, 0.25f } };
+	const MixingMatrix output_matrix = { { 1, 0, 0 }, { 0, 1, 0.5f } };
+	InputMonitor monitor(input_matrix, output_matrix, 2, 3, 1, 2);
+	// Left only: device output = 0.5 * 2 + 0.25 * 4 = 2 on device output 0.
+	CHECK(monitor.Set(0, 0, 1, 0, true));
+	CHECK(Process(monitor, { 2, 4 }, 3) == std::vector<float>({ 2, 0, 0 }));
+	// Right only, at half gain: ASIO output 1 is device output 1 and half of device output 2.
+	CHECK(monitor.Set(0, 0, 0.5f, 1, true));
+	const std::vector<float> right = Process(monitor, { 2, 4 }, 3);
+	CHECK(Near(right[0], 0) && Near(right[1], 1) && Near(right[2], 0.5f));
+	// An ASIO channel that doesn't exist in the matrices can't be monitored.
+	CHECK(!monitor.Set(1, 0, 1, 0, true));
+	CHECK(!monitor.Set(0, 2, 1, 0, true));
+}
+
+void TestAllInputs()
+{
+	InputMonitor monitor(MixingMatrix(), MixingMatrix(), 3, 2, 3, 2);
+	// -1 sets every input at once.
+	CHECK(monitor.Set(-1, 0, 1, 0, true));
+	CHECK(Process(monitor, { 1, 2, 4 }, 2) == std::vector<float>({ 7, 0 }));
+	// Then one of them can be turned off on its own...
+	CHECK(monitor.Set(1, 0, 1, 0, false));
+	CHECK(Process(monitor, { 1, 2, 4 }, 2) == std::vector<float>({ 5, 0 }));
+	// ... and -1 turns them all off. A disabled route doesn't need a valid output.
+	CHECK(monitor.Set(-1, 99, 1, 0, false));
+	CHECK(Process(monitor, { 1, 2, 4 }, 2) == std::vector<float>({ 0, 0 }));
+	CHECK(!monitor.Set(-2, 0, 1, 0, true));
+	CHECK(!monitor.Set(3, 0, 1, 0, true));
+	CHECK(!monitor.Set(0, -1, 1, 0, true));
+}
+
+void TestHandoff()
+{
+	InputMonitor monitor(MixingMatrix(), MixingMatrix(), 2, 2, 2, 2);
+	// Nothing is monitored until the first Set().
+	CHECK(Process(monitor, { 1, 1 }, 2) == std::vector<float>({ 0, 0 }));
+	// Only the latest of several changes made between two passes is seen, and it stays in effect until the next change.
+	CHECK(monitor.Set(0, 0, 1, 0, true));
+	CHECK(monitor.Set(0, 0, 2, 0, true));
+	CHECK(monitor.Set(0, 0, 3, 0, true));
+	CHECK(Process(monitor, { 1, 1 }, 2) == std::vector<float>({ 3, 0 }));
+	CHECK(Process(monitor, { 1, 1 }, 2) == std::vector<float>({ 3, 0 }));
+	CHECK(monitor.Set(0, 0, 4, 0, true));
+	CHECK(Process(monitor, { 1, 1 }, 2) == std::vector<float>({ 4, 0 }));
+
+	// A writer publishes lists where both inputs always have the same gain, and that gain only goes up. The reader must only ever see whole lists, never an older one than it has already seen.
+	// The output is gain * (1 + second_input), which stays exact in a float up to the last gain; a list with two different gains gives something that isn't a multiple of that.
+	const float second_input = 1024;
+	const int last_gain = 16000;
+	CHECK(monitor.Set(-1, 0, 0, 0, false));
+	std::atomic<bool> started(false), done(false);
+	std::thread writer([&] {
+		while (!started) std::this_thread::yield();
+		for (int gain = 1; gain <= last_gain; ++gain)
+		{
+			monitor.Set(-1, 0, static_cast<float>(gain), 0, true);
+			// Gives the reader a chance to run in between, even on a single core.
+			if (gain % 16 == 0)
+				std::this_thread::yield();
+		}
+		done = true;
+	});
+	float previous_gain = 0;
+	unsigned long long torn = 0, stale = 0, passes = 0;
+	for (bool finished = false; !finished; ++passes)
+	{
+		finished = done;
+		started = true;
+		const float output = Process(monitor, { 1, second_input }, 2)[0];
+		std::this_thread::yield();
+		const float gain = output / (1 + second_input);
+		if (gain != std::floor(gain) || output != gain + gain * second_input)
+			++torn;
+		if (gain < previous_gain)
+			++stale;
+		previous_gain = gain;
+	}
+	writer.join();
+	printf("Handoff: %llu passes, %llu torn lists, %llu stale lists, last gain %g\n", passes, torn, stale, previous_gain);
+	CHECK(torn == 0);
+	CHECK(stale == 0);
+	CHECK(previous_gain == last_gain);
+}
+
+// Renders an input file through the driver, with the host outputting silence and the given monitoring set up before start().
+bool Render(const std::string& input_path, const std::string& output_path, const std::vector<ASIOInputMonitor>& settings, std::vector<float>* output)
+{
+	ResetFakeDriverConfig();
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualInputFile", input_path);
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualOutputFile", output_path);
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualOutputChannels", DWORD(2));
+
+	const long buffer_size = 256;
+	bool ok;
+	CComObject<CFlexASIO>* const driver = new CComObject<CFlexASIO>;
+	{
+		FakeHostConfig config;
+		config.copy_inputs = false;
+		FakeHost host(driver, config);
+		ok = host.Open(buffer_size);
+		ok = CHECK(driver->future(kAsioCanInputMonitor, nullptr) == ASE_SUCCESS) && ok;
+		ASIOInputMonitor invalid = { 2, 0, 0x20000000, ASIOTrue, 0 };
+		ok = CHECK(driver->future(kAsioSetInputMonitor, &invalid) == ASE_InvalidParameter) && ok;
+		for (ASIOInputMonitor setting : settings)
+			ok = CHECK(driver->future(kAsioSetInputMonitor, &setting) == ASE_SUCCESS) && ok;
+		ok = ok && host.Start() && host.WaitForBufferSwitches(frames * 100 / buffer_size + 8, std::chrono::seconds(30));
+		ok = host.Stop() && host.Close() && ok;
+	}
+	driver->Release();
+	WaveFormat format;
+	return ReadWaveFile(output_path, &format, output) && format.channel_count == 2 && ok;
+}
+
+// Checks that output starts with the input frames transformed by expected (a function of one input frame that returns one output frame), and is silent afterwards.
+template <typename Expected> void CheckRendered(const char* name, const std::vector<float>& input, const std::vector<float>& output, Expected expected)
+{
+	if (!CHECK(output.size() >= input.size()))
+		return;
+	// The monitor adds the device input to the device output of the same callback: there is no latency to skip.
+	size_t mismatches = 0;
+	for (size_t index = 0; index < input.size(); index += 2)
+	{
+		const std::pair<float, float> frame = expected(input[index], input[index + 1]);
+		if (!Near(output[index], frame.first) || !Near(output[index + 1], frame.second))
+			++mismatches;
+	}
+	size_t noise = 0;
+	for (size_t index = input.size(); index < output.size(); ++index)
+		noise += output[index] != 0;
+	printf("%s: %zu frames, %zu mismatches, %zu non-silent samples after the input\n", name, input.size() / 2, mismatches, noise);
+	CHECK(mismatches == 0);
+	CHECK(noise == 0);
+}
+
+void TestDriver()
+{
+	const std::string prefix = "/tmp/flexasio-monitor-test-" + std::to_string(getpid());
+	const std::string input_path = prefix + "-input.wav";
+	const std::string output_path = prefix + "-output.wav";
+	std::vector<float> input(frames * 100 * 2);
+	for (size_t index = 0; index < input.size(); ++index)
+		input[index] = (index % 2 ? -0.25f : 0.5f) * std::sin(0.01f * static_cast<float>(index / 2));
+	CHECK(WriteWaveFile(input_path, SAMPLE_FORMAT_FLOAT32, 2, 48000, input));
+
+	std::vector<float> output;
+	// Without monitoring, the output is silent.
+	if (CHECK(Render(input_path, output_path, {}, &output)))
+		CheckRendered("no monitoring", input, output, [](float, float) { return std::make_pair(0.0f, 0.0f); });
+	// Input 0 on outputs 0 and 1 at 0 dB, panned hard left: bit for bit on output 0.
+	if (CHECK(Render(input_path, output_path, { { 0, 0, 0x20000000, ASIOTrue, 0 } }, &output)))
+		CheckRendered("input 0 left", input, output, [](float left, float) { return std::make_pair(left, 0.0f); });
+	// Both inputs at -6 dB, panned to the center.
+	if (CHECK(Render(input_path, output_path, { { -1, 0, 0x10000000, ASIOTrue, 0x3fffffff } }, &output)))
+		CheckRendered("all inputs centered", input, output, [](float left, float right) {
+			const float gain = 0.5f * std::cos(0.5f * half_pi);
+			return std::make_pair((left + right) * gain, (left + right) * gain);
+		});
+	// Input 1 on the last output: mono, whatever the pan. Then input 0 is turned on and off again, which leaves input 1 alone.
+	if (CHECK(Render(input_path, output_path, { { 1, 1, 0x20000000, ASIOTrue, 0x7fffffff }, { 0, 0, 0x20000000, ASIOTrue, 0 }, { 0, 0, 0x20000000, ASIOFalse, 0 } }, &output)))
+		CheckRendered("input 1 on the last output", input, output, [](float, float right) { return std::make_pair(0.0f, right); });
+
+	remove(input_path.c_str());
+	remove(output_path.c_str());
+}
+
+}
+
+int main()
+{
+	TestPanLaw();
+	TestMonoFallback();
+	TestMatrices();
+	TestAllInputs();
+	TestHandoff();
+	TestDriver();
+	return TestResult();
+}
@@ -0,0 +1,280 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Checks the recorder (IFlexASIO::StartRecording()): Recorder on its own, tapping known signals and reading the file back through ParseWaveHeader(), with overruns forced by taps larger than the ring; and then through the whole driver, with the virtual device, where the recording must match the input file and the virtual output file, and where a writer that can't keep up must drop whole callbacks and account for every one of them in GetRecordingStatus().
+
+#include "fake_host.h"
+#include "fake_registry.h"
+#include "wav_file.h"
+
+#include "../flexasio.h"
+#include "../log.h"
+#include "../recorder.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "test.h"
+
+namespace {
+
+std::wstring Widen(const std::string& path) { return std::wstring(path.begin(), path.end()); }
+
+// A distinct, exactly representable value for every sample.
+float GetSample(size_t channel, size_t frame) { return static_cast<float>(channel + 1) / 16 + static_cast<float>(frame) / (1 << 20); }
+
+// Taps frames of the known signal, starting at frame, from 3 inputs and 2 outputs. If outputs is false, Tap() gets no outputs (and should record silence for them).
+void Tap(Recorder& recorder, size_t frame, size_t frames, bool outputs = true)
+{
+	std::vector<std::vector<float>> channels(5, std::vector<float>(frames));
+	std::vector<const float*> pointers;
+	for (size_t channel = 0; channel < channels.size(); ++channel)
+	{
+		for (size_t offset = 0; offset < frames; ++offset)
+			channels[channel][offset] = GetSample(channel, frame + offset);
+		pointers.push_back(channels[channel].data());
+	}
+	recorder.Tap(pointers.data(), outputs ? pointers.data() + 3 : nullptr, frames);
+}
+
+// The file should hold input channels 2 and 0, then output channel 1 (i.e. channel 4 of the signal), for each of the given (first frame, frame count, outputs) taps, back to back.
+struct ExpectedTap { size_t frame; size_t frames; bool outputs; };
+void CheckRecording(const std::string& path, double sample_rate, const std::vector<ExpectedTap>& taps)
+{
+	std::vector<float> expected;
+	for (const ExpectedTap& tap : taps)
+		for (size_t offset = 0; offset < tap.frames; ++offset)
+		{
+			expected.push_back(GetSample(2, tap.frame + offset));
+			expected.push_back(GetSample(0, tap.frame + offset));
+			expected.push_back(tap.outputs ? GetSample(4, tap.frame + offset) : 0.0f);
+		}
+	WaveFormat format;
+	std::vector<float> samples;
+	if (!CHECK(ReadWaveFile(path, &format, &samples)))
+		return;
+	CHECK(format.channel_count == 3);
+	CHECK(format.sample_rate == sample_rate);
+	CHECK(format.sample_format == SAMPLE_FORMAT_FLOAT32);
+	CHECK(format.data_size == samples.size() * sizeof(float));
+	CHECK(samples == expected);
+}
+
+void TestRecorder(const std::string& path)
+{
+	const double sample_rate = 48000;
+	Recorder recorder;
+	// Not recording yet: tapping does nothing, and there is no status to speak of.
+	Tap(recorder, 0, 256);
+	Recorder::Status status = recorder.GetStatus();
+	CHECK(!status.recording && status.frames_written == 0 && status.overrun_count == 0);
+
+	CHECK(recorder.Start(Widen(path), sample_rate, { 2, 0 }, { 1 }));
+	CHECK(recorder.GetStatus().recording);
+	// Odd sizes, so that the ring wraps around in the middle of a tap, and one tap without outputs. 73950 frames in all, which fit in the ring (2 seconds) whether the writer drains it in between or not.
+	std::vector<ExpectedTap> taps;
+	size_t frame = 0;
+	for (size_t index = 0; index < 300; ++index)
+	{
+		const size_t frames = 97 + index % 300;
+		const bool outputs = index != 123;
+		Tap(recorder, frame, frames, outputs);
+		taps.push_back({ frame, frames, outputs });
+		frame += frames;
+	}
+	recorder.Stop();
+	status = recorder.GetStatus();
+	CHECK(!status.recording);
+	CHECK(status.frames_written == frame);
+	CHECK(status.overrun_count == 0 && status.dropped_frame_count == 0 && !status.write_error);
+	CheckRecording(path, sample_rate, taps);
+	// Stopping twice is harmless, and the status of the last recording stays.
+	recorder.Stop();
+	CHECK(recorder.GetStatus().frames_written == frame);
+
+	// At 1 kHz the ring holds 2000 frames: a bigger tap can never fit, and is dropped as a whole.
+	CHECK(recorder.Start(Widen(path), 1000, { 2, 0 }, { 1 }));
+	status = recorder.GetStatus();
+	CHECK(status.recording && status.frames_written == 0 && status.overrun_count == 0);
+	Tap(recorder, 0, 500);
+	Tap(recorder, 500, 2500);
+	Tap(recorder, 3000, 100);
+	Tap(recorder, 3100, 3000);
+	Tap(recorder, 6100, 1);
+	status = recorder.GetStatus();
+	CHECK(status.recording);
+	CHECK(status.overrun_count == 2);
+	CHECK(status.dropped_frame_count == 5500);
+	recorder.Stop();
+	status = recorder.GetStatus();
+	CHECK(!status.recording);
+	CHECK(status.frames_written == 601);
+	CHECK(status.overrun_count == 2 && status.dropped_frame_count == 5500 && !status.write_error);
+	CheckRecording(path, 1000, { { 0, 500, true }, { 3000, 100, true }, { 6100, 1, true } });
+
+	// A file that can't be created.
+	CHECK(!recorder.Start(L"/nonexistent/recording.wav", sample_rate, { 0 }, {}));
+	CHECK(!recorder.GetStatus().recording);
+}
+
+struct DriverRun
+{
+	bool ok = false;
+	unsigned long long buffer_switch_count = 0;
+	FlexASIORecordingStatus during = {};
+	FlexASIORecordingStatus after = {};
+};
+
+// Records the given channels for the whole run, from before start() to after stop().
+DriverRun RunDriver(const std::string& input_path, const std::string& output_path, const std::string& recording_path, DWORD speed, long buffer_size, unsigned long long buffer_switches, const std::vector<unsigned long>& input_channels, const std::vector<unsigned long>& output_channels)
+{
+	DriverRun run;
+	ResetFakeDriverConfig();
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualSpeed", speed);
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualInputFile", input_path);
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualOutputFile", output_path);
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualOutputChannels", DWORD(2));
+
+	const std::wstring path = Widen(recording_path);
+	CComObject<CFlexASIO>* const driver = new CComObject<CFlexASIO>;
+	{
+		FakeHost host(driver, FakeHostConfig());
+		run.ok = host.Init();
+		// The device sample rate isn't known until then.
+		CHECK(driver->StartRecording(path.c_str(), 1, input_channels.data(), 0, nullptr) == E_ILLEGAL_METHOD_CALL);
+		run.ok = run.ok && host.CreateBuffers(buffer_size);
+		const unsigned long invalid_channel = 2;
+		CHECK(driver->StartRecording(path.c_str(), 1, &invalid_channel, 0, nullptr) == E_INVALIDARG);
+		CHECK(driver->StartRecording(path.c_str(), 0, nullptr, 1, &invalid_channel) == E_INVALIDARG);
+		CHECK(driver->StartRecording(path.c_str(), 0, nullptr, 0, nullptr) == E_INVALIDARG);
+		run.ok = run.ok && CHECK(driver->StartRecording(path.c_str(), static_cast<unsigned long>(input_channels.size()), input_channels.data(), static_cast<unsigned long>(output_channels.size()), output_channels.data()) == S_OK);
+		run.ok = run.ok && host.Start() && host.WaitForBufferSwitches(buffer_switches, std::chrono::seconds(60));
+		CHECK(driver->GetRecordingStatus(&run.during) == S_OK);
+		run.ok = host.Stop() && run.ok;
+		run.buffer_switch_count = host.GetStatistics().buffer_switch_count;
+		CHECK(driver->StopRecording() == S_OK);
+		CHECK(driver->GetRecordingStatus(&run.after) == S_OK);
+		run.ok = host.Close() && run.ok;
+	}
+	driver->Release();
+	return run;
+}
+
+// At four times real time, the ring holds half a second, ten times the writer period: the recording holds every callback: the inputs are the input file (then silence), and the outputs are what went to the virtual output file.
+void TestDriver(const std::string& input_path, const std::string& output_path, const std::string& recording_path)
+{
+	const long buffer_size = 256;
+	std::vector<float> input;
+	for (size_t frame = 0; frame < 20000; ++frame)
+	{
+		input.push_back(GetSample(0, frame));
+		input.push_back(-GetSample(1, frame));
+	}
+	CHECK(WriteWaveFile(input_path, SAMPLE_FORMAT_FLOAT32, 2, 48000, input));
+	const DriverRun run = RunDriver(input_path, output_path, recording_path, 4, buffer_size, 100, { 1, 0 }, { 0, 1 });
+	if (!CHECK(run.ok))
+		return;
+	const unsigned long long frames = run.buffer_switch_count * buffer_size;
+	CHECK(run.during.recording);
+	CHECK(!run.after.recording);
+	CHECK(run.after.framesWritten == frames);
+	CHECK(run.after.overrunCount == 0 && run.after.droppedFrameCount == 0 && !run.after.writeError);
+
+	WaveFormat format;
+	std::vector<float> recording, output;
+	if (!CHECK(ReadWaveFile(recording_path, &format, &recording)) || !CHECK(ReadWaveFile(output_path, &format, &output)))
+		return;
+	CHECK(recording.size() == frames * 4);
+	CHECK(output.size() == frames * 2);
+	size_t input_mismatches = 0, output_mismatches = 0;
+	for (size_t frame = 0; frame < frames && frame * 4 < recording.size() && frame * 2 < output.size(); ++frame)
+	{
+		const bool in_file = frame * 2 < input.size();
+		input_mismatches += recording[frame * 4] != (in_file ? input[frame * 2 + 1] : 0.0f) || recording[frame * 4 + 1] != (in_file ? input[frame * 2] : 0.0f);
+		output_mismatches += recording[frame * 4 + 2] != output[frame * 2] || recording[frame * 4 + 3] != output[frame * 2 + 1];
+	}
+	printf("Driver: %llu frames recorded, %zu input mismatches, %zu output mismatches\n", static_cast<unsigned long long>(run.after.framesWritten), input_mismatches, output_mismatches);
+	CHECK(input_mismatches == 0);
+	CHECK(output_mismatches == 0);
+}
+
+// The virtual device runs as fast as it can, far faster than the writer drains the ring (every 50 ms): callbacks get dropped, always whole, and every frame is either written or counted as dropped.
+void TestDriverOverruns(const std::string& input_path, const std::string& output_path, const std::string& recording_path)
+{
+	const long buffer_size = 1024;
+	const unsigned long long buffer_switches = 1500;
+	// Each sample holds its frame index.
+	std::vector<float> input((buffer_switches + 64) * buffer_size);
+	for (size_t frame = 0; frame < input.size(); ++frame)
+		input[frame] = static_cast<float>(frame + 1) / (1 << 24);
+	CHECK(WriteWaveFile(input_path, SAMPLE_FORMAT_FLOAT32, 1, 48000, input));
+	const DriverRun run = RunDriver(input_path, output_path, recording_path, 0, buffer_size, buffer_switches, { 0 }, {});
+	if (!CHECK(run.ok))
+		return;
+	const unsigned long long frames = run.buffer_switch_count * buffer_size;
+	printf("Driver, unpaced: %llu frames, %llu written, %llu overruns (%llu frames dropped)\n", frames,
+		static_cast<unsigned long long>(run.after.framesWritten), static_cast<unsigned long long>(run.after.overrunCount), static_cast<unsigned long long>(run.after.droppedFrameCount));
+	CHECK(run.during.recording);
+	CHECK(run.during.overrunCount > 0);
+	CHECK(!run.after.recording);
+	CHECK(run.after.overrunCount >= run.during.overrunCount);
+	CHECK(run.after.droppedFrameCount == run.after.overrunCount * buffer_size);
+	CHECK(run.after.framesWritten + run.after.droppedFrameCount == frames);
+	CHECK(!run.after.writeError);
+
+	WaveFormat format;
+	std::vector<float> recording;
+	if (!CHECK(ReadWaveFile(recording_path, &format, &recording)))
+		return;
+	CHECK(recording.size() == run.after.framesWritten);
+	// Whole callbacks, in order, each one as it came from the file.
+	size_t broken_callbacks = 0;
+	long long previous_start = -1;
+	for (size_t offset = 0; offset + buffer_size <= recording.size(); offset += buffer_size)
+	{
+		const long long start = static_cast<long long>(recording[offset] * (1 << 24)) - 1;
+		bool whole = start > previous_start && start % buffer_size == 0;
+		for (long frame = 0; whole && frame < buffer_size; ++frame)
+			whole = recording[offset + frame] == static_cast<float>(start + frame + 1) / (1 << 24);
+		broken_callbacks += !whole;
+		previous_start = start;
+	}
+	CHECK(broken_callbacks == 0);
+}
+
+}
+
+int main()
+{
+	Logger::Get().SetLevel(LOG_LEVEL_WARNING);
+	const std::string prefix = "/tmp/flexasio-recorder-test-" + std::to_string(getpid());
+	const std::string input_path = prefix + "-input.wav";
+	const std::string output_path = prefix + "-output.wav";
+	const std::string recording_path = prefix + "-recording.wav";
+	TestRecorder(recording_path);
+	TestDriver(input_path, output_path, recording_path);
+	TestDriverOverruns(input_path, output_path, recording_path);
+	remove(input_path.c_str());
+	remove(output_path.c_str());
+	remove(recording_path.c_str());
+	return TestResult();
+}
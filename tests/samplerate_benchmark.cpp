@@ -0,0 +1,84 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Measures the CPU cost of SampleRateConverter for each quality preset and instruction set, between 44.1 kHz and 48 kHz both ways, for a stereo and an 8 channel stream, in 10 ms blocks.
+// Reports the time per block and the share of one core it takes to keep up in real time, next to the filter length and group delay each preset costs.
+// Run with --quick (as CTest does) to just go through every combination once, briefly.
+
+#include "../samplerate.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+void Run(double input_rate, double output_rate, size_t channel_count, ResamplerQuality quality, InstructionSet instruction_set, double seconds)
+{
+	const size_t block_frames = static_cast<size_t>(input_rate / 100);
+	SampleRateConverter converter(channel_count, input_rate, output_rate, quality, block_frames, instruction_set);
+	std::vector<float> input(channel_count * block_frames), output(channel_count * 2 * block_frames);
+	for (size_t index = 0; index < input.size(); ++index)
+		input[index] = static_cast<float>(0.5 * sin(index * 0.01));
+	std::vector<const float*> input_channels(channel_count);
+	std::vector<float*> output_channels(channel_count);
+	for (size_t channel = 0; channel < channel_count; ++channel)
+	{
+		input_channels[channel] = input.data() + channel * block_frames;
+		output_channels[channel] = output.data() + channel * 2 * block_frames;
+	}
+
+	const size_t block_count = static_cast<size_t>(seconds * 100);
+	size_t output_frames = 0;
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t block = 0; block < block_count; ++block)
+	{
+		converter.Write(input_channels.data(), 0, block_frames);
+		const size_t available = converter.GetReadAvailable();
+		converter.Read(output_channels.data(), 0, available);
+		output_frames += available;
+	}
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	CHECK(output_frames + 1 >= static_cast<size_t>(block_count * block_frames * output_rate / input_rate));
+
+	printf("%6.0f %6.0f %3zu %7s %7s | %5zu %7.3f | %9.2f %7.3f\n", input_rate, output_rate, channel_count, GetResamplerQualityName(quality), GetInstructionSetName(instruction_set),
+		converter.GetTapCount(), converter.GetDelay() * 1000, elapsed / block_count * 1e6, 100 * elapsed / (block_count / 100.0));
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+	const double seconds = quick ? 0.1 : 20;
+	printf("%6s %6s %3s %7s %7s | %5s %7s | %9s %7s\n", "in", "out", "ch", "quality", "isa", "taps", "delay", "us/10ms", "% core");
+	for (const double input_rate : { 44100.0, 48000.0 })
+		for (const size_t channel_count : { size_t(2), size_t(8) })
+			for (int quality = 0; quality < RESAMPLER_QUALITY_COUNT; ++quality)
+				for (const InstructionSet instruction_set : { INSTRUCTION_SET_SCALAR, INSTRUCTION_SET_SSE2, INSTRUCTION_SET_AVX2 })
+				{
+					if (instruction_set > GetBestInstructionSet())
+						continue;
+					Run(input_rate, input_rate == 44100 ? 48000 : 44100, channel_count, static_cast<ResamplerQuality>(quality), instruction_set, seconds);
+				}
+	return TestResult();
+}
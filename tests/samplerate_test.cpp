@@ -0,0 +1,239 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Checks SampleRateConverter between 44.1 kHz and 48 kHz, both ways, at each quality and with each instruction set:
+//  - the exact number of frames produced, with irregular Write() sizes, against ceil(N * L / M), GetOutputFrames() and GetInputFrames();
+//  - the group delay of a tone going through, against GetDelay();
+//  - the gain and the residual error of that tone, against the quality's stopband attenuation;
+//  - the gain at the passband edge, and how much of a tone in the stopband leaks through as an alias or an image;
+//  - that all instruction sets agree with each other.
+
+#include "../samplerate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+// Low enough that one period is longer than the longest filter delay, so that the measured phase tells the delay without ambiguity.
+const double tone_frequency = 97;
+
+struct RatePair
+{
+	double input;
+	double output;
+	// Reduced ratio.
+	unsigned long long interpolation;
+	unsigned long long decimation;
+};
+
+const RatePair rate_pairs[] = {
+	{ 44100, 48000, 160, 147 },
+	{ 48000, 44100, 147, 160 },
+};
+
+void CheckFrameCounts(const RatePair& rates, ResamplerQuality quality)
+{
+	const size_t max_input_frames = 1024;
+	SampleRateConverter converter(1, rates.input, rates.output, quality, max_input_frames);
+	std::mt19937 random(static_cast<unsigned int>(rates.input + quality));
+	std::uniform_int_distribution<size_t> write_size(0, max_input_frames);
+	std::vector<float> input(max_input_frames, 0.25f), output(4 * max_input_frames);
+	const float* const input_channels[] = { input.data() };
+	float* const output_channels[] = { output.data() };
+
+	unsigned long long total_input = 0;
+	unsigned long long total_output = 0;
+	unsigned long mismatch_count = 0;
+	for (int write = 0; write < 5000; ++write)
+	{
+		// Sometimes ask for a specific number of output frames, like the stream callback does.
+		size_t frames;
+		if (write % 3 == 0)
+		{
+			const size_t wanted = std::uniform_int_distribution<size_t>(1, 900)(random);
+			frames = converter.GetInputFrames(wanted);
+			if (frames > max_input_frames)
+				frames = max_input_frames;
+			// GetInputFrames() is the minimum: one frame less must not be enough.
+			else if (frames > 0 && converter.GetReadAvailable() + converter.GetOutputFrames(frames - 1) >= wanted)
+				++mismatch_count;
+			else if (converter.GetReadAvailable() + converter.GetOutputFrames(frames) < wanted)
+				++mismatch_count;
+		}
+		else
+			frames = write_size(random);
+
+		const size_t predicted = converter.GetOutputFrames(frames);
+		const size_t available_before = converter.GetReadAvailable();
+		converter.Write(input_channels, 0, frames);
+		if (converter.GetReadAvailable() != available_before + predicted)
+			++mismatch_count;
+		total_input += frames;
+		total_output += predicted;
+		// The count never drifts: exactly ceil(N * L / M) frames so far.
+		if (total_output != (total_input * rates.interpolation + rates.decimation - 1) / rates.decimation)
+			++mismatch_count;
+		// Read everything, in two uneven chunks.
+		const size_t available = converter.GetReadAvailable();
+		converter.Read(output_channels, 0, available / 3);
+		converter.Read(output_channels, 0, available - available / 3);
+		if (converter.GetReadAvailable() != 0)
+			++mismatch_count;
+	}
+	printf("%.0f -> %.0f, %s: %llu frames in, %llu frames out, %lu mismatches\n", rates.input, rates.output, GetResamplerQualityName(quality), total_input, total_output, mismatch_count);
+	CHECK(mismatch_count == 0);
+}
+
+// Least-squares fit of a * sin(w t) + b * cos(w t) to the last second of the signal; returns the amplitude, the delay (phase lag / w, in seconds), and the RMS of what's left.
+void FitTone(const std::vector<float>& signal, double sample_rate, double frequency, double* amplitude, double* delay, double* residual_rms)
+{
+	// Over a whole second, tones at different whole frequencies are orthogonal, so other tones in the signal don't leak into the fit.
+	const size_t begin = signal.size() - static_cast<size_t>(sample_rate);
+	const double w = 2 * pi * frequency;
+	double ss = 0, cc = 0, sc = 0, ys = 0, yc = 0;
+	for (size_t index = begin; index < signal.size(); ++index)
+	{
+		const double t = index / sample_rate;
+		const double s = sin(w * t), c = cos(w * t);
+		ss += s * s; cc += c * c; sc += s * c; ys += signal[index] * s; yc += signal[index] * c;
+	}
+	const double determinant = ss * cc - sc * sc;
+	const double a = (ys * cc - yc * sc) / determinant;
+	const double b = (yc * ss - ys * sc) / determinant;
+	*amplitude = std::sqrt(a * a + b * b);
+	// a sin(wt) + b cos(wt) = A sin(w (t - delay)), so a = A cos(w delay) and b = -A sin(w delay).
+	*delay = std::atan2(-b, a) / w;
+	double residual = 0;
+	for (size_t index = begin; index < signal.size(); ++index)
+	{
+		const double t = index / sample_rate;
+		const double error = signal[index] - (a * sin(w * t) + b * cos(w * t));
+		residual += error * error;
+	}
+	*residual_rms = std::sqrt(residual / (signal.size() - begin));
+}
+
+// Runs a tone through the converter, and returns the output: long enough for the filter to settle, plus one second to measure.
+std::vector<float> ConvertTone(const RatePair& rates, ResamplerQuality quality, InstructionSet instruction_set, double frequency)
+{
+	const double seconds = 1.5;
+	const size_t block_frames = 441;
+	SampleRateConverter converter(1, rates.input, rates.output, quality, block_frames, instruction_set);
+	const size_t input_frames = static_cast<size_t>(seconds * rates.input);
+	std::vector<float> input(input_frames);
+	for (size_t index = 0; index < input_frames; ++index)
+		input[index] = static_cast<float>(0.5 * sin(2 * pi * frequency * index / rates.input));
+	std::vector<float> output;
+	std::vector<float> block(4 * block_frames);
+	float* const output_channels[] = { block.data() };
+	for (size_t offset = 0; offset < input_frames; offset += block_frames)
+	{
+		const float* const input_channels[] = { input.data() };
+		converter.Write(input_channels, offset, (std::min)(block_frames, input_frames - offset));
+		const size_t available = converter.GetReadAvailable();
+		converter.Read(output_channels, 0, available);
+		output.insert(output.end(), block.begin(), block.begin() + available);
+	}
+	return output;
+}
+
+void CheckTone(const RatePair& rates, ResamplerQuality quality)
+{
+	// Stopband attenuation of each quality, in dB (see samplerate.cpp).
+	static const double attenuation[] = { 60, 90, 120 };
+	const SampleRateConverter converter(1, rates.input, rates.output, quality, 441);
+	const double expected_delay = converter.GetDelay();
+
+	std::vector<float> reference;
+	for (const InstructionSet instruction_set : { INSTRUCTION_SET_SCALAR, INSTRUCTION_SET_SSE2, INSTRUCTION_SET_AVX2 })
+	{
+		if (instruction_set > GetBestInstructionSet())
+			continue;
+		const std::vector<float> output = ConvertTone(rates, quality, instruction_set, tone_frequency);
+		if (reference.empty())
+			reference = output;
+		else
+		{
+			// The kernels only differ in the order they sum things up in.
+			double max_difference = 0;
+			for (size_t index = 0; index < (std::min)(output.size(), reference.size()); ++index)
+				max_difference = (std::max)(max_difference, std::abs(double(output[index]) - reference[index]));
+			CHECK(output.size() == reference.size());
+			if (!CHECK(max_difference < 1e-5))
+				printf("%s differs from scalar by %g\n", GetInstructionSetName(instruction_set), max_difference);
+		}
+	}
+
+	double amplitude, delay, residual_rms;
+	FitTone(reference, rates.output, tone_frequency, &amplitude, &delay, &residual_rms);
+	const double residual_db = 20 * log10(residual_rms / 0.5);
+	printf("%.0f -> %.0f, %s: %zu taps, delay %.3f ms (measured %.3f ms), gain %+.4f dB, residual %.1f dB\n",
+		rates.input, rates.output, GetResamplerQualityName(quality), converter.GetTapCount(), expected_delay * 1000, delay * 1000, 20 * log10(amplitude / 0.5), residual_db);
+	// Within a hundredth of a frame.
+	CHECK(std::abs(delay - expected_delay) < 0.01 / rates.output);
+	CHECK(std::abs(20 * log10(amplitude / 0.5)) < 0.01);
+	// The passband ripple matches the stopband attenuation for a Kaiser window, but float accumulation limits the highest quality.
+	CHECK(residual_db < -(std::min)(attenuation[quality], 110.0) + 6);
+}
+
+// Passband ripple and stopband attenuation, from the quality settings in samplerate.cpp.
+void CheckResponse(const RatePair& rates, ResamplerQuality quality)
+{
+	static const double attenuation[] = { 60, 90, 120 };
+	static const double passband[] = { 0.8, 0.9, 0.95 };
+	const double nyquist = (std::min)(rates.input, rates.output) / 2;
+	const double ripple_db = 20 * log10(1 + 2 * pow(10, -attenuation[quality] / 20));
+	double amplitude, delay, residual_rms;
+
+	const double passband_frequency = std::floor(0.98 * passband[quality] * nyquist);
+	FitTone(ConvertTone(rates, quality, GetBestInstructionSet(), passband_frequency), rates.output, passband_frequency, &amplitude, &delay, &residual_rms);
+	const double passband_db = 20 * log10(amplitude / 0.5);
+
+	// Just past the stopband edge, which is the lower of the two Nyquist frequencies. When downsampling, a tone there would alias down to output rate - frequency; when upsampling, the image of a tone at input rate - frequency shows up there.
+	const double stopband_frequency = std::ceil(1.025 * nyquist);
+	const double input_frequency = rates.input > rates.output ? stopband_frequency : rates.input - stopband_frequency;
+	const double leak_frequency = rates.input > rates.output ? rates.output - stopband_frequency : stopband_frequency;
+	FitTone(ConvertTone(rates, quality, GetBestInstructionSet(), input_frequency), rates.output, leak_frequency, &amplitude, &delay, &residual_rms);
+	const double leak_db = 20 * log10(amplitude / 0.5);
+
+	printf("%.0f -> %.0f, %s: %+.4f dB at %.0f Hz (passband edge), %.1f dB leaking from %.0f Hz to %.0f Hz\n",
+		rates.input, rates.output, GetResamplerQualityName(quality), passband_db, passband_frequency, leak_db, input_frequency, leak_frequency);
+	CHECK(std::abs(passband_db) < ripple_db);
+	CHECK(leak_db < -attenuation[quality] + 1);
+}
+
+}
+
+int main()
+{
+	for (const RatePair& rates : rate_pairs)
+		for (int quality = 0; quality < RESAMPLER_QUALITY_COUNT; ++quality)
+		{
+			CheckFrameCounts(rates, static_cast<ResamplerQuality>(quality));
+			CheckTone(rates, static_cast<ResamplerQuality>(quality));
+			CheckResponse(rates, static_cast<ResamplerQuality>(quality));
+		}
+	return TestResult();
+}
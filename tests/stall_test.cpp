@@ -0,0 +1,187 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Runs the driver into stalls and checks that it recovers from them: the virtual device through VirtualStallInterval, and the fake PortAudio through stall_after_callbacks, with a latency calibration under way.
+// Meanwhile another thread keeps asking for the latencies, as the host does after the resync request, which races with the streams being replaced.
+// The driver must keep switching buffers, ask the host for a resync (not a reset) every time, and never fail getLatencies(), and stop() must not deadlock with the calibration or the recovery.
+// Finally, stop() is called while the host is handling kAsioLatenciesChanged, which the audio thread sends when the output FIFO latency grows: the host then calls getLatencies() from the audio thread that stop() is waiting for.
+
+#include "fake_host.h"
+#include "fake_portaudio.h"
+#include "fake_registry.h"
+
+#include "../flexasio.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "test.h"
+
+namespace {
+
+const long buffer_size = 480;
+
+struct Scenario
+{
+	const char* name;
+	bool virtual_device;
+	// Callbacks before each stall.
+	unsigned long stall_interval;
+	bool calibrate;
+	unsigned long long resyncs;
+};
+
+bool WaitForResyncs(FakeHost& host, unsigned long long count, std::chrono::milliseconds timeout)
+{
+	const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+	while (host.GetStatistics().resync_request_count < count)
+	{
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	return true;
+}
+
+void Run(const Scenario& scenario, const std::string& output_file)
+{
+	ResetFakeDriverConfig();
+	SetFakeRegistryValue("Software\\FlexASIO", "StallTimeout", DWORD(100));
+	FakePortAudioConfig fake_config;
+	fake_config.devices[0].period_frames = buffer_size;
+	if (scenario.virtual_device)
+	{
+		SetFakeRegistryValue("Software\\FlexASIO", "VirtualOutputFile", output_file);
+		SetFakeRegistryValue("Software\\FlexASIO", "VirtualStallInterval", DWORD(scenario.stall_interval));
+	}
+	else
+		fake_config.stall_after_callbacks = scenario.stall_interval;
+	if (scenario.calibrate)
+	{
+		SetFakeRegistryValue("Software\\FlexASIO", "CalibrateLatency", DWORD(1));
+		SetFakeRegistryValue("Software\\FlexASIO", "CalibrationOutputChannel", DWORD(0));
+		SetFakeRegistryValue("Software\\FlexASIO", "CalibrationInputChannel", DWORD(0));
+	}
+	ConfigureFakePortAudio(fake_config);
+
+	CComObject<CFlexASIO>* const driver = new CComObject<CFlexASIO>;
+	{
+		FakeHost host(driver, FakeHostConfig());
+		CHECK(host.Open(buffer_size));
+		CHECK(host.Start());
+
+		std::atomic<bool> querying(true);
+		std::atomic<unsigned long long> failed_queries(0);
+		std::thread query_thread([&] {
+			while (querying.load())
+			{
+				long input_latency, output_latency;
+				if (driver->getLatencies(&input_latency, &output_latency) != ASE_OK)
+					++failed_queries;
+			}
+		});
+		const bool recovered = WaitForResyncs(host, scenario.resyncs, std::chrono::seconds(20));
+		querying.store(false);
+		query_thread.join();
+
+		// Stopping right away catches the recovery and the calibration in the middle of whatever they are doing.
+		CHECK(host.Stop());
+		CHECK(host.Close());
+		const FakeHostStatistics statistics = host.GetStatistics();
+		printf("%-40s %llu buffer switches, %llu resync requests, %llu reset requests, %llu failed latency queries\n",
+			scenario.name, statistics.buffer_switch_count, statistics.resync_request_count, statistics.reset_request_count, failed_queries.load() + statistics.failed_latency_query_count);
+		CHECK(recovered);
+		CHECK(statistics.buffer_switch_count > scenario.resyncs * scenario.stall_interval);
+		CHECK(statistics.reset_request_count == 0);
+		CHECK(failed_queries.load() == 0);
+		CHECK(statistics.failed_latency_query_count == 0);
+	}
+	driver->Release();
+}
+
+void RunStopDuringLatencyChange()
+{
+	ResetFakeDriverConfig();
+	FakePortAudioConfig fake_config;
+	// With a device period that isn't a multiple of the buffer size, the output FIFO level wanders, so its latency grows over the first callbacks.
+	fake_config.devices[0].period_frames = 256;
+	ConfigureFakePortAudio(fake_config);
+
+	CComObject<CFlexASIO>* const driver = new CComObject<CFlexASIO>;
+	{
+		FakeHostConfig host_config;
+		host_config.latencies_changed_delay_ms = 500;
+		FakeHost host(driver, host_config);
+		CHECK(host.Open(buffer_size));
+		CHECK(host.Start());
+		const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		while (host.GetStatistics().latencies_changed_count == 0 && std::chrono::steady_clock::now() < deadline)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		CHECK(host.GetStatistics().latencies_changed_count > 0);
+
+		// The audio thread is now in the host, about to call getLatencies(), and stop() waits for it. Stopping on another thread turns a deadlock into a failure instead of a hang.
+		const std::chrono::steady_clock::time_point stop_start = std::chrono::steady_clock::now();
+		std::atomic<bool> stopped(false);
+		bool stop_succeeded = false;
+		std::thread stop_thread([&] {
+			stop_succeeded = host.Stop();
+			stopped.store(true);
+		});
+		while (!stopped.load() && std::chrono::steady_clock::now() < stop_start + std::chrono::seconds(10))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (!stopped.load())
+		{
+			fprintf(stderr, "%s:%d: stop() deadlocked with getLatencies() in kAsioLatenciesChanged\n", __FILE__, __LINE__);
+			std::_Exit(EXIT_FAILURE);
+		}
+		stop_thread.join();
+		const double stop_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stop_start).count();
+		CHECK(stop_succeeded);
+		CHECK(host.Close());
+		const FakeHostStatistics statistics = host.GetStatistics();
+		printf("%-40s stop() took %.0f ms, %llu latency changes, %llu failed latency queries\n",
+			"latency change during stop()", stop_ms, statistics.latencies_changed_count, statistics.failed_latency_query_count);
+		CHECK(statistics.failed_latency_query_count == 0);
+	}
+	driver->Release();
+}
+
+}
+
+int main()
+{
+	const std::string output_file = "/tmp/flexasio-stall-test-" + std::to_string(getpid()) + ".wav";
+	const Scenario scenarios[] = {
+		{ "virtual device", true, 50, false, 3 },
+		{ "fake device, calibration interrupted", false, 50, true, 3 },
+		// The recording takes 1.8 s, so the calibration gets to fail (the fake device doesn't loop back) before the stall, and starts over after it.
+		{ "fake device, calibration done", false, 200, true, 2 },
+	};
+	for (const Scenario& scenario : scenarios)
+		Run(scenario, output_file);
+	RunStopDuringLatencyChange();
+	remove(output_file.c_str());
+	return TestResult();
+}
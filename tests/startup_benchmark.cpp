@@ -0,0 +1,210 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Measures what the host waits for when it loads the driver, opens the devices, and resets them, with and without the features meant to speed that up:
+//  - listing: creating an instance, init(), getChannels(), getBufferSize(), getSampleRate() and releasing it, which is all that many hosts do with every installed driver.
+//    Compared: PortAudio initialized in init() (DeferredInitialization = 0), deferred with a cold capability cache, deferred with a warm one, and warm with BackgroundInitialization.
+//  - opening: from createBuffers() to the first bufferSwitch(), and from start() to the end of the first stream callback.
+//  - resetting: stop(), disposeBuffers(), createBuffers() and start() again until the first bufferSwitch(), with and without the stream pool (StreamPoolTimeout).
+// The PortAudio calls that are slow on Windows are simulated with fixed delays (see FakePortAudioConfig), so the numbers show which of those costs each path pays, not how long they take on a real system; they are not a substitute for measurements on Windows.
+// Run with --quick (as CTest does) for shorter simulated delays and a single repetition, which still checks that the fast paths skip the slow calls.
+
+#include "fake_host.h"
+#include "fake_portaudio.h"
+#include "fake_registry.h"
+
+#include "../capabilities.h"
+#include "../flexasio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "test.h"
+
+namespace {
+
+const long buffer_size = 480;
+
+struct Delays
+{
+	double initialize_ms;
+	double open_stream_ms;
+	double start_stream_ms;
+};
+
+double GetMilliseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+double Median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+void Configure(const Delays& delays, bool deferred, bool background, DWORD stream_pool_timeout)
+{
+	ResetFakeDriverConfig();
+	SetFakeRegistryValue("Software\\FlexASIO", "CapabilityCache", DWORD(1));
+	SetFakeRegistryValue("Software\\FlexASIO", "DeferredInitialization", DWORD(deferred ? 1 : 0));
+	SetFakeRegistryValue("Software\\FlexASIO", "BackgroundInitialization", DWORD(background ? 1 : 0));
+	SetFakeRegistryValue("Software\\FlexASIO", "StreamPoolTimeout", stream_pool_timeout);
+	FakePortAudioConfig fake_config;
+	fake_config.initialize_delay_ms = delays.initialize_ms;
+	fake_config.open_stream_delay_ms = delays.open_stream_ms;
+	fake_config.start_stream_delay_ms = delays.start_stream_ms;
+	fake_config.devices[0].period_frames = buffer_size;
+	ConfigureFakePortAudio(fake_config);
+}
+
+void ClearCapabilityCache()
+{
+	remove(CapabilityCache::GetDefaultPath().c_str());
+}
+
+struct ListResult
+{
+	// Until the host has its answers, and until Release() returns, which waits for any initialization still running in the background.
+	double answered_ms;
+	double released_ms;
+	unsigned long initializations;
+};
+
+ListResult ListDriver()
+{
+	GetFakeStreamStatistics(true);
+	const auto start = std::chrono::steady_clock::now();
+	CComObject<CFlexASIO>* const driver = new CComObject<CFlexASIO>;
+	CHECK(driver->init(nullptr));
+	long input_channels, output_channels, min_size, max_size, preferred_size, granularity;
+	ASIOSampleRate sample_rate;
+	CHECK(driver->getChannels(&input_channels, &output_channels) == ASE_OK);
+	CHECK(driver->getBufferSize(&min_size, &max_size, &preferred_size, &granularity) == ASE_OK);
+	CHECK(driver->getSampleRate(&sample_rate) == ASE_OK);
+	ListResult result;
+	result.answered_ms = GetMilliseconds(start);
+	driver->Release();
+	result.released_ms = GetMilliseconds(start);
+	result.initializations = GetFakeStreamStatistics().initializations;
+	return result;
+}
+
+void RunListing(const Delays& delays, int repetitions)
+{
+	printf("Listing the driver (simulated Pa_Initialize() %.0f ms), median of %d:\n", delays.initialize_ms, repetitions);
+	struct Mode
+	{
+		const char* name;
+		bool deferred;
+		bool background;
+		bool warm;
+	};
+	const Mode modes[] = {
+		{ "initialize in init()", false, false, true },
+		{ "deferred, cold cache", true, false, false },
+		{ "deferred, warm cache", true, false, true },
+		{ "background, warm cache", true, true, true },
+	};
+	for (const Mode& mode : modes)
+	{
+		std::vector<double> answered_times, released_times;
+		unsigned long max_initializations = 0;
+		for (int repetition = 0; repetition < repetitions; ++repetition)
+		{
+			Configure(delays, mode.deferred, mode.background, 0);
+			ClearCapabilityCache();
+			// A first instance fills the cache, like the host's previous session would have.
+			if (mode.warm)
+				ListDriver();
+			const ListResult result = ListDriver();
+			answered_times.push_back(result.answered_ms);
+			released_times.push_back(result.released_ms);
+			max_initializations = (std::max)(max_initializations, result.initializations);
+		}
+		printf("  %-24s answered in %7.1f ms, released in %7.1f ms, %lu PortAudio initialization(s)\n", mode.name, Median(answered_times), Median(released_times), max_initializations);
+		if (mode.deferred && !mode.background)
+			CHECK(max_initializations == (mode.warm ? 0u : 1u));
+	}
+}
+
+void RunOpenAndReset(const Delays& delays, int repetitions)
+{
+	printf("Opening and resetting (simulated Pa_OpenStream() %.0f ms, Pa_StartStream() %.0f ms, %ld frame periods), median of %d:\n", delays.open_stream_ms, delays.start_stream_ms, buffer_size, repetitions);
+	for (const bool pooled : { false, true })
+	{
+		std::vector<double> open_times, first_callback_times, reset_times;
+		unsigned long reset_streams_opened = 0;
+		for (int repetition = 0; repetition < repetitions; ++repetition)
+		{
+			Configure(delays, true, false, pooled ? 10000 : 0);
+			ClearCapabilityCache();
+			CComObject<CFlexASIO>* const driver = new CComObject<CFlexASIO>;
+			{
+				FakeHost host(driver, FakeHostConfig());
+				CHECK(host.Init());
+				// The host waits for the first buffer switch, whose timing is only known to within the 1 ms WaitForBufferSwitches() polls at.
+				auto start = std::chrono::steady_clock::now();
+				const bool opened = host.CreateBuffers(buffer_size) && host.Start() && host.WaitForBufferSwitches(1, std::chrono::seconds(10));
+				open_times.push_back(GetMilliseconds(start));
+				first_callback_times.push_back(GetFakeStreamStatistics().first_callback_delay_ms);
+				CHECK(opened);
+
+				const unsigned long streams_opened_before = GetFakeStreamStatistics().streams_opened;
+				const unsigned long long buffer_switches = host.GetStatistics().buffer_switch_count;
+				start = std::chrono::steady_clock::now();
+				const bool reset = host.Stop() && host.Close() && host.CreateBuffers(buffer_size) && host.Start() && host.WaitForBufferSwitches(buffer_switches + 1, std::chrono::seconds(10));
+				reset_times.push_back(GetMilliseconds(start));
+				reset_streams_opened = (std::max)(reset_streams_opened, GetFakeStreamStatistics().streams_opened - streams_opened_before);
+				CHECK(reset);
+			}
+			driver->Release();
+		}
+		printf("  %-16s createBuffers() to first bufferSwitch() %7.1f ms, start to first callback %6.1f ms, reset %7.1f ms (%lu stream(s) opened)\n",
+			pooled ? "stream pool" : "no stream pool", Median(open_times), Median(first_callback_times), Median(reset_times), reset_streams_opened);
+		// With the pool, the reset reuses the streams instead of opening new ones.
+		if (pooled)
+			CHECK(reset_streams_opened == 0);
+		else
+			CHECK(reset_streams_opened > 0);
+	}
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+	// Keep the capability cache of this run away from any other.
+	const std::string cache_directory = "/tmp/flexasio-startup-benchmark-" + std::to_string(getpid());
+	setenv("LOCALAPPDATA", cache_directory.c_str(), 1);
+	const Delays delays = quick ? Delays{ 30, 10, 2 } : Delays{ 300, 100, 20 };
+	const int repetitions = quick ? 1 : 5;
+	RunListing(delays, repetitions);
+	RunOpenAndReset(delays, repetitions);
+	ClearCapabilityCache();
+	return TestResult();
+}
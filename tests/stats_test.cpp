@@ -0,0 +1,184 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Reads StatisticsData back through its shared memory section, the way a monitoring tool in another process would: checks the header, the rejection of layouts the reader doesn't understand, and that reads retry instead of returning a copy torn by a concurrent RecordCallback().
+
+#include "../stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+struct SharedView
+{
+	HANDLE mapping = NULL;
+	void* view = nullptr;
+
+	explicit SharedView(const std::string& name)
+	{
+		mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+		if (mapping)
+			view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(StatisticsData));
+	}
+	~SharedView()
+	{
+		if (view) UnmapViewOfFile(view);
+		if (mapping) CloseHandle(mapping);
+	}
+	StatisticsData& data() const { return *static_cast<StatisticsData*>(view); }
+};
+
+void CheckLayout(const StreamStatistics& statistics)
+{
+	CHECK(!statistics.GetSharedMemoryName().empty());
+	const SharedView shared(statistics.GetSharedMemoryName());
+	if (!CHECK(shared.view != nullptr)) return;
+	CHECK(memcmp(shared.data().magic, "FlexASIO", 8) == 0);
+	CHECK(shared.data().version == StatisticsData::current_version);
+	CHECK(shared.data().size == sizeof(StatisticsData));
+	CHECK(shared.data().sequence.load() % 2 == 0);
+}
+
+void CheckReadSharedMemory(StreamStatistics& statistics)
+{
+	const SharedView shared(statistics.GetSharedMemoryName());
+	if (!CHECK(shared.view != nullptr)) return;
+
+	statistics.Reset();
+	for (int callback = 0; callback < 100; ++callback)
+		statistics.RecordCallback(callback < 10 ? 2000 : 500, 1000, 100);
+	statistics.RecordOutputUnderflow();
+	statistics.RecordStall();
+
+	StreamStatistics::Summary summary;
+	if (!CHECK(StreamStatistics::ReadSharedMemory(shared.view, sizeof(StatisticsData), &summary))) return;
+	CHECK(summary.callback_count == 100);
+	CHECK(summary.deadline_miss_count == 10);
+	CHECK(summary.deadline_miss_percentage == 10);
+	CHECK(summary.max_load == 2);
+	CHECK(summary.output_underflow_count == 1);
+	CHECK(summary.stall_count == 1);
+	CHECK(summary.callback_duration.max == 2000);
+	const StreamStatistics::Summary local = statistics.GetSummary();
+	CHECK(local.callback_count == summary.callback_count && local.average_load == summary.average_load && local.callback_duration.p99 == summary.callback_duration.p99);
+
+	// Readers must refuse anything they don't fully understand, rather than misinterpret it.
+	CHECK(!StreamStatistics::ReadSharedMemory(shared.view, sizeof(StatisticsData) - 1, &summary));
+	CHECK(!StreamStatistics::ReadSharedMemory(nullptr, sizeof(StatisticsData), &summary));
+	std::vector<char> copy(sizeof(StatisticsData));
+	memcpy(copy.data(), shared.view, copy.size());
+	StatisticsData& copy_data = *reinterpret_cast<StatisticsData*>(copy.data());
+	CHECK(StreamStatistics::ReadSharedMemory(copy.data(), copy.size(), &summary));
+	copy_data.version = StatisticsData::current_version + 1;
+	CHECK(!StreamStatistics::ReadSharedMemory(copy.data(), copy.size(), &summary));
+	copy_data.version = StatisticsData::current_version;
+	copy_data.size = sizeof(StatisticsData) + 8;
+	CHECK(!StreamStatistics::ReadSharedMemory(copy.data(), copy.size(), &summary));
+	copy_data.size = sizeof(StatisticsData);
+	// A section whose writer hasn't finished setting it up yet.
+	memset(copy_data.magic, 0, sizeof(copy_data.magic));
+	CHECK(!StreamStatistics::ReadSharedMemory(copy.data(), copy.size(), &summary));
+}
+
+// While the sequence is odd, a write is in progress and the reader must wait for it to finish.
+void CheckReaderWaitsForWriter(StreamStatistics& statistics)
+{
+	const SharedView shared(statistics.GetSharedMemoryName());
+	if (!CHECK(shared.view != nullptr)) return;
+	statistics.Reset();
+	statistics.RecordCallback(500, 1000, 100);
+
+	std::atomic<unsigned long>& sequence = shared.data().sequence;
+	const unsigned long even_sequence = sequence.load();
+	sequence.store(even_sequence + 1);
+	std::atomic<bool> read_done(false);
+	StreamStatistics::Summary summary;
+	std::thread reader([&] {
+		StreamStatistics::ReadSharedMemory(shared.view, sizeof(StatisticsData), &summary);
+		read_done.store(true);
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	CHECK(!read_done.load());
+	shared.data().callback_count.store(2);
+	shared.data().deadline_miss_count.store(1);
+	sequence.store(even_sequence + 2);
+	reader.join();
+	CHECK(read_done.load());
+	// The reader got the state after the write, not the one before.
+	CHECK(summary.callback_count == 2);
+	CHECK(summary.deadline_miss_count == 1);
+}
+
+// Hammers the section with a writer where every callback misses its deadline: any consistent read has as many deadline misses as callbacks.
+void CheckNoTornReads(StreamStatistics& statistics)
+{
+	const SharedView shared(statistics.GetSharedMemoryName());
+	if (!CHECK(shared.view != nullptr)) return;
+	statistics.Reset();
+
+	std::atomic<bool> stop(false);
+	std::thread writer([&] {
+		while (!stop.load(std::memory_order_relaxed))
+			statistics.RecordCallback(1500, 1000, 100);
+	});
+	size_t read_count = 0;
+	size_t torn_count = 0;
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		StreamStatistics::Summary summary;
+		if (!StreamStatistics::ReadSharedMemory(shared.view, sizeof(StatisticsData), &summary))
+		{
+			++torn_count;
+			continue;
+		}
+		++read_count;
+		if (summary.deadline_miss_count != summary.callback_count || summary.max_load != (summary.callback_count > 0 ? 1.5 : 0))
+			++torn_count;
+		std::this_thread::yield();
+	}
+	stop.store(true);
+	writer.join();
+	printf("%zu reads during concurrent writes, %zu inconsistent\n", read_count, torn_count);
+	CHECK(read_count > 0);
+	CHECK(torn_count == 0);
+}
+
+}
+
+int main()
+{
+	StreamStatistics statistics;
+	CheckLayout(statistics);
+	{
+		// The section name is per process, so a second instance can only keep its data private.
+		StreamStatistics second_statistics;
+		CHECK(second_statistics.GetSharedMemoryName().empty());
+	}
+	CheckReadSharedMemory(statistics);
+	CheckReaderWaitsForWriter(statistics);
+	CheckNoTornReads(statistics);
+	return TestResult();
+}
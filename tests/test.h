@@ -0,0 +1,54 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+
+// Minimal checking helpers for the standalone tests in this directory. Failed checks are reported on stderr, and make TestResult() return a non-zero exit status.
+// Checks don't abort the test, so that a broken kernel reports every mismatch category at once instead of just the first one.
+
+inline int& GetTestFailureCount()
+{
+	static int failure_count = 0;
+	return failure_count;
+}
+
+inline bool CheckCondition(bool condition, const char* expression, const char* file, int line)
+{
+	if (!condition)
+	{
+		fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+		++GetTestFailureCount();
+	}
+	return condition;
+}
+
+inline int TestResult()
+{
+	if (GetTestFailureCount() > 0)
+	{
+		fprintf(stderr, "%d check(s) failed\n", GetTestFailureCount());
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
+
+#define CHECK(condition) CheckCondition((condition), #condition, __FILE__, __LINE__)
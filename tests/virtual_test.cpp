@@ -0,0 +1,192 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Renders WAV files through the whole driver with the virtual device (VirtualInputFile and VirtualOutputFile) and a host that copies its inputs to its outputs, the way a regression render on a build machine would, and checks that:
+//  - the input samples come back bit for bit in the output file, delayed by the latency and followed by silence, for every input format;
+//  - a file cut short (its header claiming more samples than there are, with a partial frame at the end) plays what is there;
+//  - a file larger than the window the virtual device maps at a time (64 MB) plays across the window boundary;
+//  - VirtualSpeed paces the callbacks at a multiple of real time.
+
+#include "fake_host.h"
+#include "fake_registry.h"
+#include "wav_file.h"
+
+#include "../flexasio.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "test.h"
+
+namespace {
+
+const double sample_rate = 48000;
+const size_t channel_count = 2;
+
+// Non-zero samples that every format can represent exactly (multiples of 2^-15), so that the start of the input is easy to find in the output.
+std::vector<float> GenerateSamples(size_t frames, unsigned seed)
+{
+	std::mt19937 random(seed);
+	std::uniform_int_distribution<int> value(1, 32767);
+	std::bernoulli_distribution negative(0.5);
+	std::vector<float> samples(frames * channel_count);
+	for (float& sample : samples)
+		sample = (negative(random) ? -value(random) : value(random)) / 32768.0f;
+	return samples;
+}
+
+struct RenderResult
+{
+	bool ok = false;
+	WaveFormat format = {};
+	std::vector<float> samples;
+	// Wall clock time from start() until the requested number of buffer switches.
+	double seconds = 0;
+};
+
+RenderResult Render(const std::string& input_path, const std::string& output_path, long buffer_size, unsigned long long buffer_switches, DWORD speed = 0)
+{
+	RenderResult result;
+	ResetFakeDriverConfig();
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualInputFile", input_path);
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualOutputFile", output_path);
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualOutputChannels", DWORD(channel_count));
+	SetFakeRegistryValue("Software\\FlexASIO", "VirtualSpeed", speed);
+
+	CComObject<CFlexASIO>* const driver = new CComObject<CFlexASIO>;
+	{
+		FakeHost host(driver, FakeHostConfig());
+		result.ok = host.Open(buffer_size) && host.GetInputChannelCount() == static_cast<long>(channel_count) && host.GetOutputChannelCount() == static_cast<long>(channel_count);
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		result.ok = result.ok && host.Start() && host.WaitForBufferSwitches(buffer_switches, std::chrono::seconds(60));
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		// Closing the buffers finalizes the output file.
+		result.ok = host.Stop() && host.Close() && result.ok;
+	}
+	driver->Release();
+	result.ok = ReadWaveFile(output_path, &result.format, &result.samples) && result.ok;
+	return result;
+}
+
+// Checks that output is silence, then expected, then silence again, bit for bit.
+void CheckRendered(const char* name, const RenderResult& result, const std::vector<float>& expected)
+{
+	if (!CHECK(result.ok))
+		return;
+	CHECK(result.format.channel_count == channel_count);
+	CHECK(result.format.sample_rate == sample_rate);
+	CHECK(result.format.sample_format == SAMPLE_FORMAT_FLOAT32);
+
+	const std::vector<float>& output = result.samples;
+	size_t offset = 0;
+	while (offset < output.size() && output[offset] == 0)
+		++offset;
+	offset -= offset % channel_count;
+	const bool complete = CHECK(output.size() >= offset + expected.size());
+	const bool leading_silence = offset < output.size();
+	const bool matches = complete && memcmp(output.data() + offset, expected.data(), expected.size() * sizeof(float)) == 0;
+	bool trailing_silence = true;
+	for (size_t index = offset + expected.size(); index < output.size(); ++index)
+		trailing_silence = trailing_silence && output[index] == 0;
+	printf("%-32s %zu frames in, %zu frames out, latency %zu frames\n", name, expected.size() / channel_count, output.size() / channel_count, offset / channel_count);
+	if (!CHECK(leading_silence && matches && trailing_silence))
+		fprintf(stderr, "  %s: %s\n", name, !matches ? "samples differ" : "no silence around the samples");
+}
+
+void TestFormats(const std::string& input_path, const std::string& output_path)
+{
+	const long buffer_size = 256;
+	const size_t frames = 12345;
+	const std::vector<float> samples = GenerateSamples(frames, 1);
+	for (const SampleFormat format : { SAMPLE_FORMAT_INT16, SAMPLE_FORMAT_INT24, SAMPLE_FORMAT_INT32, SAMPLE_FORMAT_FLOAT32, SAMPLE_FORMAT_FLOAT64 })
+	{
+		CHECK(WriteWaveFile(input_path, format, channel_count, sample_rate, samples));
+		// What the file holds, as the driver should decode it.
+		WaveFormat input_format;
+		std::vector<float> expected;
+		CHECK(ReadWaveFile(input_path, &input_format, &expected));
+		CHECK(expected.size() == samples.size());
+		const std::string name = std::string("format ") + GetSampleFormatName(format);
+		CheckRendered(name.c_str(), Render(input_path, output_path, buffer_size, frames / buffer_size + 16), expected);
+	}
+}
+
+void TestTruncated(const std::string& input_path, const std::string& output_path)
+{
+	const long buffer_size = 256;
+	const size_t frames = 5000;
+	const std::vector<float> samples = GenerateSamples(frames, 2);
+	// The header claims twice the samples, and there are three bytes of a partial 16-bit stereo frame at the end.
+	CHECK(WriteWaveFile(input_path, SAMPLE_FORMAT_INT16, channel_count, sample_rate, samples, 2 * frames, 3));
+	CheckRendered("truncated file", Render(input_path, output_path, buffer_size, 2 * frames / buffer_size + 16), samples);
+}
+
+void TestLargeFile(const std::string& input_path, const std::string& output_path)
+{
+	// Enough 32-bit float stereo frames to go past the first 64 MB window, and then some.
+	const long buffer_size = 4096;
+	const size_t frames = (64 << 20) / (channel_count * sizeof(float)) + 100000;
+	const std::vector<float> samples = GenerateSamples(frames, 3);
+	CHECK(WriteWaveFile(input_path, SAMPLE_FORMAT_FLOAT32, channel_count, sample_rate, samples));
+	CheckRendered("larger than the map window", Render(input_path, output_path, buffer_size, frames / buffer_size + 8), samples);
+}
+
+void TestSpeed(const std::string& input_path, const std::string& output_path)
+{
+	const long buffer_size = 480;
+	const size_t frames = 24000;
+	CHECK(WriteWaveFile(input_path, SAMPLE_FORMAT_FLOAT32, channel_count, sample_rate, GenerateSamples(frames, 4)));
+	// Half a second of audio.
+	const unsigned long long buffer_switches = frames / buffer_size;
+	const double audio_seconds = static_cast<double>(buffer_switches * buffer_size) / sample_rate;
+	for (const DWORD speed : { 1, 4 })
+	{
+		const RenderResult result = Render(input_path, output_path, buffer_size, buffer_switches, speed);
+		CHECK(result.ok);
+		printf("VirtualSpeed %lu: %.3f s of audio in %.3f s\n", static_cast<unsigned long>(speed), audio_seconds, result.seconds);
+		// The first callback comes right away, hence the one buffer of slack; being late is only bounded by how busy the machine is.
+		CHECK(result.seconds >= (audio_seconds - buffer_size / sample_rate) / speed);
+		CHECK(result.seconds < 4 * audio_seconds / speed + 0.5);
+	}
+	const RenderResult unpaced = Render(input_path, output_path, buffer_size, buffer_switches, 0);
+	CHECK(unpaced.ok);
+	printf("VirtualSpeed 0: %.3f s of audio in %.3f s\n", audio_seconds, unpaced.seconds);
+}
+
+}
+
+int main()
+{
+	const std::string prefix = "/tmp/flexasio-virtual-test-" + std::to_string(getpid());
+	const std::string input_path = prefix + "-input.wav";
+	const std::string output_path = prefix + "-output.wav";
+	TestFormats(input_path, output_path);
+	TestTruncated(input_path, output_path);
+	TestLargeFile(input_path, output_path);
+	TestSpeed(input_path, output_path);
+	remove(input_path.c_str());
+	remove(output_path.c_str());
+	return TestResult();
+}
@@ -0,0 +1,93 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// Reading and writing whole WAV files, for tests that feed the virtual device or read back what the driver wrote (see VirtualDevice and Recorder).
+
+#include "../convert.h"
+#include "../wav.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Writes a plain RIFF file (WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT) with the given interleaved samples, encoded in format.
+// If declared_frames is larger than the number of frames, the header says so, like a file that got cut short. extra_bytes of garbage follow the samples, e.g. a partial frame.
+inline bool WriteWaveFile(const std::string& path, SampleFormat format, size_t channel_count, double sample_rate, const std::vector<float>& samples, size_t declared_frames = 0, size_t extra_bytes = 0)
+{
+	const SampleConverter converter = GetSampleConverter(format, INSTRUCTION_SET_SCALAR);
+	std::vector<unsigned char> data(samples.size() * converter.sample_size + extra_bytes, 0x5A);
+	converter.encode(data.data(), samples.data(), samples.size());
+	const unsigned long long data_size = (std::max)(samples.size() / channel_count, declared_frames) * channel_count * converter.sample_size;
+
+	std::vector<unsigned char> header;
+	const auto append = [&](unsigned long long value, size_t size) {
+		for (size_t byte = 0; byte < size; ++byte)
+			header.push_back(static_cast<unsigned char>(value >> (8 * byte)));
+	};
+	const auto append_tag = [&](const char* tag) {
+		for (size_t byte = 0; byte < 4; ++byte)
+			header.push_back(static_cast<unsigned char>(tag[byte]));
+	};
+	const bool is_float = format == SAMPLE_FORMAT_FLOAT32 || format == SAMPLE_FORMAT_FLOAT64;
+	append_tag("RIFF");
+	append(4 + 8 + 16 + 8 + data_size, 4);
+	append_tag("WAVE");
+	append_tag("fmt ");
+	append(16, 4);
+	append(is_float ? 3 : 1, 2);
+	append(channel_count, 2);
+	append(static_cast<unsigned long long>(sample_rate), 4);
+	append(static_cast<unsigned long long>(sample_rate) * channel_count * converter.sample_size, 4);
+	append(channel_count * converter.sample_size, 2);
+	append(8 * converter.sample_size, 2);
+	append_tag("data");
+	append(data_size, 4);
+
+	FILE* const file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+	const bool written = fwrite(header.data(), 1, header.size(), file) == header.size() && fwrite(data.data(), 1, data.size(), file) == data.size();
+	return fclose(file) == 0 && written;
+}
+
+// Reads a whole WAV file the way the driver would (through ParseWaveHeader()), and decodes its samples to interleaved floats. Ignores a partial frame at the end.
+inline bool ReadWaveFile(const std::string& path, WaveFormat* format, std::vector<float>* samples)
+{
+	FILE* const file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+	std::vector<unsigned char> data;
+	unsigned char chunk[65536];
+	size_t chunk_size;
+	while ((chunk_size = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		data.insert(data.end(), chunk, chunk + chunk_size);
+	fclose(file);
+	if (!ParseWaveHeader(data.data(), data.size(), format))
+		return false;
+	const size_t sample_size = GetSampleSize(format->sample_format);
+	const size_t block_align = format->channel_count * sample_size;
+	const size_t available = static_cast<size_t>((std::min)(format->data_size, static_cast<unsigned long long>(data.size() - format->data_offset)));
+	const size_t frames = available / block_align;
+	samples->resize(frames * format->channel_count);
+	GetSampleConverter(format->sample_format, INSTRUCTION_SET_SCALAR).decode(samples->data(), data.data() + format->data_offset, samples->size());
+	return true;
+}
@@ -0,0 +1,67 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "timing.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Loop bandwidth, in Hz. Lower means smoother but slower to converge, so the loop starts wide and narrows down as it locks.
+const double initial_bandwidth = 1.0;
+const double final_bandwidth = 0.1;
+// If a callback is off by more than this (in seconds), something happened to the stream (e.g. a glitch or a stall) and the loop starts over rather than slowly catching up.
+const double max_error = 0.01;
+const double pi = 3.14159265358979323846;
+}
+
+DelayLockedLoop::DelayLockedLoop() : sample_rate(0), locked(false), lock_frame(0), time(0), frame(0), period(0) { }
+
+void DelayLockedLoop::Reset(double sample_rate)
+{
+	this->sample_rate = sample_rate;
+	locked = false;
+}
+
+void DelayLockedLoop::Update(double time, long long frame)
+{
+	if (locked && frame > this->frame)
+	{
+		const double predicted_time = GetTime(frame);
+		const double error = time - predicted_time;
+		if (std::abs(error) < max_error)
+		{
+			// The loop is updated at irregular intervals (PortAudio callbacks can vary in size), so the coefficients are recomputed for each interval.
+			const double bandwidth = (std::max)(final_bandwidth, initial_bandwidth / (1 + (frame - lock_frame) / sample_rate));
+			const double omega = 2 * pi * bandwidth * (frame - this->frame) / sample_rate;
+			const double b = std::sqrt(2.0) * omega;
+			const double c = omega * omega;
+			period += c * error / (frame - this->frame);
+			this->time = predicted_time + b * error;
+			this->frame = frame;
+			return;
+		}
+	}
+
+	locked = true;
+	lock_frame = frame;
+	this->time = time;
+	this->frame = frame;
+	period = 1 / sample_rate;
+}
@@ -0,0 +1,48 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+// Second-order delay-locked loop that turns jittery callback times into a smooth mapping between stream frames and time.
+// This is the classic audio DLL (as used in JACK): the loop tracks both the time of the current frame and the actual duration of a frame, which differs slightly from the nominal one because of clock drift.
+class DelayLockedLoop
+{
+	public:
+		DelayLockedLoop();
+
+		void Reset(double sample_rate);
+		// time is when frame was processed, as measured by a high resolution clock, in seconds. Frames must be increasing.
+		void Update(double time, long long frame);
+		// Extrapolated from the last update. Only valid after the first update.
+		double GetTime(long long frame) const { return time + period * (frame - this->frame); }
+		// Filtered duration of one frame, in seconds.
+		double GetPeriod() const { return period; }
+		bool IsLocked() const { return locked; }
+
+	private:
+		double sample_rate;
+		bool locked;
+		// The frame of the first update since the loop (re)started.
+		long long lock_frame;
+		// Filtered time of frame.
+		double time;
+		long long frame;
+		// Filtered duration of one frame, in seconds.
+		double period;
+};
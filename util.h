@@ -21,20 +21,51 @@
 
 #include <windows.h>
 
+#include <memory>
 #include <string>
 #include <sstream>
 
-class Log : public std::stringstream
+#include "log.h"
+
+// Non-real-time logging frontend. Formats a line with the usual stream operators and hands it over to the logger.
+// Nothing gets formatted (or allocated) if the level is disabled. Do not use this on the audio thread; use RealtimeLog() instead.
+class Log
 {
 	public:
-		Log()
+		explicit Log(LogLevel level = LOG_LEVEL_INFO) : level(level)
 		{
-			*this << "FlexASIO: [" << timeGetTime() << "] ";
+			if (Logger::Get().IsEnabled(level))
+				stream.reset(new std::stringstream);
 		}
 
 		~Log()
 		{
-			*this << std::endl;
-			OutputDebugString(str().c_str());
+			if (stream)
+				Logger::Get().Write(level, stream->str());
+		}
+
+		template <typename T> Log& operator<<(const T& value)
+		{
+			if (stream)
+				*stream << value;
+			return *this;
 		}
+
+	private:
+		Log(const Log&);
+		Log& operator=(const Log&);
+
+		const LogLevel level;
+		std::unique_ptr<std::stringstream> stream;
 };
+
+// False if the process has exited, or if it can't be opened at all (e.g. because it never existed).
+inline bool IsProcessRunning(DWORD process_id)
+{
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, process_id);
+	if (!process)
+		return false;
+	const bool running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+	CloseHandle(process);
+	return running;
+}
@@ -0,0 +1,265 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "virtual.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "util.h"
+
+namespace {
+// How much of the input file is mapped at a time. Large enough that remapping is rare, small enough to fit in a 32-bit address space.
+const size_t input_view_window = 64 << 20;
+// The output file goes through a CRT buffer this large, so that writes to the OS are few and sequential.
+const size_t output_file_buffer_size = 4 << 20;
+}
+
+VirtualDevice::VirtualDevice() :
+	input_file(NULL), input_mapping(NULL), input_file_size(0), input_view(NULL), input_view_offset(0), input_view_size(0), input_position(0),
+	callback(NULL), user_data(NULL), sample_rate(0), period(0), speed(0), stall_interval(0), output_file(NULL), output_channel_count(0), output_frames(0), output_error(false), stream_frames(0),
+	stopping(false)
+{
+	memset(&input_format, 0, sizeof(input_format));
+	input_converter = GetSampleConverter(SAMPLE_FORMAT_FLOAT32);
+}
+
+VirtualDevice::~VirtualDevice()
+{
+	StopStream();
+	CloseStream();
+	if (input_view)
+		UnmapViewOfFile(input_view);
+	if (input_mapping)
+		CloseHandle(input_mapping);
+	if (input_file)
+		CloseHandle(input_file);
+}
+
+bool VirtualDevice::OpenInput(const std::string& path)
+{
+	input_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (input_file == INVALID_HANDLE_VALUE)
+	{
+		input_file = NULL;
+		Log(LOG_LEVEL_ERROR) << "Unable to open virtual input file " << path;
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(input_file, &file_size) || file_size.QuadPart == 0)
+	{
+		Log(LOG_LEVEL_ERROR) << "Virtual input file " << path << " is empty";
+		return false;
+	}
+	input_file_size = static_cast<unsigned long long>(file_size.QuadPart);
+	input_mapping = CreateFileMappingA(input_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!input_mapping)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to map virtual input file " << path;
+		return false;
+	}
+
+	const size_t header_size = static_cast<size_t>((std::min)(input_file_size, static_cast<unsigned long long>(input_view_window)));
+	const unsigned char* header = MapInput(0, header_size);
+	if (!header || !ParseWaveHeader(header, header_size, &input_format))
+	{
+		memset(&input_format, 0, sizeof(input_format));
+		Log(LOG_LEVEL_ERROR) << "Virtual input file " << path << " is not a WAV file, or not in a format we can read";
+		return false;
+	}
+	// Truncated files are common (e.g. a crashed render), and the samples that are there are still useful.
+	const size_t block_align = input_format.channel_count * GetSampleSize(input_format.sample_format);
+	input_format.data_size = (std::min)(input_format.data_size, input_file_size - input_format.data_offset);
+	input_format.data_size -= input_format.data_size % block_align;
+	input_converter = GetSampleConverter(input_format.sample_format);
+	Log() << "Virtual input file " << path << ": " << input_format.channel_count << " channels, " << input_format.sample_rate << " Hz, " << GetSampleFormatName(input_format.sample_format)
+	      << ", " << input_format.data_size / block_align / input_format.sample_rate << " seconds";
+	return true;
+}
+
+bool VirtualDevice::OpenStream(PaStreamCallback* callback, void* user_data, double sample_rate, size_t period, double speed, const std::string& output_path, long output_channel_count)
+{
+	CloseStream();
+	if (!output_path.empty())
+	{
+		output_file = fopen(output_path.c_str(), "wb");
+		if (!output_file)
+		{
+			Log(LOG_LEVEL_ERROR) << "Unable to create virtual output file " << output_path;
+			return false;
+		}
+		output_file_buffer.resize(output_file_buffer_size);
+		setvbuf(output_file, output_file_buffer.data(), _IOFBF, output_file_buffer.size());
+		if (!WriteWaveHeader(output_file, output_channel_count, sample_rate, 0))
+		{
+			Log(LOG_LEVEL_ERROR) << "Unable to write to virtual output file " << output_path;
+			fclose(output_file);
+			output_file = NULL;
+			return false;
+		}
+	}
+
+	this->callback = callback;
+	this->user_data = user_data;
+	this->sample_rate = sample_rate;
+	this->period = period;
+	this->speed = speed;
+	this->output_channel_count = output_channel_count;
+	output_frames = 0;
+	output_error = false;
+	stream_frames = 0;
+	input_position = 0;
+
+	const size_t input_channel_count = input_format.channel_count;
+	input_buffer.assign(input_channel_count * period, 0);
+	input_channels.clear();
+	for (size_t channel = 0; channel < input_channel_count; ++channel)
+		input_channels.push_back(input_buffer.data() + channel * period);
+	output_buffer.assign(output_channel_count * period, 0);
+	output_channels.clear();
+	for (long channel = 0; channel < output_channel_count; ++channel)
+		output_channels.push_back(output_buffer.data() + channel * period);
+	interleaved_buffer.assign((std::max)(input_channel_count, static_cast<size_t>(output_channel_count)) * period, 0);
+	return true;
+}
+
+void VirtualDevice::CloseStream()
+{
+	if (!output_file)
+		return;
+	if (!WriteWaveHeader(output_file, output_channel_count, sample_rate, output_frames * output_channel_count * sizeof(float)) || fclose(output_file) != 0)
+		output_error = true;
+	output_file = NULL;
+	output_file_buffer.clear();
+	Log() << "Closed virtual output file: " << output_frames << " frames written" << (output_error ? ", with write errors" : "");
+}
+
+PaError VirtualDevice::StartStream()
+{
+	if (!callback)
+		return paBadStreamPtr;
+	if (thread.joinable())
+		return paStreamIsNotStopped;
+	stopping.store(false);
+	thread = std::thread(&VirtualDevice::Run, this);
+	return paNoError;
+}
+
+PaError VirtualDevice::StopStream()
+{
+	if (!thread.joinable())
+		return paStreamIsStopped;
+	stopping.store(true);
+	thread.join();
+	return paNoError;
+}
+
+void VirtualDevice::Run()
+{
+	const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	const unsigned long long start_frames = stream_frames;
+	unsigned long callback_count = 0;
+	while (!stopping.load())
+	{
+		if (stall_interval > 0 && callback_count == stall_interval)
+		{
+			Log(LOG_LEVEL_WARNING) << "Virtual device: stalling after " << callback_count << " callbacks";
+			while (!stopping.load())
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			break;
+		}
+		++callback_count;
+
+		if (!input_channels.empty())
+			ReadInput(period);
+
+		PaStreamCallbackTimeInfo time_info;
+		time_info.currentTime = time_info.inputBufferAdcTime = time_info.outputBufferDacTime = stream_frames / sample_rate;
+		callback(input_channels.empty() ? NULL : input_channels.data(), output_channels.empty() ? NULL : output_channels.data(), static_cast<unsigned long>(period), &time_info, 0, user_data);
+
+		if (output_file)
+			WriteOutput(period);
+		stream_frames += period;
+
+		if (speed > 0)
+			std::this_thread::sleep_until(start_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((stream_frames - start_frames) / sample_rate / speed)));
+	}
+}
+
+void VirtualDevice::ReadInput(size_t frames)
+{
+	const size_t channel_count = input_format.channel_count;
+	const size_t block_align = channel_count * input_converter.sample_size;
+	size_t available_frames = static_cast<size_t>((std::min)(static_cast<unsigned long long>(frames), (input_format.data_size - input_position) / block_align));
+	if (available_frames > 0)
+	{
+		const unsigned char* samples = MapInput(input_format.data_offset + input_position, available_frames * block_align);
+		if (!samples)
+			available_frames = 0;
+		else
+		{
+			input_converter.decode(interleaved_buffer.data(), samples, available_frames * channel_count);
+			DeinterleaveSamples(input_channels.data(), 0, interleaved_buffer.data(), channel_count, available_frames);
+			input_position += available_frames * block_align;
+			if (input_position == input_format.data_size)
+				Log() << "Reached the end of the virtual input file after " << (stream_frames + available_frames) / sample_rate << " seconds, the rest of the input is silent";
+		}
+	}
+	if (available_frames < frames)
+		for (size_t channel = 0; channel < channel_count; ++channel)
+			memset(input_channels[channel] + available_frames, 0, (frames - available_frames) * sizeof(float));
+}
+
+const unsigned char* VirtualDevice::MapInput(unsigned long long offset, size_t size)
+{
+	if (input_view && offset >= input_view_offset && offset + size <= input_view_offset + input_view_size)
+		return input_view + (offset - input_view_offset);
+
+	if (input_view)
+		UnmapViewOfFile(input_view);
+	// Views have to start on an allocation granularity boundary.
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	const unsigned long long view_offset = offset - offset % system_info.dwAllocationGranularity;
+	const size_t view_size = static_cast<size_t>((std::min)(input_file_size - view_offset, (std::max)(static_cast<unsigned long long>(input_view_window), offset + size - view_offset)));
+	input_view = static_cast<const unsigned char*>(MapViewOfFile(input_mapping, FILE_MAP_READ, static_cast<DWORD>(view_offset >> 32), static_cast<DWORD>(view_offset), view_size));
+	if (!input_view)
+	{
+		Log(LOG_LEVEL_ERROR) << "Unable to map virtual input file at offset " << view_offset;
+		input_view_size = 0;
+		return NULL;
+	}
+	input_view_offset = view_offset;
+	input_view_size = view_size;
+	return input_view + (offset - view_offset);
+}
+
+void VirtualDevice::WriteOutput(size_t frames)
+{
+	InterleaveSamples(interleaved_buffer.data(), output_channels.data(), 0, output_channel_count, frames);
+	if (fwrite(interleaved_buffer.data(), output_channel_count * sizeof(float), frames, output_file) != frames)
+	{
+		if (!output_error)
+			Log(LOG_LEVEL_ERROR) << "Unable to write to virtual output file";
+		output_error = true;
+		return;
+	}
+	output_frames += frames;
+}
@@ -0,0 +1,106 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <windows.h>
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "convert.h"
+#include "wav.h"
+#include "portaudio.h"
+
+// Stands in for the PortAudio devices when running offline (see Config::virtual_input_file): input comes from a WAV file, and output goes to another.
+// Callbacks come from a thread driven by a virtual clock, either as fast as the callback returns or paced at a multiple of real time. They have the same signature as PortAudio callbacks, so that the driver runs the exact same code path as with real devices.
+class VirtualDevice
+{
+	public:
+		VirtualDevice();
+		~VirtualDevice();
+
+		// The input file is memory-mapped one window at a time, so it can be larger than the address space. Its format sets the input channel count and the sample rate.
+		bool OpenInput(const std::string& path);
+		long GetInputChannelCount() const { return static_cast<long>(input_format.channel_count); }
+		// 0 if there is no input file.
+		double GetInputSampleRate() const { return input_format.sample_rate; }
+
+		// The equivalent of Pa_OpenStream(). Starts over from the beginning of the input file. If output_path is not empty, output goes there, as 32-bit float samples.
+		// The callback gets period frames at a time, in non-interleaved float buffers. speed is a multiple of real time, 0 meaning as fast as the callback returns.
+		bool OpenStream(PaStreamCallback* callback, void* user_data, double sample_rate, size_t period, double speed, const std::string& output_path, long output_channel_count);
+		// Finalizes the output file.
+		void CloseStream();
+		// Once the input file runs out, the input is silent; it's up to the host to stop.
+		PaError StartStream();
+		PaError StopStream();
+		// Testing aid for stall recovery: if non-zero, the virtual clock stops after this many callbacks from the start of the stream, as if the device had disappeared, until the stream is stopped.
+		void SetStallInterval(unsigned long callback_count) { stall_interval = callback_count; }
+		// The equivalent of Pa_GetStreamTime(), in virtual time. Only meaningful while the stream is stopped.
+		double GetStreamTime() const { return sample_rate > 0 ? stream_frames / sample_rate : 0; }
+
+	private:
+		VirtualDevice(const VirtualDevice&);
+		VirtualDevice& operator=(const VirtualDevice&);
+
+		void Run();
+		// Fills input_channels with the next frames of the input file.
+		void ReadInput(size_t frames);
+		// Makes sure [offset, offset + size) of the input file is mapped, and returns where it is.
+		const unsigned char* MapInput(unsigned long long offset, size_t size);
+		void WriteOutput(size_t frames);
+
+		HANDLE input_file;
+		HANDLE input_mapping;
+		unsigned long long input_file_size;
+		WaveFormat input_format;
+		SampleConverter input_converter;
+		// The part of the input file that is currently mapped.
+		const unsigned char* input_view;
+		unsigned long long input_view_offset;
+		size_t input_view_size;
+		// Relative to the beginning of the samples, in bytes.
+		unsigned long long input_position;
+
+		PaStreamCallback* callback;
+		void* user_data;
+		double sample_rate;
+		size_t period;
+		double speed;
+		unsigned long stall_interval;
+		FILE* output_file;
+		std::vector<char> output_file_buffer;
+		long output_channel_count;
+		unsigned long long output_frames;
+		bool output_error;
+		// Virtual time, in frames since the stream was opened.
+		unsigned long long stream_frames;
+
+		// Non-interleaved buffers passed to the callback, and interleaved samples for the files.
+		std::vector<float> input_buffer;
+		std::vector<float*> input_channels;
+		std::vector<float> output_buffer;
+		std::vector<float*> output_channels;
+		std::vector<float> interleaved_buffer;
+		std::atomic<bool> stopping;
+		std::thread thread;
+};
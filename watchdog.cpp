@@ -0,0 +1,84 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "watchdog.h"
+
+StallWatchdog::StallWatchdog(StallHandler on_stall) :
+	on_stall(on_stall), last_feed(0), armed(false), timeout(0), stopping(false) { }
+
+StallWatchdog::~StallWatchdog()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeup.notify_all();
+	if (thread.joinable())
+		thread.join();
+}
+
+void StallWatchdog::Arm(std::chrono::milliseconds timeout)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Feed();
+	armed = true;
+	this->timeout = timeout;
+	if (!thread.joinable())
+		thread = std::thread(&StallWatchdog::Run, this);
+	wakeup.notify_all();
+}
+
+void StallWatchdog::Disarm()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	armed = false;
+	wakeup.notify_all();
+}
+
+bool StallWatchdog::HasStalled() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return GetTimeSinceFeed() >= timeout;
+}
+
+void StallWatchdog::Run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping)
+	{
+		if (!armed)
+		{
+			wakeup.wait(lock);
+			continue;
+		}
+
+		// Checking a few times per timeout keeps the stall from going unnoticed for much longer than the timeout.
+		wakeup.wait_for(lock, timeout / 4);
+		if (stopping || !armed)
+			continue;
+		const std::chrono::steady_clock::duration time_since_feed = GetTimeSinceFeed();
+		if (time_since_feed < timeout)
+			continue;
+
+		armed = false;
+		lock.unlock();
+		on_stall(std::chrono::duration_cast<std::chrono::milliseconds>(time_since_feed));
+		lock.lock();
+	}
+}
@@ -0,0 +1,68 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Notices when the stream stops calling back, e.g. because the device was unplugged or the backend hung, which PortAudio doesn't reliably report.
+// The audio thread calls Feed() on every callback. If nothing comes for longer than the timeout, the stall handler is called from the watchdog thread.
+// The handler is called at most once per Arm(): if it wants the watchdog to keep watching after dealing with the stall, it has to arm it again.
+class StallWatchdog
+{
+	public:
+		// Gets how long it's been since the last callback.
+		typedef std::function<void(std::chrono::milliseconds stall_duration)> StallHandler;
+
+		explicit StallWatchdog(StallHandler on_stall);
+		// Waits for the handler to return, if it's running.
+		~StallWatchdog();
+
+		// Starts watching, counting from now. The thread is only started the first time.
+		void Arm(std::chrono::milliseconds timeout);
+		// Doesn't wait for the handler if it's already running, so that it can be called with locks held that the handler takes.
+		void Disarm();
+		// True if nothing has come for longer than the timeout. Lets the handler check that the stall is still current once it gets hold of its locks, as the stream might have been restarted in the meantime.
+		bool HasStalled() const;
+		// Real-time safe.
+		void Feed() { last_feed.store(Now(), std::memory_order_relaxed); }
+
+	private:
+		StallWatchdog(const StallWatchdog&);
+		StallWatchdog& operator=(const StallWatchdog&);
+
+		static long long Now() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+		std::chrono::steady_clock::duration GetTimeSinceFeed() const { return std::chrono::steady_clock::duration(Now() - last_feed.load(std::memory_order_relaxed)); }
+		void Run();
+
+		const StallHandler on_stall;
+		// In steady_clock ticks.
+		std::atomic<long long> last_feed;
+		mutable std::mutex mutex;
+		std::condition_variable wakeup;
+		bool armed;
+		std::chrono::steady_clock::duration timeout;
+		bool stopping;
+		std::thread thread;
+};
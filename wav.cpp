@@ -0,0 +1,183 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "wav.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+// Trailing 14 bytes of the KSDATAFORMAT_SUBTYPE_PCM and KSDATAFORMAT_SUBTYPE_IEEE_FLOAT GUIDs, which only differ in the first 2.
+const unsigned char subformat_suffix[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+const unsigned short wave_format_pcm = 1;
+const unsigned short wave_format_ieee_float = 3;
+const unsigned short wave_format_extensible = 0xFFFE;
+// Going through one channel at a time over a long buffer would stride across far more cache lines than the cache can keep, hence the blocks.
+const size_t interleave_block_frames = 64;
+
+unsigned long long ReadInteger(const unsigned char* data, size_t size)
+{
+	unsigned long long value = 0;
+	for (size_t byte_index = 0; byte_index < size; ++byte_index)
+		value |= static_cast<unsigned long long>(data[byte_index]) << (byte_index * 8);
+	return value;
+}
+
+void AppendTag(std::vector<unsigned char>* header, const char* tag)
+{
+	header->insert(header->end(), tag, tag + 4);
+}
+
+void AppendInteger(std::vector<unsigned char>* header, unsigned long long value, size_t size)
+{
+	for (size_t byte_index = 0; byte_index < size; ++byte_index)
+		header->push_back(static_cast<unsigned char>(value >> (byte_index * 8)));
+}
+
+bool GetSampleFormat(unsigned short format_tag, unsigned short bits_per_sample, SampleFormat* format)
+{
+	if (format_tag == wave_format_pcm)
+	{
+		if (bits_per_sample == 16) { *format = SAMPLE_FORMAT_INT16; return true; }
+		if (bits_per_sample == 24) { *format = SAMPLE_FORMAT_INT24; return true; }
+		if (bits_per_sample == 32) { *format = SAMPLE_FORMAT_INT32; return true; }
+	}
+	if (format_tag == wave_format_ieee_float)
+	{
+		if (bits_per_sample == 32) { *format = SAMPLE_FORMAT_FLOAT32; return true; }
+		if (bits_per_sample == 64) { *format = SAMPLE_FORMAT_FLOAT64; return true; }
+	}
+	return false;
+}
+}
+
+bool ParseWaveHeader(const unsigned char* data, size_t size, WaveFormat* format)
+{
+	if (size < 12 || (memcmp(data, "RIFF", 4) != 0 && memcmp(data, "RF64", 4) != 0) || memcmp(data + 8, "WAVE", 4) != 0)
+		return false;
+	const bool rf64 = memcmp(data, "RF64", 4) == 0;
+
+	bool has_format = false;
+	unsigned long long rf64_data_size = 0;
+	for (size_t offset = 12; offset + 8 <= size; )
+	{
+		const unsigned char* chunk = data + offset;
+		const unsigned long long chunk_size = ReadInteger(chunk + 4, 4);
+		if (memcmp(chunk, "ds64", 4) == 0 && chunk_size >= 16 && offset + 8 + 16 <= size)
+			rf64_data_size = ReadInteger(chunk + 8 + 8, 8);
+		else if (memcmp(chunk, "fmt ", 4) == 0)
+		{
+			if (chunk_size < 16 || offset + 8 + chunk_size > size)
+				return false;
+			unsigned short format_tag = static_cast<unsigned short>(ReadInteger(chunk + 8, 2));
+			format->channel_count = static_cast<size_t>(ReadInteger(chunk + 10, 2));
+			format->sample_rate = static_cast<double>(ReadInteger(chunk + 12, 4));
+			const unsigned short block_align = static_cast<unsigned short>(ReadInteger(chunk + 20, 2));
+			const unsigned short bits_per_sample = static_cast<unsigned short>(ReadInteger(chunk + 22, 2));
+			if (format_tag == wave_format_extensible)
+			{
+				if (chunk_size < 40 || memcmp(chunk + 8 + 26, subformat_suffix, sizeof(subformat_suffix)) != 0)
+					return false;
+				format_tag = static_cast<unsigned short>(ReadInteger(chunk + 8 + 24, 2));
+			}
+			if (!GetSampleFormat(format_tag, bits_per_sample, &format->sample_format) || format->channel_count == 0 || format->sample_rate <= 0 ||
+				block_align != format->channel_count * GetSampleSize(format->sample_format))
+				return false;
+			has_format = true;
+		}
+		else if (memcmp(chunk, "data", 4) == 0)
+		{
+			if (!has_format)
+				return false;
+			format->data_offset = offset + 8;
+			format->data_size = rf64 && chunk_size == 0xFFFFFFFF ? rf64_data_size : chunk_size;
+			return true;
+		}
+		// Chunks are padded to an even size.
+		offset += static_cast<size_t>(8 + chunk_size + (chunk_size & 1));
+	}
+	return false;
+}
+
+bool WriteWaveHeader(FILE* file, size_t channel_count, double sample_rate, unsigned long long data_size)
+{
+	const size_t block_align = channel_count * sizeof(float);
+	const unsigned long long riff_size = 4 + (8 + 28) + (8 + 40) + 8 + data_size;
+	const bool rf64 = riff_size > 0xFFFFFFFF;
+
+	// The ds64 chunk that RF64 requires is always there, disguised as a JUNK chunk if the file turns out not to need it (see EBU Tech 3306).
+	std::vector<unsigned char> header;
+	AppendTag(&header, rf64 ? "RF64" : "RIFF");
+	AppendInteger(&header, rf64 ? 0xFFFFFFFF : riff_size, 4);
+	AppendTag(&header, "WAVE");
+	AppendTag(&header, rf64 ? "ds64" : "JUNK");
+	AppendInteger(&header, 28, 4);
+	AppendInteger(&header, rf64 ? riff_size : 0, 8);
+	AppendInteger(&header, rf64 ? data_size : 0, 8);
+	AppendInteger(&header, rf64 ? data_size / block_align : 0, 8);
+	AppendInteger(&header, 0, 4);
+	AppendTag(&header, "fmt ");
+	AppendInteger(&header, 40, 4);
+	AppendInteger(&header, wave_format_extensible, 2);
+	AppendInteger(&header, channel_count, 2);
+	AppendInteger(&header, static_cast<unsigned long>(sample_rate), 4);
+	AppendInteger(&header, static_cast<unsigned long>(sample_rate) * block_align, 4);
+	AppendInteger(&header, block_align, 2);
+	AppendInteger(&header, 32, 2);
+	AppendInteger(&header, 22, 2);
+	AppendInteger(&header, 32, 2);
+	AppendInteger(&header, 0, 4);
+	AppendInteger(&header, wave_format_ieee_float, 2);
+	header.insert(header.end(), subformat_suffix, subformat_suffix + sizeof(subformat_suffix));
+	AppendTag(&header, "data");
+	AppendInteger(&header, rf64 ? 0xFFFFFFFF : data_size, 4);
+
+	return fseek(file, 0, SEEK_SET) == 0 && fwrite(header.data(), 1, header.size(), file) == header.size();
+}
+
+void InterleaveSamples(float* destination, const float* const* sources, size_t source_offset, size_t channel_count, size_t frames)
+{
+	for (size_t block_offset = 0; block_offset < frames; block_offset += interleave_block_frames)
+	{
+		const size_t block_frames = (std::min)(frames - block_offset, interleave_block_frames);
+		for (size_t channel = 0; channel < channel_count; ++channel)
+		{
+			const float* source = sources[channel] + source_offset + block_offset;
+			float* channel_destination = destination + block_offset * channel_count + channel;
+			for (size_t frame = 0; frame < block_frames; ++frame)
+				channel_destination[frame * channel_count] = source[frame];
+		}
+	}
+}
+
+void DeinterleaveSamples(float* const* destinations, size_t destination_offset, const float* source, size_t channel_count, size_t frames)
+{
+	for (size_t block_offset = 0; block_offset < frames; block_offset += interleave_block_frames)
+	{
+		const size_t block_frames = (std::min)(frames - block_offset, interleave_block_frames);
+		for (size_t channel = 0; channel < channel_count; ++channel)
+		{
+			const float* channel_source = source + block_offset * channel_count + channel;
+			float* destination = destinations[channel] + destination_offset + block_offset;
+			for (size_t frame = 0; frame < block_frames; ++frame)
+				destination[frame] = channel_source[frame * channel_count];
+		}
+	}
+}
@@ -0,0 +1,49 @@
+/*
+
+	Copyright (C) 2014 Etienne Dechamps (e-t172) <etienne@edechamps.fr>
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+
+#include "convert.h"
+
+// Minimal support for the WAV files FlexASIO reads and writes (see Recorder and VirtualDevice): PCM or float samples, RIFF or RF64.
+
+struct WaveFormat
+{
+	size_t channel_count;
+	double sample_rate;
+	SampleFormat sample_format;
+	// Where the samples are in the file, in bytes.
+	unsigned long long data_offset;
+	unsigned long long data_size;
+};
+
+// Parses the beginning of a WAV file, up to and including the header of the data chunk. data and size don't need to cover the samples themselves.
+// Returns false if the header is malformed, extends beyond size, or describes a format we can't decode.
+bool ParseWaveHeader(const unsigned char* data, size_t size, WaveFormat* format);
+
+// Writes a WAVE_FORMAT_EXTENSIBLE 32-bit float header at the beginning of the file, for data_size bytes of samples. The samples follow right after.
+// The header is always the same size, so it can be written once with a data_size of 0 and rewritten in place once the size is known, including beyond 4 GB (RF64).
+bool WriteWaveHeader(FILE* file, size_t channel_count, double sample_rate, unsigned long long data_size);
+
+// Between the non-interleaved float buffers used everywhere else and the interleaved samples of WAV files.
+void InterleaveSamples(float* destination, const float* const* sources, size_t source_offset, size_t channel_count, size_t frames);
+void DeinterleaveSamples(float* const* destinations, size_t destination_offset, const float* source, size_t channel_count, size_t frames);